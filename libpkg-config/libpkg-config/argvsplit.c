@@ -47,8 +47,14 @@
 void
 pkg_config_argv_free (char** argv)
 {
-  free (argv[0]);
-  free (argv);
+  pkg_config_argv_free_with (NULL, argv);
+}
+
+void
+pkg_config_argv_free_with (const pkg_config_allocator_t* a, char** argv)
+{
+  pkg_config_mem_free (a, argv[0]);
+  pkg_config_mem_free (a, argv);
 }
 
 /*
@@ -68,7 +74,16 @@ pkg_config_argv_free (char** argv)
 int
 pkg_config_argv_split (const char* src, int* argc, char*** argv)
 {
-  char* buf = malloc (strlen (src) + 1);
+  return pkg_config_argv_split_with (NULL, src, argc, argv);
+}
+
+int
+pkg_config_argv_split_with (const pkg_config_allocator_t* a,
+                            const char* src,
+                            int* argc,
+                            char*** argv)
+{
+  char* buf = pkg_config_mem_alloc (a, strlen (src) + 1);
   const char* src_iter;
   char* dst_iter;
   int argc_count = 0;
@@ -81,7 +96,7 @@ pkg_config_argv_split (const char* src, int* argc, char*** argv)
 
   memset (buf, 0, strlen (src) + 1);
 
-  *argv = calloc (argv_size, sizeof (void*));
+  *argv = pkg_config_mem_calloc (a, argv_size, sizeof (void*));
   (*argv)[argc_count] = dst_iter;
 
   while (*src_iter)
@@ -121,7 +136,8 @@ pkg_config_argv_split (const char* src, int* argc, char*** argv)
         if (argc_count == argv_size)
         {
           argv_size += 5;
-          *argv = realloc (*argv, sizeof (void*) * argv_size);
+          *argv = pkg_config_mem_realloc (
+              a, *argv, sizeof (void*) * argv_size);
         }
 
         (*argv)[argc_count] = dst_iter;
@@ -149,8 +165,8 @@ pkg_config_argv_split (const char* src, int* argc, char*** argv)
 
   if (escaped || quote)
   {
-    free (*argv);
-    free (buf);
+    pkg_config_mem_free (a, *argv);
+    pkg_config_mem_free (a, buf);
     return -1;
   }
 
@@ -0,0 +1,443 @@
+/*
+ * async.c
+ * asynchronous package queries
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+/*
+ * !doc
+ *
+ * libpkg-config `async` module
+ * ============================
+ *
+ * The libpkg-config `async` module allows an event-driven program to look up
+ * packages and collect their flags without blocking its own threads on the
+ * file system. The requests are queued on an asynchronous context and are
+ * executed either by its internal worker thread or by the caller-provided
+ * executor. The result is delivered to the request's completion callback.
+ *
+ * The requests of a context share its client object and are therefore
+ * executed one at a time (with the client locked), though each cflags and
+ * libs request may resolve the dependencies using multiple threads (see
+ * pkg_config_pkg_resolve() for details). While there are outstanding
+ * requests, the client may only be used from the completion callbacks.
+ *
+ * The completion callback is called on the executing thread with the client
+ * locked. It may use the client (for example, to reference the package) and
+ * submit new requests but it should not wait for the requests to complete.
+ * Note also that the diagnostics handlers are called on the executing
+ * thread.
+ */
+
+#define PKG_CONFIG_ASYNC_FIND   0
+#define PKG_CONFIG_ASYNC_CFLAGS 1
+#define PKG_CONFIG_ASYNC_LIBS   2
+
+typedef struct
+{
+  pkg_config_node_t iter; /* Internal queue node. */
+
+  pkg_config_async_t* async;
+  int kind;               /* PKG_CONFIG_ASYNC_* */
+  char* name;
+  int maxdepth;
+
+  pkg_config_async_func_t func;
+  void* data;
+} async_request_t;
+
+struct pkg_config_async_
+{
+  pkg_config_client_t* client;
+  unsigned int threads;
+
+  pkg_config_async_executor_func_t executor;
+  void* executor_data;
+
+  /* Serializes the client use by the requests.
+   */
+  pkg_config_mutex_t client_lock;
+
+  /* Protects the members below.
+   */
+  pkg_config_mutex_t lock;
+  pkg_config_cond_t work; /* Queue is not empty or stopping. */
+  pkg_config_cond_t done; /* No pending requests. */
+
+  size_t pending;          /* Submitted and not yet completed. */
+  pkg_config_list_t queue; /* Internal executor queue. */
+
+  bool started;
+  bool stop;
+  pkg_config_thread_t worker;
+};
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_async_t* pkg_config_async_new(pkg_config_client_t
+ * *client, unsigned int threads, pkg_config_async_executor_func_t executor,
+ * void *executor_data)
+ *
+ *    Allocate an asynchronous context for the client object. If the executor
+ *    is NULL, then the requests are executed by the internal worker thread
+ *    (started on the first request). Otherwise, each request is passed to
+ *    the executor as a task (the task function and its argument), which it
+ *    should call exactly once, on any thread (but not before returning if
+ *    the request is submitted from a completion callback, since the client
+ *    is locked).
+ *
+ *    :param pkg_config_client_t* client: The client object to use.
+ *    :param uint threads: The number of threads to use for resolving the
+ *    dependencies of each cflags or libs request. 0 means the number of
+ *    hardware threads and 1 disables the parallel resolution.
+ *    :param pkg_config_async_executor_func_t executor: The executor or NULL.
+ *    :param void* executor_data: The data passed to the executor.
+ *    :return: An asynchronous context or NULL if unable to allocate memory.
+ *    :rtype: pkg_config_async_t*
+ */
+pkg_config_async_t*
+pkg_config_async_new (pkg_config_client_t* client,
+                      unsigned int threads,
+                      pkg_config_async_executor_func_t executor,
+                      void* executor_data)
+{
+  pkg_config_async_t* a = calloc (1, sizeof (pkg_config_async_t));
+
+  if (a == NULL)
+    return NULL;
+
+  a->client = client;
+  a->threads = threads;
+  a->executor = executor;
+  a->executor_data = executor_data;
+
+  if (!pkg_config_mutex_init (&a->client_lock))
+    goto fail1;
+
+  if (!pkg_config_mutex_init (&a->lock))
+    goto fail2;
+
+  if (!pkg_config_cond_init (&a->work))
+    goto fail3;
+
+  if (!pkg_config_cond_init (&a->done))
+    goto fail4;
+
+  return a;
+
+fail4:
+  pkg_config_cond_destroy (&a->work);
+fail3:
+  pkg_config_mutex_destroy (&a->lock);
+fail2:
+  pkg_config_mutex_destroy (&a->client_lock);
+fail1:
+  free (a);
+  return NULL;
+}
+
+/* Execute the request and call its completion callback.
+ */
+static void
+async_run (void* task)
+{
+  async_request_t* r = task;
+  pkg_config_async_t* a = r->async;
+  pkg_config_client_t* client = a->client;
+  pkg_config_list_t list = LIBPKG_CONFIG_LIST_INITIALIZER;
+  unsigned int e;
+
+  pkg_config_mutex_lock (&a->client_lock);
+
+  pkg_config_pkg_t* pkg = pkg_config_pkg_find (client, r->name, &e);
+
+  if (pkg == NULL)
+  {
+    if (e == LIBPKG_CONFIG_ERRF_OK)
+      e = LIBPKG_CONFIG_ERRF_PACKAGE_NOT_FOUND;
+  }
+  else if (r->kind != PKG_CONFIG_ASYNC_FIND)
+  {
+    if (a->threads != 1)
+      e = pkg_config_pkg_resolve (client, pkg, r->maxdepth, a->threads);
+
+    if (e == LIBPKG_CONFIG_ERRF_OK)
+      e = (r->kind == PKG_CONFIG_ASYNC_CFLAGS
+           ? pkg_config_pkg_cflags (client, pkg, &list, r->maxdepth)
+           : pkg_config_pkg_libs (client, pkg, &list, r->maxdepth));
+  }
+
+  r->func (client,
+           pkg,
+           r->kind != PKG_CONFIG_ASYNC_FIND ? &list : NULL,
+           e,
+           r->data);
+
+  pkg_config_fragment_free (&list);
+
+  if (pkg != NULL)
+    pkg_config_pkg_unref (client, pkg);
+
+  pkg_config_mutex_unlock (&a->client_lock);
+
+  free (r->name);
+  free (r);
+
+  pkg_config_mutex_lock (&a->lock);
+
+  if (--a->pending == 0)
+    pkg_config_cond_broadcast (&a->done);
+
+  pkg_config_mutex_unlock (&a->lock);
+}
+
+static void
+async_worker (void* arg)
+{
+  pkg_config_async_t* a = arg;
+
+  pkg_config_mutex_lock (&a->lock);
+
+  for (;;)
+  {
+    while (a->queue.head == NULL && !a->stop)
+      pkg_config_cond_wait (&a->work, &a->lock);
+
+    if (a->queue.head == NULL)
+      break;
+
+    async_request_t* r = a->queue.head->data;
+    pkg_config_list_delete (&r->iter, &a->queue);
+
+    pkg_config_mutex_unlock (&a->lock);
+    async_run (r);
+    pkg_config_mutex_lock (&a->lock);
+  }
+
+  pkg_config_mutex_unlock (&a->lock);
+}
+
+static bool
+async_submit (pkg_config_async_t* a,
+              int kind,
+              const char* name,
+              int maxdepth,
+              pkg_config_async_func_t func,
+              void* data)
+{
+  async_request_t* r = calloc (1, sizeof (async_request_t));
+
+  if (r == NULL)
+    return false;
+
+  if ((r->name = strdup (name)) == NULL)
+  {
+    free (r);
+    return false;
+  }
+
+  r->async = a;
+  r->kind = kind;
+  r->maxdepth = maxdepth;
+  r->func = func;
+  r->data = data;
+
+  pkg_config_mutex_lock (&a->lock);
+
+  if (a->executor == NULL)
+  {
+    if (!a->started)
+    {
+      if (!pkg_config_thread_create (&a->worker, async_worker, a))
+      {
+        pkg_config_mutex_unlock (&a->lock);
+        free (r->name);
+        free (r);
+        return false;
+      }
+
+      a->started = true;
+    }
+
+    pkg_config_list_insert_tail (&r->iter, r, &a->queue);
+    pkg_config_cond_signal (&a->work);
+  }
+
+  a->pending++;
+
+  pkg_config_mutex_unlock (&a->lock);
+
+  if (a->executor != NULL)
+    a->executor (async_run, r, a->executor_data);
+
+  return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkg_config_async_find(pkg_config_async_t *async,
+ * const char *name, pkg_config_async_func_t func, void *data)
+ *
+ *    Submit the request to find the package (see pkg_config_pkg_find() for
+ *    details). The completion callback receives the package (or NULL if not
+ *    found), NULL fragment list, and the error flags (with
+ *    ``LIBPKG_CONFIG_ERRF_PACKAGE_NOT_FOUND`` set if not found). The package
+ *    reference is released after the callback returns and so the callback
+ *    should acquire its own to keep the package.
+ *
+ *    :param pkg_config_async_t* async: The asynchronous context to use.
+ *    :param char* name: The package name or file.
+ *    :param pkg_config_async_func_t func: The completion callback.
+ *    :param void* data: The data passed to the completion callback.
+ *    :return: true if submitted, false if unable to allocate memory.
+ *    :rtype: bool
+ */
+bool
+pkg_config_async_find (pkg_config_async_t* a,
+                       const char* name,
+                       pkg_config_async_func_t func,
+                       void* data)
+{
+  return async_submit (a, PKG_CONFIG_ASYNC_FIND, name, 0, func, data);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkg_config_async_cflags(pkg_config_async_t *async,
+ * const char *name, int maxdepth, pkg_config_async_func_t func, void *data)
+ *
+ *    Submit the request to find the package and collect its compiler flags
+ *    (see pkg_config_pkg_cflags() for details). The completion callback
+ *    receives the package (or NULL if not found), the fragment list, and
+ *    the error flags. The fragment list is freed after the callback returns
+ *    and so the callback should move the fragments out to keep them.
+ *
+ *    :param pkg_config_async_t* async: The asynchronous context to use.
+ *    :param char* name: The package name or file.
+ *    :param int maxdepth: The maximum allowed depth for dependency graph
+ *    traversal. -1 means infinite.
+ *    :param pkg_config_async_func_t func: The completion callback.
+ *    :param void* data: The data passed to the completion callback.
+ *    :return: true if submitted, false if unable to allocate memory.
+ *    :rtype: bool
+ */
+bool
+pkg_config_async_cflags (pkg_config_async_t* a,
+                         const char* name,
+                         int maxdepth,
+                         pkg_config_async_func_t func,
+                         void* data)
+{
+  return async_submit (a, PKG_CONFIG_ASYNC_CFLAGS, name, maxdepth, func, data);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkg_config_async_libs(pkg_config_async_t *async,
+ * const char *name, int maxdepth, pkg_config_async_func_t func, void *data)
+ *
+ *    Submit the request to find the package and collect its linker flags
+ *    (see pkg_config_pkg_libs() for details). Otherwise the same as
+ *    pkg_config_async_cflags().
+ *
+ *    :param pkg_config_async_t* async: The asynchronous context to use.
+ *    :param char* name: The package name or file.
+ *    :param int maxdepth: The maximum allowed depth for dependency graph
+ *    traversal. -1 means infinite.
+ *    :param pkg_config_async_func_t func: The completion callback.
+ *    :param void* data: The data passed to the completion callback.
+ *    :return: true if submitted, false if unable to allocate memory.
+ *    :rtype: bool
+ */
+bool
+pkg_config_async_libs (pkg_config_async_t* a,
+                       const char* name,
+                       int maxdepth,
+                       pkg_config_async_func_t func,
+                       void* data)
+{
+  return async_submit (a, PKG_CONFIG_ASYNC_LIBS, name, maxdepth, func, data);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_async_wait(pkg_config_async_t *async)
+ *
+ *    Wait for all the outstanding requests to complete (that is, for their
+ *    completion callbacks to return), including the requests submitted by
+ *    the callbacks. Should not be called from a completion callback.
+ *
+ *    :param pkg_config_async_t* async: The asynchronous context to wait on.
+ *    :return: nothing
+ */
+void
+pkg_config_async_wait (pkg_config_async_t* a)
+{
+  pkg_config_mutex_lock (&a->lock);
+
+  while (a->pending != 0)
+    pkg_config_cond_wait (&a->done, &a->lock);
+
+  pkg_config_mutex_unlock (&a->lock);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_async_free(pkg_config_async_t *async)
+ *
+ *    Wait for all the outstanding requests to complete, stop the internal
+ *    worker thread, if any, and free the asynchronous context. The client
+ *    object is not freed.
+ *
+ *    :param pkg_config_async_t* async: The asynchronous context to free.
+ *    :return: nothing
+ */
+void
+pkg_config_async_free (pkg_config_async_t* a)
+{
+  if (a == NULL)
+    return;
+
+  pkg_config_async_wait (a);
+
+  if (a->started)
+  {
+    pkg_config_mutex_lock (&a->lock);
+    a->stop = true;
+    pkg_config_cond_signal (&a->work);
+    pkg_config_mutex_unlock (&a->lock);
+
+    pkg_config_thread_join (&a->worker);
+  }
+
+  pkg_config_cond_destroy (&a->done);
+  pkg_config_cond_destroy (&a->work);
+  pkg_config_mutex_destroy (&a->lock);
+  pkg_config_mutex_destroy (&a->client_lock);
+  free (a);
+}
@@ -35,7 +35,248 @@
  *
  * A cache is tied to a specific pkg-config client object, so package objects
  * should not be shared across threads.
+ *
+ * The cached packages are indexed by their ids. The index is built on the
+ * first lookup and is maintained as the packages are added and removed. If
+ * unable to allocate memory for the index, then the lookups fall back to
+ * scanning the cache.
+ *
+ * Besides packages, the cache also memoizes the fragment lists produced by
+ * pkg_config_pkg_cflags() and pkg_config_pkg_libs() so that repeated queries
+ * for the same root package do not re-walk the dependency graph. Such a
+ * result is hashed by the root package, the query kind, the client flags (as
+ * overridden by the traversal context, see pkg_config_traversal_init()), and
+ * the maximum traversal depth. Only successful results are memoized and,
+ * when a package is removed from the cache, the results of this package and
+ * its dependents are dropped (see pkg_config_cache_remove() for details).
+ *
+ * Finally, the cache maintains a reverse dependency index which maps a
+ * package id to the dependencies whose `match` points to a package with this
+ * id. Together with the file identity recorded when a package is loaded,
+ * this allows pkg_config_cache_refresh() to only invalidate the packages
+ * whose files have changed on disk and the results of their dependents.
+ */
+
+/* Flags that do not affect the result of a fragment query and should not be
+ * part of the memoized result key.
+ */
+#define PKG_CONFIG_CACHE_RESULT_FLAGS_IGNORED                                \
+  (LIBPKG_CONFIG_PKG_PKGF_NO_CACHE |                                         \
+   LIBPKG_CONFIG_PKG_PKGF_ITER_PKG_IS_PRIVATE |                              \
+   LIBPKG_CONFIG_PKG_PKGF_NO_BATCH_LOAD)
+
+typedef struct pkg_config_cache_result_
+{
+  /* Hash key (see PKG_CONFIG_CACHE_RESULT_KEY_SIZE).
+   */
+  const pkg_config_pkg_t* root;
+  unsigned int kind;  /* PKG_CONFIG_CACHE_RESULT_* */
+  unsigned int flags; /* LIBPKG_CONFIG_PKG_PKGF_* */
+  int maxdepth;
+
+  /* Next result for the same root package or NULL.
+   */
+  struct pkg_config_cache_result_* next;
+
+  pkg_config_list_t frags;
+} pkg_config_cache_result_t;
+
+/* The result key: the root, kind, flags, and maxdepth members (which are
+ * contiguous and have no padding in between).
+ */
+#define PKG_CONFIG_CACHE_RESULT_KEY_SIZE                                     \
+  (offsetof (pkg_config_cache_result_t, maxdepth) + sizeof (int))
+
+typedef struct pkg_config_result_cache_
+{
+  pkg_config_hash_t results; /* Key to result. */
+  pkg_config_hash_t roots;   /* Root package to its first result. */
+
+  /* Allocator of the cache, its tables, and its results (but not of the
+   * result fragments, which remember their own).
+   */
+  const pkg_config_allocator_t* allocator;
+} pkg_config_result_cache_t;
+
+/* Reverse dependency index entry.
+ */
+typedef struct
+{
+  char* id;               /* Hash key. */
+  pkg_config_list_t deps; /* Dependencies matching package with this id. */
+} pkg_config_cache_match_t;
+
+/* Add the package to the set and the worklist unless already in the set.
+ * Return false if unable to allocate memory.
+ */
+static bool
+refresh_add (pkg_config_hash_t* set,
+             pkg_config_pkg_t*** worklist,
+             size_t* count,
+             size_t* capacity,
+             pkg_config_pkg_t* pkg)
+{
+  if (pkg_config_hash_lookup (set, pkg, 0) != NULL)
+    return true;
+
+  if (*count == *capacity)
+  {
+    size_t c = *capacity != 0 ? *capacity * 2 : 16;
+    pkg_config_pkg_t** a = realloc (*worklist, c * sizeof (pkg_config_pkg_t*));
+
+    if (a == NULL)
+      return false;
+
+    *worklist = a;
+    *capacity = c;
+  }
+
+  if (!pkg_config_hash_insert (set, pkg, 0, pkg))
+    return false;
+
+  (*worklist)[(*count)++] = pkg;
+  return true;
+}
+
+/* Return the reverse dependency index entry for the package or NULL.
+ */
+static pkg_config_cache_match_t*
+match_index_find (const pkg_config_client_t* client,
+                  const pkg_config_pkg_t* pkg)
+{
+  if (client->match_index == NULL)
+    return NULL;
+
+  void** v = pkg_config_hash_lookup (
+      client->match_index, pkg->id, strlen (pkg->id));
+
+  return v != NULL ? *v : NULL;
+}
+
+/* Add the (direct and indirect) dependents of the packages in the worklist
+ * to the set and the worklist using the reverse dependency index. Return
+ * false if unable to allocate memory.
+ */
+static bool
+refresh_add_dependents (const pkg_config_client_t* client,
+                        pkg_config_hash_t* set,
+                        pkg_config_pkg_t*** worklist,
+                        size_t* count,
+                        size_t* capacity)
+{
+  pkg_config_node_t* iter;
+
+  for (size_t i = 0; i != *count; ++i)
+  {
+    pkg_config_pkg_t* pkg = (*worklist)[i];
+    pkg_config_cache_match_t* m = match_index_find (client, pkg);
+
+    if (m == NULL)
+      continue;
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (m->deps.head, iter)
+    {
+      pkg_config_dependency_t* dep = iter->data;
+
+      if (dep->match == pkg && dep->parent != NULL &&
+          !refresh_add (set, worklist, count, capacity, dep->parent))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+static void
+pkg_index_free (pkg_config_client_t* client)
+{
+  pkg_config_hash_t* index = client->pkg_index;
+
+  if (index != NULL)
+  {
+    const pkg_config_allocator_t* a = index->allocator;
+
+    pkg_config_hash_free (index);
+    pkg_config_mem_free (a, index);
+    client->pkg_index = NULL;
+  }
+}
+
+/* Index the package unless a more recently added package with the same id
+ * is already indexed. Note that the cache list is in the most recently
+ * added first order. If unable to allocate memory, free the index.
  */
+static void
+pkg_index_add (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
+{
+  size_t n = strlen (pkg->id);
+
+  if (pkg_config_hash_lookup (client->pkg_index, pkg->id, n) == NULL &&
+      !pkg_config_hash_insert (client->pkg_index, pkg->id, n, pkg))
+    pkg_index_free (client);
+}
+
+/* Build the package cache index leaving it NULL if unable to allocate
+ * memory.
+ */
+static void
+pkg_index_build (pkg_config_client_t* client)
+{
+  const pkg_config_allocator_t* a = client->allocator;
+  pkg_config_node_t* node;
+
+  if ((client->pkg_index = pkg_config_mem_calloc (
+           a, 1, sizeof (pkg_config_hash_t))) == NULL)
+    return;
+
+  client->pkg_index->allocator = a;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->pkg_cache.head, node)
+  {
+    pkg_index_add (client, node->data);
+
+    if (client->pkg_index == NULL)
+      break;
+  }
+}
+
+/* Return the cached package with the specified id or NULL without
+ * acquiring a reference or counting a lookup.
+ */
+pkg_config_pkg_t*
+pkg_config_cache_find (pkg_config_client_t* client, const char* id)
+{
+  pkg_config_node_t* node;
+
+  if (client->pkg_cache.head == NULL)
+    return NULL;
+
+  if (client->pkg_index == NULL)
+    pkg_index_build (client);
+
+  if (client->pkg_index != NULL)
+  {
+    void** v = pkg_config_hash_lookup (client->pkg_index, id, strlen (id));
+
+    if (v == NULL)
+      return NULL;
+
+    PKG_CONFIG_STATS_INC (client, pkg_cache_compares);
+    return *v;
+  }
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->pkg_cache.head, node)
+  {
+    pkg_config_pkg_t* pkg = node->data;
+
+    PKG_CONFIG_STATS_INC (client, pkg_cache_compares);
+
+    if (strcmp (pkg->id, id) == 0)
+      return pkg;
+  }
+
+  return NULL;
+}
 
 /*
  * !doc
@@ -55,19 +296,16 @@
 pkg_config_pkg_t*
 pkg_config_cache_lookup (pkg_config_client_t* client, const char* id)
 {
-  pkg_config_node_t* node;
+  pkg_config_pkg_t* pkg = pkg_config_cache_find (client, id);
 
-  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->pkg_cache.head, node)
+  if (pkg != NULL)
   {
-    pkg_config_pkg_t* pkg = node->data;
-
-    if (!strcmp (pkg->id, id))
-    {
-      PKG_CONFIG_TRACE (client, "found: %s @%p", id, pkg);
-      return pkg_config_pkg_ref (client, pkg);
-    }
+    PKG_CONFIG_STATS_INC (client, pkg_cache_hits);
+    PKG_CONFIG_TRACE (client, "found: %s @%p", id, pkg);
+    return pkg_config_pkg_ref (client, pkg);
   }
 
+  PKG_CONFIG_STATS_INC (client, pkg_cache_misses);
   PKG_CONFIG_TRACE (client, "miss: %s", id);
   return NULL;
 }
@@ -94,19 +332,61 @@ pkg_config_cache_add (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
   pkg_config_pkg_ref (client, pkg);
   pkg_config_list_insert (&pkg->cache_iter, pkg, &client->pkg_cache);
 
+  /* The most recently added package shadows any other with the same id.
+   * Note that we re-insert the entry since its key is the package id.
+   */
+  if (client->pkg_index != NULL)
+  {
+    pkg_config_hash_remove (client->pkg_index, pkg->id, strlen (pkg->id));
+    pkg_index_add (client, pkg);
+  }
+
   PKG_CONFIG_TRACE (client, "added @%p to cache", pkg);
 
   /* mark package as cached */
   pkg->flags |= LIBPKG_CONFIG_PKG_PROPF_CACHED;
 }
 
+/* Drop the memoized results and graphs of the package and its (direct and
+ * indirect) dependents. If unable to allocate memory, drop all of them.
+ */
+static void
+drop_dependents (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
+{
+  if (client->result_cache == NULL && client->graph_cache == NULL)
+    return;
+
+  pkg_config_hash_t affected = PKG_CONFIG_HASH_INITIALIZER;
+  pkg_config_pkg_t** worklist = NULL;
+  size_t count = 0, capacity = 0;
+
+  if (refresh_add (&affected, &worklist, &count, &capacity, pkg) &&
+      refresh_add_dependents (client, &affected, &worklist, &count, &capacity))
+  {
+    for (size_t i = 0; i != count; ++i)
+      pkg_config_cache_result_drop (client, worklist[i]);
+
+    pkg_config_graph_cache_drop (client, &affected);
+  }
+  else
+  {
+    pkg_config_cache_result_free (client);
+    pkg_config_graph_cache_free (client);
+  }
+
+  pkg_config_hash_free (&affected);
+  free (worklist);
+}
+
 /*
  * !doc
  *
  * .. c:function:: void pkg_config_cache_remove(pkg_config_client_t *client,
  * pkg_config_pkg_t *pkg)
  *
- *    Deletes a package from the client object's package cache.
+ *    Deletes a package from the client object's package cache. The memoized
+ *    results and cached graphs of this package and its (direct and indirect)
+ *    dependents are dropped.
  *
  *    :param pkg_config_client_t* client: The client object to modify.
  *    :param pkg_config_pkg_t* pkg: The package object to remove from the
@@ -118,12 +398,167 @@ pkg_config_cache_remove (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
   if (pkg == NULL)
     return;
 
+  /* Note that the memoized results and graphs can only become stale if a
+   * package is removed from the cache (in which case a subsequent lookup may
+   * end up loading a different .pc file) or if the package is freed (in
+   * which case its address can be reused). Adding a package, on the other
+   * hand, cannot affect a successful result since it only depends on the
+   * packages that were already found. Thus we drop the results and graphs
+   * of this package and its (direct and indirect) dependents here and don't
+   * bother in pkg_config_cache_add().
+   */
+  drop_dependents (client, pkg);
+
   if (!(pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CACHED))
     return;
 
   PKG_CONFIG_TRACE (client, "removed @%p from cache", pkg);
 
   pkg_config_list_delete (&pkg->cache_iter, &client->pkg_cache);
+
+  /* If the package is indexed, then replace it with the package it shadows,
+   * if any.
+   */
+  if (client->pkg_index != NULL)
+  {
+    size_t n = strlen (pkg->id);
+    void** v = pkg_config_hash_lookup (client->pkg_index, pkg->id, n);
+
+    if (v != NULL && *v == pkg)
+    {
+      pkg_config_node_t* node;
+
+      pkg_config_hash_remove (client->pkg_index, pkg->id, n);
+
+      LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->pkg_cache.head, node)
+      {
+        pkg_config_pkg_t* p = node->data;
+
+        if (strcmp (p->id, pkg->id) == 0)
+        {
+          pkg_index_add (client, p);
+          break;
+        }
+      }
+    }
+  }
+}
+
+/* Set the dependency match to the package, adding it to the reverse
+ * dependency index. Return false if unable to allocate memory, in which case
+ * the match is left unset (so that the index is always complete).
+ */
+bool
+pkg_config_cache_set_match (pkg_config_client_t* client,
+                            pkg_config_dependency_t* dep,
+                            pkg_config_pkg_t* pkg)
+{
+  assert (dep->match == NULL);
+
+  /* Built-in packages never change and so don't need to be indexed.
+   */
+  if (pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST)
+  {
+    dep->match = pkg_config_pkg_ref (client, pkg);
+    return true;
+  }
+
+  pkg_config_hash_t* index = client->match_index;
+
+  if (index == NULL)
+  {
+    const pkg_config_allocator_t* a = client->allocator;
+
+    if ((index = pkg_config_mem_calloc (a, 1, sizeof (pkg_config_hash_t)))
+        == NULL)
+      return false;
+
+    index->allocator = a;
+    client->match_index = index;
+  }
+
+  /* Note that the entries are allocated with the index allocator so that
+   * they can be freed with the index.
+   */
+  const pkg_config_allocator_t* a = index->allocator;
+  size_t n = strlen (pkg->id);
+  void** v = pkg_config_hash_lookup (index, pkg->id, n);
+  pkg_config_cache_match_t* m;
+
+  if (v != NULL)
+    m = *v;
+  else
+  {
+    m = pkg_config_mem_calloc (a, 1, sizeof (pkg_config_cache_match_t));
+    if (m == NULL)
+      return false;
+
+    if ((m->id = pkg_config_mem_strdup (a, pkg->id)) == NULL ||
+        !pkg_config_hash_insert (index, m->id, n, m))
+    {
+      pkg_config_mem_free (a, m->id);
+      pkg_config_mem_free (a, m);
+      return false;
+    }
+  }
+
+  dep->match = pkg_config_pkg_ref (client, pkg);
+  pkg_config_list_insert (&dep->match_iter, dep, &m->deps);
+  return true;
+}
+
+/* Remove the dependency from the reverse dependency index, if present. Note
+ * that the match itself is left intact.
+ */
+void
+pkg_config_cache_unindex_match (pkg_config_client_t* client,
+                                pkg_config_dependency_t* dep)
+{
+  if (dep->match_iter.data == NULL)
+    return;
+
+  void** v = pkg_config_hash_lookup (
+      client->match_index, dep->match->id, strlen (dep->match->id));
+
+  assert (v != NULL);
+  pkg_config_cache_match_t* m = *v;
+
+  pkg_config_list_delete (&dep->match_iter, &m->deps);
+  memset (&dep->match_iter, 0, sizeof dep->match_iter);
+}
+
+/* Free the reverse dependency index, detaching the indexed dependencies.
+ */
+static void
+match_index_free (pkg_config_client_t* client)
+{
+  pkg_config_hash_t* index = client->match_index;
+
+  if (index == NULL)
+    return;
+
+  for (size_t i = 0; i != index->capacity; ++i)
+  {
+    pkg_config_cache_match_t* m = index->entries[i].value;
+    pkg_config_node_t *iter, *iter2;
+
+    if (index->entries[i].key == NULL)
+      continue;
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY_SAFE (m->deps.head, iter2, iter)
+    {
+      memset (iter, 0, sizeof *iter);
+    }
+
+    pkg_config_mem_free (index->allocator, m->id);
+    pkg_config_mem_free (index->allocator, m);
+  }
+
+  const pkg_config_allocator_t* a = index->allocator;
+
+  pkg_config_hash_free (index);
+  pkg_config_mem_free (a, index);
+  client->match_index = NULL;
 }
 
 static inline void
@@ -154,6 +589,11 @@ pkg_config_cache_free (pkg_config_client_t* client)
 {
   pkg_config_node_t *iter, *iter2;
 
+  pkg_config_cache_result_free (client);
+  pkg_config_graph_cache_free (client);
+  match_index_free (client);
+  pkg_index_free (client);
+
   /* first we clear cached match pointers */
   LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->pkg_cache.head, iter)
   {
@@ -175,3 +615,332 @@ pkg_config_cache_free (pkg_config_client_t* client)
 
   PKG_CONFIG_TRACE (client, "cleared package cache");
 }
+
+/* Remove the cached packages for which the predicate returns true from the
+ * cache so that the next lookup reloads them. Only the dependency matches
+ * pointing to such packages and the memoized results and graphs of their
+ * (direct and indirect) dependents are dropped. Return
+ * LIBPKG_CONFIG_ERRF_MEMORY if unable to allocate memory, in which case the
+ * cache is left unchanged.
+ */
+unsigned int
+pkg_config_cache_invalidate (pkg_config_client_t* client,
+                             bool (*pred) (const pkg_config_pkg_t*, void*),
+                             void* data)
+{
+  unsigned int r = LIBPKG_CONFIG_ERRF_MEMORY;
+  pkg_config_node_t *iter, *iter2;
+
+  pkg_config_hash_t stale = PKG_CONFIG_HASH_INITIALIZER;
+  pkg_config_hash_t affected = PKG_CONFIG_HASH_INITIALIZER;
+  pkg_config_pkg_t** worklist = NULL;
+  size_t count = 0, capacity = 0, stale_count;
+
+  /* First collect the stale packages.
+   */
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->pkg_cache.head, iter)
+  {
+    pkg_config_pkg_t* pkg = iter->data;
+
+    if ((pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) || !pred (pkg, data))
+      continue;
+
+    PKG_CONFIG_TRACE (client, "stale: %s", pkg->filename);
+
+    if (!pkg_config_hash_insert (&stale, pkg, 0, pkg) ||
+        !refresh_add (&affected, &worklist, &count, &capacity, pkg))
+      goto done;
+  }
+
+  stale_count = count;
+
+  /* Then find all their dependents using the reverse dependency index.
+   */
+  if (!refresh_add_dependents (
+          client, &affected, &worklist, &count, &capacity))
+    goto done;
+
+  r = LIBPKG_CONFIG_ERRF_OK;
+
+  if (stale_count == 0)
+    goto done;
+
+  /* Now that nothing can fail, clear the matches pointing to the stale
+   * packages.
+   */
+  for (size_t i = 0; i != stale_count; ++i)
+  {
+    pkg_config_pkg_t* pkg = worklist[i];
+    pkg_config_cache_match_t* m = match_index_find (client, pkg);
+
+    if (m == NULL)
+      continue;
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY_SAFE (m->deps.head, iter2, iter)
+    {
+      pkg_config_dependency_t* dep = iter->data;
+
+      if (dep->match != pkg)
+        continue;
+
+      pkg_config_cache_unindex_match (client, dep);
+      dep->match = NULL;
+      pkg_config_pkg_unref (client, pkg);
+    }
+  }
+
+  /* Drop the memoized results and graphs of the affected packages.
+   */
+  for (size_t i = 0; i != count; ++i)
+    pkg_config_cache_result_drop (client, worklist[i]);
+
+  pkg_config_graph_cache_drop (client, &affected);
+
+  /* Finally, remove the stale packages from the cache. Note that we don't
+   * use pkg_config_cache_remove() since we have already dropped everything
+   * it would. Instead, the package cache index is rebuilt on the next lookup
+   * (which is no worse than this scan).
+   */
+  pkg_index_free (client);
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY_SAFE (client->pkg_cache.head, iter2, iter)
+  {
+    pkg_config_pkg_t* pkg = iter->data;
+
+    if (pkg_config_hash_lookup (&stale, pkg, 0) == NULL)
+      continue;
+
+    pkg_config_list_delete (&pkg->cache_iter, &client->pkg_cache);
+    pkg->flags &= ~LIBPKG_CONFIG_PKG_PROPF_CACHED;
+    pkg_config_pkg_unref (client, pkg);
+  }
+
+  PKG_CONFIG_TRACE (client,
+                    "invalidated cache: %lu stale, %lu affected",
+                    (unsigned long)stale_count,
+                    (unsigned long)count);
+
+done:
+  pkg_config_hash_free (&stale);
+  pkg_config_hash_free (&affected);
+  free (worklist);
+
+  return r;
+}
+
+static bool
+file_changed (const pkg_config_pkg_t* pkg, void* data)
+{
+  (void)data;
+  return pkg_config_pkg_file_changed (pkg);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkg_config_cache_refresh(pkg_config_client_t
+ * *client)
+ *
+ *    Re-validates the client object's package cache against the filesystem.
+ *    Every cached package whose file has changed (according to its device,
+ *    inode, size, and modification time) or no longer exists is removed from
+ *    the cache so that the next lookup reloads it. Only the dependency
+ *    matches pointing to such packages and the memoized results and graphs
+ *    of their (direct and indirect) dependents are dropped; everything else
+ *    stays cached. The cached search directory file ids (see
+ *    pkg_config_path_add()) and handles are also discarded.
+ *
+ *    Note that new package files that would shadow the cached packages are
+ *    not detected (see pkg_config_watch_open() for an alternative). This
+ *    function should not be called while resolving dependencies in parallel
+ *    (see pkg_config_pkg_resolve()).
+ *
+ *    :param pkg_config_client_t* client: The client object to modify.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` on success or
+ *    ``LIBPKG_CONFIG_ERRF_MEMORY`` if unable to allocate memory, in which
+ *    case the cache is left unchanged.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_cache_refresh (pkg_config_client_t* client)
+{
+  pkg_config_path_cache_reset (client->path_cache);
+  pkg_config_path_close_dirs (&client->dir_list);
+  return pkg_config_cache_invalidate (client, file_changed, NULL);
+}
+
+/* Look up a memoized fragment query result for the query flags. Return NULL
+ * if there is no such result or the cache is disabled for the query.
+ */
+const pkg_config_list_t*
+pkg_config_cache_result_lookup (const pkg_config_client_t* client,
+                                const pkg_config_pkg_t* root,
+                                unsigned int kind,
+                                unsigned int flags,
+                                int maxdepth)
+{
+  if (flags & LIBPKG_CONFIG_PKG_PKGF_NO_CACHE)
+    return NULL;
+
+  if (client->result_cache != NULL)
+  {
+    pkg_config_cache_result_t k;
+    k.root = root;
+    k.kind = kind;
+    k.flags = flags & ~PKG_CONFIG_CACHE_RESULT_FLAGS_IGNORED;
+    k.maxdepth = maxdepth;
+
+    void** v = pkg_config_hash_lookup (&client->result_cache->results,
+                                       &k,
+                                       PKG_CONFIG_CACHE_RESULT_KEY_SIZE);
+    if (v != NULL)
+    {
+      const pkg_config_cache_result_t* r = *v;
+
+      PKG_CONFIG_STATS_INC (client, result_cache_hits);
+      PKG_CONFIG_TRACE (client, "result hit: %s/%u", root->id, kind);
+      return &r->frags;
+    }
+  }
+
+  PKG_CONFIG_STATS_INC (client, result_cache_misses);
+  PKG_CONFIG_TRACE (client, "result miss: %s/%u", root->id, kind);
+  return NULL;
+}
+
+/* Memoize a copy of the fragment query result. Note that the result is
+ * simply not memoized if unable to allocate memory.
+ */
+void
+pkg_config_cache_result_add (pkg_config_client_t* client,
+                             const pkg_config_pkg_t* root,
+                             unsigned int kind,
+                             unsigned int flags,
+                             int maxdepth,
+                             const pkg_config_list_t* frags)
+{
+  pkg_config_result_cache_t* c = client->result_cache;
+  pkg_config_cache_result_t* r;
+
+  if (flags & LIBPKG_CONFIG_PKG_PKGF_NO_CACHE)
+    return;
+
+  if (c == NULL)
+  {
+    const pkg_config_allocator_t* a = client->allocator;
+
+    if ((c = pkg_config_mem_calloc (a, 1, sizeof (pkg_config_result_cache_t)))
+        == NULL)
+      return;
+
+    c->allocator = a;
+    c->results.allocator = a;
+    c->roots.allocator = a;
+    client->result_cache = c;
+  }
+
+  r = pkg_config_mem_calloc (
+      c->allocator, 1, sizeof (pkg_config_cache_result_t));
+  if (r == NULL)
+    return;
+
+  r->root = root;
+  r->kind = kind;
+  r->flags = flags & ~PKG_CONFIG_CACHE_RESULT_FLAGS_IGNORED;
+  r->maxdepth = maxdepth;
+
+  if (pkg_config_hash_lookup (
+          &c->results, r, PKG_CONFIG_CACHE_RESULT_KEY_SIZE) != NULL)
+  {
+    pkg_config_mem_free (c->allocator, r); /* Already memoized. */
+    return;
+  }
+
+  /* Chain the result to the root's other results (so that we can drop them
+   * all), if any.
+   */
+  void** v = pkg_config_hash_lookup (&c->roots, root, 0);
+  r->next = v != NULL ? *v : NULL;
+
+  if (!pkg_config_hash_insert (
+          &c->results, r, PKG_CONFIG_CACHE_RESULT_KEY_SIZE, r))
+  {
+    pkg_config_mem_free (c->allocator, r);
+    return;
+  }
+
+  if (!pkg_config_hash_insert (&c->roots, root, 0, r))
+  {
+    pkg_config_hash_remove (&c->results, r, PKG_CONFIG_CACHE_RESULT_KEY_SIZE);
+    pkg_config_mem_free (c->allocator, r);
+    return;
+  }
+
+  /* Note that copying fragments as private (which is what this function
+   * does) never merges them, so we get an exact copy.
+   */
+  pkg_config_fragment_copy_list (client, &r->frags, frags);
+
+  PKG_CONFIG_TRACE (client, "added result %s/%u to cache", root->id, kind);
+}
+
+/* Drop all the memoized fragment query results.
+ */
+void
+pkg_config_cache_result_free (pkg_config_client_t* client)
+{
+  pkg_config_result_cache_t* c = client->result_cache;
+
+  if (c == NULL)
+    return;
+
+  for (size_t i = 0; i != c->results.capacity; ++i)
+  {
+    pkg_config_cache_result_t* r = c->results.entries[i].value;
+
+    if (c->results.entries[i].key == NULL)
+      continue;
+
+    pkg_config_fragment_free (&r->frags);
+    pkg_config_mem_free (c->allocator, r);
+  }
+
+  pkg_config_hash_free (&c->results);
+  pkg_config_hash_free (&c->roots);
+  pkg_config_mem_free (c->allocator, c);
+  client->result_cache = NULL;
+
+  PKG_CONFIG_TRACE (client, "cleared result cache");
+}
+
+/* Drop the memoized fragment query results for the specified root package.
+ */
+void
+pkg_config_cache_result_drop (pkg_config_client_t* client,
+                              const pkg_config_pkg_t* root)
+{
+  pkg_config_result_cache_t* c = client->result_cache;
+
+  if (c == NULL)
+    return;
+
+  void** v = pkg_config_hash_lookup (&c->roots, root, 0);
+
+  if (v == NULL)
+    return;
+
+  pkg_config_cache_result_t* r = *v;
+  pkg_config_hash_remove (&c->roots, root, 0);
+
+  while (r != NULL)
+  {
+    pkg_config_cache_result_t* n = r->next;
+
+    PKG_CONFIG_TRACE (client, "dropped result %s/%u", root->id, r->kind);
+
+    pkg_config_hash_remove (&c->results, r, PKG_CONFIG_CACHE_RESULT_KEY_SIZE);
+    pkg_config_fragment_free (&r->frags);
+    pkg_config_mem_free (c->allocator, r);
+    r = n;
+  }
+}
@@ -57,7 +57,8 @@ trace_path_list (const pkg_config_client_t* client,
 #endif
 
 static inline void
-build_default_search_path (pkg_config_list_t* dirlist)
+build_default_search_path (pkg_config_client_t* client,
+                           pkg_config_list_t* dirlist)
 {
 #ifdef _WIN32
   char namebuf[MAX_PATH];
@@ -73,19 +74,21 @@ build_default_search_path (pkg_config_list_t* dirlist)
   }
   p = strrchr (namebuf, '/');
   if (p == NULL)
-    pkg_config_path_split (PKG_CONFIG_DEFAULT_PATH, dirlist, true);
+    pkg_config_path_split_with (
+        client, PKG_CONFIG_DEFAULT_PATH, dirlist, true);
 
   *p = '\0';
   pkg_config_strlcpy (outbuf, namebuf, sizeof outbuf);
   pkg_config_strlcat (outbuf, "/", sizeof outbuf);
   pkg_config_strlcat (outbuf, "../lib/pkgconfig", sizeof outbuf);
-  pkg_config_path_add (outbuf, dirlist, true);
+  pkg_config_path_add_with (client, outbuf, dirlist, true);
   pkg_config_strlcpy (outbuf, namebuf, sizeof outbuf);
   pkg_config_strlcat (outbuf, "/", sizeof outbuf);
   pkg_config_strlcat (outbuf, "../share/pkgconfig", sizeof outbuf);
-  pkg_config_path_add (outbuf, dirlist, true);
+  pkg_config_path_add_with (client, outbuf, dirlist, true);
 #else
-  pkg_config_path_split (PKG_CONFIG_DEFAULT_PATH, dirlist, true);
+  pkg_config_path_split_with (
+      client, PKG_CONFIG_DEFAULT_PATH, dirlist, true);
 #endif
 }
 
@@ -107,17 +110,17 @@ build_default_search_path (pkg_config_list_t* dirlist)
 void
 pkg_config_client_dir_list_build (pkg_config_client_t* client)
 {
-  pkg_config_path_build_from_environ (
-      "PKG_CONFIG_PATH", NULL, &client->dir_list, true);
+  pkg_config_path_build_from_environ_with (
+      client, "PKG_CONFIG_PATH", NULL, &client->dir_list, true);
 
   if (getenv ("PKG_CONFIG_LIBDIR") != NULL)
   {
     /* PKG_CONFIG_LIBDIR= should empty the default search path entirely. */
-    pkg_config_path_build_from_environ (
-        "PKG_CONFIG_LIBDIR", NULL, &client->dir_list, true);
+    pkg_config_path_build_from_environ_with (
+        client, "PKG_CONFIG_LIBDIR", NULL, &client->dir_list, true);
   }
   else if (!(client->flags & LIBPKG_CONFIG_PKG_PKGF_ENV_ONLY))
-    build_default_search_path (&client->dir_list);
+    build_default_search_path (client, &client->dir_list);
 }
 
 /*
@@ -222,6 +225,127 @@ pkg_config_client_new (pkg_config_error_handler_func_t error_handler,
   return out;
 }
 
+static inline bool
+clone_string (char** dst, const char* src)
+{
+  return src == NULL || (*dst = strdup (src)) != NULL;
+}
+
+static bool
+clone_global_vars (const pkg_config_allocator_t* a,
+                   pkg_config_list_t* dst,
+                   const pkg_config_list_t* src)
+{
+  pkg_config_node_t* n;
+
+  /* Since tuples are prepended, copy in reverse to preserve the order.
+   */
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY_REVERSE (src->tail, n)
+  {
+    const pkg_config_tuple_t* s = n->data;
+    pkg_config_tuple_t* t =
+        pkg_config_mem_calloc (a, 1, sizeof (pkg_config_tuple_t));
+
+    if (t == NULL)
+      return false;
+
+    t->allocator = a;
+
+    if ((t->key = pkg_config_mem_strdup (a, s->key)) == NULL ||
+        (t->value = pkg_config_mem_strdup (a, s->value)) == NULL)
+    {
+      pkg_config_mem_free (a, t->key);
+      pkg_config_mem_free (a, t);
+      return false;
+    }
+
+    pkg_config_list_insert (&t->iter, t, dst);
+  }
+
+  return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_client_t*
+ * pkg_config_client_clone(pkg_config_client_t *parent)
+ *
+ *    Allocate a pkg-config client object with the same configuration as the
+ *    parent: flags, handlers, sysroot and buildroot directories, prefix
+ *    variable name, global variables, search directories, and filtered
+ *    directories. The clone's configuration can then be changed without
+ *    affecting the parent (for example, to resolve the same packages for a
+ *    different sysroot). The clone does not re-read the environment.
+ *
+ *    The clone shares the package file sources (files split into key/value
+ *    lines, which does not depend on the configuration) with the parent and
+ *    its other clones. As a result, each package file is read only once by
+ *    all of them (provided it doesn't change on disk), while the packages
+ *    themselves, as well as the caches of packages and results, are private
+ *    to each client. Note that the sharing starts with the first clone and
+ *    so the packages loaded by the parent prior to that are not shared.
+ *
+ *    The clone can be used and freed independently from the parent,
+ *    including in another thread. Note, however, that cloning modifies the
+ *    parent (to start sharing) and so is subject to the same threading
+ *    restrictions as its other uses.
+ *
+ *    :param pkg_config_client_t* parent: The client object to clone.
+ *    :return: A pkg-config client object or NULL if unable to allocate
+ *    memory.
+ *    :rtype: pkg_config_client_t*
+ */
+pkg_config_client_t*
+pkg_config_client_clone (pkg_config_client_t* parent)
+{
+  pkg_config_client_t* client;
+
+  if (parent->sources == NULL &&
+      (parent->sources = pkg_config_source_cache_new ()) == NULL)
+    return NULL;
+
+  if ((client = calloc (1, sizeof (pkg_config_client_t))) == NULL)
+    return NULL;
+
+  client->error_handler = parent->error_handler;
+  client->error_handler_data = parent->error_handler_data;
+  client->warn_handler = parent->warn_handler;
+  client->warn_handler_data = parent->warn_handler_data;
+  client->trace_handler = parent->trace_handler;
+  client->trace_handler_data = parent->trace_handler_data;
+  client->span_handler = parent->span_handler;
+  client->span_handler_data = parent->span_handler_data;
+  client->diag_handler = parent->diag_handler;
+  client->diag_handler_data = parent->diag_handler_data;
+  client->diag_kinds = parent->diag_kinds;
+  client->allocator = parent->allocator;
+
+  client->flags = parent->flags;
+  client->sources = pkg_config_source_cache_ref (parent->sources);
+
+  pkg_config_path_copy_list_with (
+      client->allocator, &client->dir_list, &parent->dir_list);
+  pkg_config_path_copy_list_with (
+      client->allocator, &client->filter_libdirs, &parent->filter_libdirs);
+  pkg_config_path_copy_list_with (client->allocator,
+                                  &client->filter_includedirs,
+                                  &parent->filter_includedirs);
+
+  if (!clone_string (&client->sysroot_dir, parent->sysroot_dir)       ||
+      !clone_string (&client->buildroot_dir, parent->buildroot_dir)   ||
+      !clone_string (&client->prefix_varname, parent->prefix_varname) ||
+      !clone_global_vars (
+          client->allocator, &client->global_vars, &parent->global_vars))
+  {
+    pkg_config_client_free (client);
+    return NULL;
+  }
+
+  PKG_CONFIG_TRACE (client, "cloned client @%p from @%p", client, parent);
+  return client;
+}
+
 /*
  * !doc
  *
@@ -250,8 +374,17 @@ pkg_config_client_deinit (pkg_config_client_t* client)
   pkg_config_path_free (&client->filter_includedirs);
 
   pkg_config_tuple_free_global (client);
+  pkg_config_watch_close (client);
   pkg_config_path_free (&client->dir_list);
+  pkg_config_path_cache_free (client->path_cache);
   pkg_config_cache_free (client);
+
+#ifdef PKG_CONFIG_LOADER
+  pkg_config_loader_free (client->loader);
+#endif
+
+  if (client->sources != NULL)
+    pkg_config_source_cache_unref (client->sources);
 }
 
 /*
@@ -272,6 +405,92 @@ pkg_config_client_free (pkg_config_client_t* client)
   free (client);
 }
 
+/* All the counters are size_t so we can treat the stats object as an array
+ * for the purpose of the atomic access.
+ */
+#define PKG_CONFIG_STATS_COUNT                                           \
+  (sizeof (pkg_config_client_stats_t) / sizeof (size_t))
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_client_get_stats(const pkg_config_client_t
+ * *client, pkg_config_client_stats_t *stats)
+ *
+ *    Retrieves a snapshot of the client's performance counters (see
+ *    ``pkg_config_client_stats_t`` for their semantics). The counters are
+ *    cumulative since the client initialization or the last reset. If the
+ *    library is built with ``LIBPKG_CONFIG_NSTATS``, all the counters are
+ *    zero.
+ *
+ *    Note that the snapshot may be retrieved while the client is used by
+ *    another thread in which case the counters are individually but not
+ *    mutually consistent.
+ *
+ *    :param pkg_config_client_t* client: The client object being accessed.
+ *    :param pkg_config_client_stats_t* stats: The object to store the
+ *    counters in.
+ *    :return: nothing
+ */
+void
+pkg_config_client_get_stats (const pkg_config_client_t* client,
+                             pkg_config_client_stats_t* stats)
+{
+  const size_t* s = (const size_t*)&client->stats;
+  size_t* d = (size_t*)stats;
+
+  for (size_t i = 0; i != PKG_CONFIG_STATS_COUNT; ++i)
+    d[i] = pkg_config_atomic_load_size (&s[i]);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_client_reset_stats(pkg_config_client_t
+ * *client)
+ *
+ *    Resets the client's performance counters to zero.
+ *
+ *    :param pkg_config_client_t* client: The client object being modified.
+ *    :return: nothing
+ */
+void
+pkg_config_client_reset_stats (pkg_config_client_t* client)
+{
+  size_t* d = (size_t*)&client->stats;
+
+  for (size_t i = 0; i != PKG_CONFIG_STATS_COUNT; ++i)
+    pkg_config_atomic_store_size (&d[i], 0);
+}
+
+/* Add the counters accumulated by a temporary copy of the client (see
+ * resolve.c for details) to the client's counters.
+ */
+void
+pkg_config_client_merge_stats (pkg_config_client_t* client,
+                               const pkg_config_client_stats_t* stats)
+{
+#ifndef LIBPKG_CONFIG_NSTATS
+  const size_t* s = (const size_t*)stats;
+  size_t* d = (size_t*)&client->stats;
+
+  for (size_t i = 0; i != PKG_CONFIG_STATS_COUNT; ++i)
+  {
+    if (s[i] == 0)
+      continue;
+
+    if (&d[i] == &client->stats.var_max_depth ||
+        &d[i] == &client->stats.max_traversal_nodes)
+      pkg_config_atomic_max_size (&d[i], s[i]);
+    else
+      pkg_config_atomic_add_size (&d[i], s[i]);
+  }
+#else
+  (void) client;
+  (void) stats;
+#endif
+}
+
 /*
  * !doc
  *
@@ -385,6 +604,115 @@ pkg_config_client_set_buildroot_dir (pkg_config_client_t* client,
                                    : "$(top_builddir)");
 }
 
+/* Format the diagnostics message, prefixing it with the function name, if
+ * any. Return the length of the complete message which may be greater than
+ * or equal to the buffer size, in which case the message is truncated.
+ */
+static size_t
+diag_format (char* buf,
+             size_t size,
+             const char* funcname,
+             const char* format,
+             va_list args)
+{
+  size_t n = 0;
+  int r;
+
+  if (funcname != NULL && (r = snprintf (buf, size, "[%s]: ", funcname)) > 0)
+    n = (size_t)r;
+
+  if ((r = vsnprintf (n < size ? buf + n : NULL,
+                      n < size ? size - n : 0,
+                      format,
+                      args)) > 0)
+    n += (size_t)r;
+
+  return n;
+}
+
+/* Report the diagnostics to the deferred handler, if it handles this kind,
+ * or format the message and report it to the message handler, serializing
+ * the handler calls during the parallel dependency resolution.
+ *
+ * Most messages fit into a small stack buffer and for those that don't we
+ * allocate the buffer of the exact size (falling back to the truncated
+ * message if unable to).
+ */
+static void
+diag_report (const pkg_config_client_t* client,
+             unsigned int kind,
+             unsigned int eflag,
+             const char* filename,
+             size_t lineno,
+             const char* funcname,
+             const char* format,
+             va_list args)
+{
+  if ((client->diag_kinds & kind) != 0)
+  {
+    if (client->resolver != NULL)
+      pkg_config_mutex_lock (&client->resolver->diag_lock);
+
+    client->diag_handler (kind, eflag,
+                          filename, lineno,
+                          funcname,
+                          format, args,
+                          client, client->diag_handler_data);
+
+    if (client->resolver != NULL)
+      pkg_config_mutex_unlock (&client->resolver->diag_lock);
+
+    return;
+  }
+
+  pkg_config_error_handler_func_t handler;
+  const void* data;
+
+  switch (kind)
+  {
+  case LIBPKG_CONFIG_DIAG_ERROR:
+    handler = client->error_handler;
+    data = client->error_handler_data;
+    break;
+  case LIBPKG_CONFIG_DIAG_WARN:
+    handler = client->warn_handler;
+    data = client->warn_handler_data;
+    break;
+  default:
+    handler = client->trace_handler;
+    data = client->trace_handler_data;
+    break;
+  }
+
+  char sbuf[PKG_CONFIG_DIAG_BUFSIZE];
+  char* buf = sbuf;
+  va_list va;
+
+  va_copy (va, args);
+  size_t n = diag_format (sbuf, sizeof (sbuf), funcname, format, va);
+  va_end (va);
+
+  if (n >= sizeof (sbuf) && (buf = malloc (n + 1)) != NULL)
+  {
+    va_copy (va, args);
+    diag_format (buf, n + 1, funcname, format, va);
+    va_end (va);
+  }
+  else
+    buf = sbuf;
+
+  if (client->resolver != NULL)
+    pkg_config_mutex_lock (&client->resolver->diag_lock);
+
+  handler (eflag, filename, lineno, buf, client, data);
+
+  if (client->resolver != NULL)
+    pkg_config_mutex_unlock (&client->resolver->diag_lock);
+
+  if (buf != sbuf)
+    free (buf);
+}
+
 /*
  * !doc
  *
@@ -408,19 +736,18 @@ pkg_config_error (const pkg_config_client_t* client,
                   const char* format,
                   ...)
 {
-  if (client->error_handler != NULL)
+  if (client->error_handler != NULL ||
+      (client->diag_kinds & LIBPKG_CONFIG_DIAG_ERROR) != 0)
   {
-    char buf[PKG_CONFIG_BUFSIZE];
     va_list va;
 
     va_start (va, format);
-    vsnprintf (buf, sizeof buf, format, va);
+    diag_report (client,
+                 LIBPKG_CONFIG_DIAG_ERROR, eflag,
+                 filename, lineno,
+                 NULL /* funcname */,
+                 format, va);
     va_end (va);
-
-    client->error_handler (eflag,
-                           filename, lineno,
-                           buf,
-                           client, client->error_handler_data);
   }
 }
 
@@ -442,19 +769,18 @@ pkg_config_warn (const pkg_config_client_t* client,
                  size_t lineno,
                  const char* format, ...)
 {
-  if (client->warn_handler != NULL)
+  if (client->warn_handler != NULL ||
+      (client->diag_kinds & LIBPKG_CONFIG_DIAG_WARN) != 0)
   {
-    char buf[PKG_CONFIG_BUFSIZE];
     va_list va;
 
     va_start (va, format);
-    vsnprintf (buf, sizeof buf, format, va);
+    diag_report (client,
+                 LIBPKG_CONFIG_DIAG_WARN, LIBPKG_CONFIG_ERRF_OK,
+                 filename, lineno,
+                 NULL /* funcname */,
+                 format, va);
     va_end (va);
-
-    client->warn_handler (LIBPKG_CONFIG_ERRF_OK,
-                          filename, lineno,
-                          buf,
-                          client, client->warn_handler_data);
   }
 }
 
@@ -482,26 +808,21 @@ pkg_config_trace (const pkg_config_client_t* client,
                   const char* format,
                   ...)
 {
-  if (client == NULL || client->trace_handler == NULL)
-    return;
-
 #ifndef LIBPKG_CONFIG_NTRACE
+  if (client != NULL &&
+      (client->trace_handler != NULL ||
+       (client->diag_kinds & LIBPKG_CONFIG_DIAG_TRACE) != 0))
+  {
+    va_list va;
 
-  char buf[PKG_CONFIG_BUFSIZE];
-  size_t len;
-  va_list va;
-
-  len = snprintf (buf, sizeof buf, "[%s]: ", funcname);
-
-  va_start (va, format);
-  vsnprintf (buf + len, sizeof (buf) - len, format, va);
-  va_end (va);
-
-  client->trace_handler (
-      LIBPKG_CONFIG_ERRF_OK,
-      filename, lineno,
-      buf,
-      client, client->trace_handler_data);
+    va_start (va, format);
+    diag_report (client,
+                 LIBPKG_CONFIG_DIAG_TRACE, LIBPKG_CONFIG_ERRF_OK,
+                 filename, lineno,
+                 funcname,
+                 format, va);
+    va_end (va);
+  }
 #else
   (void)client;
   (void)filename;
@@ -722,3 +1043,168 @@ pkg_config_client_set_trace_handler (
   client->trace_handler = trace_handler;
   client->trace_handler_data = trace_handler_data;
 }
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_client_get_span_handler(const
+ * pkg_config_client_t *client)
+ *
+ *    Returns the span handler if one is set, else ``NULL``.
+ *
+ *    :param pkg_config_client_t* client: The client object to get the span
+ *    handler from.
+ *    :return: a function pointer to the span handler or ``NULL``
+ */
+pkg_config_span_handler_func_t
+pkg_config_client_get_span_handler (const pkg_config_client_t* client)
+{
+  return client->span_handler;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_client_set_span_handler(pkg_config_client_t
+ * *client, pkg_config_span_handler_func_t span_handler, void
+ * *span_handler_data)
+ *
+ *    Sets a span handler (see the `trace` module for details) on a client
+ *    object or uninstalls one if set to ``NULL``.
+ *
+ *    :param pkg_config_client_t* client: The client object to set the span
+ *    handler on.
+ *    :param pkg_config_span_handler_func_t span_handler: The span handler to
+ *    set.
+ *    :param void* span_handler_data: Optional data to associate with the
+ *    span handler.
+ *    :return: nothing
+ */
+void
+pkg_config_client_set_span_handler (
+    pkg_config_client_t* client,
+    pkg_config_span_handler_func_t span_handler,
+    void* span_handler_data)
+{
+  client->span_handler = span_handler;
+  client->span_handler_data = span_handler_data;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_client_get_diag_handler(const
+ * pkg_config_client_t *client)
+ *
+ *    Returns the deferred diagnostics handler if one is set, else ``NULL``.
+ *
+ *    :param pkg_config_client_t* client: The client object to get the
+ *    diagnostics handler from.
+ *    :return: a function pointer to the diagnostics handler or ``NULL``
+ */
+pkg_config_diag_handler_func_t
+pkg_config_client_get_diag_handler (const pkg_config_client_t* client)
+{
+  return client->diag_handler;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_client_set_diag_handler(pkg_config_client_t
+ * *client, pkg_config_diag_handler_func_t diag_handler, void
+ * *diag_handler_data, unsigned int diag_kinds)
+ *
+ *    Sets a deferred diagnostics handler on a client object or uninstalls
+ *    one if set to ``NULL``. For the diagnostics kinds it handles, this
+ *    handler is called with the format and its arguments instead of the
+ *    corresponding message handler being called with the formatted message,
+ *    which allows the application to skip or redirect the formatting.
+ *
+ *    :param pkg_config_client_t* client: The client object to set the
+ *    diagnostics handler on.
+ *    :param pkg_config_diag_handler_func_t diag_handler: The diagnostics
+ *    handler to set.
+ *    :param void* diag_handler_data: Optional data to associate with the
+ *    diagnostics handler.
+ *    :param uint diag_kinds: The diagnostics kinds to handle (a mask of
+ *    ``LIBPKG_CONFIG_DIAG_*``).
+ *    :return: nothing
+ */
+void
+pkg_config_client_set_diag_handler (
+    pkg_config_client_t* client,
+    pkg_config_diag_handler_func_t diag_handler,
+    void* diag_handler_data,
+    unsigned int diag_kinds)
+{
+  client->diag_handler = diag_handler;
+  client->diag_handler_data = diag_handler_data;
+  client->diag_kinds = diag_handler != NULL ? diag_kinds : 0;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const pkg_config_allocator_t
+ * *pkg_config_client_get_allocator(const pkg_config_client_t *client)
+ *
+ *    Returns the allocator if one is set, else ``NULL``.
+ *
+ *    :param pkg_config_client_t* client: The client object to get the
+ *    allocator from.
+ *    :return: the allocator or ``NULL``
+ */
+const pkg_config_allocator_t*
+pkg_config_client_get_allocator (const pkg_config_client_t* client)
+{
+  return client->allocator;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_client_set_allocator(pkg_config_client_t
+ * *client, const pkg_config_allocator_t *allocator)
+ *
+ *    Sets the allocator of the package, dependency, fragment, variable, and
+ *    path objects created by the client from now on or reverts to the C
+ *    library if set to ``NULL``. The clones of the client inherit its
+ *    allocator.
+ *
+ *    Each object remembers the allocator it was allocated with and is freed
+ *    with it (in particular, the package-owned memory is freed with the
+ *    allocator of the client that loaded the package). As a result, the
+ *    allocator can be changed at any time but must remain valid while any
+ *    object allocated with it exists. The strings returned by the
+ *    pkg_config_tuple_parse() function are also allocated with the client
+ *    allocator. Note that if the client is used for the parallel dependency
+ *    resolution (see pkg_config_pkg_resolve()), then the allocator is called
+ *    from multiple threads.
+ *
+ *    The package file read buffers, the traversal state, the client's
+ *    package and result caches and indexes, the dependency graphs (see
+ *    pkg_config_graph_build()), and the reverse dependency indexes (see
+ *    pkg_config_revdep_index_build()) are also allocated with the client
+ *    allocator. Each cache or index uses the allocator that was set when it
+ *    was created (normally, by the first query) until it is cleared.
+ *
+ *    The rest of the client state (filter directory lists built during the
+ *    client initialization, the search directory index, the parallel
+ *    resolution state, etc) as well as the rendered strings (see
+ *    pkg_config_fragment_render()) are still allocated with the C library.
+ *    This includes the file contents kept in the source cache, which is
+ *    shared by the client clones (see pkg_config_client_clone()) that may
+ *    have different allocators.
+ *
+ *    :param pkg_config_client_t* client: The client object to set the
+ *    allocator on.
+ *    :param pkg_config_allocator_t* allocator: The allocator to set.
+ *    :return: nothing
+ */
+void
+pkg_config_client_set_allocator (pkg_config_client_t* client,
+                                 const pkg_config_allocator_t* allocator)
+{
+  client->allocator = allocator;
+}
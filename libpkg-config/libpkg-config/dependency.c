@@ -71,6 +71,168 @@ dependency_to_str (const pkg_config_dependency_t* dep,
 }
 #endif
 
+static void
+dependency_free (pkg_config_dependency_t* dep)
+{
+  if (dep->match != NULL)
+  {
+    pkg_config_cache_unindex_match (dep->match->owner, dep);
+    pkg_config_pkg_unref (dep->match->owner, dep->match);
+  }
+
+  pkg_config_mem_free (dep->allocator, dep->package);
+  pkg_config_mem_free (dep->allocator, dep->version);
+  pkg_config_mem_free (dep->allocator, dep->version_key);
+  pkg_config_mem_free (dep->allocator, dep);
+}
+
+/* Index of a dependency list being built by package name, which makes
+ * collision detection O(1) for lists with many dependencies (see
+ * pkg_config_dependency_parse_str()). The dependencies with the same name
+ * are chained in the list order. Note that the removed dependencies are not
+ * freed until the index is since their names may still be used as keys.
+ *
+ * If unable to allocate memory, we fall back to the linear search.
+ */
+#define DEPENDENCY_INDEX_NONE ((size_t)-1)
+
+typedef struct
+{
+  pkg_config_dependency_t* dep; /* NULL if removed. */
+  size_t next;                  /* Next with the same name or NONE. */
+} dependency_index_node_t;
+
+typedef struct
+{
+  size_t head;
+  size_t tail;
+} dependency_index_chain_t;
+
+typedef struct
+{
+  pkg_config_hash_t names; /* Package name to chain index plus 1. */
+
+  dependency_index_chain_t* chains;
+  size_t chains_count;
+  size_t chains_capacity;
+
+  dependency_index_node_t* nodes;
+  size_t nodes_count;
+  size_t nodes_capacity;
+
+  pkg_config_list_t removed;
+  bool failed;
+} dependency_index_t;
+
+static bool
+dependency_index_grow (void** array,
+                       size_t* capacity,
+                       size_t count,
+                       size_t size)
+{
+  if (count < *capacity)
+    return true;
+
+  size_t c = *capacity != 0 ? *capacity * 2 : 16;
+  void* a = realloc (*array, c * size);
+
+  if (a == NULL)
+    return false;
+
+  *array = a;
+  *capacity = c;
+  return true;
+}
+
+static void
+dependency_index_add (dependency_index_t* x, pkg_config_dependency_t* dep)
+{
+  if (x->failed)
+    return;
+
+  if (!dependency_index_grow ((void**)&x->nodes,
+                              &x->nodes_capacity,
+                              x->nodes_count,
+                              sizeof (dependency_index_node_t)))
+  {
+    x->failed = true;
+    return;
+  }
+
+  size_t i = x->nodes_count;
+  size_t n = strlen (dep->package);
+  void** v = pkg_config_hash_lookup (&x->names, dep->package, n);
+
+  if (v != NULL)
+  {
+    dependency_index_chain_t* c = &x->chains[(size_t)*v - 1];
+
+    x->nodes[c->tail].next = i;
+    c->tail = i;
+  }
+  else
+  {
+    if (!dependency_index_grow ((void**)&x->chains,
+                                &x->chains_capacity,
+                                x->chains_count,
+                                sizeof (dependency_index_chain_t)) ||
+        !pkg_config_hash_insert (
+            &x->names, dep->package, n, (void*)(x->chains_count + 1)))
+    {
+      x->failed = true;
+      return;
+    }
+
+    dependency_index_chain_t* c = &x->chains[x->chains_count++];
+    c->head = c->tail = i;
+  }
+
+  x->nodes[i].dep = dep;
+  x->nodes[i].next = DEPENDENCY_INDEX_NONE;
+  x->nodes_count++;
+}
+
+/* Return the index node of the first dependency with the same name that is
+ * coloured differently or NULL.
+ */
+static dependency_index_node_t*
+dependency_index_find (const dependency_index_t* x,
+                       const pkg_config_dependency_t* dep)
+{
+  void** v =
+      pkg_config_hash_lookup (&x->names, dep->package, strlen (dep->package));
+
+  if (v == NULL)
+    return NULL;
+
+  for (size_t i = x->chains[(size_t)*v - 1].head;
+       i != DEPENDENCY_INDEX_NONE;
+       i = x->nodes[i].next)
+  {
+    dependency_index_node_t* n = &x->nodes[i];
+
+    if (n->dep != NULL && n->dep->flags != dep->flags)
+      return n;
+  }
+
+  return NULL;
+}
+
+static void
+dependency_index_free (dependency_index_t* x)
+{
+  pkg_config_node_t *node, *next;
+
+  pkg_config_hash_free (&x->names);
+  free (x->chains);
+  free (x->nodes);
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY_SAFE (x->removed.head, next, node)
+  {
+    dependency_free (node->data);
+  }
+}
+
 /* find a colliding dependency that is coloured differently */
 static inline pkg_config_dependency_t*
 find_colliding_dependency (const pkg_config_dependency_t* dep,
@@ -92,17 +254,29 @@ find_colliding_dependency (const pkg_config_dependency_t* dep,
   return NULL;
 }
 
+/* If the index is not NULL, then it must be for this list.
+ */
 static inline pkg_config_dependency_t*
 add_or_replace_dependency_node (const pkg_config_client_t* client,
                                 pkg_config_dependency_t* dep,
-                                pkg_config_list_t* list)
+                                pkg_config_list_t* list,
+                                dependency_index_t* index)
 {
 #ifndef LIBPKG_CONFIG_NTRACE
   char depbuf[PKG_CONFIG_ITEM_SIZE];
 #else
   (void)client;
 #endif
-  pkg_config_dependency_t* dep2 = find_colliding_dependency (dep, list);
+  dependency_index_node_t* node = NULL;
+  pkg_config_dependency_t* dep2;
+
+  if (index != NULL && !index->failed)
+  {
+    node = dependency_index_find (index, dep);
+    dep2 = node != NULL ? node->dep : NULL;
+  }
+  else
+    dep2 = find_colliding_dependency (dep, list);
 
   /* there is already a node in the graph which describes this dependency */
   if (dep2 != NULL)
@@ -125,7 +299,7 @@ add_or_replace_dependency_node (const pkg_config_client_t* client,
                         depbuf,
                         dep);
 
-      free (dep);
+      dependency_free (dep);
       return NULL;
     }
     else if (dep2->flags && dep->flags == 0)
@@ -136,7 +310,20 @@ add_or_replace_dependency_node (const pkg_config_client_t* client,
                         dep2);
 
       pkg_config_list_delete (&dep2->iter, list);
-      free (dep2);
+
+      if (index != NULL)
+      {
+        /* Note that the node is always found if the index is still usable
+         * and is otherwise not needed.
+         */
+        if (node != NULL)
+          node->dep = NULL;
+
+        dep2->iter.prev = dep2->iter.next = NULL;
+        pkg_config_list_insert (&dep2->iter, dep2, &index->removed);
+      }
+      else
+        dependency_free (dep2);
     }
     else
       /* If both dependencies have equal strength, we keep both, because of
@@ -156,12 +343,16 @@ add_or_replace_dependency_node (const pkg_config_client_t* client,
                     dep->flags);
   pkg_config_list_insert_tail (&dep->iter, dep, list);
 
+  if (index != NULL)
+    dependency_index_add (index, dep);
+
   return dep;
 }
 
 static inline pkg_config_dependency_t*
 pkg_config_dependency_addraw (const pkg_config_client_t* client,
                               pkg_config_list_t* list,
+                              dependency_index_t* index,
                               const char* package,
                               size_t package_sz,
                               const char* version,
@@ -169,18 +360,30 @@ pkg_config_dependency_addraw (const pkg_config_client_t* client,
                               pkg_config_pkg_comparator_t compare,
                               unsigned int flags)
 {
+  const pkg_config_allocator_t* a = client->allocator;
   pkg_config_dependency_t* dep;
 
-  dep = calloc (1, sizeof (pkg_config_dependency_t));
-  dep->package = pkg_config_strndup (package, package_sz);
+  dep = pkg_config_mem_calloc (a, 1, sizeof (pkg_config_dependency_t));
+  PKG_CONFIG_STATS_INC (client, allocations);
+
+  dep->allocator = a;
+  dep->package = pkg_config_mem_strndup (a, package, package_sz);
 
+  /* Note that if unable to allocate, the version string is compared
+   * directly.
+   */
   if (version_sz != 0)
-    dep->version = pkg_config_strndup (version, version_sz);
+  {
+    dep->version = pkg_config_mem_strndup (a, version, version_sz);
+
+    if (dep->version != NULL)
+      dep->version_key = pkg_config_version_parse (a, dep->version);
+  }
 
   dep->compare = compare;
   dep->flags = flags;
 
-  return add_or_replace_dependency_node (client, dep, list);
+  return add_or_replace_dependency_node (client, dep, list, index);
 }
 
 /*
@@ -212,6 +415,7 @@ pkg_config_dependency_add (const pkg_config_client_t* client,
   if (version != NULL)
     return pkg_config_dependency_addraw (client,
                                          list,
+                                         NULL /* index */,
                                          package,
                                          strlen (package),
                                          version,
@@ -219,8 +423,15 @@ pkg_config_dependency_add (const pkg_config_client_t* client,
                                          compare,
                                          flags);
 
-  return pkg_config_dependency_addraw (
-      client, list, package, strlen (package), NULL, 0, compare, flags);
+  return pkg_config_dependency_addraw (client,
+                                       list,
+                                       NULL /* index */,
+                                       package,
+                                       strlen (package),
+                                       NULL,
+                                       0,
+                                       compare,
+                                       flags);
 }
 
 /*
@@ -259,18 +470,7 @@ pkg_config_dependency_free (pkg_config_list_t* list)
 
   LIBPKG_CONFIG_FOREACH_LIST_ENTRY_SAFE (list->head, next, node)
   {
-    pkg_config_dependency_t* dep = node->data;
-
-    if (dep->match != NULL)
-      pkg_config_pkg_unref (dep->match->owner, dep->match);
-
-    if (dep->package != NULL)
-      free (dep->package);
-
-    if (dep->version != NULL)
-      free (dep->version);
-
-    free (dep);
+    dependency_free (node->data);
   }
 }
 
@@ -307,9 +507,21 @@ pkg_config_dependency_parse_str (const pkg_config_client_t* client,
   char cmpname[32]; /* One of pkg_config_pkg_comparator_names. */
   char* cnameptr = cmpname;
   char* cnameend = cmpname + 32 - 1;
+  pkg_config_node_t* node;
 
   memset (cmpname, '\0', sizeof cmpname);
 
+  /* Index the dependencies already in the list so that we can detect
+   * collisions with the new ones in O(1).
+   */
+  dependency_index_t index;
+  memset (&index, 0, sizeof index);
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (deplist_head->head, node)
+  {
+    dependency_index_add (&index, node->data);
+  }
+
   pkg_config_strlcpy (buf, depends, sizeof buf);
   pkg_config_strlcat (buf, " ", sizeof buf);
 
@@ -362,6 +574,7 @@ pkg_config_dependency_parse_str (const pkg_config_client_t* client,
       {
         pkg_config_dependency_addraw (client,
                                       deplist_head,
+                                      &index,
                                       package,
                                       package_sz,
                                       NULL,
@@ -413,6 +626,7 @@ pkg_config_dependency_parse_str (const pkg_config_client_t* client,
 
         pkg_config_dependency_addraw (client,
                                       deplist_head,
+                                      &index,
                                       package,
                                       package_sz,
                                       version,
@@ -433,6 +647,8 @@ pkg_config_dependency_parse_str (const pkg_config_client_t* client,
 
     ptr++;
   }
+
+  dependency_index_free (&index);
 }
 
 /*
@@ -463,5 +679,16 @@ pkg_config_dependency_parse (const pkg_config_client_t* client,
   char* kvdepends = pkg_config_tuple_parse (client, &pkg->vars, depends);
 
   pkg_config_dependency_parse_str (client, deplist, kvdepends, flags);
-  free (kvdepends);
+  pkg_config_mem_free (client->allocator, kvdepends);
+
+  /* Record the owning package for the reverse dependency index.
+   */
+  pkg_config_node_t* node;
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (deplist->head, node)
+  {
+    pkg_config_dependency_t* dep = node->data;
+
+    if (dep->parent == NULL)
+      dep->parent = pkg;
+  }
 }
@@ -133,7 +133,7 @@ pkg_config_fragment_copy_munged (const pkg_config_client_t* client,
   char mungebuf[PKG_CONFIG_ITEM_SIZE];
   pkg_config_fragment_munge (
       client, mungebuf, sizeof mungebuf, source, client->sysroot_dir);
-  return strdup (mungebuf);
+  return pkg_config_mem_strdup (client->allocator, mungebuf);
 }
 
 /*
@@ -184,8 +184,11 @@ pkg_config_fragment_add (const pkg_config_client_t* client,
       data = string + 2;
     }
 
-    frag = calloc (1, sizeof (pkg_config_fragment_t));
+    frag = pkg_config_mem_calloc (
+        client->allocator, 1, sizeof (pkg_config_fragment_t));
+    PKG_CONFIG_STATS_INC (client, allocations);
 
+    frag->allocator = client->allocator;
     frag->type = type;
     frag->data = pkg_config_fragment_copy_munged (client, data);
 
@@ -214,7 +217,7 @@ pkg_config_fragment_add (const pkg_config_client_t* client,
             client, mungebuf, sizeof mungebuf, string, NULL);
 
         len = strlen (parent->data) + strlen (mungebuf) + 2;
-        newdata = malloc (len);
+        newdata = pkg_config_mem_alloc (parent->allocator, len);
 
         pkg_config_strlcpy (newdata, parent->data, len);
         pkg_config_strlcat (newdata, " ", len);
@@ -228,7 +231,7 @@ pkg_config_fragment_add (const pkg_config_client_t* client,
             newdata,
             list);
 
-        free (parent->data);
+        pkg_config_mem_free (parent->allocator, parent->data);
         parent->data = newdata;
         parent->merged = true;
 
@@ -238,17 +241,20 @@ pkg_config_fragment_add (const pkg_config_client_t* client,
 
         /* the fragment list now (maybe) has the copied node, so free the
          * original */
-        free (parent->data);
-        free (parent);
+        pkg_config_mem_free (parent->allocator, parent->data);
+        pkg_config_mem_free (parent->allocator, parent);
 
         return;
       }
     }
 
-    frag = calloc (1, sizeof (pkg_config_fragment_t));
+    frag = pkg_config_mem_calloc (
+        client->allocator, 1, sizeof (pkg_config_fragment_t));
+    PKG_CONFIG_STATS_INC (client, allocations);
 
+    frag->allocator = client->allocator;
     frag->type = 0;
-    frag->data = strdup (string);
+    frag->data = pkg_config_mem_strdup (client->allocator, string);
 
     PKG_CONFIG_TRACE (client,
                       "created special fragment {'%s'} in list @%p",
@@ -425,7 +431,10 @@ pkg_config_fragment_copy (const pkg_config_client_t* client,
              list, base, client->flags, is_private)) != NULL)
     {
       if (pkg_config_fragment_should_merge (frag))
+      {
+        PKG_CONFIG_STATS_INC (client, fragments_merged);
         pkg_config_fragment_delete (list, frag);
+      }
     }
     else if (!is_private &&
              !pkg_config_fragment_can_merge_back (
@@ -434,12 +443,16 @@ pkg_config_fragment_copy (const pkg_config_client_t* client,
       return;
   }
 
-  frag = calloc (1, sizeof (pkg_config_fragment_t));
+  frag = pkg_config_mem_calloc (
+      client->allocator, 1, sizeof (pkg_config_fragment_t));
+  PKG_CONFIG_STATS_INC (client, allocations);
+  PKG_CONFIG_STATS_INC (client, fragments_copied);
 
+  frag->allocator = client->allocator;
   frag->type = base->type;
   frag->merged = base->merged;
   if (base->data != NULL)
-    frag->data = strdup (base->data);
+    frag->data = pkg_config_mem_strdup (client->allocator, base->data);
 
   pkg_config_list_insert_tail (&frag->iter, frag, list);
 }
@@ -731,8 +744,8 @@ pkg_config_fragment_delete (pkg_config_list_t* list,
 {
   pkg_config_list_delete (&node->iter, list);
 
-  free (node->data);
-  free (node);
+  pkg_config_mem_free (node->allocator, node->data);
+  pkg_config_mem_free (node->allocator, node);
 }
 
 /*
@@ -754,8 +767,8 @@ pkg_config_fragment_free (pkg_config_list_t* list)
   {
     pkg_config_fragment_t* frag = node->data;
 
-    free (frag->data);
-    free (frag);
+    pkg_config_mem_free (frag->allocator, frag->data);
+    pkg_config_mem_free (frag->allocator, frag);
   }
 }
 
@@ -780,17 +793,18 @@ pkg_config_fragment_parse (const pkg_config_client_t* client,
                            pkg_config_list_t* vars,
                            const char* value)
 {
+  const pkg_config_allocator_t* a = client->allocator;
   int i, ret, argc;
   char** argv;
   char* repstr = pkg_config_tuple_parse (client, vars, value);
 
   PKG_CONFIG_TRACE (client, "post-subst: [%s] -> [%s]", value, repstr);
 
-  ret = pkg_config_argv_split (repstr, &argc, &argv);
+  ret = pkg_config_argv_split_with (a, repstr, &argc, &argv);
   if (ret < 0)
   {
     PKG_CONFIG_TRACE (client, "unable to parse fragment string [%s]", repstr);
-    free (repstr);
+    pkg_config_mem_free (a, repstr);
     return false;
   }
 
@@ -803,16 +817,16 @@ pkg_config_fragment_parse (const pkg_config_client_t* client,
                         "while argv[%d] == NULL",
                         argc,
                         i);
-      pkg_config_argv_free (argv);
-      free (repstr);
+      pkg_config_argv_free_with (a, argv);
+      pkg_config_mem_free (a, repstr);
       return false;
     }
 
     pkg_config_fragment_add (client, list, argv[i]);
   }
 
-  pkg_config_argv_free (argv);
-  free (repstr);
+  pkg_config_argv_free_with (a, argv);
+  pkg_config_mem_free (a, repstr);
 
   return true;
 }
@@ -0,0 +1,1111 @@
+/*
+ * graph.c
+ * resolved dependency graph
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+/*
+ * !doc
+ *
+ * libpkg-config `graph` module
+ * ============================
+ *
+ * The `graph` module resolves the dependency graph of a root package once
+ * into an immutable, flattened representation: an array of nodes, one per
+ * distinct package, in the topological order (that is, each package precedes
+ * its dependencies unless there is a dependency cycle) and an array of edges,
+ * each referring to the dependency it was resolved from, the resolved
+ * package node (if any), the edge colour (public, private, internal), and
+ * the dependency verification result. The conflict check result is stored
+ * for each node.
+ *
+ * Such a graph can then be traversed repeatedly without finding packages,
+ * verifying dependency versions, or checking conflicts. The traversal
+ * (including the callback order and error reporting) is equivalent to that
+ * of pkg_config_traversal_walk() performed with the flags and maximum depth
+ * the graph was built with. Like the rest of the traversal API, the graph
+ * functions take the flags from the traversal context rather than from the
+ * client object (see pkg_config_traversal_init() for details).
+ *
+ * Graphs are reference-counted and, unless disabled with
+ * ``LIBPKG_CONFIG_PKG_PKGF_NO_CACHE`` in the traversal context, cached on
+ * the client object keyed by the root package, the flags, and the maximum
+ * depth. Graphs hold
+ * references to their packages and must be released before the client
+ * object is deinitialized.
+ */
+
+/* Flags that do not affect the graph and should not be part of the cache
+ * key.
+ */
+#define PKG_CONFIG_GRAPH_FLAGS_IGNORED                                       \
+  (LIBPKG_CONFIG_PKG_PKGF_NO_CACHE |                                         \
+   LIBPKG_CONFIG_PKG_PKGF_ITER_PKG_IS_PRIVATE |                              \
+   LIBPKG_CONFIG_PKG_PKGF_NO_BATCH_LOAD)
+
+/* The graph cache key: the root, flags, and maxdepth members (which are
+ * contiguous and have no padding in between).
+ */
+#define PKG_CONFIG_GRAPH_KEY_SIZE                                            \
+  (offsetof (pkg_config_graph_t, maxdepth) + sizeof (int) -                \
+   offsetof (pkg_config_graph_t, root))
+
+/* Graph being built.
+ */
+typedef struct
+{
+  pkg_config_client_t* client;
+  pkg_config_graph_t* graph;
+
+  size_t nodes_capacity;
+  size_t edges_capacity;
+  size_t depths_capacity;
+
+  int* depths;              /* Remaining traversal depth for each node. */
+  pkg_config_hash_t index;  /* Package to node index plus 1. */
+} pkg_config_graph_builder_t;
+
+static bool
+grow (const pkg_config_allocator_t* allocator,
+      void** array,
+      size_t* capacity,
+      size_t count,
+      size_t size)
+{
+  if (count < *capacity)
+    return true;
+
+  size_t c = *capacity != 0 ? *capacity * 2 : 16;
+  void* a = pkg_config_mem_realloc (allocator, *array, c * size);
+
+  if (a == NULL)
+    return false;
+
+  *array = a;
+  *capacity = c;
+  return true;
+}
+
+static void
+graph_free (pkg_config_graph_t* graph)
+{
+  pkg_config_client_t* client = graph->owner;
+
+  for (size_t i = 0; i != graph->edges_count; ++i)
+  {
+    pkg_config_graph_edge_t* e = &graph->edges[i];
+
+    if (e->pkg != NULL)
+      pkg_config_pkg_unref (client, e->pkg);
+  }
+
+  for (size_t i = 0; i != graph->nodes_count; ++i)
+  {
+    pkg_config_graph_node_t* n = &graph->nodes[i];
+
+    if (n->conflict_pkg != NULL)
+      pkg_config_pkg_unref (client, n->conflict_pkg);
+
+    pkg_config_pkg_unref (client, n->pkg);
+  }
+
+  const pkg_config_allocator_t* a = graph->allocator;
+
+  pkg_config_mem_free (a, graph->edges);
+  pkg_config_mem_free (a, graph->nodes);
+  pkg_config_mem_free (a, graph);
+}
+
+/* Return the node index for the package, adding a new node if necessary, or
+ * LIBPKG_CONFIG_GRAPH_NONE if unable to allocate memory.
+ */
+static size_t
+graph_node (pkg_config_graph_builder_t* b, pkg_config_pkg_t* pkg, int depth)
+{
+  pkg_config_graph_t* g = b->graph;
+  void** v = pkg_config_hash_lookup (&b->index, pkg, 0);
+
+  if (v != NULL)
+    return (size_t)(uintptr_t)*v - 1;
+
+  if (!grow (g->allocator,
+             (void**)&g->nodes,
+             &b->nodes_capacity,
+             g->nodes_count,
+             sizeof (pkg_config_graph_node_t)) ||
+      !grow (g->allocator,
+             (void**)&b->depths,
+             &b->depths_capacity,
+             g->nodes_count,
+             sizeof (int)))
+    return LIBPKG_CONFIG_GRAPH_NONE;
+
+  size_t i = g->nodes_count;
+
+  if (!pkg_config_hash_insert (&b->index, pkg, 0, (void*)(uintptr_t)(i + 1)))
+    return LIBPKG_CONFIG_GRAPH_NONE;
+
+  pkg_config_graph_node_t* n = &g->nodes[i];
+  memset (n, 0, sizeof (pkg_config_graph_node_t));
+  n->pkg = pkg_config_pkg_ref (b->client, pkg);
+
+  b->depths[i] = depth;
+  g->nodes_count++;
+
+  return i;
+}
+
+/* Resolve the dependency list of the node, adding the edges. Return the
+ * accumulated verification result or LIBPKG_CONFIG_ERRF_MEMORY if unable to
+ * allocate memory.
+ */
+static unsigned int
+graph_resolve (pkg_config_graph_builder_t* b,
+               size_t node,
+               const pkg_config_list_t* deplist,
+               unsigned int colour)
+{
+  pkg_config_graph_t* g = b->graph;
+  unsigned int eflags = LIBPKG_CONFIG_ERRF_OK;
+  pkg_config_node_t* n;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (deplist->head, n)
+  {
+    unsigned int eflags_local;
+    pkg_config_dependency_t* depnode = n->data;
+    pkg_config_pkg_t* pkgdep;
+
+    if (*depnode->package == '\0')
+      continue;
+
+    if (!grow (g->allocator,
+               (void**)&g->edges,
+               &b->edges_capacity,
+               g->edges_count,
+               sizeof (pkg_config_graph_edge_t)))
+      return LIBPKG_CONFIG_ERRF_MEMORY;
+
+    pkgdep =
+        pkg_config_pkg_verify_dependency (b->client, depnode, &eflags_local);
+
+    size_t ei = g->edges_count++;
+    pkg_config_graph_edge_t* e = &g->edges[ei];
+    e->dependency = depnode;
+    e->pkg = pkgdep;
+    e->target = LIBPKG_CONFIG_GRAPH_NONE;
+    e->colour = colour;
+    e->eflags = eflags_local;
+
+    if (depnode->flags & LIBPKG_CONFIG_PKG_DEPF_INTERNAL)
+      e->colour |= LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL;
+
+    eflags |= eflags_local;
+
+    if (pkgdep != NULL)
+    {
+      size_t t = graph_node (b, pkgdep, b->depths[node] - 1);
+
+      if (t == LIBPKG_CONFIG_GRAPH_NONE)
+        return LIBPKG_CONFIG_ERRF_MEMORY;
+
+      g->edges[ei].target = t;
+    }
+  }
+
+  return eflags;
+}
+
+/* Reorder the nodes topologically (reverse DFS postorder starting from the
+ * root) remapping the edge targets accordingly.
+ */
+static bool
+graph_sort (pkg_config_graph_t* g)
+{
+  const pkg_config_allocator_t* a = g->allocator;
+  size_t n = g->nodes_count;
+
+  /* Postorder, old to new index, nodes being visited, and next edge to
+   * follow.
+   */
+  size_t* order = pkg_config_mem_alloc (a, n * sizeof (size_t));
+  size_t* remap = pkg_config_mem_alloc (a, n * sizeof (size_t));
+  size_t* stack = pkg_config_mem_alloc (a, n * sizeof (size_t));
+  size_t* next = pkg_config_mem_alloc (a, n * sizeof (size_t));
+  bool* visited = pkg_config_mem_calloc (a, n, sizeof (bool));
+  pkg_config_graph_node_t* nodes =
+      pkg_config_mem_alloc (a, n * sizeof (pkg_config_graph_node_t));
+
+  bool r = false;
+
+  if (order == NULL || remap == NULL || stack == NULL || next == NULL ||
+      visited == NULL || nodes == NULL)
+    goto done;
+
+  size_t sn = 0, on = 0;
+
+  stack[sn++] = 0;
+  next[0] = g->nodes[0].edges_begin;
+  visited[0] = true;
+
+  while (sn != 0)
+  {
+    size_t i = stack[sn - 1];
+    const pkg_config_graph_node_t* node = &g->nodes[i];
+
+    if (next[i] != node->edges_end)
+    {
+      size_t t = g->edges[next[i]++].target;
+
+      if (t != LIBPKG_CONFIG_GRAPH_NONE && !visited[t])
+      {
+        visited[t] = true;
+        next[t] = g->nodes[t].edges_begin;
+        stack[sn++] = t;
+      }
+      continue;
+    }
+
+    order[on++] = i;
+    sn--;
+  }
+
+  /* All the nodes are reachable from the root by construction.
+   */
+  assert (on == n);
+
+  for (size_t i = 0; i != n; ++i)
+  {
+    size_t o = order[n - 1 - i];
+    nodes[i] = g->nodes[o];
+    remap[o] = i;
+  }
+
+  for (size_t i = 0; i != g->edges_count; ++i)
+  {
+    pkg_config_graph_edge_t* e = &g->edges[i];
+
+    if (e->target != LIBPKG_CONFIG_GRAPH_NONE)
+      e->target = remap[e->target];
+  }
+
+  pkg_config_mem_free (a, g->nodes);
+  g->nodes = nodes;
+  nodes = NULL;
+  r = true;
+
+done:
+  pkg_config_mem_free (a, nodes);
+  pkg_config_mem_free (a, visited);
+  pkg_config_mem_free (a, next);
+  pkg_config_mem_free (a, stack);
+  pkg_config_mem_free (a, remap);
+  pkg_config_mem_free (a, order);
+  return r;
+}
+
+static pkg_config_graph_t*
+graph_build (pkg_config_client_t* client,
+             pkg_config_pkg_t* root,
+             int maxdepth,
+             unsigned int flags)
+{
+  const pkg_config_allocator_t* a = client->allocator;
+  pkg_config_graph_t* g =
+      pkg_config_mem_calloc (a, 1, sizeof (pkg_config_graph_t));
+  if (g == NULL)
+    return NULL;
+
+  g->refcount = 1;
+  g->owner = client;
+  g->allocator = a;
+  g->root = root;
+  g->flags = flags;
+  g->maxdepth = maxdepth;
+
+  pkg_config_graph_builder_t b = {
+    client, g, 0, 0, 0, NULL, PKG_CONFIG_HASH_INITIALIZER};
+  b.index.allocator = a;
+
+  bool ok = graph_node (&b, root, maxdepth) != LIBPKG_CONFIG_GRAPH_NONE;
+
+  /* Resolve the graph breadth-first so that each package is reached with the
+   * maximum remaining depth. Resolve a package dependencies the same way as
+   * pkg_config_pkg_traverse() would if it were to visit this package: not at
+   * all if it is beyond the maximum depth or conflicts, and requires.private
+   * only if requested and requires were resolved successfully.
+   */
+  for (size_t i = 0; ok && i != g->nodes_count; ++i)
+  {
+    pkg_config_graph_node_t* n = &g->nodes[i];
+
+    n->edges_begin = n->edges_private = n->edges_end = g->edges_count;
+
+    if (b.depths[i] == 0)
+      continue;
+
+    if (!(flags & LIBPKG_CONFIG_PKG_PKGF_SKIP_CONFLICTS))
+    {
+      pkg_config_pkg_t* pkg;
+      pkg_config_dependency_t* c =
+          pkg_config_pkg_find_conflict (client, n->pkg, &pkg);
+
+      if (c != NULL)
+      {
+        n->eflags = LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT;
+        n->conflict = c;
+        n->conflict_pkg = pkg;
+        continue;
+      }
+    }
+
+    unsigned int e = graph_resolve (
+        &b, i, &n->pkg->required, LIBPKG_CONFIG_GRAPH_EDGE_PUBLIC);
+
+    if (e & LIBPKG_CONFIG_ERRF_MEMORY)
+    {
+      ok = false;
+      break;
+    }
+
+    n = &g->nodes[i];
+    n->flags |= LIBPKG_CONFIG_GRAPH_NODEF_RESOLVED;
+    n->edges_private = g->edges_count;
+
+    if (e == LIBPKG_CONFIG_ERRF_OK &&
+        (flags & LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE))
+    {
+      e = graph_resolve (&b,
+                         i,
+                         &n->pkg->requires_private,
+                         LIBPKG_CONFIG_GRAPH_EDGE_PRIVATE);
+
+      if (e & LIBPKG_CONFIG_ERRF_MEMORY)
+      {
+        ok = false;
+        break;
+      }
+
+      n = &g->nodes[i];
+      n->flags |= LIBPKG_CONFIG_GRAPH_NODEF_RESOLVED_PRIVATE;
+    }
+
+    n->edges_end = g->edges_count;
+  }
+
+  if (ok)
+    ok = graph_sort (g);
+
+  pkg_config_hash_free (&b.index);
+  pkg_config_mem_free (a, b.depths);
+
+  if (!ok)
+  {
+    graph_free (g);
+    return NULL;
+  }
+
+  PKG_CONFIG_TRACE (client,
+                    "built graph for %s: " LIBPKG_CONFIG_SIZE_FMT
+                    " nodes, " LIBPKG_CONFIG_SIZE_FMT " edges",
+                    root->id,
+                    g->nodes_count,
+                    g->edges_count);
+
+  return g;
+}
+
+/* Add the graph to the cache, unless unable to allocate memory, in which
+ * case it is simply not cached.
+ */
+static void
+graph_cache_add (pkg_config_client_t* client, pkg_config_graph_t* g)
+{
+  if (client->graph_cache == NULL)
+  {
+    const pkg_config_allocator_t* a = client->allocator;
+
+    client->graph_cache =
+        pkg_config_mem_calloc (a, 1, sizeof (pkg_config_hash_t));
+    if (client->graph_cache == NULL)
+      return;
+
+    client->graph_cache->allocator = a;
+  }
+
+  if (pkg_config_hash_insert (
+          client->graph_cache, &g->root, PKG_CONFIG_GRAPH_KEY_SIZE, g))
+    pkg_config_graph_ref (g);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_graph_t *pkg_config_graph_build(
+ * pkg_config_traversal_t *t, pkg_config_pkg_t *root, int maxdepth)
+ *
+ *    Resolve the dependency graph of the root package up to `maxdepth`
+ *    levels using the traversal context flags. Return a cached graph if
+ *    available. Note that dependency resolution errors are not reported but
+ *    stored in the graph and reported when it is traversed.
+ *
+ *    :param pkg_config_traversal_t* t: The traversal context to use.
+ *    :param pkg_config_pkg_t* root: The root of the dependency graph.
+ *    :param int maxdepth: The maximum depth to resolve the dependency graph
+ *    for. -1 means infinite recursion.
+ *    :return: A graph reference or ``NULL`` if unable to allocate memory.
+ *    :rtype: pkg_config_graph_t *
+ */
+pkg_config_graph_t*
+pkg_config_graph_build (pkg_config_traversal_t* t,
+                        pkg_config_pkg_t* root,
+                        int maxdepth)
+{
+  pkg_config_client_t* client = t->client;
+  unsigned int flags =
+      pkg_config_traversal_result_flags (t) & ~PKG_CONFIG_GRAPH_FLAGS_IGNORED;
+  bool cache = (t->flags & LIBPKG_CONFIG_PKG_PKGF_NO_CACHE) == 0;
+
+  if (cache)
+  {
+    pkg_config_graph_t k;
+    k.root = root;
+    k.flags = flags;
+    k.maxdepth = maxdepth;
+
+    void** v = client->graph_cache != NULL
+               ? pkg_config_hash_lookup (client->graph_cache,
+                                         &k.root,
+                                         PKG_CONFIG_GRAPH_KEY_SIZE)
+               : NULL;
+
+    if (v != NULL)
+    {
+      PKG_CONFIG_TRACE (client, "graph hit: %s", root->id);
+      return pkg_config_graph_ref (*v);
+    }
+
+    PKG_CONFIG_TRACE (client, "graph miss: %s", root->id);
+  }
+
+  pkg_config_graph_t* g = graph_build (client, root, maxdepth, flags);
+
+  if (g != NULL && cache)
+    graph_cache_add (client, g);
+
+  return g;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_graph_t *pkg_config_graph_ref(
+ * pkg_config_graph_t *graph)
+ *
+ *    Adds an additional reference to the graph.
+ *
+ *    :param pkg_config_graph_t* graph: The graph object being referenced.
+ *    :return: The graph itself with an incremented reference count.
+ *    :rtype: pkg_config_graph_t *
+ */
+pkg_config_graph_t*
+pkg_config_graph_ref (pkg_config_graph_t* graph)
+{
+  graph->refcount++;
+  return graph;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_graph_unref(pkg_config_graph_t *graph)
+ *
+ *    Releases a reference on the graph. If the reference count is 0, then
+ * also free the graph, releasing the references to its packages.
+ *
+ *    :param pkg_config_graph_t* graph: The graph object being dereferenced.
+ *    :return: nothing
+ */
+void
+pkg_config_graph_unref (pkg_config_graph_t* graph)
+{
+  assert (graph->refcount != 0);
+
+  if (--graph->refcount == 0)
+    graph_free (graph);
+}
+
+/* Drop all the cached graphs.
+ */
+void
+pkg_config_graph_cache_free (pkg_config_client_t* client)
+{
+  pkg_config_hash_t* cache = client->graph_cache;
+
+  if (cache == NULL)
+    return;
+
+  /* Detach the cache first since releasing a graph may release packages,
+   * which in turn may end up here.
+   */
+  client->graph_cache = NULL;
+
+  for (size_t i = 0; i != cache->capacity; ++i)
+  {
+    if (cache->entries[i].key != NULL)
+      pkg_config_graph_unref (cache->entries[i].value);
+  }
+
+  const pkg_config_allocator_t* a = cache->allocator;
+
+  pkg_config_hash_free (cache);
+  pkg_config_mem_free (a, cache);
+
+  PKG_CONFIG_TRACE (client, "cleared graph cache");
+}
+
+/* Drop the cached graphs that contain any of the specified packages (keyed
+ * by pointer).
+ */
+void
+pkg_config_graph_cache_drop (pkg_config_client_t* client,
+                             const pkg_config_hash_t* pkgs)
+{
+  pkg_config_node_t *iter, *iter2;
+  pkg_config_list_t list = LIBPKG_CONFIG_LIST_INITIALIZER;
+  pkg_config_hash_t* cache = client->graph_cache;
+
+  if (cache == NULL)
+    return;
+
+  /* Collect the graphs to drop first since removing an entry may move the
+   * others.
+   */
+  for (size_t i = 0; i != cache->capacity; ++i)
+  {
+    pkg_config_graph_t* g = cache->entries[i].value;
+    size_t j = 0;
+
+    if (cache->entries[i].key == NULL)
+      continue;
+
+    for (; j != g->nodes_count; ++j)
+    {
+      if (pkg_config_hash_lookup (pkgs, g->nodes[j].pkg, 0) != NULL)
+        break;
+    }
+
+    if (j == g->nodes_count)
+      continue;
+
+    PKG_CONFIG_TRACE (client, "dropping graph: %s", g->root->id);
+
+    pkg_config_list_insert (&g->cache_iter, g, &list);
+  }
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (list.head, iter)
+  {
+    pkg_config_graph_t* g = iter->data;
+    pkg_config_hash_remove (cache, &g->root, PKG_CONFIG_GRAPH_KEY_SIZE);
+  }
+
+  /* See pkg_config_graph_cache_free() for why we release them separately.
+   */
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY_SAFE (list.head, iter2, iter)
+  {
+    pkg_config_graph_unref (iter->data);
+  }
+}
+
+/* Traversal frame (see pkg_config_pkg_traverse() for background).
+ */
+typedef struct
+{
+  size_t node;
+  int depth;
+
+  bool in_private;
+  size_t next;         /* Next edge to walk. */
+  unsigned int eflags; /* Errors accumulated walking the current edges. */
+
+  size_t child;        /* Node being traversed or LIBPKG_CONFIG_GRAPH_NONE. */
+} pkg_config_graph_frame_t;
+
+#define PKG_CONFIG_GRAPH_STACK_SIZE 16
+
+static inline unsigned int
+graph_visit (const pkg_config_traversal_t* t,
+             const pkg_config_graph_t* graph,
+             const pkg_config_graph_node_t* node,
+             pkg_config_traversal_func_t func,
+             void* data,
+             int depth)
+{
+  pkg_config_client_t* client = t->client;
+
+  (void)depth; /* Unused if tracing is disabled. */
+
+  PKG_CONFIG_TRACE (client, "%s: level %d", node->pkg->id, depth);
+
+  if (func != NULL)
+    func (t, node->pkg, data);
+
+  if (!(graph->flags & LIBPKG_CONFIG_PKG_PKGF_SKIP_CONFLICTS) &&
+      node->eflags == LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT)
+  {
+    pkg_config_pkg_report_conflict (
+        client, node->pkg, node->conflict, node->conflict_pkg);
+
+    return LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT;
+  }
+
+  /* Visiting a node that was not resolved would mean the traversal differs
+   * from the one used to build the graph.
+   */
+  assert ((node->flags & LIBPKG_CONFIG_GRAPH_NODEF_RESOLVED) != 0);
+
+  return LIBPKG_CONFIG_ERRF_OK;
+}
+
+static inline void
+graph_frame_init (pkg_config_graph_frame_t* frame,
+                  const pkg_config_graph_t* graph,
+                  size_t node,
+                  int depth)
+{
+  frame->node = node;
+  frame->depth = depth;
+  frame->in_private = false;
+  frame->next = graph->nodes[node].edges_begin;
+  frame->eflags = LIBPKG_CONFIG_ERRF_OK;
+  frame->child = LIBPKG_CONFIG_GRAPH_NONE;
+}
+
+static inline void
+graph_set_seen (bool* seen,
+                const pkg_config_graph_t* graph,
+                size_t node,
+                bool v)
+{
+  if ((graph->nodes[node].pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0)
+    seen[node] = v;
+}
+
+/* Walk the graph with the traversal context. Note that the traversal itself
+ * is controlled by the flags the graph was built with while the context
+ * flags are only used by the traversal function.
+ */
+static unsigned int
+graph_walk (pkg_config_traversal_t* t,
+            const pkg_config_graph_t* graph,
+            pkg_config_traversal_func_t func,
+            void* data,
+            unsigned int skip_flags)
+{
+  pkg_config_client_t* client = t->client;
+  unsigned int eflags;
+  unsigned int flags = graph->flags;
+  const pkg_config_graph_node_t* nodes = graph->nodes;
+  const pkg_config_graph_edge_t* edges = graph->edges;
+
+  if (graph->maxdepth == 0)
+    return LIBPKG_CONFIG_ERRF_OK;
+
+  /* Restore the private marker on return in case we are called from a
+   * traversal function (see pkg_config_traversal_walk() for details).
+   */
+  bool outer_private = t->in_private;
+  t->in_private = false;
+
+  eflags = graph_visit (t, graph, &nodes[0], func, data, graph->maxdepth);
+  if (eflags != LIBPKG_CONFIG_ERRF_OK)
+  {
+    t->in_private = outer_private;
+    return eflags;
+  }
+
+  /* Packages on the current path (the root package is not marked, the same
+   * as in pkg_config_pkg_traverse()).
+   */
+  const pkg_config_allocator_t* a = client->allocator;
+  bool* seen = pkg_config_mem_calloc (a, graph->nodes_count, sizeof (bool));
+  if (seen == NULL)
+  {
+    t->in_private = outer_private;
+    return LIBPKG_CONFIG_ERRF_MEMORY;
+  }
+
+  pkg_config_graph_frame_t buf[PKG_CONFIG_GRAPH_STACK_SIZE];
+  pkg_config_graph_frame_t* stack = buf;
+  size_t capacity = PKG_CONFIG_ARRAY_SIZE (buf);
+  size_t n = 0;
+
+  graph_frame_init (&stack[n++], graph, 0, graph->maxdepth);
+
+  while (n != 0)
+  {
+    pkg_config_graph_frame_t* frame = &stack[n - 1];
+    const pkg_config_graph_node_t* node = &nodes[frame->node];
+    size_t end = frame->in_private ? node->edges_end : node->edges_private;
+
+    if (frame->next != end)
+    {
+      const pkg_config_graph_edge_t* e = &edges[frame->next++];
+
+      frame->eflags |= e->eflags;
+      if (e->eflags != LIBPKG_CONFIG_ERRF_OK &&
+          !(flags & LIBPKG_CONFIG_PKG_PKGF_SKIP_ERRORS))
+      {
+        pkg_config_pkg_report_graph_error (
+            client,
+            node->pkg,
+            e->pkg != NULL ? pkg_config_pkg_ref (client, e->pkg) : NULL,
+            e->dependency,
+            e->eflags);
+        continue;
+      }
+
+      if (e->pkg == NULL)
+        continue;
+
+      size_t target = e->target;
+
+      if (seen[target] ||
+          (skip_flags && (e->dependency->flags & skip_flags) == skip_flags))
+        continue;
+
+      int depth = frame->depth - 1;
+      if (depth == 0)
+        continue;
+
+      graph_set_seen (seen, graph, target, true);
+
+      unsigned int eflags_local =
+          graph_visit (t, graph, &nodes[target], func, data, depth);
+      if (eflags_local != LIBPKG_CONFIG_ERRF_OK)
+      {
+        frame->eflags |= eflags_local;
+        graph_set_seen (seen, graph, target, false);
+        continue;
+      }
+
+      if (n == capacity)
+      {
+        size_t c = capacity * 2;
+        pkg_config_graph_frame_t* s =
+            stack != buf ? pkg_config_mem_realloc (a, stack, c * sizeof (*s))
+                         : pkg_config_mem_alloc (a, c * sizeof (*s));
+
+        if (s == NULL)
+        {
+          eflags = LIBPKG_CONFIG_ERRF_MEMORY;
+          break;
+        }
+
+        if (stack == buf)
+          memcpy (s, buf, sizeof (buf));
+
+        stack = s;
+        capacity = c;
+        frame = &stack[n - 1];
+      }
+
+      frame->child = target;
+      graph_frame_init (&stack[n++], graph, target, depth);
+      continue;
+    }
+
+    if (!frame->in_private)
+    {
+      if (frame->eflags == LIBPKG_CONFIG_ERRF_OK &&
+          (flags & LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE))
+      {
+        assert (node->flags & LIBPKG_CONFIG_GRAPH_NODEF_RESOLVED_PRIVATE);
+
+        t->in_private = true;
+
+        frame->in_private = true;
+        frame->next = node->edges_private;
+        continue;
+      }
+    }
+    else
+      t->in_private = false;
+
+    eflags = frame->eflags;
+
+    if (--n != 0)
+    {
+      frame = &stack[n - 1];
+      frame->eflags |= eflags;
+
+      graph_set_seen (seen, graph, frame->child, false);
+      frame->child = LIBPKG_CONFIG_GRAPH_NONE;
+    }
+  }
+
+  if (stack != buf)
+    pkg_config_mem_free (a, stack);
+
+  pkg_config_mem_free (a, seen);
+
+  t->in_private = outer_private;
+  return eflags;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkg_config_graph_traverse(
+ * pkg_config_traversal_t *t, const pkg_config_graph_t *graph,
+ * pkg_config_traversal_func_t func, void *data, unsigned int skip_flags)
+ *
+ *    Walk the resolved dependency graph the same way as
+ *    pkg_config_traversal_walk() would walk it for the graph root package.
+ *    Note that the walk itself is controlled by the flags the graph was built
+ *    with while the context is passed to the traversal function.
+ *
+ *    :param pkg_config_traversal_t* t: The traversal context to use. Its
+ *    client object should be the one that was used to build the graph.
+ *    :param pkg_config_graph_t* graph: The graph to walk.
+ *    :param pkg_config_traversal_func_t func: A traversal function to call
+ *    for each visited node.
+ *    :param void* data: An opaque pointer to data to be passed to the
+ *    traversal function.
+ *    :param uint skip_flags: Skip over dependency nodes containing the
+ *    specified flags. A setting of 0 skips no dependency nodes.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` on success, else an error code.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_graph_traverse (pkg_config_traversal_t* t,
+                           const pkg_config_graph_t* graph,
+                           pkg_config_traversal_func_t func,
+                           void* data,
+                           unsigned int skip_flags)
+{
+  return graph_walk (t, graph, func, data, skip_flags);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_graph_cflags(pkg_config_traversal_t *t,
+ * const pkg_config_graph_t *graph, pkg_config_list_t *list)
+ *
+ *    Walks a resolved dependency graph and extracts relevant ``CFLAGS``
+ *    fragments, the same way as pkg_config_traversal_cflags().
+ *
+ *    :param pkg_config_traversal_t* t: The traversal context to use. Its
+ *    client object should be the one that was used to build the graph.
+ *    :param pkg_config_graph_t* graph: The graph to walk.
+ *    :param pkg_config_list_t* list: The fragment list to add the extracted
+ *    ``CFLAGS`` fragments to.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` if successful, otherwise an error
+ *    code.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_graph_cflags (pkg_config_traversal_t* t,
+                         const pkg_config_graph_t* graph,
+                         pkg_config_list_t* list)
+{
+  unsigned int eflag;
+  unsigned int skip_flags =
+      (t->flags & LIBPKG_CONFIG_PKG_PKGF_DONT_FILTER_INTERNAL_CFLAGS) == 0
+          ? LIBPKG_CONFIG_PKG_DEPF_INTERNAL
+          : 0;
+  pkg_config_list_t frags = LIBPKG_CONFIG_LIST_INITIALIZER;
+
+  eflag = graph_walk (
+      t, graph, pkg_config_pkg_cflags_collect, &frags, skip_flags);
+
+  if (eflag == LIBPKG_CONFIG_ERRF_OK &&
+      t->flags & LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS)
+    eflag = graph_walk (t,
+                        graph,
+                        pkg_config_pkg_cflags_private_collect,
+                        &frags,
+                        skip_flags);
+
+  if (eflag != LIBPKG_CONFIG_ERRF_OK)
+  {
+    pkg_config_fragment_free (&frags);
+    return eflag;
+  }
+
+  pkg_config_fragment_copy_list (t->client, list, &frags);
+  pkg_config_fragment_free (&frags);
+
+  return eflag;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_graph_libs(pkg_config_traversal_t *t,
+ * const pkg_config_graph_t *graph, pkg_config_list_t *list)
+ *
+ *    Walks a resolved dependency graph and extracts relevant ``LIBS``
+ *    fragments, the same way as pkg_config_traversal_libs().
+ *
+ *    :param pkg_config_traversal_t* t: The traversal context to use. Its
+ *    client object should be the one that was used to build the graph.
+ *    :param pkg_config_graph_t* graph: The graph to walk.
+ *    :param pkg_config_list_t* list: The fragment list to add the extracted
+ *    ``LIBS`` fragments to.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` if successful, otherwise an error
+ *    code.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_graph_libs (pkg_config_traversal_t* t,
+                       const pkg_config_graph_t* graph,
+                       pkg_config_list_t* list)
+{
+  unsigned int eflag;
+
+  eflag = graph_walk (t, graph, pkg_config_pkg_libs_collect, list, 0);
+
+  if (eflag != LIBPKG_CONFIG_ERRF_OK)
+  {
+    pkg_config_fragment_free (list);
+    return eflag;
+  }
+
+  return eflag;
+}
+
+static void
+write_dot_string (FILE* f, const char* s)
+{
+  fputc ('"', f);
+
+  for (; *s != '\0'; ++s)
+  {
+    if (*s == '"' || *s == '\\')
+      fputc ('\\', f);
+
+    fputc (*s, f);
+  }
+
+  fputc ('"', f);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_graph_write_dot(const pkg_config_graph_t
+ * *graph, FILE *f)
+ *
+ *    Write the resolved dependency graph in the Graphviz DOT format. Nodes
+ * are labeled with the package id and version. Private edges are dashed,
+ * internal edges are dotted, and failed edges (as well as conflicting
+ * packages) are red. Unresolved dependencies are represented with
+ * additional nodes.
+ *
+ *    :param pkg_config_graph_t* graph: The graph to write.
+ *    :param FILE* f: The stream to write the graph to.
+ *    :return: nothing
+ */
+void
+pkg_config_graph_write_dot (const pkg_config_graph_t* graph, FILE* f)
+{
+  fputs ("digraph ", f);
+  write_dot_string (f, graph->nodes[0].pkg->id);
+  fputs (" {\n", f);
+
+  for (size_t i = 0; i != graph->nodes_count; ++i)
+  {
+    const pkg_config_graph_node_t* n = &graph->nodes[i];
+    const pkg_config_pkg_t* p = n->pkg;
+
+    char buf[PKG_CONFIG_ITEM_SIZE];
+    snprintf (buf,
+              sizeof (buf),
+              "%s %s",
+              p->id != NULL ? p->id : "",
+              p->version != NULL ? p->version : "");
+
+    fprintf (f, "  n" LIBPKG_CONFIG_SIZE_FMT " [label=", i);
+    write_dot_string (f, buf);
+
+    if (n->eflags != LIBPKG_CONFIG_ERRF_OK)
+      fputs (", color=red", f);
+
+    fputs ("];\n", f);
+  }
+
+  for (size_t i = 0; i != graph->nodes_count; ++i)
+  {
+    const pkg_config_graph_node_t* n = &graph->nodes[i];
+
+    for (size_t j = n->edges_begin; j != n->edges_end; ++j)
+    {
+      const pkg_config_graph_edge_t* e = &graph->edges[j];
+      const pkg_config_dependency_t* d = e->dependency;
+
+      if (e->target == LIBPKG_CONFIG_GRAPH_NONE)
+      {
+        fprintf (f, "  e" LIBPKG_CONFIG_SIZE_FMT " [label=", j);
+        write_dot_string (f, d->package);
+        fputs (", shape=box, style=dashed];\n", f);
+
+        fprintf (f,
+                 "  n" LIBPKG_CONFIG_SIZE_FMT " -> e" LIBPKG_CONFIG_SIZE_FMT,
+                 i,
+                 j);
+      }
+      else
+        fprintf (f,
+                 "  n" LIBPKG_CONFIG_SIZE_FMT " -> n" LIBPKG_CONFIG_SIZE_FMT,
+                 i,
+                 e->target);
+
+      if (d->version != NULL)
+      {
+        char buf[PKG_CONFIG_ITEM_SIZE];
+        snprintf (buf,
+                  sizeof (buf),
+                  "%s %s",
+                  pkg_config_pkg_get_comparator (d),
+                  d->version);
+
+        fputs (" [label=", f);
+        write_dot_string (f, buf);
+      }
+      else
+        fputs (" [label=\"\"", f);
+
+      if (e->colour & LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL)
+        fputs (", style=dotted", f);
+      else if (e->colour & LIBPKG_CONFIG_GRAPH_EDGE_PRIVATE)
+        fputs (", style=dashed", f);
+
+      if (e->eflags != LIBPKG_CONFIG_ERRF_OK)
+        fputs (", color=red", f);
+
+      fputs ("];\n", f);
+    }
+  }
+
+  fputs ("}\n", f);
+}
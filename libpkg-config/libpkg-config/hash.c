@@ -0,0 +1,227 @@
+/*
+ * hash.c
+ * internal hash table
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+/* A simple open addressing (linear probing) hash table that maps keys to
+ * opaque values. It is used internally where a linear list scan would make
+ * an operation quadratic.
+ *
+ * The keys are not copied and must outlive their entries. A key is either a
+ * byte sequence (for example, a string without the terminating '\0') or, if
+ * its size is 0, the key pointer value itself. The NULL key is not allowed.
+ *
+ * The entries are allocated with the table's allocator, which should be set
+ * (if at all) while the table is still empty.
+ */
+
+#define PKG_CONFIG_HASH_MIN_CAPACITY 16
+
+size_t
+pkg_config_hash_bytes (const void* key, size_t size)
+{
+  /* FNV-1a.
+   */
+  const unsigned char* p = key;
+  uint64_t h = 14695981039346656037ULL;
+
+  for (size_t i = 0; i != size; ++i)
+  {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+
+  return (size_t)h;
+}
+
+static inline size_t
+hash_key (const void* key, size_t size)
+{
+  if (size != 0)
+    return pkg_config_hash_bytes (key, size);
+
+  /* Fibonacci hashing of the pointer value with the (always zero) alignment
+   * bits shifted out.
+   */
+  uint64_t h = (uint64_t)(uintptr_t)key >> 3;
+  return (size_t)((h * 11400714819323198485ULL) >> 16);
+}
+
+static inline bool
+entry_match (const pkg_config_hash_entry_t* e,
+             const void* key,
+             size_t size,
+             size_t hash)
+{
+  if (size == 0)
+    return e->key == key && e->size == 0;
+
+  return e->hash == hash &&
+         e->size == size &&
+         memcmp (e->key, key, size) == 0;
+}
+
+static pkg_config_hash_entry_t*
+hash_find (const pkg_config_hash_t* table,
+           const void* key,
+           size_t size,
+           size_t hash)
+{
+  size_t mask = table->capacity - 1;
+
+  for (size_t i = hash & mask; ; i = (i + 1) & mask)
+  {
+    pkg_config_hash_entry_t* e = &table->entries[i];
+
+    if (e->key == NULL || entry_match (e, key, size, hash))
+      return e;
+  }
+}
+
+static bool
+hash_grow (pkg_config_hash_t* table)
+{
+  size_t capacity = table->capacity != 0
+                    ? table->capacity * 2
+                    : PKG_CONFIG_HASH_MIN_CAPACITY;
+
+  pkg_config_hash_entry_t* entries = pkg_config_mem_calloc (
+      table->allocator, capacity, sizeof (pkg_config_hash_entry_t));
+
+  if (entries == NULL)
+    return false;
+
+  pkg_config_hash_t t = {entries, capacity, table->count, table->allocator};
+
+  for (size_t i = 0; i != table->capacity; ++i)
+  {
+    const pkg_config_hash_entry_t* e = &table->entries[i];
+
+    if (e->key != NULL)
+      *hash_find (&t, e->key, e->size, e->hash) = *e;
+  }
+
+  pkg_config_mem_free (table->allocator, table->entries);
+  *table = t;
+  return true;
+}
+
+/* Return a pointer to the value of the entry with the specified key or NULL
+ * if there is no such entry.
+ */
+void**
+pkg_config_hash_lookup (const pkg_config_hash_t* table,
+                        const void* key,
+                        size_t size)
+{
+  if (table->count == 0)
+    return NULL;
+
+  pkg_config_hash_entry_t* e =
+      hash_find (table, key, size, hash_key (key, size));
+
+  return e->key != NULL ? &e->value : NULL;
+}
+
+/* Insert an entry or, if an entry with this key already exists, replace its
+ * value. Return false if unable to allocate memory.
+ */
+bool
+pkg_config_hash_insert (pkg_config_hash_t* table,
+                        const void* key,
+                        size_t size,
+                        void* value)
+{
+  assert (key != NULL);
+
+  /* Keep the load factor under 3/4.
+   */
+  if ((table->count + 1) * 4 > table->capacity * 3 && !hash_grow (table))
+    return false;
+
+  size_t hash = hash_key (key, size);
+  pkg_config_hash_entry_t* e = hash_find (table, key, size, hash);
+
+  if (e->key == NULL)
+  {
+    e->key = key;
+    e->size = size;
+    e->hash = hash;
+    table->count++;
+  }
+
+  e->value = value;
+  return true;
+}
+
+/* Remove the entry with the specified key returning false if there is no
+ * such entry. Note that this may move other entries (so any pointers
+ * returned by pkg_config_hash_lookup() are invalidated).
+ */
+bool
+pkg_config_hash_remove (pkg_config_hash_t* table,
+                        const void* key,
+                        size_t size)
+{
+  if (table->count == 0)
+    return false;
+
+  pkg_config_hash_entry_t* entries = table->entries;
+  pkg_config_hash_entry_t* e =
+      hash_find (table, key, size, hash_key (key, size));
+
+  if (e->key == NULL)
+    return false;
+
+  /* Shift back the following entries of the probe sequence that would
+   * otherwise become unreachable (that is, whose home slot is not in the
+   * cyclic range (i, j]).
+   */
+  size_t mask = table->capacity - 1;
+  size_t i = (size_t)(e - entries);
+
+  for (size_t j = (i + 1) & mask; entries[j].key != NULL; j = (j + 1) & mask)
+  {
+    size_t k = entries[j].hash & mask;
+
+    if (i < j ? (k <= i || k > j) : (k <= i && k > j))
+    {
+      entries[i] = entries[j];
+      i = j;
+    }
+  }
+
+  memset (&entries[i], 0, sizeof (entries[i]));
+  table->count--;
+  return true;
+}
+
+void
+pkg_config_hash_free (pkg_config_hash_t* table)
+{
+  pkg_config_mem_free (table->allocator, table->entries);
+
+  table->entries = NULL;
+  table->capacity = 0;
+  table->count = 0;
+}
@@ -0,0 +1,597 @@
+/*
+ * loader.c
+ * batched package file reading
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+#ifdef PKG_CONFIG_LOADER
+#  include <errno.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/sysmacros.h> /* makedev() */
+#  include <linux/stat.h>    /* struct statx */
+#  if defined(__has_include)
+#    if __has_include(<linux/io_uring.h>)
+#      include <linux/io_uring.h>
+#    endif
+#  endif
+
+/* The operations we use were added in Linux 5.6 and we check for a feature
+ * flag added in 5.7 (see pkg_config_loader_new()).
+ */
+#  if defined(__NR_io_uring_setup) && defined(IORING_FEAT_FAST_POLL)
+#    define PKG_CONFIG_IO_URING
+#  endif
+#endif
+
+/*
+ * !doc
+ *
+ * libpkg-config `loader` module
+ * =============================
+ *
+ * The `loader` module reads a batch of package files in a search directory
+ * (for example, all the files of a directory scan or the candidate files for
+ * all the dependencies of a package) with a handful of system calls instead
+ * of about eight per file. It is currently only supported on Linux, using
+ * io_uring: the files are opened relative to the directory handle (see
+ * path.c), stat'ed, and read (and closed) in three rounds of submissions,
+ * each covering as many files as fit into the ring. Since setting up the
+ * ring is not free (a system call and three mappings), the loader is created
+ * on the first use and kept in the client object (or, during the parallel
+ * resolution, in each worker; see resolve.c) until it is deinitialized.
+ *
+ * The loader is an optimization that can fail at any point: if io_uring is
+ * not available (old kernel, disabled with a sysctl, filtered by seccomp,
+ * etc.) or batching is disabled with ``LIBPKG_CONFIG_PKG_PKGF_NO_BATCH_LOAD``,
+ * then pkg_config_loader_get() returns NULL and, if an individual file
+ * cannot be read for any reason other than it not being openable (it is not
+ * a regular file, it changed while being read, etc.), then the file is
+ * marked to be read the usual way. Note also that we use the system calls
+ * directly rather than liburing to avoid the dependency.
+ */
+
+#ifdef PKG_CONFIG_IO_URING
+
+#ifndef AT_EMPTY_PATH
+#  define AT_EMPTY_PATH 0x1000
+#endif
+
+#ifndef AT_STATX_SYNC_AS_STAT
+#  define AT_STATX_SYNC_AS_STAT 0x0000
+#endif
+
+/* Ring size. Reading a file takes two entries (read and close).
+ */
+#define PKG_CONFIG_LOADER_ENTRIES 64
+
+/* Files larger than this are read the usual way.
+ */
+#define PKG_CONFIG_LOADER_MAX_SIZE (1024 * 1024)
+
+/* Completion user data bit marking the close operations (whose results we
+ * ignore).
+ */
+#define PKG_CONFIG_LOADER_CLOSE ((uint64_t)1 << 32)
+
+/* Per-file state of a submission round.
+ */
+typedef struct
+{
+  int fd;
+  int res;
+  struct statx stx;
+} loader_slot;
+
+struct pkg_config_loader_
+{
+  int fd;
+
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring; /* Same as sq_ring if mapped together. */
+  size_t cq_ring_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  unsigned int batch; /* Files per submission round. */
+  bool failed;
+
+  /* Note that the slots are part of the loader rather than the round since
+   * the kernel may still be writing into them if a round fails.
+   */
+  loader_slot slots[PKG_CONFIG_LOADER_ENTRIES / 2];
+};
+
+static void
+loader_unmap (pkg_config_loader_t* l)
+{
+  if (l->sqes != NULL)
+    munmap (l->sqes, l->sqes_size);
+
+  if (l->cq_ring != NULL && l->cq_ring != l->sq_ring)
+    munmap (l->cq_ring, l->cq_ring_size);
+
+  if (l->sq_ring != NULL)
+    munmap (l->sq_ring, l->sq_ring_size);
+}
+
+static void*
+loader_map (int fd, size_t size, off_t offset)
+{
+  void* p = mmap (NULL,
+                  size,
+                  PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE,
+                  fd,
+                  offset);
+
+  return p != MAP_FAILED ? p : NULL;
+}
+
+pkg_config_loader_t*
+pkg_config_loader_new (const pkg_config_client_t* client)
+{
+  if ((client->flags & LIBPKG_CONFIG_PKG_PKGF_NO_BATCH_LOAD) != 0)
+    return NULL;
+
+  struct io_uring_params p;
+  memset (&p, 0, sizeof (p));
+
+  int fd = (int)syscall (__NR_io_uring_setup, PKG_CONFIG_LOADER_ENTRIES, &p);
+
+  if (fd == -1)
+  {
+    PKG_CONFIG_TRACE (client, "io_uring unavailable: %s", strerror (errno));
+    return NULL;
+  }
+
+  pkg_config_loader_t* l;
+
+  if ((p.features & IORING_FEAT_FAST_POLL) == 0 ||
+      (l = calloc (1, sizeof (pkg_config_loader_t))) == NULL)
+  {
+    close (fd);
+    return NULL;
+  }
+
+  l->fd = fd;
+  l->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (unsigned int);
+  l->cq_ring_size =
+      p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  l->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0)
+  {
+    if (l->cq_ring_size > l->sq_ring_size)
+      l->sq_ring_size = l->cq_ring_size;
+
+    l->cq_ring_size = l->sq_ring_size;
+  }
+
+  if ((l->sq_ring = loader_map (fd, l->sq_ring_size, IORING_OFF_SQ_RING))
+      == NULL)
+    goto fail;
+
+  l->cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP) != 0
+               ? l->sq_ring
+               : loader_map (fd, l->cq_ring_size, IORING_OFF_CQ_RING);
+
+  if (l->cq_ring == NULL ||
+      (l->sqes = loader_map (fd, l->sqes_size, IORING_OFF_SQES)) == NULL)
+    goto fail;
+
+  char* sq = l->sq_ring;
+  char* cq = l->cq_ring;
+
+  l->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+  l->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+  l->sq_array = (unsigned int*)(sq + p.sq_off.array);
+  l->cq_head = (unsigned int*)(cq + p.cq_off.head);
+  l->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+  l->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+  l->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+  l->batch = p.sq_entries / 2;
+  return l;
+
+fail:
+  loader_unmap (l);
+  close (fd);
+  free (l);
+  return NULL;
+}
+
+/* Loader of a client for which batch loading is not available (see
+ * pkg_config_loader_get()).
+ */
+static pkg_config_loader_t loader_unavailable;
+
+pkg_config_loader_t*
+pkg_config_loader_get (pkg_config_client_t* client)
+{
+  if ((client->flags & LIBPKG_CONFIG_PKG_PKGF_NO_BATCH_LOAD) != 0)
+    return NULL;
+
+  pkg_config_loader_t* l = client->loader;
+
+  if (l == NULL)
+  {
+    if ((l = pkg_config_loader_new (client)) == NULL)
+      l = &loader_unavailable;
+
+    client->loader = l;
+  }
+
+  return l != &loader_unavailable && !l->failed ? l : NULL;
+}
+
+void
+pkg_config_loader_free (pkg_config_loader_t* l)
+{
+  if (l == NULL || l == &loader_unavailable)
+    return;
+
+  loader_unmap (l);
+  close (l->fd);
+  free (l);
+}
+
+/* Queue a submission entry. Note that the tail is only published by
+ * loader_run().
+ */
+static struct io_uring_sqe*
+loader_sqe (pkg_config_loader_t* l,
+            unsigned int* tail,
+            uint8_t opcode,
+            int fd,
+            uint64_t data)
+{
+  unsigned int i = *tail & *l->sq_mask;
+  struct io_uring_sqe* sqe = &l->sqes[i];
+
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = data;
+
+  l->sq_array[i] = i;
+  ++*tail;
+  return sqe;
+}
+
+/* Submit the queued entries and wait for all of them to complete, saving
+ * the results in the slots. Return false if the submission or the wait
+ * failed, in which case the loader is marked as failed and should not be
+ * used any further.
+ */
+static bool
+loader_run (pkg_config_loader_t* l, unsigned int tail, unsigned int n)
+{
+  __atomic_store_n (l->sq_tail, tail, __ATOMIC_RELEASE);
+
+  unsigned int submitted = 0;
+  unsigned int completed = 0;
+
+  while (completed != n)
+  {
+    unsigned int wait = submitted == n ? 1 : 0;
+    long r = syscall (__NR_io_uring_enter,
+                      l->fd,
+                      n - submitted,
+                      wait,
+                      wait != 0 ? IORING_ENTER_GETEVENTS : 0,
+                      NULL,
+                      0);
+
+    if (r == -1)
+    {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      {
+        l->failed = true;
+        return false;
+      }
+    }
+    else
+      submitted += (unsigned int)r;
+
+    unsigned int head = *l->cq_head;
+    unsigned int ctail = __atomic_load_n (l->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != ctail; ++head, ++completed)
+    {
+      const struct io_uring_cqe* cqe = &l->cqes[head & *l->cq_mask];
+
+      if ((cqe->user_data & PKG_CONFIG_LOADER_CLOSE) == 0)
+        l->slots[cqe->user_data].res = cqe->res;
+    }
+
+    __atomic_store_n (l->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  return true;
+}
+
+/* Close the files opened in a failed round synchronously.
+ */
+static void
+loader_close (pkg_config_loader_t* l, unsigned int count)
+{
+  for (unsigned int i = 0; i != count; ++i)
+  {
+    loader_slot* s = &l->slots[i];
+
+    if (s->fd != -1)
+    {
+      close (s->fd);
+      s->fd = -1;
+    }
+  }
+}
+
+/* Read a round of at most batch files.
+ */
+static void
+loader_round (pkg_config_loader_t* l,
+              int dfd,
+              pkg_config_load_t* loads,
+              unsigned int count)
+{
+  loader_slot* slots = l->slots;
+  unsigned int tail = *l->sq_tail;
+  unsigned int n = 0;
+
+  /* Open.
+   */
+  for (unsigned int i = 0; i != count; ++i)
+  {
+    struct io_uring_sqe* sqe =
+        loader_sqe (l, &tail, IORING_OP_OPENAT, dfd, i);
+
+    sqe->addr = (uint64_t)(uintptr_t)loads[i].name;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+    slots[i].fd = -1;
+    slots[i].res = -ECANCELED;
+  }
+
+  if (!loader_run (l, tail, count))
+  {
+    /* Close the files whose opens have completed. Those still in progress
+     * (if any) are leaked (this should never happen in practice).
+     */
+    for (unsigned int i = 0; i != count; ++i)
+    {
+      if (slots[i].res >= 0)
+        slots[i].fd = slots[i].res;
+    }
+
+    loader_close (l, count);
+    return;
+  }
+
+  for (unsigned int i = 0; i != count; ++i)
+  {
+    pkg_config_load_t* ld = &loads[i];
+    int r = slots[i].res;
+
+    /* Note that EINVAL means the operation is not supported.
+     */
+    if (r >= 0)
+    {
+      slots[i].fd = r;
+      ++n;
+    }
+    else if (r != -EINVAL)
+      ld->error = -r;
+  }
+
+  if (n == 0)
+    return;
+
+  /* Stat the open files to size the buffers and record the identities
+   * (see pkg_config_pkg_file_changed()).
+   */
+  n = 0;
+  for (unsigned int i = 0; i != count; ++i)
+  {
+    if (slots[i].fd == -1)
+      continue;
+
+    struct io_uring_sqe* sqe =
+        loader_sqe (l, &tail, IORING_OP_STATX, slots[i].fd, i);
+
+    sqe->addr = (uint64_t)(uintptr_t)"";
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = (uint64_t)(uintptr_t)&slots[i].stx;
+    sqe->statx_flags = AT_EMPTY_PATH | AT_STATX_SYNC_AS_STAT;
+    ++n;
+  }
+
+  if (!loader_run (l, tail, n))
+  {
+    loader_close (l, count);
+    return;
+  }
+
+  /* Read (the size plus one to detect a file that has grown) and close the
+   * open files. Note that the close is hard-linked to the read so that it
+   * is performed even if the read fails.
+   */
+  n = 0;
+  for (unsigned int i = 0; i != count; ++i)
+  {
+    pkg_config_load_t* ld = &loads[i];
+    const struct statx* stx = &slots[i].stx;
+
+    if (slots[i].fd == -1)
+      continue;
+
+    const unsigned int mask =
+        STATX_TYPE | STATX_INO | STATX_SIZE | STATX_MTIME;
+
+    if (slots[i].res == 0                &&
+        (stx->stx_mask & mask) == mask   &&
+        S_ISREG (stx->stx_mode)          &&
+        stx->stx_size != 0               &&
+        stx->stx_size <= PKG_CONFIG_LOADER_MAX_SIZE)
+    {
+      ld->size = (size_t)stx->stx_size;
+      ld->buf = pkg_config_mem_alloc (ld->allocator, ld->size + 1);
+    }
+
+    if (ld->buf != NULL)
+    {
+      struct io_uring_sqe* sqe =
+          loader_sqe (l, &tail, IORING_OP_READ, slots[i].fd, i);
+
+      sqe->addr = (uint64_t)(uintptr_t)ld->buf;
+      sqe->len = (uint32_t)ld->size + 1;
+      sqe->off = 0;
+      sqe->flags = IOSQE_IO_HARDLINK;
+      ++n;
+    }
+
+    loader_sqe (l,
+                &tail,
+                IORING_OP_CLOSE,
+                slots[i].fd,
+                PKG_CONFIG_LOADER_CLOSE | i);
+    ++n;
+  }
+
+  if (!loader_run (l, tail, n))
+  {
+    /* The reads may still be in progress, so leak the buffers rather than
+     * risk them being written to after they are freed (this should never
+     * happen in practice).
+     */
+    for (unsigned int i = 0; i != count; ++i)
+      loads[i].buf = NULL;
+
+    return;
+  }
+
+  for (unsigned int i = 0; i != count; ++i)
+  {
+    pkg_config_load_t* ld = &loads[i];
+    const struct statx* stx = &slots[i].stx;
+
+    if (ld->buf == NULL)
+      continue;
+
+    if (slots[i].res < 0 || (size_t)slots[i].res != ld->size)
+    {
+      pkg_config_mem_free (ld->allocator, ld->buf);
+      ld->buf = NULL;
+      continue;
+    }
+
+    ld->error = 0;
+
+    memset (&ld->st, 0, sizeof (ld->st));
+    ld->st.st_dev = makedev (stx->stx_dev_major, stx->stx_dev_minor);
+    ld->st.st_ino = (ino_t)stx->stx_ino;
+    ld->st.st_mode = stx->stx_mode;
+    ld->st.st_size = (off_t)stx->stx_size;
+    ld->st.st_mtim.tv_sec = (time_t)stx->stx_mtime.tv_sec;
+    ld->st.st_mtim.tv_nsec = (long)stx->stx_mtime.tv_nsec;
+  }
+}
+
+void
+pkg_config_loader_load (pkg_config_loader_t* l,
+                        const pkg_config_client_t* client,
+                        pkg_config_path_t* dir,
+                        pkg_config_load_t* loads,
+                        size_t count)
+{
+  for (size_t i = 0; i != count; ++i)
+  {
+    loads[i].error = PKG_CONFIG_LOAD_FALLBACK;
+    loads[i].buf = NULL;
+    loads[i].size = 0;
+    loads[i].allocator = client->allocator;
+  }
+
+  int dfd = pkg_config_path_dir_fd (dir);
+
+  if (dfd == -1 || l->failed)
+    return;
+
+  PKG_CONFIG_TRACE (client,
+                    "loading " LIBPKG_CONFIG_SIZE_FMT " files from %s",
+                    count,
+                    dir->path);
+
+  for (size_t i = 0; i < count && !l->failed; i += l->batch)
+  {
+    size_t n = count - i < l->batch ? count - i : l->batch;
+    loader_round (l, dfd, loads + i, (unsigned int)n);
+  }
+}
+
+#elif defined(PKG_CONFIG_LOADER)
+
+pkg_config_loader_t*
+pkg_config_loader_new (const pkg_config_client_t* client)
+{
+  (void)client;
+  return NULL;
+}
+
+pkg_config_loader_t*
+pkg_config_loader_get (pkg_config_client_t* client)
+{
+  (void)client;
+  return NULL;
+}
+
+void
+pkg_config_loader_free (pkg_config_loader_t* l)
+{
+  (void)l;
+}
+
+void
+pkg_config_loader_load (pkg_config_loader_t* l,
+                        const pkg_config_client_t* client,
+                        pkg_config_path_t* dir,
+                        pkg_config_load_t* loads,
+                        size_t count)
+{
+  (void)l;
+  (void)client;
+  (void)dir;
+  (void)loads;
+  (void)count;
+}
+
+#endif
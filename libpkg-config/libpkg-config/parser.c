@@ -24,27 +24,84 @@
 
 #include <libpkg-config/stdinc.h>
 
-/*
- * !doc
- *
- * .. c:function:: pkg_config_pkg_t *pkg_config_parser_parse(const
- * pkg_config_client_t *client, const char *filename, FILE *f)
- *
- *    Parse a .pc file into a pkg_config_pkg_t object structure.
- *
- *    :param pkg_config_client_t* client: The pkg-config client object to use
- * for dependency resolution. :param char* filename: The filename of the
- * package file (including full path). :param FILE* f: The file object to read
- * from. :returns: A ``pkg_config_pkg_t`` object which contains the package
- * data. :rtype: pkg_config_pkg_t *
+/* Append a line to the source copying the key and value into its buffer.
+ * Note that the lines refer to the buffer by offsets since it may be
+ * reallocated.
+ */
+static bool
+source_add_line (pkg_config_source_t* src,
+                 size_t* capacity,
+                 size_t* lines_capacity,
+                 size_t lineno,
+                 char op,
+                 const char* key,
+                 const char* value,
+                 bool trailing_ws)
+{
+  size_t kn = strlen (key) + 1;
+  size_t vn = strlen (value) + 1;
+
+  if (src->size + kn + vn > *capacity)
+  {
+    size_t c = *capacity != 0 ? *capacity : 256;
+    while (src->size + kn + vn > c)
+      c *= 2;
+
+    char* b = realloc (src->buf, c);
+    if (b == NULL)
+      return false;
+
+    src->buf = b;
+    *capacity = c;
+  }
+
+  if (src->lines_count == *lines_capacity)
+  {
+    size_t c = *lines_capacity != 0 ? *lines_capacity * 2 : 16;
+    pkg_config_source_line_t* l =
+        realloc (src->lines, c * sizeof (pkg_config_source_line_t));
+    if (l == NULL)
+      return false;
+
+    src->lines = l;
+    *lines_capacity = c;
+  }
+
+  pkg_config_source_line_t* l = &src->lines[src->lines_count++];
+  l->lineno = lineno;
+  l->op = op;
+  l->trailing_ws = trailing_ws;
+
+  l->key = src->size;
+  memcpy (src->buf + src->size, key, kn);
+  src->size += kn;
+
+  l->value = src->size;
+  memcpy (src->buf + src->size, value, vn);
+  src->size += vn;
+
+  return true;
+}
+
+void
+pkg_config_source_free (pkg_config_source_t* src)
+{
+  free (src->filename);
+  free (src->buf);
+  free (src->lines);
+  free (src);
+}
+
+/* Read the file splitting it into key/value lines. The file is closed in
+ * any case. Note that the diagnostics for the lines are issued when they
+ * are applied (see pkg_config_parser_apply()). The resulting source has one
+ * reference.
  */
 unsigned int
-pkg_config_parser_parse (pkg_config_client_t* client,
-                         FILE* f,
-                         void* data,
-                         const pkg_config_parser_operand_func_t* ops,
-                         size_t ops_count,
-                         const char* filename)
+pkg_config_parser_lex (pkg_config_client_t* client,
+                       FILE* f,
+                       const char* filename,
+                       pkg_config_source_t** result)
 {
   unsigned int eflags = LIBPKG_CONFIG_ERRF_OK;
 
@@ -146,13 +203,27 @@ pkg_config_parser_parse (pkg_config_client_t* client,
     readbuf = malloc (readbufn);
   }
 
+  pkg_config_source_t* src = calloc (1, sizeof (pkg_config_source_t));
+  size_t capacity = 0;
+  size_t lines_capacity = 0;
+
+  if (readbuf == NULL || src == NULL)
+  {
+    free (readbuf);
+    free (src);
+    fclose (f);
+    return LIBPKG_CONFIG_ERRF_MEMORY;
+  }
+
+  src->refs = 1;
+
   while (pkg_config_fgetline (readbuf, readbufn, f) != NULL)
   {
     char op, *p, *key, *value;
 #if 0
     bool warned_key_whitespace = false;
 #endif
-    bool warned_value_whitespace = false;
+    bool trailing_ws = false;
 
     lineno++;
 
@@ -202,23 +273,69 @@ pkg_config_parser_parse (pkg_config_client_t* client,
       p = value + (strlen (value) - 1);
       while (p >= value && isspace ((unsigned int)*p))
       {
-        if (!warned_value_whitespace && op == '=')
-        {
-          pkg_config_warn (
-            client,
-            filename,
-            lineno,
-            "trailing whitespace encountered while parsing value section");
-
-          warned_value_whitespace = true;
-        }
+        if (op == '=')
+          trailing_ws = true;
 
         *p = '\0';
         p--;
       }
     }
 
-    unsigned char i = (unsigned char)op;
+    if (!source_add_line (src,
+                          &capacity,
+                          &lines_capacity,
+                          lineno,
+                          op,
+                          key,
+                          value,
+                          trailing_ws))
+    {
+      eflags = LIBPKG_CONFIG_ERRF_MEMORY;
+      break;
+    }
+  }
+
+  PKG_CONFIG_STATS_ADD (client, bytes_parsed, readbufn - 2);
+  PKG_CONFIG_STATS_ADD (client, lines_parsed, lineno);
+
+  free (readbuf);
+  fclose (f);
+
+  if (eflags != LIBPKG_CONFIG_ERRF_OK)
+  {
+    pkg_config_source_free (src);
+    return eflags;
+  }
+
+  *result = src;
+  return eflags;
+}
+
+/* Apply the source lines to the data object. Stop and return the error on
+ * the first line that fails to apply.
+ */
+unsigned int
+pkg_config_parser_apply (pkg_config_client_t* client,
+                         const pkg_config_source_t* src,
+                         void* data,
+                         const pkg_config_parser_operand_func_t* ops,
+                         size_t ops_count,
+                         const char* filename)
+{
+  unsigned int eflags = LIBPKG_CONFIG_ERRF_OK;
+
+  for (size_t j = 0; j != src->lines_count; ++j)
+  {
+    const pkg_config_source_line_t* l = &src->lines[j];
+
+    if (l->trailing_ws)
+      pkg_config_warn (
+        client,
+        filename,
+        l->lineno,
+        "trailing whitespace encountered while parsing value section");
+
+    unsigned char i = (unsigned char)l->op;
 
     if (i >= ops_count || ops[i] == NULL)
     {
@@ -226,20 +343,208 @@ pkg_config_parser_parse (pkg_config_client_t* client,
       pkg_config_error (client,
                         eflags,
                         filename,
-                        lineno,
+                        l->lineno,
                         "unexpected key/value separator '%c'",
-                        op);
+                        l->op);
       break;
     }
     else
     {
-      eflags = ops[i](data, lineno, key, value);
+      eflags =
+        ops[i](data, l->lineno, src->buf + l->key, src->buf + l->value);
       if (eflags != LIBPKG_CONFIG_ERRF_OK)
         break;
     }
   }
 
-  free (readbuf);
-  fclose (f);
   return eflags;
 }
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_pkg_t *pkg_config_parser_parse(const
+ * pkg_config_client_t *client, const char *filename, FILE *f)
+ *
+ *    Parse a .pc file into a pkg_config_pkg_t object structure.
+ *
+ *    :param pkg_config_client_t* client: The pkg-config client object to use
+ * for dependency resolution. :param char* filename: The filename of the
+ * package file (including full path). :param FILE* f: The file object to read
+ * from. :returns: A ``pkg_config_pkg_t`` object which contains the package
+ * data. :rtype: pkg_config_pkg_t *
+ */
+unsigned int
+pkg_config_parser_parse (pkg_config_client_t* client,
+                         FILE* f,
+                         void* data,
+                         const pkg_config_parser_operand_func_t* ops,
+                         size_t ops_count,
+                         const char* filename)
+{
+  pkg_config_source_t* src;
+  unsigned int eflags = pkg_config_parser_lex (client, f, filename, &src);
+
+  if (eflags == LIBPKG_CONFIG_ERRF_OK)
+  {
+    eflags =
+        pkg_config_parser_apply (client, src, data, ops, ops_count, filename);
+    pkg_config_source_free (src);
+  }
+
+  return eflags;
+}
+
+/* The source cache is shared between a client and its clones, which may be
+ * used from different threads. The sources are reference-counted under the
+ * cache mutex so that a source being applied stays valid even if it is
+ * replaced in the cache in the meantime.
+ */
+pkg_config_source_cache_t*
+pkg_config_source_cache_new (void)
+{
+  pkg_config_source_cache_t* cache =
+      calloc (1, sizeof (pkg_config_source_cache_t));
+
+  if (cache == NULL)
+    return NULL;
+
+  if (!pkg_config_mutex_init (&cache->mutex))
+  {
+    free (cache);
+    return NULL;
+  }
+
+  cache->refs = 1;
+  return cache;
+}
+
+pkg_config_source_cache_t*
+pkg_config_source_cache_ref (pkg_config_source_cache_t* cache)
+{
+  pkg_config_mutex_lock (&cache->mutex);
+  cache->refs++;
+  pkg_config_mutex_unlock (&cache->mutex);
+
+  return cache;
+}
+
+static void
+source_unref (pkg_config_source_t* src)
+{
+  if (--src->refs == 0)
+    pkg_config_source_free (src);
+}
+
+void
+pkg_config_source_cache_unref (pkg_config_source_cache_t* cache)
+{
+  pkg_config_mutex_lock (&cache->mutex);
+  size_t refs = --cache->refs;
+  pkg_config_mutex_unlock (&cache->mutex);
+
+  if (refs != 0)
+    return;
+
+  for (size_t i = 0; i != cache->sources.capacity; ++i)
+  {
+    pkg_config_hash_entry_t* e = &cache->sources.entries[i];
+
+    if (e->key != NULL)
+      source_unref (e->value);
+  }
+
+  pkg_config_hash_free (&cache->sources);
+  pkg_config_mutex_destroy (&cache->mutex);
+  free (cache);
+}
+
+/* Return the source for the package file if cached and the file identity
+ * matches and NULL otherwise. The returned source should be released with
+ * pkg_config_source_cache_release().
+ */
+pkg_config_source_t*
+pkg_config_source_cache_find (pkg_config_source_cache_t* cache,
+                              const pkg_config_pkg_t* pkg)
+{
+  pkg_config_source_t* r = NULL;
+
+  pkg_config_mutex_lock (&cache->mutex);
+
+  void** v = pkg_config_hash_lookup (
+      &cache->sources, pkg->filename, strlen (pkg->filename));
+
+  if (v != NULL)
+  {
+    pkg_config_source_t* src = *v;
+
+    if (src->file_dev == pkg->file_dev   &&
+        src->file_ino == pkg->file_ino   &&
+        src->file_size == pkg->file_size &&
+        src->file_mtime == pkg->file_mtime)
+    {
+      src->refs++;
+      r = src;
+    }
+  }
+
+  pkg_config_mutex_unlock (&cache->mutex);
+  return r;
+}
+
+/* Add the source for the package file to the cache, replacing the source
+ * for an older version of the file, if any. The source is unchanged if
+ * unable to allocate memory.
+ */
+void
+pkg_config_source_cache_add (pkg_config_source_cache_t* cache,
+                             const pkg_config_pkg_t* pkg,
+                             pkg_config_source_t* src)
+{
+  if ((src->filename = strdup (pkg->filename)) == NULL)
+    return;
+
+  src->file_dev = pkg->file_dev;
+  src->file_ino = pkg->file_ino;
+  src->file_size = pkg->file_size;
+  src->file_mtime = pkg->file_mtime;
+
+  size_t n = strlen (src->filename);
+
+  pkg_config_mutex_lock (&cache->mutex);
+
+  void** v = pkg_config_hash_lookup (&cache->sources, src->filename, n);
+
+  if (v != NULL)
+  {
+    /* Note that the key points to the old source's file name.
+     */
+    pkg_config_source_t* old = *v;
+    pkg_config_hash_remove (&cache->sources, src->filename, n);
+    source_unref (old);
+  }
+
+  if (pkg_config_hash_insert (&cache->sources, src->filename, n, src))
+    src->refs++;
+
+  pkg_config_mutex_unlock (&cache->mutex);
+}
+
+/* Release the source obtained from pkg_config_source_cache_find() or
+ * pkg_config_parser_lex(). The cache should be the one the source was added
+ * to, if any, and may be NULL otherwise.
+ */
+void
+pkg_config_source_cache_release (pkg_config_source_cache_t* cache,
+                                 pkg_config_source_t* src)
+{
+  if (cache == NULL)
+  {
+    source_unref (src);
+    return;
+  }
+
+  pkg_config_mutex_lock (&cache->mutex);
+  source_unref (src);
+  pkg_config_mutex_unlock (&cache->mutex);
+}
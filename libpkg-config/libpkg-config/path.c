@@ -29,34 +29,6 @@
 #define PKG_CONFIG_CACHE_INODES
 #endif
 
-static bool
-#ifdef PKG_CONFIG_CACHE_INODES
-path_list_contains_entry (const char* text,
-                          pkg_config_list_t* dirlist,
-                          struct stat* st)
-#else
-path_list_contains_entry (const char* text, pkg_config_list_t* dirlist)
-#endif
-{
-  pkg_config_node_t* n;
-
-  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (dirlist->head, n)
-  {
-    pkg_config_path_t* pn = n->data;
-
-#ifdef PKG_CONFIG_CACHE_INODES
-    if (pn->handle_device == (void*)(intptr_t)st->st_dev &&
-        pn->handle_path == (void*)(intptr_t)st->st_ino)
-      return true;
-#endif
-
-    if (!strcmp (text, pn->path))
-      return true;
-  }
-
-  return false;
-}
-
 /*
  * !doc
  *
@@ -88,47 +60,349 @@ pkg_config_path_add (const char* text,
                      pkg_config_list_t* dirlist,
                      bool filter)
 {
+  pkg_config_path_add_with (NULL, text, dirlist, filter);
+}
+
+/* Search directory cache.
+ *
+ * To filter out the duplicate directories, pkg_config_path_add() looks for
+ * a directory with the same (normalized) path or, if supported, the same
+ * file id (device and inode numbers) in the list. For the client's search
+ * directory list this is done with the help of the index of the list
+ * directories by the path and the file id. The index is kept in sync with
+ * the list by comparing the list state (head, tail, and length) with the one
+ * it was built for and rebuilding it (without any system calls, since the
+ * file ids are stored in the list nodes) on mismatch. Note that this only
+ * detects the modifications other than appending if they change the list
+ * state, which should be the case unless the list is freed and rebuilt
+ * directly (rather than with pkg_config_path_add()) to exactly the same
+ * number of nodes.
+ *
+ * Also, the successful file id queries are cached per client by the
+ * normalized path so that repeatedly adding the same directory, even to
+ * different lists, is free of system calls. This cache is cleared by
+ * pkg_config_cache_refresh().
+ *
+ * The cache records (which are also the index values) are owned by the
+ * cache and the hash table keys are borrowed from them.
+ */
+typedef struct
+{
+  uintptr_t dev;
+  uintptr_t ino;
+} path_file_id;
+
+typedef struct
+{
+  path_file_id id;
+  bool id_valid;
+  char path[]; /* Normalized path. */
+} path_record;
+
+struct pkg_config_path_cache_
+{
+  pkg_config_hash_t records; /* Path to path_record*. */
+
+  /* Search directory list index and the list state it was built for.
+   */
+  pkg_config_hash_t paths; /* Path to path_record*. */
+  pkg_config_hash_t files; /* File id to path_record*. */
+
+  const pkg_config_node_t* head;
+  const pkg_config_node_t* tail;
+  size_t length;
+};
+
+static void
+path_cache_clear_index (pkg_config_path_cache_t* cache)
+{
+  pkg_config_hash_free (&cache->paths);
+  pkg_config_hash_free (&cache->files);
+
+  cache->head = NULL;
+  cache->tail = NULL;
+  cache->length = SIZE_MAX; /* Never matches. */
+}
+
+void
+pkg_config_path_cache_reset (pkg_config_path_cache_t* cache)
+{
+  if (cache == NULL)
+    return;
+
+  /* The index references the records so drop it as well.
+   */
+  path_cache_clear_index (cache);
+
+  for (size_t i = 0; i != cache->records.capacity; ++i)
+  {
+    if (cache->records.entries[i].key != NULL)
+      free (cache->records.entries[i].value);
+  }
+
+  pkg_config_hash_free (&cache->records);
+}
+
+void
+pkg_config_path_cache_free (pkg_config_path_cache_t* cache)
+{
+  pkg_config_path_cache_reset (cache);
+  free (cache);
+}
+
+static pkg_config_path_cache_t*
+path_cache_get (pkg_config_client_t* client)
+{
+  if (client->path_cache == NULL)
+  {
+    pkg_config_path_cache_t* c = calloc (1, sizeof (pkg_config_path_cache_t));
+
+    if (c != NULL)
+      c->length = SIZE_MAX;
+
+    client->path_cache = c;
+  }
+
+  return client->path_cache;
+}
+
+/* Return the record for the path, creating it if not present. Return NULL
+ * if unable to allocate memory.
+ */
+static path_record*
+path_cache_record (pkg_config_path_cache_t* cache, const char* path)
+{
+  size_t n = strlen (path);
+  void** v = pkg_config_hash_lookup (&cache->records, path, n);
+
+  if (v != NULL)
+    return *v;
+
+  path_record* r = malloc (sizeof (path_record) + n + 1);
+
+  if (r == NULL)
+    return NULL;
+
+  r->id_valid = false;
+  memcpy (r->path, path, n + 1);
+
+  if (!pkg_config_hash_insert (&cache->records, r->path, n, r))
+  {
+    free (r);
+    return NULL;
+  }
+
+  return r;
+}
+
+/* Add the record to the index returning false if unable to allocate memory.
+ */
+static bool
+path_cache_index (pkg_config_path_cache_t* cache, path_record* r)
+{
+  if (!pkg_config_hash_insert (&cache->paths, r->path, strlen (r->path), r))
+    return false;
+
+  if (r->id_valid &&
+      !pkg_config_hash_insert (&cache->files, &r->id, sizeof (r->id), r))
+    return false;
+
+  return true;
+}
+
+/* Make sure the index matches the list, rebuilding it if necessary. Return
+ * false if unable to allocate memory, in which case the index is cleared.
+ */
+static bool
+path_cache_sync (pkg_config_path_cache_t* cache,
+                 const pkg_config_list_t* dirlist)
+{
+  if (cache->head == dirlist->head &&
+      cache->tail == dirlist->tail &&
+      cache->length == dirlist->length)
+    return true;
+
+  path_cache_clear_index (cache);
+
+  pkg_config_node_t* n;
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (dirlist->head, n)
+  {
+    const pkg_config_path_t* pn = n->data;
+    path_record* r = path_cache_record (cache, pn->path);
+
+    if (r == NULL)
+    {
+      path_cache_clear_index (cache);
+      return false;
+    }
+
+    if (pn->handle_path != NULL || pn->handle_device != NULL)
+    {
+      r->id.dev = (uintptr_t)pn->handle_device;
+      r->id.ino = (uintptr_t)pn->handle_path;
+      r->id_valid = true;
+    }
+
+    if (!path_cache_index (cache, r))
+    {
+      path_cache_clear_index (cache);
+      return false;
+    }
+  }
+
+  cache->head = dirlist->head;
+  cache->tail = dirlist->tail;
+  cache->length = dirlist->length;
+  return true;
+}
+
+static bool
+path_list_contains_entry (const char* text,
+                          const pkg_config_list_t* dirlist,
+                          const path_file_id* id)
+{
+  pkg_config_node_t* n;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (dirlist->head, n)
+  {
+    pkg_config_path_t* pn = n->data;
+
+    if (id != NULL &&
+        pn->handle_device == (void*)id->dev &&
+        pn->handle_path == (void*)id->ino)
+      return true;
+
+    if (!strcmp (text, pn->path))
+      return true;
+  }
+
+  return false;
+}
+
+/* Query the directory file id following the symlinks. Return false if the
+ * directory does not exist.
+ */
+#ifdef PKG_CONFIG_CACHE_INODES
+static bool
+path_file_id_query (pkg_config_client_t* client,
+                    const char* path,
+                    path_file_id* id)
+{
+  struct stat st;
+
+  if (client != NULL)
+    PKG_CONFIG_STATS_INC (client, dirs_stated);
+
+  if (lstat (path, &st) == -1)
+    return false;
+
+  /* Note that a dangling symlink is identified by its own inode.
+   */
+  if (S_ISLNK (st.st_mode))
+  {
+    struct stat lst = st;
+
+    if (stat (path, &st) == -1)
+      st = lst;
+  }
+
+  id->dev = (uintptr_t)(intptr_t)st.st_dev;
+  id->ino = (uintptr_t)(intptr_t)st.st_ino;
+  return true;
+}
+#endif
+
+void
+pkg_config_path_add_with (pkg_config_client_t* client,
+                          const char* text,
+                          pkg_config_list_t* dirlist,
+                          bool filter)
+{
+  const pkg_config_allocator_t* a =
+      client != NULL ? client->allocator : NULL;
+
   pkg_config_path_t* node;
   char path[PKG_CONFIG_ITEM_SIZE];
 
   pkg_config_strlcpy (path, text, sizeof path);
   pkg_config_path_relocate (path, sizeof path);
 
-#ifdef PKG_CONFIG_CACHE_INODES
-  struct stat st;
+  pkg_config_path_cache_t* cache =
+      client != NULL ? path_cache_get (client) : NULL;
+
+  /* Only the client's search directory list is indexed.
+   */
+  bool indexed = (cache != NULL &&
+                  dirlist == &client->dir_list &&
+                  path_cache_sync (cache, dirlist));
+
+  path_record* r = NULL;
+  path_file_id id = {0, 0};
+  bool id_valid = false;
 
   if (filter)
   {
-    if (lstat (path, &st) == -1)
+    if (indexed &&
+        pkg_config_hash_lookup (&cache->paths, path, strlen (path)) != NULL)
       return;
-    if (S_ISLNK (st.st_mode))
+
+#ifdef PKG_CONFIG_CACHE_INODES
+    if (cache != NULL && (r = path_cache_record (cache, path)) != NULL &&
+        r->id_valid)
+      id = r->id;
+    else if (path_file_id_query (client, path, &id))
     {
-      char pathbuf[PKG_CONFIG_ITEM_SIZE * 4];
-      char* linkdest = realpath (path, pathbuf);
+      if (r != NULL)
+      {
+        r->id = id;
+        r->id_valid = true;
+      }
+    }
+    else
+      return;
+
+    id_valid = true;
+#endif
 
-      if (linkdest != NULL && stat (linkdest, &st) == -1)
+    if (indexed)
+    {
+      if (id_valid &&
+          pkg_config_hash_lookup (&cache->files, &id, sizeof (id)) != NULL)
         return;
     }
-    if (path_list_contains_entry (path, dirlist, &st))
+    else if (path_list_contains_entry (path, dirlist, id_valid ? &id : NULL))
       return;
   }
-#else
-  if (filter && path_list_contains_entry (path, dirlist))
-    return;
-#endif
 
-  node = calloc (1, sizeof (pkg_config_path_t));
-  node->path = strdup (path);
+  node = pkg_config_mem_calloc (a, 1, sizeof (pkg_config_path_t));
+  node->path = pkg_config_mem_strdup (a, path);
+  node->dir_fd = PKG_CONFIG_DIR_FD_NONE;
+  node->allocator = a;
 
-#ifdef PKG_CONFIG_CACHE_INODES
-  if (filter)
+  if (id_valid)
   {
-    node->handle_path = (void*)(intptr_t)st.st_ino;
-    node->handle_device = (void*)(intptr_t)st.st_dev;
+    node->handle_path = (void*)id.ino;
+    node->handle_device = (void*)id.dev;
   }
-#endif
 
   pkg_config_list_insert_tail (&node->lnode, node, dirlist);
+
+  /* Keep the index in sync, if possible.
+   */
+  if (indexed)
+  {
+    if (r == NULL)
+      r = path_cache_record (cache, path);
+
+    if (r != NULL && path_cache_index (cache, r))
+    {
+      cache->head = dirlist->head;
+      cache->tail = dirlist->tail;
+      cache->length = dirlist->length;
+    }
+    else
+      path_cache_clear_index (cache);
+  }
 }
 
 /*
@@ -149,6 +423,15 @@ size_t
 pkg_config_path_split (const char* text,
                        pkg_config_list_t* dirlist,
                        bool filter)
+{
+  return pkg_config_path_split_with (NULL, text, dirlist, filter);
+}
+
+size_t
+pkg_config_path_split_with (pkg_config_client_t* client,
+                            const char* text,
+                            pkg_config_list_t* dirlist,
+                            bool filter)
 {
   size_t count = 0;
   char *workbuf, *p, *iter;
@@ -156,14 +439,17 @@ pkg_config_path_split (const char* text,
   if (text == NULL || *text == '\0')
     return 0;
 
-  iter = workbuf = strdup (text);
+  const pkg_config_allocator_t* a =
+      client != NULL ? client->allocator : NULL;
+
+  iter = workbuf = pkg_config_mem_strdup (a, text);
   while ((p = strtok (iter, LIBPKG_CONFIG_PATH_SEP_S)) != NULL)
   {
-    pkg_config_path_add (p, dirlist, filter);
+    pkg_config_path_add_with (client, p, dirlist, filter);
 
     count++, iter = NULL;
   }
-  free (workbuf);
+  pkg_config_mem_free (a, workbuf);
 
   return count;
 }
@@ -190,15 +476,26 @@ pkg_config_path_build_from_environ (const char* envvarname,
                                     const char* fallback,
                                     pkg_config_list_t* dirlist,
                                     bool filter)
+{
+  return pkg_config_path_build_from_environ_with (
+      NULL, envvarname, fallback, dirlist, filter);
+}
+
+size_t
+pkg_config_path_build_from_environ_with (pkg_config_client_t* client,
+                                         const char* envvarname,
+                                         const char* fallback,
+                                         pkg_config_list_t* dirlist,
+                                         bool filter)
 {
   const char* data;
 
   data = getenv (envvarname);
   if (data != NULL)
-    return pkg_config_path_split (data, dirlist, filter);
+    return pkg_config_path_split_with (client, data, dirlist, filter);
 
   if (fallback != NULL && *fallback != '\0')
-    return pkg_config_path_split (fallback, dirlist, filter);
+    return pkg_config_path_split_with (client, fallback, dirlist, filter);
 
   /* no fallback and no environment variable, thusly no nodes added */
   return 0;
@@ -255,6 +552,14 @@ pkg_config_path_match_list (const char* path,
 void
 pkg_config_path_copy_list (pkg_config_list_t* dst,
                            const pkg_config_list_t* src)
+{
+  pkg_config_path_copy_list_with (NULL, dst, src);
+}
+
+void
+pkg_config_path_copy_list_with (const pkg_config_allocator_t* a,
+                                pkg_config_list_t* dst,
+                                const pkg_config_list_t* src)
 {
   pkg_config_node_t* n;
 
@@ -262,8 +567,10 @@ pkg_config_path_copy_list (pkg_config_list_t* dst,
   {
     pkg_config_path_t *srcpath = n->data, *path;
 
-    path = calloc (1, sizeof (pkg_config_path_t));
-    path->path = strdup (srcpath->path);
+    path = pkg_config_mem_calloc (a, 1, sizeof (pkg_config_path_t));
+    path->path = pkg_config_mem_strdup (a, srcpath->path);
+    path->dir_fd = PKG_CONFIG_DIR_FD_NONE;
+    path->allocator = a;
 
 #ifdef PKG_CONFIG_CACHE_INODES
     path->handle_path = srcpath->handle_path;
@@ -293,38 +600,196 @@ pkg_config_path_free (pkg_config_list_t* dirlist)
   {
     pkg_config_path_t* pnode = n->data;
 
-    free (pnode->path);
-    free (pnode);
+#ifdef PKG_CONFIG_DIR_FDS
+    if (pnode->dir_fd >= 0)
+      close (pnode->dir_fd);
+#endif
+
+    pkg_config_mem_free (pnode->allocator, pnode->path);
+    pkg_config_mem_free (pnode->allocator, pnode);
   }
 
   pkg_config_list_zero (dirlist);
 }
 
-static char*
-normpath (const char* path)
+/* Directory handles.
+ *
+ * Rather than formatting the absolute path of each package file candidate
+ * and having the kernel resolve it from the root, the search directories are
+ * kept open and the candidates are opened relative to them with openat()
+ * (see pkg_config_pkg_find()). The handles are opened on the first probe and
+ * closed when the list is freed or by pkg_config_cache_refresh() (since a
+ * directory could have been replaced). Note that the handle is not checked
+ * against the path on each probe (that would cost a stat() per directory and
+ * defeat the purpose) so until the refresh a renamed or replaced directory
+ * is still searched through it.
+ *
+ * If a directory cannot be opened (normally because it does not exist),
+ * this is remembered and the path-based probing is used for it instead.
+ * Note also that the list nodes are shared by the threads during the
+ * parallel dependency resolution (see resolve.c) so the handle is published
+ * atomically.
+ */
+#ifdef PKG_CONFIG_DIR_FDS
+int
+pkg_config_path_dir_fd (pkg_config_path_t* node)
 {
-  if (!path)
-    return NULL;
+  int fd = pkg_config_atomic_load (&node->dir_fd);
 
-  char* copy = strdup (path);
-  if (NULL == copy)
-    return NULL;
-  char* ptr = copy;
+  if (fd == PKG_CONFIG_DIR_FD_NONE)
+  {
+    int h = open (node->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int v = h != -1 ? h : PKG_CONFIG_DIR_FD_FAILED;
+
+    if (pkg_config_atomic_cas (&node->dir_fd, PKG_CONFIG_DIR_FD_NONE, v))
+      fd = v;
+    else
+    {
+      if (h != -1)
+        close (h);
+
+      fd = pkg_config_atomic_load (&node->dir_fd);
+    }
+  }
+
+  return fd >= 0 ? fd : -1;
+}
+#endif
+
+void
+pkg_config_path_close_dirs (pkg_config_list_t* dirlist)
+{
+#ifdef PKG_CONFIG_DIR_FDS
+  pkg_config_node_t* n;
 
-  int ii;
-  for (ii = 0; copy[ii]; ii++)
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (dirlist->head, n)
   {
-    *ptr++ = path[ii];
-    if ('/' == path[ii])
+    pkg_config_path_t* pnode = n->data;
+
+    if (pnode->dir_fd >= 0)
+      close (pnode->dir_fd);
+
+    pnode->dir_fd = PKG_CONFIG_DIR_FD_NONE;
+  }
+#else
+  (void)dirlist;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: size_t pkg_config_path_normalize(char *path, bool dotdot)
+ *
+ *    Normalizes a path in place and in a single pass: collapses the
+ *    repeated directory separators and removes the ``.`` segments. If
+ *    requested, also resolves the ``..`` segments lexically, dropping them
+ *    together with the preceding segment (or at the root). Note that the
+ *    lexical resolution is only correct if the preceding segment is not a
+ *    symlink, so it is not performed by pkg_config_path_relocate().
+ *
+ *    A trailing separator is preserved (but not added by resolving the
+ *    ``..`` segments, for example, in ``a/b/..``) and a path that
+ *    normalizes to nothing (for example, ``./``) becomes ``.``. Only ``/``
+ *    is recognized as a separator.
+ *
+ *    :param char* path: The path to normalize.
+ *    :param bool dotdot: Whether to resolve the ``..`` segments.
+ *    :return: the length of the normalized path
+ *    :rtype: size_t
+ */
+size_t
+pkg_config_path_normalize (char* path, bool dotdot)
+{
+  if (*path == '\0')
+    return 0;
+
+  const char* r = path; /* Read position. */
+  char* w = path;       /* Write position (never ahead of read). */
+
+#ifdef _WIN32
+  /* Keep the drive letter so that it is never dropped by `..`.
+   */
+  if (isalpha ((unsigned char)r[0]) && r[1] == ':')
+  {
+    w += 2;
+    r += 2;
+  }
+#endif
+
+  if (*r == '/')
+  {
+    *w++ = '/';
+    while (*r == '/')
+      ++r;
+  }
+
+  /* The beginning of the segments which `..` may not go above.
+   */
+  char* base = w;
+
+  /* Whether the last segment is `..` that has dropped the preceding segment
+   * and is not followed by a separator, in which case the separator of the
+   * segment that now ends the path should go as well.
+   */
+  bool trim = false;
+
+  while (*r != '\0')
+  {
+    const char* s = r;
+    while (*r != '\0' && *r != '/')
+      ++r;
+
+    size_t n = r - s;
+    bool sep = (*r == '/');
+
+    trim = false;
+
+    while (*r == '/')
+      ++r;
+
+    if (n == 1 && s[0] == '.')
+      continue;
+
+    if (dotdot && n == 2 && s[0] == '.' && s[1] == '.')
     {
-      ii++;
-      while ('/' == path[ii]) ii++;
-      ii--;
+      /* Find the preceding segment, if any. Note that it always ends with
+       * a separator.
+       */
+      if (w != base)
+      {
+        char* p = w - 1;
+        while (p != base && p[-1] != '/')
+          --p;
+
+        if (!(w - p == 3 && p[0] == '.' && p[1] == '.'))
+        {
+          w = p;
+          trim = !sep;
+          continue;
+        }
+      }
+      else if (base != path && base[-1] == '/')
+        continue; /* `..` at the root is the root. */
     }
+
+    if (w != s)
+      memmove (w, s, n);
+
+    w += n;
+
+    if (sep)
+      *w++ = '/';
   }
-  *ptr = '\0';
 
-  return copy;
+  if (trim && w != base)
+    --w;
+
+  if (w == path)
+    *w++ = '.';
+
+  *w = '\0';
+  return w - path;
 }
 
 /*
@@ -332,7 +797,8 @@ normpath (const char* path)
  *
  * .. c:function:: bool pkg_config_path_relocate(char *buf, size_t buflen)
  *
- *    Relocates a path, possibly calling normpath() on it.
+ *    Relocates a path, normalizing it in place (see
+ *    pkg_config_path_normalize(); the ``..`` segments are left as is).
  *
  *    :param char* buf: The path to relocate.
  *    :param size_t buflen: The buffer length the path is contained in.
@@ -342,20 +808,8 @@ normpath (const char* path)
 bool
 pkg_config_path_relocate (char* buf, size_t buflen)
 {
-  char* tmpbuf;
-
-  if ((tmpbuf = normpath (buf)) != NULL)
-  {
-    size_t tmpbuflen = strlen (tmpbuf);
-    if (tmpbuflen > buflen)
-    {
-      free (tmpbuf);
-      return false;
-    }
-
-    pkg_config_strlcpy (buf, tmpbuf, buflen);
-    free (tmpbuf);
-  }
+  (void)buflen; /* Normalization never lengthens the path. */
 
+  pkg_config_path_normalize (buf, false /* dotdot */);
   return true;
 }
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 #include <libpkg-config/list.h> /* pkg_config_list_t */
@@ -73,6 +74,21 @@ typedef struct pkg_config_fragment_ pkg_config_fragment_t;
 typedef struct pkg_config_path_ pkg_config_path_t;
 typedef struct pkg_config_client_ pkg_config_client_t;
 
+/* Memory allocator (see pkg_config_client_set_allocator()).
+ *
+ * The functions have the semantics of malloc(), realloc(), and free() and
+ * receive the allocator data as their first argument. The allocator object
+ * is referenced by the objects allocated with it and must remain valid
+ * until they are all freed.
+ */
+typedef struct pkg_config_allocator_
+{
+  void* (*alloc) (void* data, size_t size);
+  void* (*realloc) (void* data, void* p, size_t size);
+  void (*free) (void* data, void* p);
+  void* data;
+} pkg_config_allocator_t;
+
 struct pkg_config_fragment_
 {
   pkg_config_node_t iter;
@@ -81,6 +97,8 @@ struct pkg_config_fragment_
   char* data;
 
   bool merged;
+
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
 };
 
 struct pkg_config_dependency_
@@ -90,10 +108,17 @@ struct pkg_config_dependency_
   char* package;
   pkg_config_pkg_comparator_t compare;
   char* version;
+  struct pkg_config_version_* version_key; /* Pre-parsed version or NULL. */
   pkg_config_pkg_t* parent;
   pkg_config_pkg_t* match;
 
+  /* Reverse dependency index node (see pkg_config_cache_refresh()).
+   */
+  pkg_config_node_t match_iter;
+
   unsigned int flags; /* LIBPKG_CONFIG_PKG_DEPF_* */
+
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
 };
 
 #define LIBPKG_CONFIG_PKG_DEPF_INTERNAL 0x01
@@ -104,6 +129,8 @@ struct pkg_config_tuple_
 
   char* key;
   char* value;
+
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
 };
 
 struct pkg_config_path_
@@ -113,6 +140,12 @@ struct pkg_config_path_
   char* path;
   void* handle_path;
   void* handle_device;
+
+  /* Directory handle or negative if not open (see path.c for details).
+   */
+  int dir_fd;
+
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
 };
 
 struct pkg_config_pkg_
@@ -124,6 +157,7 @@ struct pkg_config_pkg_
   char* filename;
   char* realname;
   char* version;
+  struct pkg_config_version_* version_key; /* Pre-parsed version or NULL. */
   char* description;
   char* url;
   char* pc_filedir;
@@ -138,11 +172,26 @@ struct pkg_config_pkg_
   pkg_config_list_t requires_private;
   pkg_config_list_t conflicts;
 
+  /* Index of the required list by package name. Only built if the package
+   * has conflicts and is used to check them without scanning the list.
+   */
+  struct pkg_config_hash_* required_index;
+
   pkg_config_list_t vars;
 
   unsigned int flags; /* LIBPKG_CONFIG_PKG_PROPF_* */
 
   pkg_config_client_t* owner;
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
+
+  /* Identity of the file the package was loaded from at the time of loading
+   * (see pkg_config_cache_refresh()). The modification time is in
+   * nanoseconds, if supported by the platform, and in seconds otherwise.
+   */
+  uint64_t file_dev;
+  uint64_t file_ino;
+  uint64_t file_size;
+  int64_t file_mtime;
 
   /* these resources are owned by the package and do not need special
    * management, under no circumstance attempt to allocate or free objects
@@ -155,7 +204,7 @@ struct pkg_config_pkg_
 #define LIBPKG_CONFIG_PKG_PROPF_NONE        0x00
 #define LIBPKG_CONFIG_PKG_PROPF_CONST       0x01
 #define LIBPKG_CONFIG_PKG_PROPF_CACHED      0x02
-#define LIBPKG_CONFIG_PKG_PROPF_SEEN        0x04
+#define LIBPKG_CONFIG_PKG_PROPF_SEEN        0x04 /* Unused. */
 #define LIBPKG_CONFIG_PKG_PROPF_UNINSTALLED 0x08
 
 typedef bool (*pkg_config_pkg_iteration_func_t) (const pkg_config_pkg_t* pkg,
@@ -164,6 +213,31 @@ typedef void (*pkg_config_pkg_traverse_func_t) (pkg_config_client_t* client,
                                                 pkg_config_pkg_t* pkg,
                                                 void* data);
 
+/* Dependency graph traversal context (see pkg_config_traversal_init()).
+ */
+typedef struct pkg_config_traversal_ pkg_config_traversal_t;
+
+typedef void (*pkg_config_traversal_func_t) (const pkg_config_traversal_t* t,
+                                             pkg_config_pkg_t* pkg,
+                                             void* data);
+
+struct pkg_config_traversal_
+{
+  pkg_config_client_t* client;
+
+  /* LIBPKG_CONFIG_PKG_PKGF_* flags controlling the traversal.
+   */
+  unsigned int flags;
+
+  /* True while walking a requires.private list.
+   */
+  bool in_private;
+
+  /* Packages on the current path (only valid during the traversal).
+   */
+  struct pkg_config_hash_* seen;
+};
+
 /* The eflag argument is one of LIBPKG_CONFIG_ERRF_* "flags" for
    errors and 0 (*_OK) for warnings/traces.
 
@@ -178,11 +252,152 @@ typedef void (*pkg_config_error_handler_func_t) (
   const pkg_config_client_t* client,
   const void* data);
 
+/* Diagnostics kinds (see pkg_config_client_set_diag_handler()).
+ */
+#define LIBPKG_CONFIG_DIAG_ERROR 0x01
+#define LIBPKG_CONFIG_DIAG_WARN  0x02
+#define LIBPKG_CONFIG_DIAG_TRACE 0x04
+
+/* Deferred diagnostics handler. Instead of the formatted message it receives
+ * the printf-style format and its arguments so that the formatting (if any)
+ * is left to the handler. The arguments are only valid during the handler
+ * call and, if used more than once, must be copied with va_copy().
+ *
+ * The kind is one of LIBPKG_CONFIG_DIAG_* and the eflag is as for the
+ * message handler. The funcname is the reporting function for traces and
+ * NULL otherwise.
+ */
+typedef void (*pkg_config_diag_handler_func_t) (
+  unsigned int kind,
+  unsigned int eflag,
+  const char* filename,
+  size_t lineno,
+  const char* funcname,
+  const char* format,
+  va_list args,
+  const pkg_config_client_t* client,
+  void* data);
+
+/* Span kinds (see trace.c for details).
+ */
+#define LIBPKG_CONFIG_SPAN_FIND     1 /* Package search by name. */
+#define LIBPKG_CONFIG_SPAN_PARSE    2 /* Package file reading and lexing. */
+#define LIBPKG_CONFIG_SPAN_EXPAND   3 /* Variable and field expansion. */
+#define LIBPKG_CONFIG_SPAN_TRAVERSE 4 /* Dependency graph traversal. */
+#define LIBPKG_CONFIG_SPAN_RENDER   5 /* Fragment list rendering. */
+
+/* Span begin or end event. The id is the package id (or the package name
+ * for LIBPKG_CONFIG_SPAN_FIND) and is only valid during the handler call.
+ * The time is in nanoseconds from an unspecified point and is monotonic.
+ * The thread is an opaque id of the thread the span is on.
+ */
+typedef struct pkg_config_span_
+{
+  unsigned int kind; /* LIBPKG_CONFIG_SPAN_* */
+  bool end;
+  const char* id;
+  uint64_t time;
+  uint64_t thread;
+} pkg_config_span_t;
+
+typedef void (*pkg_config_span_handler_func_t) (
+  const pkg_config_span_t* span,
+  const pkg_config_client_t* client,
+  void* data);
+
+/* Client performance counters (see pkg_config_client_get_stats()).
+ *
+ * The counters are cumulative since the client initialization or the last
+ * pkg_config_client_reset_stats() call. If the library is built with
+ * LIBPKG_CONFIG_NSTATS, they are not maintained and are always zero.
+ */
+typedef struct pkg_config_client_stats_
+{
+  /* Package files opened and the attempts to open that failed (normally
+   * because the file does not exist in the search directory).
+   */
+  size_t files_opened;
+  size_t files_failed;
+
+  /* Package files (also counted as opened) read in batches (see loader.c).
+   */
+  size_t files_batched;
+
+  /* Directory file id queries made to filter out the duplicate search
+   * directories (see path.c for details).
+   */
+  size_t dirs_stated;
+
+  /* Bytes and lines read from the package files (the files whose sources
+   * are reused from the shared source cache are not counted).
+   */
+  size_t bytes_parsed;
+  size_t lines_parsed;
+
+  /* Package cache, result cache (see cache.c), and shared source cache (see
+   * pkg_config_client_clone()) lookups.
+   */
+  size_t pkg_cache_hits;
+  size_t pkg_cache_misses;
+  size_t result_cache_hits;
+  size_t result_cache_misses;
+  size_t source_cache_hits;
+
+  /* Package id comparisons made by the package cache lookups. Normally
+   * the cache is indexed and this is at most one per lookup.
+   */
+  size_t pkg_cache_compares;
+
+  /* Package searches that found nothing. Note that there is no negative
+   * cache so each such search repeats the search directory probing.
+   */
+  size_t pkg_not_found;
+
+  /* Variable references expanded and the maximum nesting depth of the
+   * expansion (a variable referenced from a variable value, etc).
+   */
+  size_t var_expansions;
+  size_t var_max_depth;
+
+  /* Dependency edges verified (matched with the packages), graph
+   * traversals, packages visited by all the traversals, and the maximum
+   * number of packages visited by a single traversal.
+   */
+  size_t edges_verified;
+  size_t traversals;
+  size_t nodes_visited;
+  size_t max_traversal_nodes;
+
+  /* Fragments copied between the fragment lists and previous copies removed
+   * from the destination list as a result (see pkg_config_fragment_copy()).
+   */
+  size_t fragments_copied;
+  size_t fragments_merged;
+
+  /* Package, dependency, fragment, and variable objects allocated.
+   */
+  size_t allocations;
+} pkg_config_client_stats_t;
+
 struct pkg_config_client_
 {
   pkg_config_list_t dir_list;
   pkg_config_list_t pkg_cache;
 
+  /* Package cache index by package id (see cache.c for details) or NULL.
+   */
+  struct pkg_config_hash_* pkg_index;
+
+  /* Memoized pkg_config_pkg_cflags()/pkg_config_pkg_libs() results (see
+   * cache.c for details) or NULL.
+   */
+  struct pkg_config_result_cache_* result_cache;
+
+  /* Cached resolved dependency graphs by the root package, flags, and
+   * maximum depth (see graph.c for details) or NULL.
+   */
+  struct pkg_config_hash_* graph_cache;
+
   pkg_config_list_t filter_libdirs;
   pkg_config_list_t filter_includedirs;
 
@@ -196,12 +411,63 @@ struct pkg_config_client_
   pkg_config_error_handler_func_t warn_handler;
   pkg_config_error_handler_func_t trace_handler;
 
+  /* Span handler (see trace.c for details) or NULL.
+   */
+  pkg_config_span_handler_func_t span_handler;
+  void* span_handler_data;
+
+  /* Deferred diagnostics handler (see pkg_config_client_set_diag_handler())
+   * or NULL and the diagnostics kinds (LIBPKG_CONFIG_DIAG_*) it handles.
+   */
+  pkg_config_diag_handler_func_t diag_handler;
+  void* diag_handler_data;
+  unsigned int diag_kinds;
+
   char* sysroot_dir;
   char* buildroot_dir;
 
   unsigned int flags; /* LIBPKG_CONFIG_PKG_PKGF_* */
 
   char* prefix_varname;
+
+  /* Parallel dependency resolution state (see pkg_config_pkg_resolve()) or
+   * NULL if not in progress.
+   */
+  struct pkg_config_resolver_* resolver;
+
+  /* Reverse dependency index: dependencies by the id of the package they
+   * match (see cache.c for details).
+   */
+  struct pkg_config_hash_* match_index;
+
+  /* Search directory watch (see pkg_config_watch_open()) or NULL.
+   */
+  struct pkg_config_watch_* watch;
+
+  /* Package file sources shared with the clones (see
+   * pkg_config_client_clone()) or NULL.
+   */
+  struct pkg_config_source_cache_* sources;
+
+  /* Search directory index and directory file id cache (see path.c for
+   * details) or NULL.
+   */
+  struct pkg_config_path_cache_* path_cache;
+
+  /* Batch package file loader (see loader.c), created on the first use, or
+   * NULL.
+   */
+  struct pkg_config_loader_* loader;
+
+  /* Allocator of the package, dependency, fragment, variable, and path
+   * objects (see pkg_config_client_set_allocator()) or NULL for the C
+   * library.
+   */
+  const pkg_config_allocator_t* allocator;
+
+  /* Performance counters.
+   */
+  pkg_config_client_stats_t stats;
 };
 
 #define LIBPKG_CONFIG_PKG_PKGF_NONE                        0x0000
@@ -212,12 +478,18 @@ struct pkg_config_client_
 #define LIBPKG_CONFIG_PKG_PKGF_SKIP_CONFLICTS              0x0010
 #define LIBPKG_CONFIG_PKG_PKGF_NO_CACHE                    0x0020
 #define LIBPKG_CONFIG_PKG_PKGF_SKIP_ERRORS                 0x0040
+
+/* Deprecated: no longer set by the traversals (see the in_private member of
+ * pkg_config_traversal_t instead).
+ */
 #define LIBPKG_CONFIG_PKG_PKGF_ITER_PKG_IS_PRIVATE         0x0080
+
 #define LIBPKG_CONFIG_PKG_PKGF_REDEFINE_PREFIX             0x0100
 #define LIBPKG_CONFIG_PKG_PKGF_DONT_RELOCATE_PATHS         0x0200
 #define LIBPKG_CONFIG_PKG_PKGF_DONT_FILTER_INTERNAL_CFLAGS 0x0400
 #define LIBPKG_CONFIG_PKG_PKGF_MERGE_SPECIAL_FRAGMENTS     0x0800
 #define LIBPKG_CONFIG_PKG_PKGF_FDO_SYSROOT_RULES           0x1000
+#define LIBPKG_CONFIG_PKG_PKGF_NO_BATCH_LOAD               0x2000
 
 /* client.c */
 LIBPKG_CONFIG_SYMEXPORT void
@@ -229,10 +501,17 @@ LIBPKG_CONFIG_SYMEXPORT pkg_config_client_t*
 pkg_config_client_new (pkg_config_error_handler_func_t error_handler,
                        void* error_handler_data,
                        bool init_filters);
+LIBPKG_CONFIG_SYMEXPORT pkg_config_client_t*
+pkg_config_client_clone (pkg_config_client_t* parent);
 LIBPKG_CONFIG_SYMEXPORT void
 pkg_config_client_deinit (pkg_config_client_t* client);
 LIBPKG_CONFIG_SYMEXPORT void
 pkg_config_client_free (pkg_config_client_t* client);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_client_get_stats (const pkg_config_client_t* client,
+                             pkg_config_client_stats_t* stats);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_client_reset_stats (pkg_config_client_t* client);
 LIBPKG_CONFIG_SYMEXPORT const char*
 pkg_config_client_get_sysroot_dir (const pkg_config_client_t* client);
 LIBPKG_CONFIG_SYMEXPORT void
@@ -270,6 +549,26 @@ LIBPKG_CONFIG_SYMEXPORT void
 pkg_config_client_set_trace_handler (pkg_config_client_t* client,
                                      pkg_config_error_handler_func_t trace_handler,
                                      void* trace_handler_data);
+LIBPKG_CONFIG_SYMEXPORT pkg_config_span_handler_func_t
+pkg_config_client_get_span_handler (const pkg_config_client_t* client);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_client_set_span_handler (
+  pkg_config_client_t* client,
+  pkg_config_span_handler_func_t span_handler,
+  void* span_handler_data);
+LIBPKG_CONFIG_SYMEXPORT pkg_config_diag_handler_func_t
+pkg_config_client_get_diag_handler (const pkg_config_client_t* client);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_client_set_diag_handler (
+  pkg_config_client_t* client,
+  pkg_config_diag_handler_func_t diag_handler,
+  void* diag_handler_data,
+  unsigned int diag_kinds);
+LIBPKG_CONFIG_SYMEXPORT const pkg_config_allocator_t*
+pkg_config_client_get_allocator (const pkg_config_client_t* client);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_client_set_allocator (pkg_config_client_t* client,
+                                 const pkg_config_allocator_t* allocator);
 LIBPKG_CONFIG_SYMEXPORT void
 pkg_config_client_dir_list_build (pkg_config_client_t* client);
 
@@ -371,6 +670,26 @@ pkg_config_pkg_traverse (pkg_config_client_t* client,
                          void* data,
                          int maxdepth,
                          unsigned int skip_flags);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_traversal_init (pkg_config_traversal_t* t,
+                           pkg_config_client_t* client);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_traversal_walk (pkg_config_traversal_t* t,
+                           pkg_config_pkg_t* root,
+                           pkg_config_traversal_func_t func,
+                           void* data,
+                           int maxdepth,
+                           unsigned int skip_flags);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_traversal_cflags (pkg_config_traversal_t* t,
+                             pkg_config_pkg_t* root,
+                             pkg_config_list_t* list,
+                             int maxdepth);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_traversal_libs (pkg_config_traversal_t* t,
+                           pkg_config_pkg_t* root,
+                           pkg_config_list_t* list,
+                           int maxdepth);
 LIBPKG_CONFIG_SYMEXPORT unsigned int
 pkg_config_pkg_verify_graph (pkg_config_client_t* client,
                              pkg_config_pkg_t* root,
@@ -406,6 +725,183 @@ pkg_config_scan_all (pkg_config_client_t* client,
                      void* ptr,
                      pkg_config_pkg_iteration_func_t func);
 
+/* resolve.c */
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_pkg_resolve (pkg_config_client_t* client,
+                        pkg_config_pkg_t* root,
+                        int maxdepth,
+                        unsigned int threads);
+
+/* async.c */
+typedef struct pkg_config_async_ pkg_config_async_t;
+
+/* The fragment list is NULL for find requests.
+ */
+typedef void (*pkg_config_async_func_t) (pkg_config_client_t* client,
+                                         pkg_config_pkg_t* pkg,
+                                         pkg_config_list_t* fragments,
+                                         unsigned int eflags,
+                                         void* data);
+
+typedef void (*pkg_config_async_task_func_t) (void* task);
+
+typedef void (*pkg_config_async_executor_func_t) (
+  pkg_config_async_task_func_t func,
+  void* task,
+  void* data);
+
+LIBPKG_CONFIG_SYMEXPORT pkg_config_async_t*
+pkg_config_async_new (pkg_config_client_t* client,
+                      unsigned int threads,
+                      pkg_config_async_executor_func_t executor,
+                      void* executor_data);
+LIBPKG_CONFIG_SYMEXPORT bool
+pkg_config_async_find (pkg_config_async_t* async,
+                       const char* name,
+                       pkg_config_async_func_t func,
+                       void* data);
+LIBPKG_CONFIG_SYMEXPORT bool
+pkg_config_async_cflags (pkg_config_async_t* async,
+                         const char* name,
+                         int maxdepth,
+                         pkg_config_async_func_t func,
+                         void* data);
+LIBPKG_CONFIG_SYMEXPORT bool
+pkg_config_async_libs (pkg_config_async_t* async,
+                       const char* name,
+                       int maxdepth,
+                       pkg_config_async_func_t func,
+                       void* data);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_async_wait (pkg_config_async_t* async);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_async_free (pkg_config_async_t* async);
+
+/* graph.c */
+typedef struct pkg_config_graph_ pkg_config_graph_t;
+typedef struct pkg_config_graph_node_ pkg_config_graph_node_t;
+typedef struct pkg_config_graph_edge_ pkg_config_graph_edge_t;
+
+#define LIBPKG_CONFIG_GRAPH_NONE ((size_t)-1)
+
+struct pkg_config_graph_edge_
+{
+  pkg_config_dependency_t* dependency;
+
+  /* The resolved package or NULL. Note that the package can be present even
+   * if its version does not satisfy the dependency constraint.
+   */
+  pkg_config_pkg_t* pkg;
+  size_t target; /* Resolved package node index or LIBPKG_CONFIG_GRAPH_NONE. */
+
+  unsigned int colour; /* LIBPKG_CONFIG_GRAPH_EDGE_* */
+  unsigned int eflags; /* Dependency verification result. */
+};
+
+#define LIBPKG_CONFIG_GRAPH_EDGE_PUBLIC   0x01 /* Requires */
+#define LIBPKG_CONFIG_GRAPH_EDGE_PRIVATE  0x02 /* Requires.private */
+#define LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL 0x04 /* Requires.internal */
+
+struct pkg_config_graph_node_
+{
+  pkg_config_pkg_t* pkg;
+
+  /* The node edges are [edges_begin, edges_end) with the Requires edges
+   * followed by the Requires.private edges starting from edges_private.
+   */
+  size_t edges_begin;
+  size_t edges_private;
+  size_t edges_end;
+
+  unsigned int flags; /* LIBPKG_CONFIG_GRAPH_NODEF_* */
+
+  /* The conflict check result. If eflags is
+   * LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT, then conflict is the conflict rule
+   * and conflict_pkg is the conflicting package.
+   */
+  unsigned int eflags;
+  pkg_config_dependency_t* conflict;
+  pkg_config_pkg_t* conflict_pkg;
+};
+
+#define LIBPKG_CONFIG_GRAPH_NODEF_RESOLVED         0x01 /* Requires. */
+#define LIBPKG_CONFIG_GRAPH_NODEF_RESOLVED_PRIVATE 0x02 /* Requires.private. */
+
+struct pkg_config_graph_
+{
+  pkg_config_node_t cache_iter;
+
+  int refcount;
+  pkg_config_client_t* owner;
+
+  /* The root package (the same as nodes[0].pkg) and the flags and maximum
+   * depth the graph was built with. Together they are the graph cache key
+   * (see graph.c for details).
+   */
+  pkg_config_pkg_t* root;
+  unsigned int flags; /* LIBPKG_CONFIG_PKG_PKGF_* */
+  int maxdepth;
+
+  /* Nodes in the topological order (the root node is always first).
+   */
+  pkg_config_graph_node_t* nodes;
+  size_t nodes_count;
+
+  pkg_config_graph_edge_t* edges;
+  size_t edges_count;
+
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
+};
+
+LIBPKG_CONFIG_SYMEXPORT pkg_config_graph_t*
+pkg_config_graph_build (pkg_config_traversal_t* t,
+                        pkg_config_pkg_t* root,
+                        int maxdepth);
+LIBPKG_CONFIG_SYMEXPORT pkg_config_graph_t*
+pkg_config_graph_ref (pkg_config_graph_t* graph);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_graph_unref (pkg_config_graph_t* graph);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_graph_traverse (pkg_config_traversal_t* t,
+                           const pkg_config_graph_t* graph,
+                           pkg_config_traversal_func_t func,
+                           void* data,
+                           unsigned int skip_flags);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_graph_cflags (pkg_config_traversal_t* t,
+                         const pkg_config_graph_t* graph,
+                         pkg_config_list_t* list);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_graph_libs (pkg_config_traversal_t* t,
+                       const pkg_config_graph_t* graph,
+                       pkg_config_list_t* list);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_graph_write_dot (const pkg_config_graph_t* graph, FILE* f);
+
+/* revdep.c */
+typedef struct pkg_config_revdep_index_ pkg_config_revdep_index_t;
+
+/* Return true to stop the query. The colour is LIBPKG_CONFIG_GRAPH_EDGE_*.
+ */
+typedef bool (*pkg_config_revdep_func_t) (const pkg_config_pkg_t* pkg,
+                                          const pkg_config_dependency_t* dep,
+                                          unsigned int colour,
+                                          int depth,
+                                          void* data);
+
+LIBPKG_CONFIG_SYMEXPORT pkg_config_revdep_index_t*
+pkg_config_revdep_index_build (pkg_config_client_t* client,
+                               unsigned int* eflags);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_revdep_index_free (pkg_config_revdep_index_t* index);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_revdep_query (const pkg_config_revdep_index_t* index,
+                         const char* name,
+                         unsigned int colours,
+                         int maxdepth,
+                         pkg_config_revdep_func_t func,
+                         void* data);
+
 /* parse.c */
 LIBPKG_CONFIG_SYMEXPORT pkg_config_pkg_t*
 pkg_config_pkg_new_from_file (pkg_config_client_t* client,
@@ -548,6 +1044,53 @@ LIBPKG_CONFIG_SYMEXPORT void
 pkg_config_cache_remove (pkg_config_client_t* client, pkg_config_pkg_t* pkg);
 LIBPKG_CONFIG_SYMEXPORT void
 pkg_config_cache_free (pkg_config_client_t* client);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_cache_refresh (pkg_config_client_t* client);
+
+/* watch.c */
+LIBPKG_CONFIG_SYMEXPORT int
+pkg_config_watch_open (pkg_config_client_t* client);
+LIBPKG_CONFIG_SYMEXPORT unsigned int
+pkg_config_watch_process (pkg_config_client_t* client);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_watch_close (pkg_config_client_t* client);
+
+/* server.c */
+typedef struct pkg_config_server_ pkg_config_server_t;
+
+LIBPKG_CONFIG_SYMEXPORT pkg_config_server_t*
+pkg_config_server_new (void);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_server_free (pkg_config_server_t* server);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_server_set_memory_limit (pkg_config_server_t* server,
+                                    size_t limit);
+LIBPKG_CONFIG_SYMEXPORT int
+pkg_config_server_serve (pkg_config_server_t* server, int in, int out);
+LIBPKG_CONFIG_SYMEXPORT int
+pkg_config_server_listen (pkg_config_server_t* server, int fd);
+
+/* trace.c */
+typedef struct pkg_config_chrome_trace_ pkg_config_chrome_trace_t;
+
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_span_begin (const pkg_config_client_t* client,
+                       unsigned int kind,
+                       const char* id);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_span_end (const pkg_config_client_t* client,
+                     unsigned int kind,
+                     const char* id);
+LIBPKG_CONFIG_SYMEXPORT const char*
+pkg_config_span_kind_name (unsigned int kind);
+LIBPKG_CONFIG_SYMEXPORT pkg_config_chrome_trace_t*
+pkg_config_chrome_trace_open (FILE* out);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_chrome_trace_close (pkg_config_chrome_trace_t* trace);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_chrome_trace_handler (const pkg_config_span_t* span,
+                                 const pkg_config_client_t* client,
+                                 void* data);
 
 /* path.c */
 LIBPKG_CONFIG_SYMEXPORT void
@@ -565,6 +1108,8 @@ LIBPKG_CONFIG_SYMEXPORT bool
 pkg_config_path_match_list (const char* path, const pkg_config_list_t* dirlist);
 LIBPKG_CONFIG_SYMEXPORT void
 pkg_config_path_free (pkg_config_list_t* dirlist);
+LIBPKG_CONFIG_SYMEXPORT size_t
+pkg_config_path_normalize (char* path, bool dotdot);
 LIBPKG_CONFIG_SYMEXPORT bool
 pkg_config_path_relocate (char* buf, size_t buflen);
 LIBPKG_CONFIG_SYMEXPORT void
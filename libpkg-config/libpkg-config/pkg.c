@@ -58,7 +58,7 @@ pkg_get_parent_dir (pkg_config_pkg_t* pkg)
   if (pathbuf != NULL)
     pathbuf[0] = '\0';
 
-  return strdup (buf);
+  return pkg_config_mem_strdup (pkg->allocator, buf);
 }
 
 typedef unsigned int /* eflags */ (*pkg_config_pkg_parser_keyword_func_t) (
@@ -304,7 +304,7 @@ determine_prefix (const pkg_config_pkg_t* pkg, char* buf, size_t buflen)
  * /foo bar/baz    ->  /foo\ bar/baz
  */
 static char*
-convert_path_to_value (const char* path)
+convert_path_to_value (const pkg_config_allocator_t* a, const char* path)
 {
   const char cs[] = " \\\"'";
 
@@ -330,9 +330,9 @@ convert_path_to_value (const char* path)
    * to be escaped.
    */
   if (n == 0)
-    return strdup (path);
+    return pkg_config_mem_strdup (a, path);
 
-  char* buf = malloc (strlen (path) + n + 1);
+  char* buf = pkg_config_mem_alloc (a, strlen (path) + n + 1);
 
   if (buf != NULL)
   {
@@ -370,36 +370,6 @@ convert_path_to_value (const char* path)
   return buf;
 }
 
-static void
-remove_additional_separators (char* buf)
-{
-  char* p = buf;
-
-  while (*p)
-  {
-    if (*p == '/')
-    {
-      char* q;
-
-      q = ++p;
-      while (*q && *q == '/') q++;
-
-      if (p != q)
-        memmove (p, q, strlen (q) + 1);
-    }
-    else
-    {
-      p++;
-    }
-  }
-}
-
-static void
-canonicalize_path (char* buf)
-{
-  remove_additional_separators (buf);
-}
-
 static bool
 is_path_prefix_equal (const char* path1, const char* path2, size_t path2_len)
 {
@@ -428,7 +398,7 @@ pkg_config_pkg_parser_value_set (void* opaque,
 
   char canonicalized_value[PKG_CONFIG_ITEM_SIZE];
   pkg_config_strlcpy (canonicalized_value, value, sizeof canonicalized_value);
-  canonicalize_path (canonicalized_value);
+  pkg_config_path_normalize (canonicalized_value, false /* dotdot */);
 
   /* Some pc files will use absolute paths for all of their directories
    * which is broken when redefining the prefix. We try to outsmart the
@@ -457,7 +427,7 @@ pkg_config_pkg_parser_value_set (void* opaque,
 
     if (relvalue != NULL)
     {
-      char* prefix_value = convert_path_to_value (relvalue);
+      char* prefix_value = convert_path_to_value (pkg->allocator, relvalue);
       if (prefix_value == NULL)
         return LIBPKG_CONFIG_ERRF_MEMORY;
 
@@ -465,7 +435,7 @@ pkg_config_pkg_parser_value_set (void* opaque,
           pkg->owner, &pkg->vars, "orig_prefix", canonicalized_value, true);
       pkg->prefix = pkg_config_tuple_add (
           pkg->owner, &pkg->vars, keyword, prefix_value, false);
-      free (prefix_value);
+      pkg_config_mem_free (pkg->allocator, prefix_value);
     }
     else
       pkg_config_tuple_add (pkg->owner, &pkg->vars, keyword, value, true);
@@ -516,30 +486,91 @@ pkg_config_pkg_validate (const pkg_config_client_t* client,
   return eflags;
 }
 
-/*
- * !doc
- *
- * .. c:function:: pkg_config_pkg_t *pkg_config_pkg_new_from_file(const
- * pkg_config_client_t *client, const char *filename, FILE *f)
- *
- *    Parse a .pc file into a pkg_config_pkg_t object structure.
- *
- *    :param pkg_config_client_t* client: The pkg-config client object to use
- * for dependency resolution. :param char* filename: The filename of the
- * package file (including full path). :param FILE* f: The file object to read
- * from. :returns: A ``pkg_config_pkg_t`` object which contains the package
- * data. :rtype: pkg_config_pkg_t *
+/* Build the index of the required list by package name. Note that for
+ * duplicate requires the index refers to the last one.
  */
-pkg_config_pkg_t*
-pkg_config_pkg_new_from_file (pkg_config_client_t* client,
-                              const char* filename,
-                              FILE* f,
-                              unsigned int* eflags)
+static unsigned int
+pkg_config_pkg_index_required (pkg_config_pkg_t* pkg)
+{
+  pkg_config_node_t* node;
+  pkg_config_hash_t* index =
+    pkg_config_mem_calloc (pkg->allocator, 1, sizeof (pkg_config_hash_t));
+
+  if (index == NULL)
+    return LIBPKG_CONFIG_ERRF_MEMORY;
+
+  index->allocator = pkg->allocator;
+  pkg->required_index = index;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (pkg->required.head, node)
+  {
+    pkg_config_dependency_t* dep = node->data;
+
+    if (*dep->package == '\0')
+      continue;
+
+    if (!pkg_config_hash_insert (index,
+                                 dep->package,
+                                 strlen (dep->package),
+                                 dep))
+      return LIBPKG_CONFIG_ERRF_MEMORY;
+  }
+
+  return LIBPKG_CONFIG_ERRF_OK;
+}
+
+/* Return the file modification time in nanoseconds, if supported by the
+ * platform, and in seconds otherwise.
+ */
+static inline int64_t
+file_mtime (const struct stat* st)
+{
+#if defined(__APPLE__)
+  return (int64_t)st->st_mtimespec.tv_sec * 1000000000 +
+         st->st_mtimespec.tv_nsec;
+#elif defined(st_mtime) /* POSIX.1-2008 st_mtim. */
+  return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#else
+  return (int64_t)st->st_mtime;
+#endif
+}
+
+static inline bool
+file_identity_equal (const pkg_config_pkg_t* pkg, const struct stat* st)
+{
+  return pkg->file_dev == (uint64_t)st->st_dev   &&
+         pkg->file_ino == (uint64_t)st->st_ino   &&
+         pkg->file_size == (uint64_t)st->st_size &&
+         pkg->file_mtime == file_mtime (st);
+}
+
+/* Return true if the package file has changed since the package was loaded
+ * or no longer exists.
+ */
+bool
+pkg_config_pkg_file_changed (const pkg_config_pkg_t* pkg)
+{
+  struct stat st;
+
+  return stat (pkg->filename, &st) != 0 || !file_identity_equal (pkg, &st);
+}
+
+/* Parse the package from the stream (see pkg_config_pkg_new_from_file()).
+ * The file identity may be unknown, in which case the file is considered
+ * changed on refresh.
+ */
+static pkg_config_pkg_t*
+pkg_new (pkg_config_client_t* client,
+         const char* filename,
+         FILE* f,
+         const struct stat* st,
+         unsigned int* eflags)
 {
   pkg_config_pkg_t* pkg;
   char* idptr;
 
-  pkg = calloc (1, sizeof (pkg_config_pkg_t));
+  pkg = pkg_config_mem_calloc (
+      client->allocator, 1, sizeof (pkg_config_pkg_t));
 
   if (pkg == NULL)
   {
@@ -547,11 +578,27 @@ pkg_config_pkg_new_from_file (pkg_config_client_t* client,
     return NULL;
   }
 
+  PKG_CONFIG_STATS_INC (client, allocations);
+
   pkg->owner = client;
-  pkg->filename = strdup (filename);
+  pkg->allocator = client->allocator;
+  pkg->filename = pkg_config_mem_strdup (pkg->allocator, filename);
   pkg->pc_filedir = pkg_get_parent_dir (pkg);
 
-  char* pc_filedir_value = convert_path_to_value (pkg->pc_filedir);
+  /* Record the file identity for pkg_config_cache_refresh().
+   */
+  if (st != NULL)
+  {
+    pkg->file_dev = (uint64_t)st->st_dev;
+    pkg->file_ino = (uint64_t)st->st_ino;
+    pkg->file_size = (uint64_t)st->st_size;
+    pkg->file_mtime = file_mtime (st);
+  }
+  else
+    pkg->file_mtime = -1;
+
+  char* pc_filedir_value =
+      convert_path_to_value (pkg->allocator, pkg->pc_filedir);
   if (pc_filedir_value == NULL)
   {
     *eflags = LIBPKG_CONFIG_ERRF_MEMORY;
@@ -560,7 +607,7 @@ pkg_config_pkg_new_from_file (pkg_config_client_t* client,
 
   pkg_config_tuple_add (
       client, &pkg->vars, "pcfiledir", pc_filedir_value, true);
-  free (pc_filedir_value);
+  pkg_config_mem_free (pkg->allocator, pc_filedir_value);
 
   /* If pc_filedir is outside of sysroot_dir, clear pc_filedir
    * See https://github.com/pkgconf/pkgconf/issues/213
@@ -594,18 +641,51 @@ pkg_config_pkg_new_from_file (pkg_config_client_t* client,
     idptr = ++mungeptr;
 #endif
 
-  pkg->id = strdup (idptr);
+  pkg->id = pkg_config_mem_strdup (pkg->allocator, idptr);
   idptr = strrchr (pkg->id, '.');
   if (idptr)
     *idptr = '\0';
 
-  *eflags = pkg_config_parser_parse (client,
-                                     f,
-                                     pkg,
-                                     pkg_parser_funcs,
-                                     PKG_CONFIG_ARRAY_SIZE (pkg_parser_funcs),
-                                     pkg->filename);
+  /* Reuse the source split into lines by another client sharing the source
+   * cache, if possible (see pkg_config_client_clone()). Note that we only
+   * cache sources of files with known identity.
+   */
+  pkg_config_source_cache_t* sc =
+      pkg->file_mtime != -1 ? client->sources : NULL;
+  pkg_config_source_t* src =
+      sc != NULL ? pkg_config_source_cache_find (sc, pkg) : NULL;
+
+  if (src != NULL)
+  {
+    PKG_CONFIG_STATS_INC (client, source_cache_hits);
+    PKG_CONFIG_TRACE (client, "source hit: %s", pkg->filename);
+
+    fclose (f);
+    *eflags = LIBPKG_CONFIG_ERRF_OK;
+  }
+  else
+  {
+    PKG_CONFIG_SPAN_BEGIN (client, PARSE, pkg->id);
+    *eflags = pkg_config_parser_lex (client, f, pkg->filename, &src);
+    PKG_CONFIG_SPAN_END (client, PARSE, pkg->id);
+
+    if (*eflags == LIBPKG_CONFIG_ERRF_OK && sc != NULL)
+      pkg_config_source_cache_add (sc, pkg, src);
+  }
 
+  if (*eflags == LIBPKG_CONFIG_ERRF_OK)
+  {
+    PKG_CONFIG_SPAN_BEGIN (client, EXPAND, pkg->id);
+    *eflags = pkg_config_parser_apply (client,
+                                       src,
+                                       pkg,
+                                       pkg_parser_funcs,
+                                       PKG_CONFIG_ARRAY_SIZE (pkg_parser_funcs),
+                                       pkg->filename);
+    PKG_CONFIG_SPAN_END (client, EXPAND, pkg->id);
+
+    pkg_config_source_cache_release (sc, src);
+  }
 
   if (*eflags != LIBPKG_CONFIG_ERRF_OK ||
       (*eflags = pkg_config_pkg_validate (client, pkg)) != LIBPKG_CONFIG_ERRF_OK)
@@ -614,9 +694,53 @@ pkg_config_pkg_new_from_file (pkg_config_client_t* client,
     return NULL;
   }
 
+  /* Note that if unable to allocate, the version string is compared
+   * directly.
+   */
+  pkg->version_key = pkg_config_version_parse (pkg->allocator, pkg->version);
+
+  if (pkg->conflicts.head != NULL &&
+      (*eflags = pkg_config_pkg_index_required (pkg)) != LIBPKG_CONFIG_ERRF_OK)
+  {
+    pkg_config_pkg_free (client, pkg);
+    return NULL;
+  }
+
   return pkg_config_pkg_ref (client, pkg);
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_pkg_t *pkg_config_pkg_new_from_file(const
+ * pkg_config_client_t *client, const char *filename, FILE *f)
+ *
+ *    Parse a .pc file into a pkg_config_pkg_t object structure.
+ *
+ *    :param pkg_config_client_t* client: The pkg-config client object to use
+ * for dependency resolution. :param char* filename: The filename of the
+ * package file (including full path). :param FILE* f: The file object to read
+ * from. :returns: A ``pkg_config_pkg_t`` object which contains the package
+ * data. :rtype: pkg_config_pkg_t *
+ */
+pkg_config_pkg_t*
+pkg_config_pkg_new_from_file (pkg_config_client_t* client,
+                              const char* filename,
+                              FILE* f,
+                              unsigned int* eflags)
+{
+  /* If we cannot determine the file identity, the file will be considered
+   * changed on refresh.
+   */
+  struct stat st;
+
+  return pkg_new (client,
+                  filename,
+                  f,
+                  fstat (fileno (f), &st) == 0 ? &st : NULL,
+                  eflags);
+}
+
 /*
  * !doc
  *
@@ -635,12 +759,25 @@ pkg_config_pkg_free (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
   if (pkg == NULL)
     return;
 
-  pkg_config_cache_remove (client, pkg);
+  /* Removing a cached package invalidates its dependents while for a
+   * package that is not cached it's sufficient to drop the memoized results
+   * for which it is the root (its address can be reused).
+   */
+  if (pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CACHED)
+    pkg_config_cache_remove (client, pkg);
+  else
+    pkg_config_cache_result_drop (client, pkg);
 
   pkg_config_dependency_free (&pkg->required);
   pkg_config_dependency_free (&pkg->requires_private);
   pkg_config_dependency_free (&pkg->conflicts);
 
+  if (pkg->required_index != NULL)
+  {
+    pkg_config_hash_free (pkg->required_index);
+    pkg_config_mem_free (pkg->allocator, pkg->required_index);
+  }
+
   pkg_config_fragment_free (&pkg->cflags);
   pkg_config_fragment_free (&pkg->cflags_private);
   pkg_config_fragment_free (&pkg->libs);
@@ -648,28 +785,17 @@ pkg_config_pkg_free (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
 
   pkg_config_tuple_free (&pkg->vars);
 
-  if (pkg->id != NULL)
-    free (pkg->id);
-
-  if (pkg->filename != NULL)
-    free (pkg->filename);
-
-  if (pkg->realname != NULL)
-    free (pkg->realname);
-
-  if (pkg->version != NULL)
-    free (pkg->version);
-
-  if (pkg->description != NULL)
-    free (pkg->description);
-
-  if (pkg->url != NULL)
-    free (pkg->url);
-
-  if (pkg->pc_filedir != NULL)
-    free (pkg->pc_filedir);
-
-  free (pkg);
+  const pkg_config_allocator_t* a = pkg->allocator;
+
+  pkg_config_mem_free (a, pkg->id);
+  pkg_config_mem_free (a, pkg->filename);
+  pkg_config_mem_free (a, pkg->realname);
+  pkg_config_mem_free (a, pkg->version);
+  pkg_config_mem_free (a, pkg->version_key);
+  pkg_config_mem_free (a, pkg->description);
+  pkg_config_mem_free (a, pkg->url);
+  pkg_config_mem_free (a, pkg->pc_filedir);
+  pkg_config_mem_free (a, pkg);
 }
 
 /*
@@ -681,6 +807,12 @@ pkg_config_pkg_free (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
  *    Adds an additional reference to the package object (unless it is
  * static).
  *
+ *    The reference count is updated atomically and so references to the
+ *    same package can be added and released from different threads
+ *    provided the rest of the client state is synchronized by the caller.
+ *    Note that releasing the last reference frees the package, which
+ *    updates the owning client's caches.
+ *
  *    :param pkg_config_client_t* client: The pkg-config client object which
  * owns the package being referenced. :param pkg_config_pkg_t* pkg: The
  * package object being referenced. :return: The package itself with an
@@ -689,20 +821,29 @@ pkg_config_pkg_free (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
 pkg_config_pkg_t*
 pkg_config_pkg_ref (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
 {
-  if (pkg->refcount >= 0)
+  if (pkg_config_atomic_load (&pkg->refcount) >= 0)
   {
     assert ((pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0);
 
-    if (pkg->owner != NULL && pkg->owner != client)
-      PKG_CONFIG_TRACE (
-          client,
-          "WTF: client %p refers to package %p owned by other client %p",
-          client,
-          pkg,
-          pkg->owner);
+    pkg_config_atomic_inc (&pkg->refcount);
 
-    pkg->refcount++;
-    PKG_CONFIG_TRACE (client, "refcount@%p: %d", pkg, pkg->refcount);
+    /* Note that the count we trace may already be stale.
+     */
+    if (client != NULL && client->trace_handler != NULL)
+    {
+      if (pkg->owner != NULL && pkg->owner != client)
+        PKG_CONFIG_TRACE (
+            client,
+            "WTF: client %p refers to package %p owned by other client %p",
+            client,
+            pkg,
+            pkg->owner);
+
+      PKG_CONFIG_TRACE (client,
+                        "refcount@%p: %d",
+                        pkg,
+                        pkg_config_atomic_load (&pkg->refcount));
+    }
   }
 
   return pkg;
@@ -715,7 +856,8 @@ pkg_config_pkg_ref (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
  * pkg_config_pkg_t *pkg)
  *
  *    Releases a reference on the package object (unless it is static).  If
- * the reference count is 0, then also free the package.
+ * the reference count is 0, then also free the package. See
+ * pkg_config_pkg_ref() for the thread safety notes.
  *
  *    :param pkg_config_client_t* client: The pkg-config client object which
  * owns the package being dereferenced. :param pkg_config_pkg_t* pkg: The
@@ -724,31 +866,112 @@ pkg_config_pkg_ref (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
 void
 pkg_config_pkg_unref (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
 {
-  if (pkg->refcount >= 0)
+  if (pkg_config_atomic_load (&pkg->refcount) >= 0)
   {
-    assert ((pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0 &&
-            pkg->refcount != 0);
+    assert ((pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0);
 
-    if (pkg->owner != NULL && pkg->owner != client)
+    /* Note that once we have decremented the count, the package may be
+     * freed by another thread (unless it was the last reference).
+     */
+    pkg_config_client_t* owner = pkg->owner;
+
+    if (client != NULL && client->trace_handler != NULL &&
+        owner != NULL && owner != client)
       PKG_CONFIG_TRACE (
           client,
           "WTF: client %p unrefs package %p owned by other client %p",
           client,
           pkg,
-          pkg->owner);
+          owner);
+
+    int r = pkg_config_atomic_dec (&pkg->refcount);
+    assert (r >= 0);
+
+    if (owner != NULL && owner->trace_handler != NULL)
+      PKG_CONFIG_TRACE (owner, "refcount@%p: %d", pkg, r);
+
+    if (r == 0)
+      pkg_config_pkg_free (owner, pkg);
+  }
+}
+
+/* Release a reference on the package unless it is the last one (in which
+ * case return false and leave the count unchanged). Unlike
+ * pkg_config_pkg_unref(), this function never frees the package and so does
+ * not access any client state.
+ */
+bool
+pkg_config_pkg_unref_shared (pkg_config_pkg_t* pkg)
+{
+  int c = pkg_config_atomic_load (&pkg->refcount);
+
+  for (;;)
+  {
+    if (c < 0)
+      return true; /* Static. */
+
+    if (c <= 1)
+      return false;
+
+    if (pkg_config_atomic_cas (&pkg->refcount, c, c - 1))
+      return true;
+
+    c = pkg_config_atomic_load (&pkg->refcount);
+  }
+}
+
+/* Open the package file in the search directory, relative to the directory
+ * handle if possible (see path.c for details). Return NULL if the file does
+ * not exist (or cannot be opened) and its path in the buffer otherwise.
+ */
+static FILE*
+pkg_open_in_dir (pkg_config_path_t* dir,
+                 const char* name,
+                 const char* suffix,
+                 char* buf,
+                 size_t size)
+{
+  int n = snprintf (buf,
+                    size,
+                    "%s%c%s%s",
+                    dir->path,
+                    LIBPKG_CONFIG_DIR_SEP_S,
+                    name,
+                    suffix);
+
+#ifdef PKG_CONFIG_DIR_FDS
+  int dfd;
+
+  /* Note that openat() would ignore the directory for an absolute name.
+   */
+  if (n > 0 && (size_t)n < size && name[0] != '/' &&
+      (dfd = pkg_config_path_dir_fd (dir)) != -1)
+  {
+    int fd = openat (dfd,
+                     buf + strlen (dir->path) + 1,
+                     O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+      return NULL;
+
+    FILE* f = fdopen (fd, "r");
 
-    pkg->refcount--;
-    PKG_CONFIG_TRACE (pkg->owner, "refcount@%p: %d", pkg, pkg->refcount);
+    if (f == NULL)
+      close (fd);
 
-    if (pkg->refcount == 0)
-      pkg_config_pkg_free (pkg->owner, pkg);
+    return f;
   }
+#else
+  (void)n;
+#endif
+
+  return fopen (buf, "r");
 }
 
 /* If the file does not exist, return NULL and LIBPKG_CONFIG_ERRF_OK. */
 static inline pkg_config_pkg_t*
 pkg_config_pkg_try_specific_path (pkg_config_client_t* client,
-                                  const char* path,
+                                  pkg_config_path_t* dir,
                                   const char* name,
                                   unsigned int* eflags)
 {
@@ -758,68 +981,217 @@ pkg_config_pkg_try_specific_path (pkg_config_client_t* client,
 
   *eflags = LIBPKG_CONFIG_ERRF_OK;
 
-  PKG_CONFIG_TRACE (client, "trying path: %s for %s", path, name);
+  PKG_CONFIG_TRACE (client, "trying path: %s for %s", dir->path, name);
 
   if ((client->flags & LIBPKG_CONFIG_PKG_PKGF_CONSIDER_UNINSTALLED) != 0)
   {
-    snprintf (locbuf,
-              sizeof locbuf,
-              "%s%c%s-uninstalled" PKG_CONFIG_EXT,
-              path,
-              LIBPKG_CONFIG_DIR_SEP_S,
-              name);
+    f = pkg_open_in_dir (dir,
+                         name,
+                         "-uninstalled" PKG_CONFIG_EXT,
+                         locbuf,
+                         sizeof locbuf);
 
-    if ((f = fopen (locbuf, "r")) != NULL)
+    if (f != NULL)
     {
+      PKG_CONFIG_STATS_INC (client, files_opened);
       PKG_CONFIG_TRACE (client, "found (uninstalled): %s", locbuf);
       pkg = pkg_config_pkg_new_from_file (client, locbuf, f, eflags);
       if (pkg != NULL)
         pkg->flags |= LIBPKG_CONFIG_PKG_PROPF_UNINSTALLED;
       return pkg;
     }
-  }
 
-  snprintf (locbuf,
-            sizeof locbuf,
-            "%s%c%s" PKG_CONFIG_EXT,
-            path,
-            LIBPKG_CONFIG_DIR_SEP_S,
-            name);
+    PKG_CONFIG_STATS_INC (client, files_failed);
+  }
 
-  if ((f = fopen (locbuf, "r")) != NULL)
+  if ((f = pkg_open_in_dir (dir, name, PKG_CONFIG_EXT, locbuf, sizeof locbuf))
+      != NULL)
   {
+    PKG_CONFIG_STATS_INC (client, files_opened);
     PKG_CONFIG_TRACE (client, "found: %s", locbuf);
     pkg = pkg_config_pkg_new_from_file (client, locbuf, f, eflags);
     return pkg;
   }
 
+  PKG_CONFIG_STATS_INC (client, files_failed);
   return NULL;
 }
 
-/*
- * !doc
- *
- * .. c:function:: pkg_config_pkg_t *pkg_config_pkg_find(pkg_config_client_t
- * *client, const char *name)
- *
- *    Search for a package.
- *
- *    :param pkg_config_client_t* client: The pkg-config client object to use
- * for dependency resolution. :param char* name: The name of the package
- * `atom` to use for searching. :return: A package object reference if the
- * package was found, else ``NULL``. :rtype: pkg_config_pkg_t *
- *
- *
- * If not found, return NULL and LIBPKG_CONFIG_ERRF_OK.
- *
+#ifdef PKG_CONFIG_LOADER
+/* Load the package from the file read by the loader or, if it was not read
+ * but may exist, open it the usual way (see loader.c for details). Save the
+ * file path in the buffer and free the file contents. If the file does not
+ * exist, return NULL and LIBPKG_CONFIG_ERRF_OK.
  */
-pkg_config_pkg_t*
-pkg_config_pkg_find (pkg_config_client_t* client,
-                     const char* name,
-                     unsigned int* eflags)
+static pkg_config_pkg_t*
+pkg_load (pkg_config_client_t* client,
+          pkg_config_path_t* dir,
+          pkg_config_load_t* ld,
+          char* buf,
+          size_t size,
+          unsigned int* eflags)
+{
+  pkg_config_pkg_t* pkg = NULL;
+  FILE* f;
+
+  *eflags = LIBPKG_CONFIG_ERRF_OK;
+
+  snprintf (buf, size, "%s%c%s", dir->path, LIBPKG_CONFIG_DIR_SEP_S, ld->name);
+
+  /* Note that the parser closes the stream before we free the contents.
+   */
+  if (ld->error == 0 && (f = fmemopen (ld->buf, ld->size, "r")) != NULL)
+  {
+    PKG_CONFIG_STATS_INC (client, files_opened);
+    PKG_CONFIG_STATS_INC (client, files_batched);
+    pkg = pkg_new (client, buf, f, &ld->st, eflags);
+  }
+  else if ((ld->error == 0 || ld->error == PKG_CONFIG_LOAD_FALLBACK) &&
+           (f = pkg_open_in_dir (dir, ld->name, "", buf, size)) != NULL)
+  {
+    PKG_CONFIG_STATS_INC (client, files_opened);
+    pkg = pkg_config_pkg_new_from_file (client, buf, f, eflags);
+  }
+  else
+    PKG_CONFIG_STATS_INC (client, files_failed);
+
+  pkg_config_mem_free (ld->allocator, ld->buf);
+  ld->buf = NULL;
+  return pkg;
+}
+#endif
+
+/* Search for the packages in the client's directory list, bypassing the
+ * cache, similar to pkg_config_pkg_find_in_dirs() but reading the candidate
+ * files of all the packages in each directory in a batch (see loader.c).
+ * Set each package to NULL if not found or failed to load. Return false,
+ * without doing anything, if batch loading is not available.
+ */
+bool
+pkg_config_pkg_find_all_in_dirs (pkg_config_client_t* client,
+                                 const char* const* names,
+                                 size_t count,
+                                 pkg_config_pkg_t** pkgs)
+{
+#ifdef PKG_CONFIG_LOADER
+  pkg_config_loader_t* loader = pkg_config_loader_get (client);
+
+  if (loader == NULL)
+    return false;
+
+  /* Candidate file names (the uninstalled variant first, if considered).
+   */
+  size_t per =
+      (client->flags & LIBPKG_CONFIG_PKG_PKGF_CONSIDER_UNINSTALLED) != 0
+      ? 2
+      : 1;
+
+  pkg_config_load_t* loads = calloc (count * per, sizeof (pkg_config_load_t));
+  char** files = calloc (count * per, sizeof (char*));
+  bool* done = calloc (count, sizeof (bool));
+  bool r = loads != NULL && files != NULL && done != NULL;
+
+  for (size_t i = 0; r && i != count * per; ++i)
+  {
+    const char* name = names[i / per];
+    const char* suffix = per == 2 && i % 2 == 0
+                         ? "-uninstalled" PKG_CONFIG_EXT
+                         : PKG_CONFIG_EXT;
+    size_t n = strlen (name) + strlen (suffix) + 1;
+
+    if ((files[i] = malloc (n)) != NULL)
+      snprintf (files[i], n, "%s%s", name, suffix);
+    else
+      r = false;
+  }
+
+  if (r)
+  {
+    pkg_config_node_t* n;
+
+    for (size_t i = 0; i != count; ++i)
+      pkgs[i] = NULL;
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->dir_list.head, n)
+    {
+      pkg_config_path_t* dir = n->data;
+      size_t m = 0;
+
+      for (size_t i = 0; i != count; ++i)
+      {
+        for (size_t j = 0; !done[i] && j != per; ++j)
+          loads[m++].name = files[i * per + j];
+      }
+
+      if (m == 0)
+        break;
+
+      pkg_config_loader_load (loader, client, dir, loads, m);
+
+      m = 0;
+      for (size_t i = 0; i != count; ++i)
+      {
+        if (done[i])
+          continue;
+
+        PKG_CONFIG_TRACE (
+            client, "trying path: %s for %s", dir->path, names[i]);
+
+        for (size_t j = 0; j != per; ++j, ++m)
+        {
+          pkg_config_load_t* ld = &loads[m];
+
+          if (done[i])
+          {
+            pkg_config_mem_free (ld->allocator, ld->buf);
+            continue;
+          }
+
+          char locbuf[PKG_CONFIG_ITEM_SIZE];
+          unsigned int eflags;
+          pkg_config_pkg_t* pkg =
+              pkg_load (client, dir, ld, locbuf, sizeof locbuf, &eflags);
+
+          if (pkg != NULL || eflags != LIBPKG_CONFIG_ERRF_OK)
+          {
+            PKG_CONFIG_TRACE (client, "found: %s", locbuf);
+
+            if (pkg != NULL && j + 1 != per)
+              pkg->flags |= LIBPKG_CONFIG_PKG_PROPF_UNINSTALLED;
+
+            pkgs[i] = pkg;
+            done[i] = true;
+          }
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; files != NULL && i != count * per; ++i)
+    free (files[i]);
+
+  free (files);
+  free (loads);
+  free (done);
+
+  return r;
+#else
+  (void)client;
+  (void)names;
+  (void)count;
+  (void)pkgs;
+  return false;
+#endif
+}
+
+/* Search for a package (see pkg_config_pkg_find() for details).
+ */
+static pkg_config_pkg_t*
+pkg_find (pkg_config_client_t* client,
+          const char* name,
+          unsigned int* eflags)
 {
   pkg_config_pkg_t* pkg = NULL;
-  pkg_config_node_t* n;
   FILE* f;
 
   *eflags = LIBPKG_CONFIG_ERRF_OK;
@@ -829,14 +1201,24 @@ pkg_config_pkg_find (pkg_config_client_t* client,
   /* name might actually be a filename. */
   if (str_has_suffix (name, PKG_CONFIG_EXT))
   {
+    /* Loading a package from a file modifies the directory list, so leave
+     * it to the (serial) traversal.
+     */
+    if (client->resolver != NULL)
+      return NULL;
+
     if ((f = fopen (name, "r")) != NULL)
     {
+      PKG_CONFIG_STATS_INC (client, files_opened);
       PKG_CONFIG_TRACE (client, "%s is a file", name);
 
       pkg = pkg_config_pkg_new_from_file (client, name, f, eflags);
       if (pkg != NULL)
-        pkg_config_path_add (pkg->pc_filedir, &client->dir_list, true);
+        pkg_config_path_add_with (
+            client, pkg->pc_filedir, &client->dir_list, true);
     }
+    else
+      PKG_CONFIG_STATS_INC (client, files_failed);
 
     /* There is no point in trying anything else since the name contains the
        extension. */
@@ -853,24 +1235,36 @@ pkg_config_pkg_find (pkg_config_client_t* client,
   /* check cache */
   if (!(client->flags & LIBPKG_CONFIG_PKG_PKGF_NO_CACHE))
   {
-    if ((pkg = pkg_config_cache_lookup (client, name)) != NULL)
+    pkg_config_cache_lock (client);
+    pkg = pkg_config_cache_lookup (client, name);
+    pkg_config_cache_unlock (client);
+
+    if (pkg != NULL)
     {
       PKG_CONFIG_TRACE (client, "%s is cached", name);
       return pkg;
     }
   }
 
-  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->dir_list.head, n)
+  /* During parallel resolution the package is loaded quietly and added to the
+   * cache under the lock (see resolve.c for details).
+   */
+  if (client->resolver != NULL)
   {
-    pkg_config_path_t* pnode = n->data;
+    pkg = pkg_config_resolve_find (client, name, eflags);
 
-    pkg = pkg_config_pkg_try_specific_path (client, pnode->path, name, eflags);
-    if (pkg != NULL || *eflags != LIBPKG_CONFIG_ERRF_OK)
-      break;
+    if (pkg == NULL && *eflags == LIBPKG_CONFIG_ERRF_OK)
+      PKG_CONFIG_STATS_INC (client, pkg_not_found);
+
+    return pkg;
   }
 
+  pkg = pkg_config_pkg_find_in_dirs (client, name, eflags);
+
   if (pkg != NULL)
     pkg_config_cache_add (client, pkg);
+  else if (*eflags == LIBPKG_CONFIG_ERRF_OK)
+    PKG_CONFIG_STATS_INC (client, pkg_not_found);
 
   return pkg;
 }
@@ -878,130 +1272,519 @@ pkg_config_pkg_find (pkg_config_client_t* client,
 /*
  * !doc
  *
- * .. c:function:: int pkg_config_compare_version(const char *a, const char
- * *b)
+ * .. c:function:: pkg_config_pkg_t *pkg_config_pkg_find(pkg_config_client_t
+ * *client, const char *name)
  *
- *    Compare versions using RPM version comparison rules as described in the
- * LSB.
+ *    Search for a package.
+ *
+ *    :param pkg_config_client_t* client: The pkg-config client object to use
+ * for dependency resolution. :param char* name: The name of the package
+ * `atom` to use for searching. :return: A package object reference if the
+ * package was found, else ``NULL``. :rtype: pkg_config_pkg_t *
+ *
+ *
+ * If not found, return NULL and LIBPKG_CONFIG_ERRF_OK.
+ *
+ * Note that on POSIX the search directories are probed via the handles
+ * opened on the first lookup (see path.c for details). Until the handles are
+ * closed by pkg_config_cache_refresh(), a search directory that has been
+ * renamed or replaced may still be searched as it was when it was opened.
  *
- *    :param char* a: The first version to compare in the pair.
- *    :param char* b: The second version to compare in the pair.
- *    :return: -1 if the first version is greater, 0 if both versions are
- * equal, 1 if the second version is greater. :rtype: int
  */
-int
-pkg_config_compare_version (const char* a, const char* b)
+pkg_config_pkg_t*
+pkg_config_pkg_find (pkg_config_client_t* client,
+                     const char* name,
+                     unsigned int* eflags)
 {
-  char oldch1, oldch2;
-  char buf1[PKG_CONFIG_ITEM_SIZE], buf2[PKG_CONFIG_ITEM_SIZE];
-  char *str1, *str2;
-  char *one, *two;
-  int ret;
-  bool isnum;
+  PKG_CONFIG_SPAN_BEGIN (client, FIND, name);
+  pkg_config_pkg_t* pkg = pkg_find (client, name, eflags);
+  PKG_CONFIG_SPAN_END (client, FIND, name);
 
-  /* optimization: if version matches then it's the same version. */
-  if (a == NULL)
-    return 1;
+  return pkg;
+}
 
-  if (b == NULL)
-    return -1;
+/* Search for the package in the client's directory list, bypassing the
+ * cache.
+ */
+pkg_config_pkg_t*
+pkg_config_pkg_find_in_dirs (pkg_config_client_t* client,
+                             const char* name,
+                             unsigned int* eflags)
+{
+  pkg_config_pkg_t* pkg = NULL;
+  pkg_config_node_t* n;
 
-  if (!strcasecmp (a, b))
-    return 0;
+  *eflags = LIBPKG_CONFIG_ERRF_OK;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->dir_list.head, n)
+  {
+    pkg_config_path_t* pnode = n->data;
 
-  pkg_config_strlcpy (buf1, a, sizeof buf1);
-  pkg_config_strlcpy (buf2, b, sizeof buf2);
+    pkg = pkg_config_pkg_try_specific_path (client, pnode, name, eflags);
+    if (pkg != NULL || *eflags != LIBPKG_CONFIG_ERRF_OK)
+      break;
+  }
+
+  return pkg;
+}
 
-  one = str1 = buf1;
-  two = str2 = buf2;
+static int
+scan_name_compare (const void* a, const void* b)
+{
+  return strcmp (*(char* const*)a, *(char* const*)b);
+}
 
-  while (*one || *two)
+/* Append a copy of the name to the array. Return false if unable to
+ * allocate memory.
+ */
+static bool
+scan_name_add (char*** names,
+               size_t* count,
+               size_t* capacity,
+               const char* name)
+{
+  if (*count == *capacity)
   {
-    while (*one && !isalnum ((unsigned int)*one) && *one != '~') one++;
-    while (*two && !isalnum ((unsigned int)*two) && *two != '~') two++;
+    size_t c = *capacity != 0 ? *capacity * 2 : 64;
+    char** a = realloc (*names, c * sizeof (char*));
 
-    if (*one == '~' || *two == '~')
-    {
-      if (*one != '~')
-        return -1;
-      if (*two != '~')
-        return 1;
+    if (a == NULL)
+      return false;
 
-      one++;
-      two++;
-      continue;
-    }
+    *names = a;
+    *capacity = c;
+  }
 
-    if (!(*one && *two))
-      break;
+  if (((*names)[*count] = strdup (name)) == NULL)
+    return false;
+
+  ++*count;
+  return true;
+}
+
+/* Return the names of the .pc files in the directory, sorted so that the
+ * scan order does not depend on the filesystem. If the directory cannot be
+ * opened, return NULL and 0 count. Return false if unable to allocate
+ * memory.
+ */
+static bool
+scan_dir_names (const char* path, char*** names, size_t* count)
+{
+  size_t capacity = 0;
+  bool r = true;
+
+  *names = NULL;
+  *count = 0;
+
+#ifndef _WIN32
+  DIR* dir = opendir (path);
+  if (dir == NULL)
+    return true;
+
+  for (struct dirent* de; r && (de = readdir (dir)) != NULL; )
+  {
+    if (str_has_suffix (de->d_name, PKG_CONFIG_EXT))
+      r = scan_name_add (names, count, &capacity, de->d_name);
+  }
+
+  closedir (dir);
+#else
+  char pattern[PKG_CONFIG_ITEM_SIZE];
+  WIN32_FIND_DATAA fd;
+
+  snprintf (pattern, sizeof pattern, "%s\\*" PKG_CONFIG_EXT, path);
+
+  HANDLE h = FindFirstFileA (pattern, &fd);
+  if (h == INVALID_HANDLE_VALUE)
+    return true;
+
+  do
+  {
+    /* Note that the pattern also matches, for example, .pcx (8.3 names).
+     */
+    if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 &&
+        str_has_suffix (fd.cFileName, PKG_CONFIG_EXT))
+      r = scan_name_add (names, count, &capacity, fd.cFileName);
+  }
+  while (r && FindNextFileA (h, &fd));
+
+  FindClose (h);
+#endif
+
+  if (!r)
+  {
+    for (size_t i = 0; i != *count; ++i)
+      free ((*names)[i]);
+
+    free (*names);
+    *names = NULL;
+    *count = 0;
+    return false;
+  }
+
+  if (*count != 0)
+    qsort (*names, *count, sizeof (char*), scan_name_compare);
+
+  return true;
+}
 
-    str1 = one;
-    str2 = two;
+/* Load every package in the directory calling the function for each. Stop
+ * and return the package for which the function returns true.
+ */
+static pkg_config_pkg_t*
+pkg_config_scan_dir (pkg_config_client_t* client,
+                     pkg_config_path_t* dir,
+                     void* data,
+                     pkg_config_pkg_iteration_func_t func)
+{
+  pkg_config_pkg_t* r = NULL;
+  char** names;
+  size_t count;
+
+  PKG_CONFIG_TRACE (client, "scanning directory: %s", dir->path);
+
+  if (!scan_dir_names (dir->path, &names, &count))
+    return NULL;
+
+  /* Read the files a batch at a time, if possible (see loader.c).
+   */
+#ifdef PKG_CONFIG_LOADER
+  pkg_config_loader_t* loader =
+      count > 1 ? pkg_config_loader_get (client) : NULL;
+  pkg_config_load_t loads[PKG_CONFIG_LOAD_BATCH];
+#endif
 
-    if (isdigit ((unsigned int)*str1))
+  for (size_t i = 0; i != count; ++i)
+  {
+    char filebuf[PKG_CONFIG_ITEM_SIZE];
+    unsigned int eflags;
+    pkg_config_pkg_t* pkg = NULL;
+    FILE* f;
+
+#ifdef PKG_CONFIG_LOADER
+    pkg_config_load_t* ld = NULL;
+
+    if (loader != NULL)
     {
-      while (*str1 && isdigit ((unsigned int)*str1)) str1++;
+      size_t b = i % PKG_CONFIG_LOAD_BATCH;
+
+      if (b == 0 && r == NULL)
+      {
+        size_t n = count - i < PKG_CONFIG_LOAD_BATCH ? count - i
+                                                     : PKG_CONFIG_LOAD_BATCH;
+
+        for (size_t j = 0; j != n; ++j)
+          loads[j].name = names[i + j];
+
+        pkg_config_loader_load (loader, client, dir, loads, n);
+      }
 
-      while (*str2 && isdigit ((unsigned int)*str2)) str2++;
+      ld = &loads[b];
 
-      isnum = true;
+      /* Note that the contents of the files that follow the one we stop
+       * at still need to be freed.
+       */
+      if (r != NULL)
+      {
+        pkg_config_mem_free (ld->allocator, ld->buf);
+        ld->buf = NULL;
+      }
     }
-    else
+#endif
+
+    if (r == NULL)
     {
-      while (*str1 && isalpha ((unsigned int)*str1)) str1++;
+#ifdef PKG_CONFIG_LOADER
+      if (ld != NULL)
+      {
+        pkg = pkg_load (client, dir, ld, filebuf, sizeof filebuf, &eflags);
+
+        PKG_CONFIG_TRACE (client, "trying file: %s", filebuf);
+      }
+      else
+#endif
+      {
+        f = pkg_open_in_dir (dir, names[i], "", filebuf, sizeof filebuf);
+
+        PKG_CONFIG_TRACE (client, "trying file: %s", filebuf);
 
-      while (*str2 && isalpha ((unsigned int)*str2)) str2++;
+        if (f != NULL)
+        {
+          PKG_CONFIG_STATS_INC (client, files_opened);
+
+          pkg = pkg_config_pkg_new_from_file (client, filebuf, f, &eflags);
+        }
+      }
 
-      isnum = false;
+      if (pkg != NULL)
+      {
+        if (func (pkg, data))
+          r = pkg;
+        else
+          pkg_config_pkg_unref (client, pkg);
+      }
     }
 
-    oldch1 = *str1;
-    oldch2 = *str2;
+    free (names[i]);
+  }
+
+  free (names);
+  return r;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_pkg_t *pkg_config_scan_all(pkg_config_client_t
+ * *client, void *ptr, pkg_config_pkg_iteration_func_t func)
+ *
+ *    Iterates over all the packages in the client object's search
+ *    directories (in the search order and, within a directory, in the file
+ *    name order), loading each and calling the function. Note that the
+ *    packages are loaded bypassing the cache and a package shadowed by an
+ *    earlier directory is still visited.
+ *
+ *    :param pkg_config_client_t* client: The client object to use.
+ *    :param void* ptr: An opaque pointer passed to the function.
+ *    :param pkg_config_pkg_iteration_func_t func: The function to call for
+ *    each package. If it returns true, the iteration stops.
+ *    :return: A reference to the package for which the function returned
+ *    true or ``NULL`` if none.
+ *    :rtype: pkg_config_pkg_t *
+ */
+pkg_config_pkg_t*
+pkg_config_scan_all (pkg_config_client_t* client,
+                     void* ptr,
+                     pkg_config_pkg_iteration_func_t func)
+{
+  pkg_config_node_t* n;
+  pkg_config_pkg_t* pkg;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->dir_list.head, n)
+  {
+    pkg_config_path_t* pnode = n->data;
+
+    if ((pkg = pkg_config_scan_dir (client, pnode, ptr, func)) != NULL)
+      return pkg;
+  }
+
+  return NULL;
+}
+
+/* Extract the next segment of the version string advancing the string
+ * pointer past it. Return false if there are no more segments.
+ */
+static inline bool
+pkg_config_version_next (const char** str, pkg_config_version_segment_t* seg)
+{
+  const char* p = *str;
+
+  while (*p && !isalnum ((unsigned int)*p) && *p != '~') p++;
 
-    *str1 = '\0';
-    *str2 = '\0';
+  if (*p == '\0')
+  {
+    *str = p;
+    return false;
+  }
+
+  if (*p == '~')
+  {
+    seg->type = PKG_CONFIG_VERSION_SEG_TILDE;
+    seg->str = p++;
+    seg->size = 1;
+    seg->number = 0;
+  }
+  else if (isdigit ((unsigned int)*p))
+  {
+    uint64_t n = 0;
+
+    while (*p == '0') p++;
+
+    seg->type = PKG_CONFIG_VERSION_SEG_NUMBER;
+    seg->str = p;
+
+    for (; *p && isdigit ((unsigned int)*p); p++)
+      n = n * 10 + (uint64_t)(*p - '0'); /* Unused if wraps around. */
+
+    seg->size = p - seg->str;
+    seg->number = seg->size <= PKG_CONFIG_VERSION_NUMBER_DIGITS ? n : 0;
+  }
+  else
+  {
+    seg->type = PKG_CONFIG_VERSION_SEG_ALPHA;
+    seg->str = p;
+
+    while (*p && isalpha ((unsigned int)*p)) p++;
+
+    seg->size = p - seg->str;
+    seg->number = 0;
+  }
+
+  *str = p;
+  return true;
+}
+
+/* Compare a pair of corresponding segments, either of which can be absent
+ * (NULL). Return PKG_CONFIG_VERSION_CONTINUE if they are equal and the
+ * comparison should continue with the next pair.
+ */
+#define PKG_CONFIG_VERSION_CONTINUE 2
+
+static inline int
+pkg_config_version_segment_compare (const pkg_config_version_segment_t* a,
+                                    const pkg_config_version_segment_t* b)
+{
+  if (a == NULL && b == NULL)
+    return 0;
 
-    if (one == str1)
+  /* Tilde sorts before anything, including the end of the version.
+   */
+  if ((a != NULL && a->type == PKG_CONFIG_VERSION_SEG_TILDE) ||
+      (b != NULL && b->type == PKG_CONFIG_VERSION_SEG_TILDE))
+  {
+    if (a == NULL || a->type != PKG_CONFIG_VERSION_SEG_TILDE)
       return -1;
 
-    if (two == str2)
-      return (isnum ? 1 : -1);
+    if (b == NULL || b->type != PKG_CONFIG_VERSION_SEG_TILDE)
+      return 1;
 
-    if (isnum)
-    {
-      int onelen, twolen;
+    return PKG_CONFIG_VERSION_CONTINUE;
+  }
+
+  if (a == NULL)
+    return -1;
 
-      while (*one == '0') one++;
+  if (b == NULL)
+    return 1;
+
+  /* Numeric segment is newer than alpha.
+   */
+  if (a->type != b->type)
+    return a->type == PKG_CONFIG_VERSION_SEG_NUMBER ? 1 : -1;
 
-      while (*two == '0') two++;
+  if (a->type == PKG_CONFIG_VERSION_SEG_NUMBER)
+  {
+    /* Without leading zeros, the longer number is greater.
+     */
+    if (a->size != b->size)
+      return a->size < b->size ? -1 : 1;
 
-      onelen = strlen (one);
-      twolen = strlen (two);
+    if (a->size <= PKG_CONFIG_VERSION_NUMBER_DIGITS)
+    {
+      if (a->number != b->number)
+        return a->number < b->number ? -1 : 1;
 
-      if (onelen > twolen)
-        return 1;
-      else if (twolen > onelen)
-        return -1;
+      return PKG_CONFIG_VERSION_CONTINUE;
     }
+  }
+
+  int r = memcmp (a->str, b->str, a->size < b->size ? a->size : b->size);
+
+  if (r != 0)
+    return r < 0 ? -1 : 1;
+
+  if (a->size != b->size)
+    return a->size < b->size ? -1 : 1;
+
+  return PKG_CONFIG_VERSION_CONTINUE;
+}
+
+/* Split the version string into segments. The string must outlive the
+ * result, which should be released with the same allocator. Return NULL if
+ * unable to allocate memory.
+ */
+pkg_config_version_t*
+pkg_config_version_parse (const pkg_config_allocator_t* a, const char* str)
+{
+  pkg_config_version_segment_t seg;
+  size_t n = 0;
 
-    ret = strcmp (one, two);
-    if (ret != 0)
-      return ret < 0 ? -1 : 1;
+  for (const char* p = str; pkg_config_version_next (&p, &seg); ) n++;
 
-    *str1 = oldch1;
-    *str2 = oldch2;
+  pkg_config_version_t* v =
+      pkg_config_mem_alloc (a,
+                            sizeof (pkg_config_version_t) +
+                            n * sizeof (pkg_config_version_segment_t));
 
-    one = str1;
-    two = str2;
+  if (v == NULL)
+    return NULL;
+
+  v->str = str;
+  v->size = strlen (str);
+  v->count = 0;
+
+  for (const char* p = str; pkg_config_version_next (&p, &seg); )
+    v->segments[v->count++] = seg;
+
+  return v;
+}
+
+/* Compare pre-split versions. The result is the same as of
+ * pkg_config_compare_version() for the corresponding strings.
+ */
+int
+pkg_config_version_compare (const pkg_config_version_t* a,
+                            const pkg_config_version_t* b)
+{
+  int r;
+
+  for (size_t i = 0; ; ++i)
+  {
+    r = pkg_config_version_segment_compare (
+        i < a->count ? &a->segments[i] : NULL,
+        i < b->count ? &b->segments[i] : NULL);
+
+    if (r != PKG_CONFIG_VERSION_CONTINUE)
+      break;
   }
 
-  if ((!*one) && (!*two))
+  /* Versions that only differ in case are considered equal.
+   */
+  if (r != 0 && a->size == b->size && !strcasecmp (a->str, b->str))
     return 0;
 
-  if (!*one)
+  return r;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_compare_version(const char *a, const char
+ * *b)
+ *
+ *    Compare versions using RPM version comparison rules as described in the
+ * LSB.
+ *
+ *    :param char* a: The first version to compare in the pair.
+ *    :param char* b: The second version to compare in the pair.
+ *    :return: -1 if the first version is greater, 0 if both versions are
+ * equal, 1 if the second version is greater. :rtype: int
+ */
+int
+pkg_config_compare_version (const char* a, const char* b)
+{
+  /* optimization: if version matches then it's the same version. */
+  if (a == NULL)
+    return 1;
+
+  if (b == NULL)
     return -1;
 
-  return 1;
+  if (!strcasecmp (a, b))
+    return 0;
+
+  for (;;)
+  {
+    pkg_config_version_segment_t sa, sb;
+    bool ha = pkg_config_version_next (&a, &sa);
+    bool hb = pkg_config_version_next (&b, &sb);
+
+    int r = pkg_config_version_segment_compare (ha ? &sa : NULL,
+                                                hb ? &sb : NULL);
+
+    if (r != PKG_CONFIG_VERSION_CONTINUE)
+      return r;
+  }
 }
 
 static const pkg_config_pkg_t pkg_config_virtual = {
@@ -1077,7 +1860,7 @@ pkg_config_builtin_pkg_get (const char* name)
   return (pair != NULL) ? pair->pkg : NULL;
 }
 
-typedef bool (*pkg_config_vercmp_res_func_t) (const char* a, const char* b);
+typedef bool (*pkg_config_vercmp_res_func_t) (int cmp);
 
 typedef struct
 {
@@ -1103,46 +1886,45 @@ pkg_config_pkg_comparator_pair_namecmp (const void* key, const void* ptr)
 }
 
 static bool
-pkg_config_pkg_comparator_lt (const char* a, const char* b)
+pkg_config_pkg_comparator_lt (int cmp)
 {
-  return (pkg_config_compare_version (a, b) < 0);
+  return cmp < 0;
 }
 
 static bool
-pkg_config_pkg_comparator_gt (const char* a, const char* b)
+pkg_config_pkg_comparator_gt (int cmp)
 {
-  return (pkg_config_compare_version (a, b) > 0);
+  return cmp > 0;
 }
 
 static bool
-pkg_config_pkg_comparator_lte (const char* a, const char* b)
+pkg_config_pkg_comparator_lte (int cmp)
 {
-  return (pkg_config_compare_version (a, b) <= 0);
+  return cmp <= 0;
 }
 
 static bool
-pkg_config_pkg_comparator_gte (const char* a, const char* b)
+pkg_config_pkg_comparator_gte (int cmp)
 {
-  return (pkg_config_compare_version (a, b) >= 0);
+  return cmp >= 0;
 }
 
 static bool
-pkg_config_pkg_comparator_eq (const char* a, const char* b)
+pkg_config_pkg_comparator_eq (int cmp)
 {
-  return (pkg_config_compare_version (a, b) == 0);
+  return cmp == 0;
 }
 
 static bool
-pkg_config_pkg_comparator_ne (const char* a, const char* b)
+pkg_config_pkg_comparator_ne (int cmp)
 {
-  return (pkg_config_compare_version (a, b) != 0);
+  return cmp != 0;
 }
 
 static bool
-pkg_config_pkg_comparator_any (const char* a, const char* b)
+pkg_config_pkg_comparator_any (int cmp)
 {
-  (void)a;
-  (void)b;
+  (void)cmp;
 
   return true;
 }
@@ -1158,8 +1940,25 @@ static const pkg_config_vercmp_res_func_t pkg_config_pkg_comparator_impls[] =
   [PKG_CONFIG_CMP_NOT_EQUAL] = pkg_config_pkg_comparator_ne
 };
 
-/*
- * !doc
+/* Return true if the package version satisfies the dependency constraint,
+ * comparing the pre-split versions, if available.
+ */
+static inline bool
+pkg_config_pkg_version_match (const pkg_config_pkg_t* pkg,
+                              const pkg_config_dependency_t* dep)
+{
+  int cmp = 0;
+
+  if (dep->compare != PKG_CONFIG_CMP_ANY)
+    cmp = pkg->version_key != NULL && dep->version_key != NULL
+          ? pkg_config_version_compare (pkg->version_key, dep->version_key)
+          : pkg_config_compare_version (pkg->version, dep->version);
+
+  return pkg_config_pkg_comparator_impls[dep->compare](cmp);
+}
+
+/*
+ * !doc
  *
  * .. c:function:: const char *pkg_config_pkg_get_comparator(const
  * pkg_config_dependency_t *pkgdep)
@@ -1236,17 +2035,26 @@ pkg_config_pkg_verify_dependency (pkg_config_client_t* client,
   if (eflags != NULL)
     *eflags = LIBPKG_CONFIG_ERRF_OK;
 
+  PKG_CONFIG_STATS_INC (client, edges_verified);
   PKG_CONFIG_TRACE (
       client, "trying to verify dependency: %s", pkgdep->package);
 
+  /* Note that during parallel resolution the match can be set concurrently
+   * (see resolve.c for details).
+   */
+  pkg_config_cache_lock (client);
   if (pkgdep->match != NULL)
+    pkg = pkg_config_pkg_ref (client, pkgdep->match);
+  pkg_config_cache_unlock (client);
+
+  if (pkg != NULL)
   {
     PKG_CONFIG_TRACE (client,
                       "cached dependency: %s -> %s@%p",
                       pkgdep->package,
-                      pkgdep->match->id,
-                      pkgdep->match);
-    return pkg_config_pkg_ref (client, pkgdep->match);
+                      pkg->id,
+                      pkg);
+    return pkg;
   }
 
   unsigned int def;
@@ -1263,17 +2071,24 @@ pkg_config_pkg_verify_dependency (pkg_config_client_t* client,
   if (pkg->id == NULL)
   {
     assert ((pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0);
-    pkg->id = strdup (pkgdep->package);
+    pkg->id = pkg_config_mem_strdup (pkg->allocator, pkgdep->package);
   }
 
-  if (pkg_config_pkg_comparator_impls[pkgdep->compare](
-          pkg->version, pkgdep->version) != true)
+  if (!pkg_config_pkg_version_match (pkg, pkgdep))
   {
     if (eflags != NULL)
       *eflags |= LIBPKG_CONFIG_ERRF_PACKAGE_VER_MISMATCH;
   }
   else
-    pkgdep->match = pkg_config_pkg_ref (client, pkg);
+  {
+    /* Both concurrent resolutions of the same dependency end up with the
+     * same (cached) package so keep whichever match is set first.
+     */
+    pkg_config_cache_lock (client);
+    if (pkgdep->match == NULL)
+      pkg_config_cache_set_match (client, pkgdep, pkg);
+    pkg_config_cache_unlock (client);
+  }
 
   return pkg;
 }
@@ -1304,7 +2119,7 @@ pkg_config_pkg_verify_graph (pkg_config_client_t* client,
   return pkg_config_pkg_traverse (client, root, NULL, NULL, depth, 0);
 }
 
-static unsigned int
+unsigned int
 pkg_config_pkg_report_graph_error (pkg_config_client_t* client,
                                    const pkg_config_pkg_t* parent,
                                    pkg_config_pkg_t* pkg,
@@ -1366,123 +2181,579 @@ pkg_config_pkg_report_graph_error (pkg_config_client_t* client,
   return eflags;
 }
 
-static inline unsigned int
-pkg_config_pkg_walk_list (pkg_config_client_t* client,
-                          pkg_config_pkg_t* parent,
-                          pkg_config_list_t* deplist,
-                          pkg_config_pkg_traverse_func_t func,
-                          void* data,
-                          int depth,
-                          unsigned int skip_flags)
+/* Return true if the package requires (publicly) the specified package.
+ */
+static inline bool
+pkg_config_pkg_requires_name (const pkg_config_pkg_t* pkg, const char* name)
 {
-  unsigned int eflags = LIBPKG_CONFIG_ERRF_OK;
   pkg_config_node_t* node;
 
-  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (deplist->head, node)
+  if (pkg->required_index != NULL)
+    return pkg_config_hash_lookup (pkg->required_index,
+                                   name,
+                                   strlen (name)) != NULL;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (pkg->required.head, node)
   {
-    unsigned int eflags_local = LIBPKG_CONFIG_ERRF_OK;
-    pkg_config_dependency_t* depnode = node->data;
-    pkg_config_pkg_t* pkgdep;
+    const pkg_config_dependency_t* dep = node->data;
 
-    if (*depnode->package == '\0')
-      continue;
+    if (strcmp (dep->package, name) == 0)
+      return true;
+  }
 
-    pkgdep =
-        pkg_config_pkg_verify_dependency (client, depnode, &eflags_local);
+  return false;
+}
 
-    eflags |= eflags_local;
-    if (eflags_local != LIBPKG_CONFIG_ERRF_OK &&
-        !(client->flags & LIBPKG_CONFIG_PKG_PKGF_SKIP_ERRORS))
-    {
-      pkg_config_pkg_report_graph_error (
-          client, parent, pkgdep, depnode, eflags_local);
-      continue;
-    }
-    if (pkgdep == NULL)
+/* Find the first conflict rule of the package that is satisfied by one of
+ * its requires. Return the conflict rule and the conflicting package
+ * (reference) or NULL if there is no conflict.
+ *
+ * Note that each conflict rule is verified at most once, regardless of how
+ * many times the package it refers to is required.
+ */
+pkg_config_dependency_t*
+pkg_config_pkg_find_conflict (pkg_config_client_t* client,
+                              const pkg_config_pkg_t* root,
+                              pkg_config_pkg_t** conflict)
+{
+  pkg_config_node_t* node;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (root->conflicts.head, node)
+  {
+    pkg_config_pkg_t* pkgdep;
+    pkg_config_dependency_t* parentnode = node->data;
+    unsigned int eflags = LIBPKG_CONFIG_ERRF_OK;
+
+    if (*parentnode->package == '\0' ||
+        !pkg_config_pkg_requires_name (root, parentnode->package))
       continue;
 
-    if (pkgdep->flags & LIBPKG_CONFIG_PKG_PROPF_SEEN)
+    pkgdep = pkg_config_pkg_verify_dependency (client, parentnode, &eflags);
+    if (eflags == LIBPKG_CONFIG_ERRF_OK)
     {
-      pkg_config_pkg_unref (client, pkgdep);
-      continue;
+      *conflict = pkgdep;
+      return parentnode;
     }
 
-    if (skip_flags && (depnode->flags & skip_flags) == skip_flags)
-    {
+    if (pkgdep != NULL)
       pkg_config_pkg_unref (client, pkgdep);
-      continue;
-    }
+  }
 
-    /*
-    pkg_config_audit_log_dependency(client, pkgdep, depnode);
-    */
+  return NULL;
+}
+
+void
+pkg_config_pkg_report_conflict (pkg_config_client_t* client,
+                                const pkg_config_pkg_t* root,
+                                const pkg_config_dependency_t* parentnode,
+                                const pkg_config_pkg_t* pkgdep)
+{
+  pkg_config_error (client,
+                    LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT,
+                    NULL, 0,
+                    "version '%s' of '%s' conflicts with '%s' due to "
+                    "conflict rule '%s %s%s%s'",
+                    pkgdep->version,
+                    pkgdep->realname,
+                    root->realname,
+                    parentnode->package,
+                    pkg_config_pkg_get_comparator (parentnode),
+                    parentnode->version != NULL ? " " : "",
+                    parentnode->version != NULL ? parentnode->version : "");
+}
+
+/* Conflict cache entry: the satisfied conflict rule and the conflicting
+ * package (reference).
+ */
+typedef struct
+{
+  pkg_config_dependency_t* rule;
+  pkg_config_pkg_t* pkg;
+} pkg_config_pkg_conflict_t;
+
+/* Check the package conflicts caching the outcome for the duration of the
+ * traversal: a package is normally visited once for each path leading to it
+ * but its conflict rules can only evaluate to the same result every time.
+ *
+ * The cache maps a package to its conflict entry or to the cache itself if
+ * there is no conflict. Only packages with conflicts are cached. Note that
+ * we keep the conflicting package reference in the entry rather than rely
+ * on the rule's match, which may not be set (see
+ * pkg_config_cache_set_match()) or may be cleared by the cache
+ * invalidation.
+ */
+static inline unsigned int
+pkg_config_pkg_walk_conflicts_list (pkg_config_client_t* client,
+                                    const pkg_config_pkg_t* root,
+                                    pkg_config_hash_t* cache)
+{
+  pkg_config_pkg_t* pkgdep;
+  pkg_config_dependency_t* parentnode;
+
+  void** v = pkg_config_hash_lookup (cache, root, 0);
+  if (v != NULL)
+  {
+    if (*v == cache)
+      return LIBPKG_CONFIG_ERRF_OK;
+
+    const pkg_config_pkg_conflict_t* c = *v;
+
+    pkg_config_pkg_report_conflict (client, root, c->rule, c->pkg);
+    return LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT;
+  }
+
+  parentnode = pkg_config_pkg_find_conflict (client, root, &pkgdep);
+
+  /* Failure to cache the outcome is not an error.
+   */
+  if (parentnode == NULL)
+  {
+    pkg_config_hash_insert (cache, root, 0, cache);
+    return LIBPKG_CONFIG_ERRF_OK;
+  }
+
+  pkg_config_pkg_report_conflict (client, root, parentnode, pkgdep);
 
-    if ((pkgdep->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0)
-      pkgdep->flags |= LIBPKG_CONFIG_PKG_PROPF_SEEN;
+  pkg_config_pkg_conflict_t* c = pkg_config_mem_alloc (
+      cache->allocator, sizeof (pkg_config_pkg_conflict_t));
 
-    eflags |= pkg_config_pkg_traverse (
-        client, pkgdep, func, data, depth - 1, skip_flags);
+  if (c != NULL)
+  {
+    c->rule = parentnode;
+    c->pkg = pkgdep;
 
-    if ((pkgdep->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0)
-      pkgdep->flags &= ~LIBPKG_CONFIG_PKG_PROPF_SEEN;
+    if (pkg_config_hash_insert (cache, root, 0, c))
+      pkgdep = NULL; /* Transfer the reference to the entry. */
+    else
+      pkg_config_mem_free (cache->allocator, c);
+  }
 
+  if (pkgdep != NULL)
     pkg_config_pkg_unref (client, pkgdep);
+
+  return LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT;
+}
+
+/* Free the conflict cache releasing the conflicting packages.
+ */
+static void
+pkg_config_pkg_conflicts_free (pkg_config_client_t* client,
+                               pkg_config_hash_t* cache)
+{
+  for (size_t i = 0; i != cache->capacity; ++i)
+  {
+    pkg_config_pkg_conflict_t* c = cache->entries[i].value;
+
+    if (cache->entries[i].key == NULL || (void*)c == cache)
+      continue;
+
+    pkg_config_pkg_unref (client, c->pkg);
+    pkg_config_mem_free (cache->allocator, c);
   }
 
-  return eflags;
+  pkg_config_hash_free (cache);
 }
 
+/* The dependency graph is traversed iteratively, with each package being
+ * visited represented by a frame on an explicit, heap-allocated stack. This
+ * keeps the machine stack usage constant regardless of the graph depth
+ * (note that resolving a dependency may itself require a considerable amount
+ * of stack, see pkg_config_pkg_try_specific_path()).
+ *
+ * The traversal order, callback invocations, and error reporting are exactly
+ * the same as of the straightforward recursive implementation, which visits
+ * a package, checks its conflicts, walks its requires list, and then,
+ * if requested, its requires.private list, recursively traversing each
+ * resolved dependency that is not already on the current path.
+ */
+typedef struct pkg_config_pkg_traverse_frame_
+{
+  pkg_config_pkg_t* pkg;
+  int depth;
+
+  bool in_private;         /* Walking the requires.private list. */
+  pkg_config_node_t* next; /* Next dependency node to walk. */
+  unsigned int eflags;     /* Errors accumulated walking the current list. */
+
+  pkg_config_pkg_t* child; /* Dependency being traversed, if any. */
+} pkg_config_pkg_traverse_frame_t;
+
+/* Number of frames preallocated on the machine stack. Deeper traversals
+ * switch to the heap.
+ */
+#define PKG_CONFIG_TRAVERSE_STACK_SIZE 16
+
+/* Visit the package: call the traversal function and check conflicts.
+ */
 static inline unsigned int
-pkg_config_pkg_walk_conflicts_list (pkg_config_client_t* client,
-                                    const pkg_config_pkg_t* root,
-                                    const pkg_config_list_t* deplist)
+pkg_config_pkg_traverse_visit (const pkg_config_traversal_t* t,
+                               pkg_config_pkg_t* pkg,
+                               pkg_config_traversal_func_t func,
+                               void* data,
+                               int depth,
+                               pkg_config_hash_t* conflicts)
+{
+  pkg_config_client_t* client = t->client;
+  unsigned int eflags = LIBPKG_CONFIG_ERRF_OK;
+
+  (void)depth; /* Unused if tracing is disabled. */
+
+  PKG_CONFIG_TRACE (client, "%s: level %d", pkg->id, depth);
+
+  if (func != NULL)
+    func (t, pkg, data);
+
+  if (!(t->flags & LIBPKG_CONFIG_PKG_PKGF_SKIP_CONFLICTS) &&
+      pkg->conflicts.head != NULL)
+    eflags =
+        pkg_config_pkg_walk_conflicts_list (client, pkg, conflicts);
+
+  if (eflags == LIBPKG_CONFIG_ERRF_OK)
+    PKG_CONFIG_TRACE (client, "%s: walking requires list", pkg->id);
+
+  return eflags;
+}
+
+static inline void
+pkg_config_pkg_traverse_frame_init (pkg_config_pkg_traverse_frame_t* frame,
+                                    pkg_config_pkg_t* pkg,
+                                    int depth)
+{
+  frame->pkg = pkg;
+  frame->depth = depth;
+  frame->in_private = false;
+  frame->next = pkg->required.head;
+  frame->eflags = LIBPKG_CONFIG_ERRF_OK;
+  frame->child = NULL;
+}
+
+/* Mark the package as being on the current path. Return false if unable to
+ * allocate memory. Note that builtin packages are never marked.
+ */
+static inline bool
+pkg_config_traversal_set_seen (pkg_config_traversal_t* t,
+                               pkg_config_pkg_t* pkg)
+{
+  return (pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) != 0 ||
+         pkg_config_hash_insert (t->seen, pkg, 0, pkg);
+}
+
+static inline void
+pkg_config_traversal_unset_seen (pkg_config_traversal_t* t,
+                                 pkg_config_pkg_t* pkg)
 {
+  if ((pkg->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0)
+    pkg_config_hash_remove (t->seen, pkg, 0);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_traversal_init(pkg_config_traversal_t *t,
+ * pkg_config_client_t *client)
+ *
+ *    Initialize the dependency graph traversal context. The traversal flags
+ *    (``SEARCH_PRIVATE``, ``ADD_PRIVATE_FRAGMENTS``, ``SKIP_CONFLICTS``,
+ *    ``SKIP_ERRORS``, ``NO_CACHE``, and ``DONT_FILTER_INTERNAL_CFLAGS``) are
+ *    copied from the client object and can be modified in the context
+ *    before the traversal without affecting the client. The rest of the
+ *    client flags (which control package loading and fragment handling)
+ *    are always taken from the client.
+ *
+ *    Unlike the client object, the context is not modified by other
+ *    traversals and so, for example, the same client can be used to walk
+ *    the graph with different flags from a traversal function.
+ *
+ *    Note, however, that a traversal still loads packages into and memoizes
+ *    results in the client object's caches, which are only guarded by a
+ *    lock during pkg_config_pkg_resolve(). As a result, concurrent
+ *    traversals still require separate client objects (see
+ *    pkg_config_client_clone()).
+ *
+ *    :param pkg_config_traversal_t* t: The traversal context to initialize.
+ *    :param pkg_config_client_t* client: The pkg-config client object to use
+ *    for dependency resolution.
+ *    :return: nothing
+ */
+void
+pkg_config_traversal_init (pkg_config_traversal_t* t,
+                           pkg_config_client_t* client)
+{
+  t->client = client;
+  t->flags = client->flags & PKG_CONFIG_TRAVERSAL_FLAGS;
+  t->in_private = false;
+  t->seen = NULL;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkg_config_traversal_walk(pkg_config_traversal_t
+ * *t, pkg_config_pkg_t *root, pkg_config_traversal_func_t func, void *data,
+ * int maxdepth, unsigned int skip_flags)
+ *
+ *    Walk and resolve the dependency graph up to `maxdepth` levels.
+ *
+ *    While walking a requires.private list, the context's `in_private` member
+ *    is true. The context's `seen` member points to the set of packages on
+ *    the current path and is only valid during the traversal.
+ *
+ *    :param pkg_config_traversal_t* t: The traversal context to use.
+ *    :param pkg_config_pkg_t* root: The root of the dependency graph.
+ *    :param pkg_config_traversal_func_t func: A traversal function to call
+ *    for each resolved node in the dependency graph.
+ *    :param void* data: An opaque pointer to data to be passed to the
+ *    traversal function.
+ *    :param int maxdepth: The maximum depth to walk the dependency graph
+ *    for. -1 means infinite recursion.
+ *    :param uint skip_flags: Skip over dependency nodes containing the
+ *    specified flags. A setting of 0 skips no dependency nodes.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` on success, else an error code.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_traversal_walk (pkg_config_traversal_t* t,
+                           pkg_config_pkg_t* root,
+                           pkg_config_traversal_func_t func,
+                           void* data,
+                           int maxdepth,
+                           unsigned int skip_flags)
+{
+  pkg_config_client_t* client = t->client;
   unsigned int eflags;
-  pkg_config_node_t *node, *childnode;
 
-  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (deplist->head, node)
+  if (maxdepth == 0)
+    return LIBPKG_CONFIG_ERRF_OK;
+
+  /* Number of packages visited (see pkg_config_client_stats_t).
+   */
+  size_t visited = 1;
+  PKG_CONFIG_STATS_INC (client, traversals);
+
+  PKG_CONFIG_SPAN_BEGIN (client, TRAVERSE, root->id);
+
+  /* Note that the traversal state is allocated with the client allocator
+   * as it was at the start of the traversal.
+   */
+  const pkg_config_allocator_t* a = client->allocator;
+
+  pkg_config_hash_t conflicts = PKG_CONFIG_HASH_INITIALIZER;
+  pkg_config_hash_t seen = PKG_CONFIG_HASH_INITIALIZER;
+
+  conflicts.allocator = a;
+  seen.allocator = a;
+
+  /* Note that the traversal may be nested (for example, started from a
+   * traversal function) with the same context.
+   */
+  struct pkg_config_hash_* outer_seen = t->seen;
+  bool outer_private = t->in_private;
+
+  t->seen = &seen;
+
+  eflags = pkg_config_pkg_traverse_visit (
+      t, root, func, data, maxdepth, &conflicts);
+  if (eflags != LIBPKG_CONFIG_ERRF_OK)
   {
-    pkg_config_dependency_t* parentnode = node->data;
+    PKG_CONFIG_STATS_INC (client, nodes_visited);
+    PKG_CONFIG_STATS_MAX (client, max_traversal_nodes, visited);
 
-    if (*parentnode->package == '\0')
-      continue;
+    PKG_CONFIG_SPAN_END (client, TRAVERSE, root->id);
+
+    pkg_config_pkg_conflicts_free (client, &conflicts);
+    t->seen = outer_seen;
+    return eflags;
+  }
+
+  pkg_config_pkg_traverse_frame_t buf[PKG_CONFIG_TRAVERSE_STACK_SIZE];
+  pkg_config_pkg_traverse_frame_t* stack = buf;
+  size_t capacity = PKG_CONFIG_ARRAY_SIZE (buf);
+  size_t n = 0;
+
+  pkg_config_pkg_traverse_frame_init (&stack[n++], root, maxdepth);
+
+  while (n != 0)
+  {
+    pkg_config_pkg_traverse_frame_t* frame = &stack[n - 1];
+    pkg_config_node_t* node = frame->next;
 
-    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (root->required.head, childnode)
+    /* Walk the next dependency of the current list.
+     */
+    if (node != NULL)
     {
+      unsigned int eflags_local = LIBPKG_CONFIG_ERRF_OK;
+      pkg_config_dependency_t* depnode = node->data;
       pkg_config_pkg_t* pkgdep;
-      pkg_config_dependency_t* depnode = childnode->data;
 
-      if (*depnode->package == '\0' ||
-          strcmp (depnode->package, parentnode->package))
+      frame->next = node->next;
+
+      if (*depnode->package == '\0')
         continue;
 
-      pkgdep = pkg_config_pkg_verify_dependency (client, parentnode, &eflags);
-      if (eflags == LIBPKG_CONFIG_ERRF_OK)
+      pkgdep =
+          pkg_config_pkg_verify_dependency (client, depnode, &eflags_local);
+
+      frame->eflags |= eflags_local;
+      if (eflags_local != LIBPKG_CONFIG_ERRF_OK &&
+          !(t->flags & LIBPKG_CONFIG_PKG_PKGF_SKIP_ERRORS))
       {
-        pkg_config_error (client,
-                          LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT,
-                          NULL, 0,
-                          "version '%s' of '%s' conflicts with '%s' due to "
-                          "conflict rule '%s %s%s%s'",
-                          pkgdep->version,
-                          pkgdep->realname,
-                          root->realname,
-                          parentnode->package,
-                          pkg_config_pkg_get_comparator (parentnode),
-                          parentnode->version != NULL ? " " : "",
-                          parentnode->version != NULL ? parentnode->version
-                                                      : "");
+        pkg_config_pkg_report_graph_error (
+            client, frame->pkg, pkgdep, depnode, eflags_local);
+        continue;
+      }
+      if (pkgdep == NULL)
+        continue;
 
+      if (pkg_config_hash_lookup (&seen, pkgdep, 0) != NULL ||
+          (skip_flags && (depnode->flags & skip_flags) == skip_flags))
+      {
         pkg_config_pkg_unref (client, pkgdep);
+        continue;
+      }
 
-        return LIBPKG_CONFIG_ERRF_PACKAGE_CONFLICT;
+      /* Reaching the maximum depth is equivalent to traversing nothing.
+       */
+      int depth = frame->depth - 1;
+      if (depth == 0)
+      {
+        pkg_config_pkg_unref (client, pkgdep);
+        continue;
       }
 
-      pkg_config_pkg_unref (client, pkgdep);
+      bool oom = !pkg_config_traversal_set_seen (t, pkgdep);
+
+      if (!oom)
+      {
+        visited++;
+        eflags_local = pkg_config_pkg_traverse_visit (
+            t, pkgdep, func, data, depth, &conflicts);
+        if (eflags_local != LIBPKG_CONFIG_ERRF_OK)
+        {
+          frame->eflags |= eflags_local;
+          pkg_config_traversal_unset_seen (t, pkgdep);
+          pkg_config_pkg_unref (client, pkgdep);
+          continue;
+        }
+      }
+
+      if (!oom && n == capacity)
+      {
+        size_t c = capacity * 2;
+        pkg_config_pkg_traverse_frame_t* s =
+            stack != buf ? pkg_config_mem_realloc (a, stack, c * sizeof (*s))
+                         : pkg_config_mem_alloc (a, c * sizeof (*s));
+
+        if (s != NULL)
+        {
+          if (stack == buf)
+            memcpy (s, buf, sizeof (buf));
+
+          stack = s;
+          capacity = c;
+          frame = &stack[n - 1];
+        }
+        else
+          oom = true;
+      }
+
+      if (oom)
+      {
+        pkg_config_traversal_unset_seen (t, pkgdep);
+        pkg_config_pkg_unref (client, pkgdep);
+
+        /* Unwind the stack, releasing the packages being traversed.
+         */
+        for (; n != 0; --n)
+        {
+          frame = &stack[n - 1];
+
+          if (frame->child != NULL)
+            pkg_config_pkg_unref (client, frame->child);
+        }
+
+        eflags = LIBPKG_CONFIG_ERRF_MEMORY;
+        break;
+      }
+
+      frame->child = pkgdep;
+      pkg_config_pkg_traverse_frame_init (&stack[n++], pkgdep, depth);
+      continue;
+    }
+
+    /* The current list is exhausted. Unless there were errors, proceed with
+     * requires.private, if requested.
+     *
+     * Note that, as historically, the private marker is reset when any
+     * requires.private list is exhausted, even if walking an outer one.
+     */
+    if (!frame->in_private)
+    {
+      if (frame->eflags == LIBPKG_CONFIG_ERRF_OK &&
+          (t->flags & LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE))
+      {
+        PKG_CONFIG_TRACE (
+            client, "%s: walking requires.private list", frame->pkg->id);
+
+        t->in_private = true;
+
+        frame->in_private = true;
+        frame->next = frame->pkg->requires_private.head;
+        continue;
+      }
+    }
+    else
+      t->in_private = false;
+
+    /* Done with this package: pop the frame and return to the parent.
+     */
+    eflags = frame->eflags;
+
+    if (--n != 0)
+    {
+      frame = &stack[n - 1];
+      frame->eflags |= eflags;
+
+      pkg_config_traversal_unset_seen (t, frame->child);
+      pkg_config_pkg_unref (client, frame->child);
+      frame->child = NULL;
     }
   }
 
-  return LIBPKG_CONFIG_ERRF_OK;
+  if (stack != buf)
+    pkg_config_mem_free (a, stack);
+
+  pkg_config_hash_free (&seen);
+  pkg_config_pkg_conflicts_free (client, &conflicts);
+
+  PKG_CONFIG_STATS_ADD (client, nodes_visited, visited);
+  PKG_CONFIG_STATS_MAX (client, max_traversal_nodes, visited);
+#ifdef LIBPKG_CONFIG_NSTATS
+  (void) visited;
+#endif
+
+  PKG_CONFIG_SPAN_END (client, TRAVERSE, root->id);
+
+  t->seen = outer_seen;
+  t->in_private = outer_private;
+
+  return eflags;
+}
+
+/* Adapter for the client-based traversal functions.
+ */
+typedef struct
+{
+  pkg_config_pkg_traverse_func_t func;
+  void* data;
+} pkg_config_pkg_traverse_adapter_t;
+
+static void
+pkg_config_pkg_traverse_adapt (const pkg_config_traversal_t* t,
+                               pkg_config_pkg_t* pkg,
+                               void* data)
+{
+  const pkg_config_pkg_traverse_adapter_t* a = data;
+  a->func (t->client, pkg, a->data);
 }
 
 /*
@@ -1492,7 +2763,15 @@ pkg_config_pkg_walk_conflicts_list (pkg_config_client_t* client,
  * *client, pkg_config_pkg_t *root, pkg_config_pkg_traverse_func_t func, void
  * *data, int maxdepth, unsigned int skip_flags)
  *
- *    Walk and resolve the dependency graph up to `maxdepth` levels.
+ *    Walk and resolve the dependency graph up to `maxdepth` levels using a
+ *    traversal context initialized from the client object (see
+ *    pkg_config_traversal_walk() for details).
+ *
+ *    Note that the client object is not modified by the traversal and, in
+ *    particular, the deprecated ``LIBPKG_CONFIG_PKG_PKGF_ITER_PKG_IS_PRIVATE``
+ *    client flag is no longer set while walking a requires.private list. Use
+ *    pkg_config_traversal_walk(), which passes this information in the
+ *    traversal context, instead.
  *
  *    :param pkg_config_client_t* client: The pkg-config client object to use
  * for dependency resolution. :param pkg_config_pkg_t* root: The root of the
@@ -1513,54 +2792,21 @@ pkg_config_pkg_traverse (pkg_config_client_t* client,
                          int maxdepth,
                          unsigned int skip_flags)
 {
-  unsigned int eflags = LIBPKG_CONFIG_ERRF_OK;
+  pkg_config_traversal_t t;
+  pkg_config_traversal_init (&t, client);
 
-  if (maxdepth == 0)
-    return eflags;
+  if (func == NULL)
+    return pkg_config_traversal_walk (
+        &t, root, NULL, NULL, maxdepth, skip_flags);
 
-  PKG_CONFIG_TRACE (client, "%s: level %d", root->id, maxdepth);
-
-  if (func != NULL)
-    func (client, root, data);
+  pkg_config_pkg_traverse_adapter_t a = {func, data};
 
-  if (!(client->flags & LIBPKG_CONFIG_PKG_PKGF_SKIP_CONFLICTS))
-  {
-    eflags =
-        pkg_config_pkg_walk_conflicts_list (client, root, &root->conflicts);
-    if (eflags != LIBPKG_CONFIG_ERRF_OK)
-      return eflags;
-  }
-
-  PKG_CONFIG_TRACE (client, "%s: walking requires list", root->id);
-  eflags = pkg_config_pkg_walk_list (
-      client, root, &root->required, func, data, maxdepth, skip_flags);
-  if (eflags != LIBPKG_CONFIG_ERRF_OK)
-    return eflags;
-
-  if (client->flags & LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE)
-  {
-    PKG_CONFIG_TRACE (client, "%s: walking requires.private list", root->id);
-
-    /* XXX: ugly */
-    client->flags |= LIBPKG_CONFIG_PKG_PKGF_ITER_PKG_IS_PRIVATE;
-    eflags = pkg_config_pkg_walk_list (client,
-                                       root,
-                                       &root->requires_private,
-                                       func,
-                                       data,
-                                       maxdepth,
-                                       skip_flags);
-    client->flags &= ~LIBPKG_CONFIG_PKG_PKGF_ITER_PKG_IS_PRIVATE;
-
-    if (eflags != LIBPKG_CONFIG_ERRF_OK)
-      return eflags;
-  }
-
-  return eflags;
+  return pkg_config_traversal_walk (
+      &t, root, pkg_config_pkg_traverse_adapt, &a, maxdepth, skip_flags);
 }
 
-static void
-pkg_config_pkg_cflags_collect (pkg_config_client_t* client,
+void
+pkg_config_pkg_cflags_collect (const pkg_config_traversal_t* t,
                                pkg_config_pkg_t* pkg,
                                void* data)
 {
@@ -1570,12 +2816,12 @@ pkg_config_pkg_cflags_collect (pkg_config_client_t* client,
   LIBPKG_CONFIG_FOREACH_LIST_ENTRY (pkg->cflags.head, node)
   {
     pkg_config_fragment_t* frag = node->data;
-    pkg_config_fragment_copy (client, list, frag, false);
+    pkg_config_fragment_copy (t->client, list, frag, false);
   }
 }
 
-static void
-pkg_config_pkg_cflags_private_collect (pkg_config_client_t* client,
+void
+pkg_config_pkg_cflags_private_collect (const pkg_config_traversal_t* t,
                                        pkg_config_pkg_t* pkg,
                                        void* data)
 {
@@ -1585,71 +2831,115 @@ pkg_config_pkg_cflags_private_collect (pkg_config_client_t* client,
   LIBPKG_CONFIG_FOREACH_LIST_ENTRY (pkg->cflags_private.head, node)
   {
     pkg_config_fragment_t* frag = node->data;
-    pkg_config_fragment_copy (client, list, frag, true);
+    pkg_config_fragment_copy (t->client, list, frag, true);
   }
 }
 
 /*
  * !doc
  *
- * .. c:function:: int pkg_config_pkg_cflags(pkg_config_client_t *client,
+ * .. c:function:: int pkg_config_traversal_cflags(pkg_config_traversal_t *t,
  * pkg_config_pkg_t *root, pkg_config_list_t *list, int maxdepth)
  *
- *    Walks a dependency graph and extracts relevant ``CFLAGS`` fragments.
+ *    Walks a dependency graph and extracts relevant ``CFLAGS`` fragments
+ *    using the traversal context flags.
  *
- *    :param pkg_config_client_t* client: The pkg-config client object to use
- * for dependency resolution. :param pkg_config_pkg_t* root: The root of the
- * dependency graph. :param pkg_config_list_t* list: The fragment list to add
- * the extracted ``CFLAGS`` fragments to. :param int maxdepth: The maximum
- * allowed depth for dependency resolution.  -1 means infinite recursion.
- * :return:
- * ``LIBPKG_CONFIG_ERRF_OK`` if successful, otherwise an error code.
+ *    :param pkg_config_traversal_t* t: The traversal context to use.
+ *    :param pkg_config_pkg_t* root: The root of the dependency graph.
+ *    :param pkg_config_list_t* list: The fragment list to add the extracted
+ *    ``CFLAGS`` fragments to.
+ *    :param int maxdepth: The maximum allowed depth for dependency
+ *    resolution. -1 means infinite recursion.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` if successful, otherwise an error
+ *    code.
  *    :rtype: unsigned int
  */
 unsigned int
-pkg_config_pkg_cflags (pkg_config_client_t* client,
-                       pkg_config_pkg_t* root,
-                       pkg_config_list_t* list,
-                       int maxdepth)
+pkg_config_traversal_cflags (pkg_config_traversal_t* t,
+                             pkg_config_pkg_t* root,
+                             pkg_config_list_t* list,
+                             int maxdepth)
 {
+  pkg_config_client_t* client = t->client;
   unsigned int eflag;
+  unsigned int flags = pkg_config_traversal_result_flags (t);
   unsigned int skip_flags =
-      (client->flags & LIBPKG_CONFIG_PKG_PKGF_DONT_FILTER_INTERNAL_CFLAGS) ==
-              0
+      (t->flags & LIBPKG_CONFIG_PKG_PKGF_DONT_FILTER_INTERNAL_CFLAGS) == 0
           ? LIBPKG_CONFIG_PKG_DEPF_INTERNAL
           : 0;
   pkg_config_list_t frags = LIBPKG_CONFIG_LIST_INITIALIZER;
 
-  eflag = pkg_config_pkg_traverse (client,
-                                   root,
-                                   pkg_config_pkg_cflags_collect,
-                                   &frags,
-                                   maxdepth,
-                                   skip_flags);
+  const pkg_config_list_t* cached = pkg_config_cache_result_lookup (
+      client, root, PKG_CONFIG_CACHE_RESULT_CFLAGS, flags, maxdepth);
 
-  if (eflag == LIBPKG_CONFIG_ERRF_OK &&
-      client->flags & LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS)
-    eflag = pkg_config_pkg_traverse (client,
+  if (cached != NULL)
+  {
+    pkg_config_fragment_copy_list (client, list, cached);
+    return LIBPKG_CONFIG_ERRF_OK;
+  }
+
+  eflag = pkg_config_traversal_walk (t,
                                      root,
-                                     pkg_config_pkg_cflags_private_collect,
+                                     pkg_config_pkg_cflags_collect,
                                      &frags,
                                      maxdepth,
                                      skip_flags);
 
+  if (eflag == LIBPKG_CONFIG_ERRF_OK &&
+      t->flags & LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS)
+    eflag = pkg_config_traversal_walk (t,
+                                       root,
+                                       pkg_config_pkg_cflags_private_collect,
+                                       &frags,
+                                       maxdepth,
+                                       skip_flags);
+
   if (eflag != LIBPKG_CONFIG_ERRF_OK)
   {
     pkg_config_fragment_free (&frags);
     return eflag;
   }
 
+  pkg_config_cache_result_add (
+      client, root, PKG_CONFIG_CACHE_RESULT_CFLAGS, flags, maxdepth, &frags);
+
   pkg_config_fragment_copy_list (client, list, &frags);
   pkg_config_fragment_free (&frags);
 
   return eflag;
 }
 
-static void
-pkg_config_pkg_libs_collect (pkg_config_client_t* client,
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_pkg_cflags(pkg_config_client_t *client,
+ * pkg_config_pkg_t *root, pkg_config_list_t *list, int maxdepth)
+ *
+ *    Walks a dependency graph and extracts relevant ``CFLAGS`` fragments.
+ *
+ *    :param pkg_config_client_t* client: The pkg-config client object to use
+ * for dependency resolution. :param pkg_config_pkg_t* root: The root of the
+ * dependency graph. :param pkg_config_list_t* list: The fragment list to add
+ * the extracted ``CFLAGS`` fragments to. :param int maxdepth: The maximum
+ * allowed depth for dependency resolution.  -1 means infinite recursion.
+ * :return:
+ * ``LIBPKG_CONFIG_ERRF_OK`` if successful, otherwise an error code.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_pkg_cflags (pkg_config_client_t* client,
+                       pkg_config_pkg_t* root,
+                       pkg_config_list_t* list,
+                       int maxdepth)
+{
+  pkg_config_traversal_t t;
+  pkg_config_traversal_init (&t, client);
+
+  return pkg_config_traversal_cflags (&t, root, list, maxdepth);
+}
+
+void
+pkg_config_pkg_libs_collect (const pkg_config_traversal_t* t,
                              pkg_config_pkg_t* pkg,
                              void* data)
 {
@@ -1659,23 +2949,82 @@ pkg_config_pkg_libs_collect (pkg_config_client_t* client,
   LIBPKG_CONFIG_FOREACH_LIST_ENTRY (pkg->libs.head, node)
   {
     pkg_config_fragment_t* frag = node->data;
-    pkg_config_fragment_copy (
-        client,
-        list,
-        frag,
-        (client->flags & LIBPKG_CONFIG_PKG_PKGF_ITER_PKG_IS_PRIVATE) != 0);
+    pkg_config_fragment_copy (t->client, list, frag, t->in_private);
   }
 
-  if (client->flags & LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS)
+  if (t->flags & LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS)
   {
     LIBPKG_CONFIG_FOREACH_LIST_ENTRY (pkg->libs_private.head, node)
     {
       pkg_config_fragment_t* frag = node->data;
-      pkg_config_fragment_copy (client, list, frag, true);
+      pkg_config_fragment_copy (t->client, list, frag, true);
     }
   }
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_traversal_libs(pkg_config_traversal_t *t,
+ * pkg_config_pkg_t *root, pkg_config_list_t *list, int maxdepth)
+ *
+ *    Walks a dependency graph and extracts relevant ``LIBS`` fragments
+ *    using the traversal context flags.
+ *
+ *    :param pkg_config_traversal_t* t: The traversal context to use.
+ *    :param pkg_config_pkg_t* root: The root of the dependency graph.
+ *    :param pkg_config_list_t* list: The fragment list to add the extracted
+ *    ``LIBS`` fragments to.
+ *    :param int maxdepth: The maximum allowed depth for dependency
+ *    resolution. -1 means infinite recursion.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` if successful, otherwise an error
+ *    code.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_traversal_libs (pkg_config_traversal_t* t,
+                           pkg_config_pkg_t* root,
+                           pkg_config_list_t* list,
+                           int maxdepth)
+{
+  pkg_config_client_t* client = t->client;
+  unsigned int eflag;
+  unsigned int flags = pkg_config_traversal_result_flags (t);
+
+  /* Since the libs fragments are collected directly into the passed list,
+   * merging with its existing fragments, we only memoize the result if the
+   * list is initially empty (which is the common case).
+   */
+  bool memoize = (list->head == NULL);
+
+  if (memoize)
+  {
+    const pkg_config_list_t* cached = pkg_config_cache_result_lookup (
+        client, root, PKG_CONFIG_CACHE_RESULT_LIBS, flags, maxdepth);
+
+    if (cached != NULL)
+    {
+      pkg_config_fragment_copy_list (client, list, cached);
+      return LIBPKG_CONFIG_ERRF_OK;
+    }
+  }
+
+  eflag = pkg_config_traversal_walk (
+      t, root, pkg_config_pkg_libs_collect, list, maxdepth, 0);
+
+  if (eflag != LIBPKG_CONFIG_ERRF_OK)
+  {
+    pkg_config_fragment_free (list);
+    return eflag;
+  }
+
+  if (memoize)
+    pkg_config_cache_result_add (
+        client, root, PKG_CONFIG_CACHE_RESULT_LIBS, flags, maxdepth, list);
+
+  return eflag;
+}
+
 /*
  * !doc
  *
@@ -1699,16 +3048,8 @@ pkg_config_pkg_libs (pkg_config_client_t* client,
                      pkg_config_list_t* list,
                      int maxdepth)
 {
-  unsigned int eflag;
+  pkg_config_traversal_t t;
+  pkg_config_traversal_init (&t, client);
 
-  eflag = pkg_config_pkg_traverse (
-      client, root, pkg_config_pkg_libs_collect, list, maxdepth, 0);
-
-  if (eflag != LIBPKG_CONFIG_ERRF_OK)
-  {
-    pkg_config_fragment_free (list);
-    return eflag;
-  }
-
-  return eflag;
+  return pkg_config_traversal_libs (&t, root, list, maxdepth);
 }
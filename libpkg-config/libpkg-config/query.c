@@ -0,0 +1,392 @@
+/*
+ * query.c
+ * query server client
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/query.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/un.h>
+#  include <sys/socket.h>
+#endif
+
+/*
+ * !doc
+ *
+ * libpkg-config `query` module
+ * ============================
+ *
+ * The libpkg-config `query` module is the client side of the `server`
+ * module protocol (see server.c for details). It doesn't depend on the rest
+ * of the library. It is currently only supported on POSIX systems.
+ */
+
+#ifndef _WIN32
+
+struct pkg_config_query_
+{
+  int in;
+  int out;
+
+  char* buf;   /* Reply buffer. */
+  size_t size; /* Buffered bytes. */
+  size_t cap;
+};
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_query_t* pkg_config_query_open(int in, int out)
+ *
+ *    Allocate a query object that writes requests to the output file
+ *    descriptor and reads replies from the input file descriptor (which can
+ *    be the same). Normally, these are the pipes to the server's standard
+ *    input and output (the coprocess mode). The query object takes
+ *    ownership of the file descriptors.
+ *
+ *    :param int in: The file descriptor to read replies from.
+ *    :param int out: The file descriptor to write requests to.
+ *    :return: A query object or NULL if unable to allocate memory.
+ *    :rtype: pkg_config_query_t*
+ */
+pkg_config_query_t*
+pkg_config_query_open (int in, int out)
+{
+  pkg_config_query_t* q = calloc (1, sizeof (pkg_config_query_t));
+
+  if (q == NULL)
+  {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  q->in = in;
+  q->out = out;
+  return q;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_query_t* pkg_config_query_connect(const char
+ * *path)
+ *
+ *    Connect to the server listening on the Unix domain socket.
+ *
+ *    :param const char* path: The socket path.
+ *    :return: A query object or NULL on failure, in which case `errno` is
+ *    set (to ``ENOSYS`` if not supported on this platform).
+ *    :rtype: pkg_config_query_t*
+ */
+pkg_config_query_t*
+pkg_config_query_connect (const char* path)
+{
+  struct sockaddr_un a;
+  size_t n = strlen (path);
+
+  if (n >= sizeof (a.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
+  memset (&a, 0, sizeof (a));
+  a.sun_family = AF_UNIX;
+  memcpy (a.sun_path, path, n + 1);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd == -1)
+    return NULL;
+
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+  pkg_config_query_t* q;
+
+  if (connect (fd, (const struct sockaddr*)&a, sizeof (a)) == -1 ||
+      (q = pkg_config_query_open (fd, fd)) == NULL)
+  {
+    int e = errno;
+    close (fd);
+    errno = e;
+    return NULL;
+  }
+
+  return q;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_query_close(pkg_config_query_t *query)
+ *
+ *    Close the file descriptors and free the query object.
+ *
+ *    :param pkg_config_query_t* query: The query object to free.
+ *    :return: nothing
+ */
+void
+pkg_config_query_close (pkg_config_query_t* q)
+{
+  if (q == NULL)
+    return;
+
+  close (q->in);
+
+  if (q->out != q->in)
+    close (q->out);
+
+  free (q->buf);
+  free (q);
+}
+
+static bool
+query_write (int fd, const char* b, size_t n)
+{
+  while (n != 0)
+  {
+    ssize_t k = write (fd, b, n);
+
+    if (k == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    b += k;
+    n -= (size_t)k;
+  }
+
+  return true;
+}
+
+/* Read the reply line into the buffer, returning its length (excluding the
+ * newline) or -1 on failure.
+ */
+static ssize_t
+query_read (pkg_config_query_t* q)
+{
+  for (size_t i = 0;; )
+  {
+    char* e = (q->size != 0 ? memchr (q->buf + i, '\n', q->size - i) : NULL);
+
+    if (e != NULL)
+      return e - q->buf;
+
+    i = q->size;
+
+    if (q->size == q->cap)
+    {
+      size_t c = (q->cap != 0 ? q->cap * 2 : 4096);
+      char* b = realloc (q->buf, c);
+
+      if (b == NULL)
+      {
+        errno = ENOMEM;
+        return -1;
+      }
+
+      q->buf = b;
+      q->cap = c;
+    }
+
+    ssize_t k = read (q->in, q->buf + q->size, q->cap - q->size);
+
+    if (k == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return -1;
+    }
+
+    if (k == 0)
+    {
+      errno = EPIPE; /* Server closed the connection. */
+      return -1;
+    }
+
+    q->size += (size_t)k;
+  }
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_query_request(pkg_config_query_t *query,
+ * const char *command, const char *arg, char **reply)
+ *
+ *    Send the request and wait for the reply.
+ *
+ *    :param pkg_config_query_t* query: The query object to use.
+ *    :param const char* command: The request command (for example,
+ *    ``libs``).
+ *    :param const char* arg: The request argument or NULL if none.
+ *    :param char** reply: If not NULL, then on success set to the reply
+ *    value (the result or the diagnostics, possibly empty) that should be
+ *    freed by the caller.
+ *    :return: ``LIBPKG_CONFIG_QUERY_OK`` if the server replied with ``ok``,
+ *    ``LIBPKG_CONFIG_QUERY_ERROR`` if it replied with ``error``, or
+ *    ``LIBPKG_CONFIG_QUERY_FAILED`` on failure, in which case `errno` is set
+ *    (to ``EINVAL`` if the command or argument contain a newline or the
+ *    reply is malformed).
+ *    :rtype: int
+ */
+int
+pkg_config_query_request (pkg_config_query_t* q,
+                          const char* command,
+                          const char* arg,
+                          char** reply)
+{
+  size_t cn = strlen (command);
+  size_t an = (arg != NULL ? strlen (arg) : 0);
+
+  if (memchr (command, '\n', cn) != NULL ||
+      (arg != NULL && memchr (arg, '\n', an) != NULL))
+  {
+    errno = EINVAL;
+    return LIBPKG_CONFIG_QUERY_FAILED;
+  }
+
+  char* b = malloc (cn + an + 2);
+
+  if (b == NULL)
+  {
+    errno = ENOMEM;
+    return LIBPKG_CONFIG_QUERY_FAILED;
+  }
+
+  memcpy (b, command, cn);
+
+  size_t n = cn;
+
+  if (arg != NULL)
+  {
+    b[n++] = ' ';
+    memcpy (b + n, arg, an);
+    n += an;
+  }
+
+  b[n++] = '\n';
+
+  bool w = query_write (q->out, b, n);
+  free (b);
+
+  if (!w)
+    return LIBPKG_CONFIG_QUERY_FAILED;
+
+  ssize_t ln = query_read (q);
+
+  if (ln == -1)
+    return LIBPKG_CONFIG_QUERY_FAILED;
+
+  /* Parse the reply line and consume it.
+   */
+  size_t l = (size_t)ln;
+  char* s = q->buf;
+  int r;
+  size_t p;
+
+  if (l >= 2 && strncmp (s, "ok", 2) == 0 && (l == 2 || s[2] == ' '))
+  {
+    r = LIBPKG_CONFIG_QUERY_OK;
+    p = (l == 2 ? 2 : 3);
+  }
+  else if (l >= 6 && strncmp (s, "error ", 6) == 0)
+  {
+    r = LIBPKG_CONFIG_QUERY_ERROR;
+    p = 6;
+  }
+  else
+    r = LIBPKG_CONFIG_QUERY_FAILED;
+
+  if (r != LIBPKG_CONFIG_QUERY_FAILED && reply != NULL)
+  {
+    if ((*reply = malloc (l - p + 1)) != NULL)
+    {
+      memcpy (*reply, s + p, l - p);
+      (*reply)[l - p] = '\0';
+    }
+    else
+    {
+      errno = ENOMEM;
+      r = LIBPKG_CONFIG_QUERY_FAILED;
+    }
+  }
+  else if (r == LIBPKG_CONFIG_QUERY_FAILED)
+    errno = EINVAL;
+
+  q->size -= l + 1;
+  memmove (q->buf, q->buf + l + 1, q->size);
+
+  return r;
+}
+
+#else /* _WIN32 */
+
+pkg_config_query_t*
+pkg_config_query_connect (const char* path)
+{
+  (void)path;
+
+  errno = ENOSYS;
+  return NULL;
+}
+
+pkg_config_query_t*
+pkg_config_query_open (int in, int out)
+{
+  (void)in;
+  (void)out;
+
+  errno = ENOSYS;
+  return NULL;
+}
+
+int
+pkg_config_query_request (pkg_config_query_t* q,
+                          const char* command,
+                          const char* arg,
+                          char** reply)
+{
+  (void)q;
+  (void)command;
+  (void)arg;
+  (void)reply;
+
+  errno = ENOSYS;
+  return LIBPKG_CONFIG_QUERY_FAILED;
+}
+
+void
+pkg_config_query_close (pkg_config_query_t* q)
+{
+  (void)q;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,59 @@
+/*
+ * query.h
+ * Client for the libpkg-config query server.
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LIBPKG_CONFIG_QUERY_H
+#define LIBPKG_CONFIG_QUERY_H
+
+/* Note that this header (as well as query.c) doesn't depend on the rest of
+ * the library and so can be used by thin clients (such as compiler
+ * wrappers) that only talk to the server (see server.c for the protocol).
+ */
+#include <libpkg-config/export.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct pkg_config_query_ pkg_config_query_t;
+
+/* pkg_config_query_request() results. */
+#define LIBPKG_CONFIG_QUERY_OK     0  /* ok reply, result returned. */
+#define LIBPKG_CONFIG_QUERY_ERROR  1  /* error reply, diagnostics returned. */
+#define LIBPKG_CONFIG_QUERY_FAILED -1 /* Communication failure, errno set. */
+
+LIBPKG_CONFIG_SYMEXPORT pkg_config_query_t*
+pkg_config_query_connect (const char* path);
+LIBPKG_CONFIG_SYMEXPORT pkg_config_query_t*
+pkg_config_query_open (int in, int out);
+LIBPKG_CONFIG_SYMEXPORT int
+pkg_config_query_request (pkg_config_query_t* query,
+                          const char* command,
+                          const char* arg,
+                          char** reply);
+LIBPKG_CONFIG_SYMEXPORT void
+pkg_config_query_close (pkg_config_query_t* query);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBPKG_CONFIG_QUERY_H */
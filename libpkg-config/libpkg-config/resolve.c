@@ -0,0 +1,723 @@
+/*
+ * resolve.c
+ * parallel dependency resolution
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+/*
+ * !doc
+ *
+ * libpkg-config `resolve` module
+ * ==============================
+ *
+ * The `resolve` module warms up the client's package cache for a root
+ * package by finding, parsing, and verifying the dependencies of independent
+ * subtrees concurrently. Each package to expand is a task that is scheduled
+ * on a pool of worker threads, each with its own task queue: a worker takes
+ * the most recently queued task from its own queue and, if empty, steals the
+ * oldest task from the other queues.
+ *
+ * The resolution has no effect on the result of the subsequent traversals
+ * (for example, pkg_config_pkg_cflags() or pkg_config_pkg_libs()) other than
+ * that they find the packages already loaded and the dependencies already
+ * verified. In particular, the resolution itself does not report any errors:
+ * a package that fails to load (or that loads with diagnostics) is not
+ * cached and a dependency that fails to verify is not matched so that the
+ * traversal encounters and reports them as usual, in its deterministic
+ * order.
+ *
+ * While the resolution is in progress, the package cache and the dependency
+ * matches are guarded by a client-wide lock and the calls to the diagnostics
+ * handlers are serialized (see pkg_config_client_t::resolver). The package
+ * reference counts are atomic but releasing what may be the last reference
+ * (which frees the package and updates the cache) still requires the lock.
+ */
+
+typedef struct
+{
+  pkg_config_pkg_t* pkg; /* Reference. */
+  int depth;
+} pkg_config_resolve_task_t;
+
+typedef struct pkg_config_resolve_pool_ pkg_config_resolve_pool_t;
+
+/* Worker with its double-ended task queue (circular buffer). The owner
+ * pushes and pops at the tail while thieves take from the head.
+ */
+typedef struct
+{
+  pkg_config_resolve_pool_t* pool;
+  size_t index;
+
+  pkg_config_mutex_t lock;
+  pkg_config_resolve_task_t* tasks;
+  size_t capacity; /* 0 or power of 2. */
+  size_t head;
+  size_t count;
+
+  pkg_config_thread_t thread;
+
+  /* Batch loader of the worker's quiet client copies (see
+   * resolve_prefetch()) or NULL.
+   */
+  struct pkg_config_loader_* loader;
+} pkg_config_resolve_worker_t;
+
+struct pkg_config_resolve_pool_
+{
+  pkg_config_resolver_t resolver;
+  pkg_config_client_t* client;
+
+  /* Packages that have been queued for expansion (guarded by the cache
+   * lock).
+   */
+  pkg_config_hash_t queued;
+
+  pkg_config_resolve_worker_t* workers;
+  size_t workers_count;
+
+  /* Number of tasks in the queues and number of tasks not yet completed
+   * (including those in the queues).
+   */
+  pkg_config_mutex_t lock;
+  pkg_config_cond_t cond;
+  size_t available;
+  size_t pending;
+};
+
+#define PKG_CONFIG_RESOLVE_MIN_CAPACITY 16
+
+/* Maximum number of threads, including the calling thread.
+ */
+#define PKG_CONFIG_RESOLVE_MAX_THREADS 64
+
+/* Release a package reference. Only take the lock if this may be the last
+ * reference (freeing the package updates the cache).
+ */
+static inline void
+resolve_unref (pkg_config_client_t* client, pkg_config_pkg_t* pkg)
+{
+  if (!pkg_config_pkg_unref_shared (pkg))
+  {
+    pkg_config_cache_lock (client);
+    pkg_config_pkg_unref (client, pkg);
+    pkg_config_cache_unlock (client);
+  }
+}
+
+static void
+resolve_push (pkg_config_resolve_worker_t* w, pkg_config_pkg_t* pkg, int depth)
+{
+  pkg_config_resolve_pool_t* pool = w->pool;
+  bool r = true;
+
+  pkg_config_mutex_lock (&w->lock);
+
+  if (w->count == w->capacity)
+  {
+    size_t c = w->capacity != 0 ? w->capacity * 2
+                                : PKG_CONFIG_RESOLVE_MIN_CAPACITY;
+    pkg_config_resolve_task_t* ts =
+        malloc (c * sizeof (pkg_config_resolve_task_t));
+
+    if (ts != NULL)
+    {
+      for (size_t i = 0; i != w->count; ++i)
+        ts[i] = w->tasks[(w->head + i) & (w->capacity - 1)];
+
+      free (w->tasks);
+      w->tasks = ts;
+      w->capacity = c;
+      w->head = 0;
+    }
+    else
+      r = false;
+  }
+
+  if (r)
+  {
+    pkg_config_resolve_task_t* t =
+        &w->tasks[(w->head + w->count++) & (w->capacity - 1)];
+
+    t->pkg = pkg;
+    t->depth = depth;
+  }
+
+  pkg_config_mutex_unlock (&w->lock);
+
+  /* If unable to queue, leave the package to the traversal.
+   */
+  if (!r)
+  {
+    resolve_unref (pool->client, pkg);
+    return;
+  }
+
+  pkg_config_mutex_lock (&pool->lock);
+  pool->available++;
+  pool->pending++;
+  pkg_config_cond_signal (&pool->cond);
+  pkg_config_mutex_unlock (&pool->lock);
+}
+
+static bool
+resolve_take (pkg_config_resolve_worker_t* w,
+              bool steal,
+              pkg_config_resolve_task_t* t)
+{
+  bool r = false;
+
+  pkg_config_mutex_lock (&w->lock);
+
+  if (w->count != 0)
+  {
+    size_t i = steal ? w->head : w->head + w->count - 1;
+
+    *t = w->tasks[i & (w->capacity - 1)];
+
+    if (steal)
+      w->head = (w->head + 1) & (w->capacity - 1);
+
+    w->count--;
+    r = true;
+  }
+
+  pkg_config_mutex_unlock (&w->lock);
+
+  if (r)
+  {
+    pkg_config_resolve_pool_t* pool = w->pool;
+
+    pkg_config_mutex_lock (&pool->lock);
+    pool->available--;
+    pkg_config_mutex_unlock (&pool->lock);
+  }
+
+  return r;
+}
+
+static void
+resolve_diag_handler (unsigned int eflag,
+                      const char* filename,
+                      size_t lineno,
+                      const char* msg,
+                      const pkg_config_client_t* client,
+                      const void* data)
+{
+  (void)eflag;
+  (void)filename;
+  (void)lineno;
+  (void)msg;
+  (void)client;
+
+  *(bool*)data = true;
+}
+
+/* Forward the spans reported by the client copy used to load packages to
+ * the client's handler, serializing the calls (see pkg_config_trace()).
+ */
+static void
+resolve_span_handler (const pkg_config_span_t* span,
+                      const pkg_config_client_t* copy,
+                      void* data)
+{
+  const pkg_config_client_t* client = data;
+
+  (void)copy;
+
+  pkg_config_mutex_lock (&client->resolver->diag_lock);
+  client->span_handler (span, client, client->span_handler_data);
+  pkg_config_mutex_unlock (&client->resolver->diag_lock);
+}
+
+/* Initialize a copy of the client for loading packages quietly. The copy
+ * borrows the client's configuration (search directories, filters, global
+ * variables, etc) but has the diagnostics handlers replaced and the caches
+ * (which we should not touch without the lock) empty.
+ */
+static void
+resolve_quiet_init (pkg_config_client_t* client,
+                    pkg_config_client_t* quiet,
+                    bool* diag)
+{
+  /* Note that the performance counters are updated concurrently so we don't
+   * copy them but accumulate the copy's counters separately, adding them to
+   * the client's at the end.
+   */
+  memset (quiet, 0, sizeof (pkg_config_client_t));
+
+  quiet->dir_list = client->dir_list;
+  quiet->filter_libdirs = client->filter_libdirs;
+  quiet->filter_includedirs = client->filter_includedirs;
+  quiet->global_vars = client->global_vars;
+
+  quiet->sysroot_dir = client->sysroot_dir;
+  quiet->buildroot_dir = client->buildroot_dir;
+  quiet->prefix_varname = client->prefix_varname;
+
+  quiet->flags = client->flags;
+  quiet->sources = client->sources;
+  quiet->allocator = client->allocator;
+
+  quiet->error_handler = resolve_diag_handler;
+  quiet->error_handler_data = diag;
+  quiet->warn_handler = resolve_diag_handler;
+  quiet->warn_handler_data = diag;
+
+  if (client->span_handler != NULL)
+  {
+    quiet->span_handler = resolve_span_handler;
+    quiet->span_handler_data = client;
+  }
+}
+
+/* Add the package loaded with the quiet copy to the cache, unless some other
+ * thread has loaded it in the meantime, in which case return the cached
+ * package instead.
+ */
+static pkg_config_pkg_t*
+resolve_cache_add (pkg_config_client_t* client,
+                   pkg_config_client_t* quiet,
+                   pkg_config_pkg_t* pkg)
+{
+  pkg_config_cache_lock (client);
+
+  pkg_config_pkg_t* cached = pkg_config_cache_lookup (client, pkg->id);
+
+  if (cached == NULL)
+  {
+    pkg->owner = client;
+    pkg_config_cache_add (client, pkg);
+  }
+
+  pkg_config_cache_unlock (client);
+
+  if (cached != NULL)
+  {
+    pkg_config_pkg_unref (quiet, pkg);
+    pkg = cached;
+  }
+
+  return pkg;
+}
+
+/* Return true if the package is in the cache (without counting a lookup).
+ * Must be called with the cache lock held.
+ */
+static bool
+resolve_cached (pkg_config_client_t* client, const char* id)
+{
+  return pkg_config_cache_find (client, id) != NULL;
+}
+
+/* Load the package dependencies that are not yet cached quietly, reading
+ * their files in batches (see pkg_config_pkg_find_all_in_dirs()), and add
+ * them to the cache so that verifying the dependencies finds them there.
+ * If batch loading is not available, leave them to be loaded one at a time.
+ */
+static void
+resolve_prefetch (pkg_config_resolve_worker_t* w,
+                  const pkg_config_list_t* const* lists,
+                  size_t lists_count)
+{
+  pkg_config_client_t* client = w->pool->client;
+  size_t capacity = 0;
+  pkg_config_node_t* node;
+
+  for (size_t i = 0; i != lists_count; ++i)
+  {
+    if (lists[i] != NULL)
+      capacity += lists[i]->length;
+  }
+
+  /* There is nothing to gain from batching a single file.
+   */
+  if (capacity < 2)
+    return;
+
+  const char** names = malloc (capacity * sizeof (const char*));
+  pkg_config_pkg_t** pkgs = malloc (capacity * sizeof (pkg_config_pkg_t*));
+  size_t count = 0;
+
+  if (names == NULL || pkgs == NULL)
+  {
+    free (names);
+    free (pkgs);
+    return;
+  }
+
+  /* Skip the builtin packages, file names (see pkg_find()), duplicates,
+   * and the packages already cached.
+   */
+  pkg_config_hash_t seen = PKG_CONFIG_HASH_INITIALIZER; /* Names added. */
+
+  pkg_config_cache_lock (client);
+
+  for (size_t i = 0; i != lists_count; ++i)
+  {
+    if (lists[i] == NULL)
+      continue;
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (lists[i]->head, node)
+    {
+      const pkg_config_dependency_t* dep = node->data;
+      const char* name = dep->package;
+      size_t n = strlen (name);
+      size_t en = sizeof (PKG_CONFIG_EXT) - 1;
+      bool skip = n == 0                                                ||
+                  (n > en && strcmp (name + n - en, PKG_CONFIG_EXT) == 0) ||
+                  pkg_config_builtin_pkg_get (name) != NULL             ||
+                  resolve_cached (client, name);
+
+      /* If unable to remember the name, leave it to the traversal.
+       */
+      if (!skip && pkg_config_hash_lookup (&seen, name, n) == NULL &&
+          pkg_config_hash_insert (&seen, name, n, (void*)name))
+        names[count++] = name;
+    }
+  }
+
+  pkg_config_cache_unlock (client);
+  pkg_config_hash_free (&seen);
+
+  if (count >= 2)
+  {
+    bool diag = false;
+    pkg_config_client_t quiet;
+
+    resolve_quiet_init (client, &quiet, &diag);
+
+    /* Reuse the worker's loader rather than setting up a ring for each
+     * package.
+     */
+    quiet.loader = w->loader;
+    bool r = pkg_config_pkg_find_all_in_dirs (&quiet, names, count, pkgs);
+    w->loader = quiet.loader;
+
+    pkg_config_client_merge_stats (client, &quiet.stats);
+
+    /* Since we cannot tell which packages were loaded with diagnostics,
+     * drop them all if there were any (see pkg_config_resolve_find()).
+     */
+    for (size_t i = 0; r && i != count; ++i)
+    {
+      pkg_config_pkg_t* pkg = pkgs[i];
+
+      if (pkg == NULL)
+        continue;
+
+      if (diag)
+        pkg_config_pkg_unref (&quiet, pkg);
+      else
+        resolve_unref (client, resolve_cache_add (client, &quiet, pkg));
+    }
+  }
+
+  free (names);
+  free (pkgs);
+}
+
+/* Verify the package dependencies, queueing each resolved dependency that
+ * has not yet been queued for expansion.
+ */
+static void
+resolve_expand (pkg_config_resolve_worker_t* w,
+                pkg_config_pkg_t* pkg,
+                int depth)
+{
+  pkg_config_resolve_pool_t* pool = w->pool;
+  pkg_config_client_t* client = pool->client;
+
+  const pkg_config_list_t* lists[] = {
+    &pkg->required,
+    (client->flags & LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE) != 0
+    ? &pkg->requires_private
+    : NULL};
+
+  resolve_prefetch (w, lists, PKG_CONFIG_ARRAY_SIZE (lists));
+
+  for (size_t i = 0; i != PKG_CONFIG_ARRAY_SIZE (lists); ++i)
+  {
+    pkg_config_node_t* node;
+
+    if (lists[i] == NULL)
+      continue;
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (lists[i]->head, node)
+    {
+      pkg_config_dependency_t* dep = node->data;
+      unsigned int eflags;
+
+      if (*dep->package == '\0')
+        continue;
+
+      pkg_config_pkg_t* d =
+          pkg_config_pkg_verify_dependency (client, dep, &eflags);
+
+      if (d == NULL)
+        continue;
+
+      bool queue = false;
+
+      pkg_config_cache_lock (client);
+
+      if (depth != 1 &&
+          (d->flags & LIBPKG_CONFIG_PKG_PROPF_CONST) == 0 &&
+          pkg_config_hash_lookup (&pool->queued, d, 0) == NULL)
+        queue = pkg_config_hash_insert (&pool->queued, d, 0, d);
+
+      if (!queue)
+        pkg_config_pkg_unref (client, d);
+
+      pkg_config_cache_unlock (client);
+
+      if (queue)
+        resolve_push (w, d, depth - 1);
+    }
+  }
+}
+
+static void
+resolve_work (void* arg)
+{
+  pkg_config_resolve_worker_t* w = arg;
+  pkg_config_resolve_pool_t* pool = w->pool;
+  pkg_config_client_t* client = pool->client;
+
+  for (;;)
+  {
+    pkg_config_resolve_task_t t;
+    bool r = resolve_take (w, false /* steal */, &t);
+
+    for (size_t i = 1; !r && i != pool->workers_count; ++i)
+      r = resolve_take (&pool->workers[(w->index + i) % pool->workers_count],
+                        true /* steal */,
+                        &t);
+
+    if (r)
+    {
+      resolve_expand (w, t.pkg, t.depth);
+
+      resolve_unref (client, t.pkg);
+
+      pkg_config_mutex_lock (&pool->lock);
+      if (--pool->pending == 0)
+        pkg_config_cond_broadcast (&pool->cond);
+      pkg_config_mutex_unlock (&pool->lock);
+
+      continue;
+    }
+
+    /* Wait for more tasks or for all the tasks to complete.
+     */
+    pkg_config_mutex_lock (&pool->lock);
+
+    while (pool->available == 0 && pool->pending != 0)
+      pkg_config_cond_wait (&pool->cond, &pool->lock);
+
+    bool done = pool->pending == 0;
+
+    pkg_config_mutex_unlock (&pool->lock);
+
+    if (done)
+      break;
+  }
+}
+
+/* Load the package quietly and add it to the cache, unless some other thread
+ * has loaded it in the meantime. If the package is loaded with diagnostics,
+ * then drop it so that it is loaded again (and the diagnostics issued) by the
+ * traversal.
+ */
+pkg_config_pkg_t*
+pkg_config_resolve_find (pkg_config_client_t* client,
+                         const char* name,
+                         unsigned int* eflags)
+{
+  bool diag = false;
+  pkg_config_client_t quiet;
+
+  resolve_quiet_init (client, &quiet, &diag);
+
+  pkg_config_pkg_t* pkg = pkg_config_pkg_find_in_dirs (&quiet, name, eflags);
+
+  pkg_config_client_merge_stats (client, &quiet.stats);
+
+  if (pkg == NULL)
+    return NULL;
+
+  if (diag)
+  {
+    pkg_config_pkg_unref (&quiet, pkg);
+    *eflags = LIBPKG_CONFIG_ERRF_OK;
+    return NULL;
+  }
+
+  return resolve_cache_add (client, &quiet, pkg);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkg_config_pkg_resolve(pkg_config_client_t
+ * *client, pkg_config_pkg_t *root, int maxdepth, unsigned int threads)
+ *
+ *    Find, load, and verify the dependencies of the root package up to
+ * `maxdepth` levels using multiple threads, caching the result in the client
+ * object for the subsequent traversals. Whether the requires.private lists
+ * are resolved is determined by the ``LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE``
+ * client flag. Does nothing if the package cache is disabled with
+ * ``LIBPKG_CONFIG_PKG_PKGF_NO_CACHE``.
+ *
+ *    Note that the diagnostics handlers may be called from other threads
+ * (though never concurrently) while the resolution is in progress.
+ *
+ *    :param pkg_config_client_t* client: The pkg-config client object to use
+ * for dependency resolution. :param pkg_config_pkg_t* root: The root of the
+ * dependency graph. :param int maxdepth: The maximum depth to resolve the
+ * dependency graph for. -1 means infinite. :param uint threads: The number
+ * of threads to use, including the calling thread. 0 means the number of
+ * hardware threads. :return: ``LIBPKG_CONFIG_ERRF_OK`` on success,
+ * ``LIBPKG_CONFIG_ERRF_MEMORY`` if unable to allocate memory. Note that
+ * dependency resolution errors are not reported. :rtype: unsigned int
+ */
+unsigned int
+pkg_config_pkg_resolve (pkg_config_client_t* client,
+                        pkg_config_pkg_t* root,
+                        int maxdepth,
+                        unsigned int threads)
+{
+  if (maxdepth == 0 ||
+      (client->flags & LIBPKG_CONFIG_PKG_PKGF_NO_CACHE) != 0)
+    return LIBPKG_CONFIG_ERRF_OK;
+
+  assert (client->resolver == NULL);
+
+  if (threads == 0)
+    threads = pkg_config_thread_hardware_concurrency ();
+
+  if (threads > PKG_CONFIG_RESOLVE_MAX_THREADS)
+    threads = PKG_CONFIG_RESOLVE_MAX_THREADS;
+
+  pkg_config_resolve_pool_t pool;
+  memset (&pool, 0, sizeof (pool));
+
+  pool.client = client;
+  pool.workers = calloc (threads, sizeof (pkg_config_resolve_worker_t));
+
+  if (pool.workers == NULL)
+    return LIBPKG_CONFIG_ERRF_MEMORY;
+
+  /* Note: these are effectively infallible on all the supported platforms
+   * and so we don't bother with partial cleanup.
+   */
+  if (!pkg_config_mutex_init (&pool.resolver.cache_lock) ||
+      !pkg_config_mutex_init (&pool.resolver.diag_lock) ||
+      !pkg_config_mutex_init (&pool.lock) ||
+      !pkg_config_cond_init (&pool.cond))
+  {
+    free (pool.workers);
+    return LIBPKG_CONFIG_ERRF_MEMORY;
+  }
+
+  for (size_t i = 0; i != threads; ++i)
+  {
+    pkg_config_resolve_worker_t* w = &pool.workers[i];
+
+    w->pool = &pool;
+    w->index = i;
+
+    if (!pkg_config_mutex_init (&w->lock))
+      break;
+
+    pool.workers_count++;
+  }
+
+  PKG_CONFIG_TRACE (client,
+                    "resolving %s with %u threads",
+                    root->id,
+                    (unsigned int)pool.workers_count);
+
+  client->resolver = &pool.resolver;
+
+  /* Queue the root package on the calling thread's worker and start the
+   * rest. If unable to start a thread, carry on with what we have.
+   */
+  pkg_config_resolve_worker_t* self = &pool.workers[0];
+
+  pkg_config_cache_lock (client);
+  pkg_config_pkg_ref (client, root);
+  bool queued = pkg_config_hash_insert (&pool.queued, root, 0, root);
+  pkg_config_cache_unlock (client);
+
+  if (queued)
+    resolve_push (self, root, maxdepth);
+  else
+  {
+    resolve_unref (client, root);
+  }
+
+  size_t started = 1;
+  for (; started != pool.workers_count; ++started)
+  {
+    pkg_config_resolve_worker_t* w = &pool.workers[started];
+
+    if (!pkg_config_thread_create (&w->thread, resolve_work, w))
+      break;
+  }
+
+  resolve_work (self);
+
+  for (size_t i = 1; i != started; ++i)
+    pkg_config_thread_join (&pool.workers[i].thread);
+
+  client->resolver = NULL;
+
+  PKG_CONFIG_TRACE (client,
+                    "resolved %s: %u packages",
+                    root->id,
+                    (unsigned int)pool.queued.count);
+
+  for (size_t i = 0; i != pool.workers_count; ++i)
+  {
+    pkg_config_resolve_worker_t* w = &pool.workers[i];
+
+    assert (w->count == 0);
+
+    free (w->tasks);
+    pkg_config_mutex_destroy (&w->lock);
+
+#ifdef PKG_CONFIG_LOADER
+    pkg_config_loader_free (w->loader);
+#endif
+  }
+
+  free (pool.workers);
+  pkg_config_hash_free (&pool.queued);
+
+  pkg_config_cond_destroy (&pool.cond);
+  pkg_config_mutex_destroy (&pool.lock);
+  pkg_config_mutex_destroy (&pool.resolver.diag_lock);
+  pkg_config_mutex_destroy (&pool.resolver.cache_lock);
+
+  return queued ? LIBPKG_CONFIG_ERRF_OK : LIBPKG_CONFIG_ERRF_MEMORY;
+}
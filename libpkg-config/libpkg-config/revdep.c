@@ -0,0 +1,411 @@
+/*
+ * revdep.c
+ * reverse dependency index
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+/*
+ * !doc
+ *
+ * libpkg-config `revdep` module
+ * =============================
+ *
+ * The libpkg-config `revdep` module answers the "which packages require X"
+ * queries. The index is built once by loading every package in the search
+ * directories (see pkg_config_scan_all()) and inverting their Requires and
+ * Requires.private edges. Only the first package with a given id (in the
+ * search order) is indexed, the same as the one a lookup would find.
+ *
+ * Note that the edges are matched by package name only, without checking
+ * the dependency version constraints.
+ */
+
+typedef struct
+{
+  pkg_config_pkg_t* pkg;
+  pkg_config_dependency_t* dependency;
+  unsigned int colour; /* LIBPKG_CONFIG_GRAPH_EDGE_* */
+} pkg_config_revdep_edge_t;
+
+/* Edges of the packages requiring a package with a given name.
+ */
+typedef struct
+{
+  pkg_config_revdep_edge_t* edges;
+  size_t count;
+  size_t capacity;
+} pkg_config_revdep_entry_t;
+
+struct pkg_config_revdep_index_
+{
+  pkg_config_client_t* owner;
+
+  pkg_config_pkg_t** pkgs;
+  size_t pkgs_count;
+  size_t pkgs_capacity;
+
+  pkg_config_hash_t ids;   /* Package id to package. */
+  pkg_config_hash_t names; /* Required package name to entry. */
+
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
+};
+
+typedef struct
+{
+  pkg_config_client_t* client;
+  pkg_config_revdep_index_t* index;
+  bool failed;
+} pkg_config_revdep_scan_t;
+
+static bool
+revdep_scan (const pkg_config_pkg_t* p, void* data)
+{
+  pkg_config_revdep_scan_t* s = data;
+  pkg_config_revdep_index_t* x = s->index;
+
+  if (s->failed)
+    return false;
+
+  /* Skip the shadowed packages.
+   */
+  if (pkg_config_hash_lookup (&x->ids, p->id, strlen (p->id)) != NULL)
+    return false;
+
+  if (x->pkgs_count == x->pkgs_capacity)
+  {
+    size_t c = x->pkgs_capacity != 0 ? x->pkgs_capacity * 2 : 64;
+    pkg_config_pkg_t** a = pkg_config_mem_realloc (
+        x->allocator, x->pkgs, c * sizeof (pkg_config_pkg_t*));
+
+    if (a == NULL)
+    {
+      s->failed = true;
+      return false;
+    }
+
+    x->pkgs = a;
+    x->pkgs_capacity = c;
+  }
+
+  /* The scan releases the package unless we keep a reference.
+   */
+  pkg_config_pkg_t* pkg = (pkg_config_pkg_t*)p;
+
+  if (!pkg_config_hash_insert (&x->ids, pkg->id, strlen (pkg->id), pkg))
+  {
+    s->failed = true;
+    return false;
+  }
+
+  x->pkgs[x->pkgs_count++] = pkg_config_pkg_ref (s->client, pkg);
+  return false;
+}
+
+static bool
+revdep_add_edges (pkg_config_revdep_index_t* x,
+                  pkg_config_pkg_t* pkg,
+                  pkg_config_list_t* deps,
+                  unsigned int colour)
+{
+  pkg_config_node_t* n;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (deps->head, n)
+  {
+    pkg_config_dependency_t* dep = n->data;
+    size_t size = strlen (dep->package);
+    void** v = pkg_config_hash_lookup (&x->names, dep->package, size);
+    pkg_config_revdep_entry_t* e;
+
+    if (v != NULL)
+      e = *v;
+    else
+    {
+      if ((e = pkg_config_mem_calloc (
+               x->allocator, 1, sizeof (pkg_config_revdep_entry_t))) == NULL)
+        return false;
+
+      if (!pkg_config_hash_insert (&x->names, dep->package, size, e))
+      {
+        pkg_config_mem_free (x->allocator, e);
+        return false;
+      }
+    }
+
+    if (e->count == e->capacity)
+    {
+      size_t c = e->capacity != 0 ? e->capacity * 2 : 4;
+      pkg_config_revdep_edge_t* a = pkg_config_mem_realloc (
+          x->allocator, e->edges, c * sizeof (pkg_config_revdep_edge_t));
+
+      if (a == NULL)
+        return false;
+
+      e->edges = a;
+      e->capacity = c;
+    }
+
+    pkg_config_revdep_edge_t* r = &e->edges[e->count++];
+    r->pkg = pkg;
+    r->dependency = dep;
+    r->colour = colour;
+
+    if (dep->flags & LIBPKG_CONFIG_PKG_DEPF_INTERNAL)
+      r->colour |= LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL;
+  }
+
+  return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_revdep_index_t
+ * *pkg_config_revdep_index_build(pkg_config_client_t *client, unsigned int
+ * *eflags)
+ *
+ *    Builds the reverse dependency index for all the packages in the client
+ *    object's search directories. The index keeps references to the
+ *    packages and should be freed with pkg_config_revdep_index_free()
+ *    before the client object.
+ *
+ *    :param pkg_config_client_t* client: The client object to use.
+ *    :param uint* eflags: Set to ``LIBPKG_CONFIG_ERRF_MEMORY`` if unable to
+ *    allocate memory and to ``LIBPKG_CONFIG_ERRF_OK`` otherwise.
+ *    :return: The index or ``NULL`` on failure.
+ *    :rtype: pkg_config_revdep_index_t *
+ */
+pkg_config_revdep_index_t*
+pkg_config_revdep_index_build (pkg_config_client_t* client,
+                               unsigned int* eflags)
+{
+  const pkg_config_allocator_t* a = client->allocator;
+  pkg_config_revdep_index_t* x =
+      pkg_config_mem_calloc (a, 1, sizeof (pkg_config_revdep_index_t));
+
+  *eflags = LIBPKG_CONFIG_ERRF_MEMORY;
+
+  if (x == NULL)
+    return NULL;
+
+  x->owner = client;
+  x->allocator = a;
+  x->ids.allocator = a;
+  x->names.allocator = a;
+
+  pkg_config_revdep_scan_t s = {client, x, false};
+  pkg_config_scan_all (client, &s, revdep_scan);
+
+  for (size_t i = 0; !s.failed && i != x->pkgs_count; ++i)
+  {
+    pkg_config_pkg_t* pkg = x->pkgs[i];
+
+    if (!revdep_add_edges (
+            x, pkg, &pkg->required, LIBPKG_CONFIG_GRAPH_EDGE_PUBLIC) ||
+        !revdep_add_edges (
+            x, pkg, &pkg->requires_private, LIBPKG_CONFIG_GRAPH_EDGE_PRIVATE))
+      s.failed = true;
+  }
+
+  if (s.failed)
+  {
+    pkg_config_revdep_index_free (x);
+    return NULL;
+  }
+
+  PKG_CONFIG_TRACE (client,
+                    "built reverse dependency index: %lu packages",
+                    (unsigned long)x->pkgs_count);
+
+  *eflags = LIBPKG_CONFIG_ERRF_OK;
+  return x;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_revdep_index_free(pkg_config_revdep_index_t
+ * *index)
+ *
+ *    Releases the reverse dependency index and the package references it
+ *    holds.
+ *
+ *    :param pkg_config_revdep_index_t* index: The index to free.
+ *    :return: nothing
+ */
+void
+pkg_config_revdep_index_free (pkg_config_revdep_index_t* index)
+{
+  if (index == NULL)
+    return;
+
+  for (size_t i = 0; i != index->names.capacity; ++i)
+  {
+    if (index->names.entries[i].key != NULL)
+    {
+      pkg_config_revdep_entry_t* e = index->names.entries[i].value;
+      pkg_config_mem_free (index->allocator, e->edges);
+      pkg_config_mem_free (index->allocator, e);
+    }
+  }
+
+  pkg_config_hash_free (&index->names);
+  pkg_config_hash_free (&index->ids);
+
+  for (size_t i = 0; i != index->pkgs_count; ++i)
+    pkg_config_pkg_unref (index->owner, index->pkgs[i]);
+
+  pkg_config_mem_free (index->allocator, index->pkgs);
+  pkg_config_mem_free (index->allocator, index);
+}
+
+/* Return true if the edge is of one of the specified colours. Note that an
+ * internal edge also requires LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL.
+ */
+static inline bool
+revdep_edge_match (const pkg_config_revdep_edge_t* e, unsigned int colours)
+{
+  return (e->colour & colours &
+          (LIBPKG_CONFIG_GRAPH_EDGE_PUBLIC |
+           LIBPKG_CONFIG_GRAPH_EDGE_PRIVATE)) != 0 &&
+         ((e->colour & LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL) == 0 ||
+          (colours & LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL) != 0);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkg_config_revdep_query(const
+ * pkg_config_revdep_index_t *index, const char *name, unsigned int colours,
+ * int maxdepth, pkg_config_revdep_func_t func, void *data)
+ *
+ *    Calls the function for each package that requires the named package,
+ *    directly or, if `maxdepth` is not 1, transitively (breadth-first, so
+ *    the direct dependents come first). Each dependent is reported once
+ *    together with the dependency through which it was first reached, the
+ *    dependency colour, and the depth (1 for direct dependents).
+ *
+ *    :param pkg_config_revdep_index_t* index: The index to query.
+ *    :param char* name: The required package name.
+ *    :param uint colours: The ``LIBPKG_CONFIG_GRAPH_EDGE_*`` dependency
+ *    kinds to follow. Requires.internal dependencies are only followed if
+ *    both ``LIBPKG_CONFIG_GRAPH_EDGE_PRIVATE`` and
+ *    ``LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL`` are specified.
+ *    :param int maxdepth: The maximum depth or -1 for unlimited.
+ *    :param pkg_config_revdep_func_t func: The function to call. If it
+ *    returns true, the query stops.
+ *    :param void* data: An opaque pointer passed to the function.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` on success or
+ *    ``LIBPKG_CONFIG_ERRF_MEMORY`` if unable to allocate memory.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_revdep_query (const pkg_config_revdep_index_t* index,
+                         const char* name,
+                         unsigned int colours,
+                         int maxdepth,
+                         pkg_config_revdep_func_t func,
+                         void* data)
+{
+  unsigned int r = LIBPKG_CONFIG_ERRF_OK;
+
+  /* Breadth-first search with the queue also serving as the list of the
+   * reported packages.
+   */
+  pkg_config_hash_t visited = PKG_CONFIG_HASH_INITIALIZER;
+  const pkg_config_pkg_t** queue = NULL;
+  int* depths = NULL;
+  size_t count = 0;
+
+  if (maxdepth == 0)
+    return r;
+
+  visited.allocator = index->allocator;
+
+  if (index->pkgs_count != 0)
+  {
+    const pkg_config_allocator_t* a = index->allocator;
+
+    queue = pkg_config_mem_alloc (
+        a, index->pkgs_count * sizeof (pkg_config_pkg_t*));
+    depths = pkg_config_mem_alloc (a, index->pkgs_count * sizeof (int));
+
+    if (queue == NULL || depths == NULL)
+    {
+      r = LIBPKG_CONFIG_ERRF_MEMORY;
+      goto done;
+    }
+  }
+
+  for (size_t i = 0; i <= count; ++i)
+  {
+    int depth = 1;
+
+    /* Start with the requested package and continue with the queued ones.
+     */
+    if (i != 0)
+    {
+      if (maxdepth > 0 && depths[i - 1] >= maxdepth)
+        continue;
+
+      name = queue[i - 1]->id;
+      depth = depths[i - 1] + 1;
+    }
+
+    void** v = pkg_config_hash_lookup (&index->names, name, strlen (name));
+    if (v == NULL)
+      continue;
+
+    const pkg_config_revdep_entry_t* e = *v;
+
+    for (size_t j = 0; j != e->count; ++j)
+    {
+      const pkg_config_revdep_edge_t* edge = &e->edges[j];
+
+      if (!revdep_edge_match (edge, colours) ||
+          pkg_config_hash_lookup (&visited, edge->pkg, 0) != NULL)
+        continue;
+
+      if (!pkg_config_hash_insert (&visited, edge->pkg, 0, edge->pkg))
+      {
+        r = LIBPKG_CONFIG_ERRF_MEMORY;
+        goto done;
+      }
+
+      /* Every indexed package is queued at most once.
+       */
+      assert (count != index->pkgs_count);
+      queue[count] = edge->pkg;
+      depths[count] = depth;
+      ++count;
+
+      if (func (edge->pkg, edge->dependency, edge->colour, depth, data))
+        goto done;
+    }
+  }
+
+done:
+  pkg_config_hash_free (&visited);
+  pkg_config_mem_free (index->allocator, queue);
+  pkg_config_mem_free (index->allocator, depths);
+
+  return r;
+}
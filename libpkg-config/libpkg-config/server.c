@@ -0,0 +1,1005 @@
+/*
+ * server.c
+ * warm cache query server
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+#include <errno.h>
+#include <limits.h> /* UINT_MAX */
+
+#ifndef _WIN32
+#  include <poll.h>
+#  include <fcntl.h>
+#  include <sys/socket.h>
+#endif
+
+/*
+ * !doc
+ *
+ * libpkg-config `server` module
+ * =============================
+ *
+ * The libpkg-config `server` module answers queries from other processes
+ * (for example, compiler wrappers) using warm clients, that is, clients that
+ * stay loaded between the queries. It is currently only supported on POSIX
+ * systems.
+ *
+ * The protocol is line-based: each request is a single line consisting of
+ * the command optionally followed by a space and the argument (which
+ * extends to the end of the line) and is answered with a single line which
+ * is either ``ok``, optionally followed by a space and the result, or
+ * ``error`` followed by a space and the diagnostics. The requests are
+ * answered in order and so can be pipelined.
+ *
+ * The following commands change the connection's configuration (the search
+ * directories, the sysroot directory, the client flags, and the global
+ * variables) and are answered with ``ok``:
+ *
+ * .. code-block:: none
+ *
+ *    path <dir>          add search directory (default: from environment)
+ *    sysroot <dir>       set sysroot directory
+ *    define <name>=<val> define global variable
+ *    flags <num>         set LIBPKG_CONFIG_PKG_PKGF_* flags (default: 0)
+ *    reset               restore the default configuration
+ *
+ * The following commands query the packages:
+ *
+ * .. code-block:: none
+ *
+ *    cflags <name>       rendered compiler flags
+ *    libs <name>         rendered linker flags
+ *    modversion <name>   package version
+ *    exists <deps>       1 if dependency list is satisfied, 0 otherwise
+ *
+ * Finally, the ``shutdown`` command makes pkg_config_server_listen() return
+ * after answering it.
+ *
+ * The server keeps a warm client for each distinct configuration, which are
+ * clones of a common base client and so also share the package file sources
+ * (see pkg_config_client_clone() for details). The number of warm clients
+ * is limited with the least recently used one freed to make room for a new
+ * configuration. The memory used by the warm clients is accounted for with
+ * an allocator (see pkg_config_client_set_allocator()) and can also be
+ * limited (see pkg_config_server_set_memory_limit()). Before answering a
+ * query the
+ * client's caches are brought up to date with the changes in the search
+ * directories (see pkg_config_watch_open() and pkg_config_cache_refresh()).
+ *
+ * The server is single-threaded: the connections are multiplexed with
+ * poll(2) and the requests are answered with blocking writes. Since writing
+ * to a connection closed by the peer raises ``SIGPIPE``, the program should
+ * ignore this signal.
+ */
+
+#ifndef _WIN32
+
+/* Maximum request line length, including the newline.
+ */
+#define PKG_CONFIG_SERVER_LINE_SIZE 4096
+
+/* Maximum number of warm clients. Each holds its loaded packages and a
+ * watch descriptor so the least recently used one is freed when the limit
+ * is reached.
+ */
+#define PKG_CONFIG_SERVER_CONFIG_MAX 16
+
+/* Warm client for a configuration.
+ */
+typedef struct
+{
+  pkg_config_node_t iter;
+
+  char* key;                   /* Configuration commands (see below). */
+  pkg_config_client_t* client;
+  int watch;                   /* Watch descriptor or -1 if refreshing. */
+} server_config_t;
+
+/* Connection.
+ *
+ * The configuration is represented as the configuration commands (without
+ * reset) received so far, one per line. This representation doubles as the
+ * warm client key and so the flags value is normalized to decimal (so that,
+ * for example, `flags 1` and `flags 0x1` share the warm client).
+ */
+typedef struct
+{
+  pkg_config_node_t iter;
+
+  int in;
+  int out;
+  bool own;                    /* Close the descriptors. */
+
+  char* config;                /* NULL if default. */
+  size_t config_size;
+
+  char buf[PKG_CONFIG_SERVER_LINE_SIZE];
+  size_t size;
+} server_conn_t;
+
+/* Header of a block allocated with the memory accounting allocator. The
+ * union makes sure the block itself is suitably aligned.
+ */
+typedef union
+{
+  size_t size;
+  long double ld;
+  long long ll;
+  void* p;
+} server_block_t;
+
+struct pkg_config_server_
+{
+  pkg_config_client_t* base;
+
+  pkg_config_allocator_t allocator; /* Of the warm clients. */
+  size_t memory;                    /* Allocated with it. */
+  size_t memory_limit;              /* 0 if unlimited. */
+
+  pkg_config_list_t configs;   /* server_config_t, least recent first. */
+  pkg_config_hash_t index;     /* Configuration key to server_config_t*. */
+
+  char diag[1024];             /* Current query errors. */
+  bool shutdown;
+};
+
+static void
+server_diag (unsigned int e,
+             const char* file,
+             size_t line,
+             const char* msg,
+             const pkg_config_client_t* client,
+             const void* data)
+{
+  (void) e;      /* Unused. */
+  (void) client; /* Unused. */
+
+  pkg_config_server_t* s = (pkg_config_server_t*)data;
+  size_t n = strlen (s->diag);
+
+  if (n != 0)
+    n = pkg_config_strlcat (s->diag, "; ", sizeof (s->diag));
+
+  if (n < sizeof (s->diag) && file != NULL)
+    n += snprintf (s->diag + n,
+                   sizeof (s->diag) - n,
+                   "%s:" LIBPKG_CONFIG_SIZE_FMT ": ",
+                   file, line);
+
+  if (n < sizeof (s->diag))
+    pkg_config_strlcat (s->diag, msg, sizeof (s->diag));
+}
+
+static void*
+server_alloc (void* data, size_t size)
+{
+  pkg_config_server_t* s = data;
+  server_block_t* b;
+
+  if (size > (size_t)-1 - sizeof (server_block_t) ||
+      (b = malloc (sizeof (server_block_t) + size)) == NULL)
+    return NULL;
+
+  b->size = size;
+  s->memory += size;
+  return b + 1;
+}
+
+static void*
+server_realloc (void* data, void* p, size_t size)
+{
+  if (p == NULL)
+    return server_alloc (data, size);
+
+  pkg_config_server_t* s = data;
+  server_block_t* b = (server_block_t*)p - 1;
+  size_t n = b->size;
+
+  if (size > (size_t)-1 - sizeof (server_block_t) ||
+      (b = realloc (b, sizeof (server_block_t) + size)) == NULL)
+    return NULL;
+
+  b->size = size;
+  s->memory = s->memory - n + size;
+  return b + 1;
+}
+
+static void
+server_dealloc (void* data, void* p)
+{
+  pkg_config_server_t* s = data;
+  server_block_t* b = (server_block_t*)p - 1;
+
+  s->memory -= b->size;
+  free (b);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_server_t* pkg_config_server_new(void)
+ *
+ *    Allocate a server object. The default configuration search directories
+ *    and filtered directories are initialized from the environment (see
+ *    pkg_config_client_dir_list_build() for details).
+ *
+ *    :return: A server object or NULL if unable to allocate memory or not
+ *    supported on this platform (in which case `errno` is set to
+ *    ``ENOSYS``).
+ *    :rtype: pkg_config_server_t*
+ */
+pkg_config_server_t*
+pkg_config_server_new (void)
+{
+  pkg_config_server_t* s;
+
+  if ((s = calloc (1, sizeof (pkg_config_server_t))) == NULL)
+    return NULL;
+
+  s->allocator.alloc = server_alloc;
+  s->allocator.realloc = server_realloc;
+  s->allocator.free = server_dealloc;
+  s->allocator.data = s;
+
+  if ((s->base = pkg_config_client_new (server_diag,
+                                        s,
+                                        true /* init_filters */)) == NULL)
+  {
+    free (s);
+    return NULL;
+  }
+
+  /* Note that the clones (that is, the warm clients) inherit the
+   * allocator.
+   */
+  pkg_config_client_set_allocator (s->base, &s->allocator);
+  pkg_config_client_dir_list_build (s->base);
+  return s;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_server_set_memory_limit(
+ * pkg_config_server_t *server, size_t limit)
+ *
+ *    Limit the memory used by the warm clients, that is, allocated with the
+ *    client allocator (see pkg_config_client_set_allocator()). If after
+ *    answering a query the limit is exceeded, then the least recently used
+ *    warm clients other than the one that answered the query are freed until
+ *    the memory usage is within the limit. Note that the limit is not
+ *    enforced for a single warm client.
+ *
+ *    :param pkg_config_server_t* server: The server object to modify.
+ *    :param size_t limit: The limit in bytes or 0 for no limit (default).
+ *    :return: nothing
+ */
+void
+pkg_config_server_set_memory_limit (pkg_config_server_t* s, size_t limit)
+{
+  s->memory_limit = limit;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_server_free(pkg_config_server_t *server)
+ *
+ *    Free the server object together with its warm clients.
+ *
+ *    :param pkg_config_server_t* server: The server object to free.
+ *    :return: nothing
+ */
+void
+pkg_config_server_free (pkg_config_server_t* s)
+{
+  pkg_config_node_t* n;
+  pkg_config_node_t* tn;
+
+  if (s == NULL)
+    return;
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY_SAFE (s->configs.head, tn, n)
+  {
+    server_config_t* c = n->data;
+
+    pkg_config_client_free (c->client);
+    free (c->key);
+    free (c);
+  }
+
+  pkg_config_hash_free (&s->index);
+  pkg_config_client_free (s->base);
+  free (s);
+}
+
+/* Apply the configuration commands to a freshly cloned client.
+ */
+static void
+server_configure (pkg_config_client_t* client, const char* key)
+{
+  bool path = false;
+
+  for (const char* b = key; *b != '\0'; )
+  {
+    const char* e = strchr (b, '\n');
+    const char* a = strchr (b, ' ') + 1;
+    char* v = pkg_config_strndup (a, e - a);
+
+    if (v != NULL)
+    {
+      if (strncmp (b, "path ", 5) == 0)
+      {
+        /* The first path overrides the default search directories.
+         */
+        if (!path)
+        {
+          pkg_config_path_free (&client->dir_list);
+          path = true;
+        }
+
+        pkg_config_path_add_with (client, v, &client->dir_list, true);
+      }
+      else if (strncmp (b, "sysroot ", 8) == 0)
+        pkg_config_client_set_sysroot_dir (client, v);
+      else if (strncmp (b, "define ", 7) == 0)
+        pkg_config_tuple_define_global (client, v);
+      else if (strncmp (b, "flags ", 6) == 0)
+        pkg_config_client_set_flags (client,
+                                     (unsigned int)strtoul (v, NULL, 0));
+
+      free (v);
+    }
+
+    b = e + 1;
+  }
+}
+
+/* Free the least recently used warm client.
+ */
+static void
+server_evict (pkg_config_server_t* s)
+{
+  server_config_t* c = s->configs.head->data;
+
+  PKG_CONFIG_TRACE (s->base, "evicting warm client");
+
+  pkg_config_list_delete (&c->iter, &s->configs);
+  pkg_config_hash_remove (&s->index, c->key, strlen (c->key));
+  pkg_config_client_free (c->client);
+  free (c->key);
+  free (c);
+}
+
+/* Free the least recently used warm clients, except for the most recently
+ * used one, while the memory limit is exceeded.
+ */
+static void
+server_trim (pkg_config_server_t* s)
+{
+  while (s->memory_limit != 0           &&
+         s->memory > s->memory_limit    &&
+         s->configs.length > 1)
+    server_evict (s);
+}
+
+/* Return the warm client for the configuration, creating it if necessary,
+ * or NULL if unable to allocate memory.
+ */
+static server_config_t*
+server_config (pkg_config_server_t* s, const char* key)
+{
+  size_t n = strlen (key);
+  void** v = pkg_config_hash_lookup (&s->index, key, n);
+
+  server_config_t* c;
+
+  if (v != NULL)
+  {
+    c = *v;
+
+    /* Move to the end of the list as the most recently used.
+     */
+    pkg_config_list_delete (&c->iter, &s->configs);
+    memset (&c->iter, 0, sizeof c->iter);
+    pkg_config_list_insert_tail (&c->iter, c, &s->configs);
+    return c;
+  }
+
+  if (s->configs.length == PKG_CONFIG_SERVER_CONFIG_MAX)
+    server_evict (s);
+
+  c = calloc (1, sizeof (server_config_t));
+
+  if (c == NULL)
+    return NULL;
+
+  if ((c->key = pkg_config_strndup (key, n)) == NULL ||
+      (c->client = pkg_config_client_clone (s->base)) == NULL)
+  {
+    free (c->key);
+    free (c);
+    return NULL;
+  }
+
+  server_configure (c->client, key);
+
+  if (!pkg_config_hash_insert (&s->index, c->key, n, c))
+  {
+    pkg_config_client_free (c->client);
+    free (c->key);
+    free (c);
+    return NULL;
+  }
+
+  pkg_config_list_insert_tail (&c->iter, c, &s->configs);
+
+  /* Fall back to re-stat'ing the cached packages if watching is not
+   * supported.
+   */
+  c->watch = pkg_config_watch_open (c->client);
+
+  PKG_CONFIG_TRACE (s->base, "warm client " LIBPKG_CONFIG_SIZE_FMT "%s",
+                    s->configs.length,
+                    c->watch == -1 ? " (not watching)" : "");
+  return c;
+}
+
+/* Write the whole buffer, returning false on error.
+ */
+static bool
+server_write (int fd, const char* b, size_t n)
+{
+  while (n != 0)
+  {
+    ssize_t k = write (fd, b, n);
+
+    if (k == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    b += k;
+    n -= (size_t)k;
+  }
+
+  return true;
+}
+
+/* Write the reply line. Newlines in the value, if any, are replaced with
+ * spaces.
+ */
+static bool
+server_reply (server_conn_t* c, bool ok, const char* v)
+{
+  size_t n = (v != NULL ? strlen (v) : 0);
+  char* b = malloc (n + 8);
+
+  if (b == NULL)
+    return false;
+
+  char* p = b;
+
+  p += sprintf (p, "%s", ok ? "ok" : "error");
+
+  if (v != NULL)
+  {
+    *p++ = ' ';
+
+    for (const char* q = v; *q != '\0'; ++q)
+      *p++ = (*q == '\n' ? ' ' : *q);
+  }
+
+  *p++ = '\n';
+
+  bool r = server_write (c->out, b, p - b);
+  free (b);
+  return r;
+}
+
+/* Answer a query with the connection's warm client.
+ */
+static bool
+server_query (pkg_config_server_t* s,
+              server_conn_t* c,
+              const char* cmd,
+              const char* arg)
+{
+  server_config_t* sc = server_config (s,
+                                       c->config != NULL ? c->config : "");
+
+  if (sc == NULL)
+    return server_reply (c, false, "unable to allocate memory");
+
+  pkg_config_client_t* client = sc->client;
+
+  unsigned int e = (sc->watch != -1
+                    ? pkg_config_watch_process (client)
+                    : pkg_config_cache_refresh (client));
+
+  if (e != LIBPKG_CONFIG_ERRF_OK)
+    return server_reply (c, false, "unable to allocate memory");
+
+  s->diag[0] = '\0';
+
+  if (strcmp (cmd, "exists") == 0)
+  {
+    pkg_config_list_t deps = LIBPKG_CONFIG_LIST_INITIALIZER;
+    pkg_config_node_t* n;
+    bool r = true;
+
+    pkg_config_dependency_parse_str (client, &deps, arg, 0);
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (deps.head, n)
+    {
+      pkg_config_pkg_t* pkg;
+
+      if ((pkg = pkg_config_pkg_verify_dependency (client, n->data, &e)) !=
+          NULL)
+        pkg_config_pkg_unref (client, pkg);
+
+      if (e != LIBPKG_CONFIG_ERRF_OK)
+      {
+        r = false;
+        break;
+      }
+    }
+
+    pkg_config_dependency_free (&deps);
+    return server_reply (c, true, r ? "1" : "0");
+  }
+
+  pkg_config_pkg_t* pkg = pkg_config_pkg_find (client, arg, &e);
+
+  if (pkg == NULL)
+  {
+    if (s->diag[0] == '\0')
+      snprintf (s->diag, sizeof (s->diag), "package '%s' not found", arg);
+
+    return server_reply (c, false, s->diag);
+  }
+
+  bool r;
+
+  if (strcmp (cmd, "modversion") == 0)
+    r = server_reply (c, true, pkg->version != NULL ? pkg->version : "");
+  else
+  {
+    pkg_config_list_t list = LIBPKG_CONFIG_LIST_INITIALIZER;
+
+    e = (strcmp (cmd, "cflags") == 0
+         ? pkg_config_pkg_cflags (client, pkg, &list, -1)
+         : pkg_config_pkg_libs (client, pkg, &list, -1));
+
+    if (e == LIBPKG_CONFIG_ERRF_OK)
+    {
+      PKG_CONFIG_SPAN_BEGIN (client, RENDER, pkg->id);
+      char* v = pkg_config_fragment_render (&list, true /* escape */, NULL);
+      PKG_CONFIG_SPAN_END (client, RENDER, pkg->id);
+
+      /* Strip the trailing separator.
+       */
+      if (v != NULL)
+      {
+        size_t n = strlen (v);
+
+        while (n != 0 && v[n - 1] == ' ')
+          v[--n] = '\0';
+      }
+
+      r = (v != NULL
+           ? server_reply (c, true, v)
+           : server_reply (c, false, "unable to allocate memory"));
+
+      free (v);
+    }
+    else
+    {
+      if (s->diag[0] == '\0')
+        snprintf (s->diag, sizeof (s->diag),
+                  "unable to resolve dependencies of '%s'", arg);
+
+      r = server_reply (c, false, s->diag);
+    }
+
+    pkg_config_fragment_free (&list);
+  }
+
+  pkg_config_pkg_unref (client, pkg);
+  return r;
+}
+
+/* Handle a request line, returning false if the connection should be
+ * closed.
+ */
+static bool
+server_request (pkg_config_server_t* s, server_conn_t* c, char* line)
+{
+  char* arg = strchr (line, ' ');
+
+  if (arg != NULL)
+    *arg++ = '\0';
+
+  const char* cmd = line;
+
+  if (strcmp (cmd, "reset") == 0 || strcmp (cmd, "shutdown") == 0)
+  {
+    if (arg != NULL)
+      return server_reply (c, false, "unexpected argument");
+
+    if (cmd[0] == 'r')
+    {
+      free (c->config);
+      c->config = NULL;
+      c->config_size = 0;
+    }
+    else
+      s->shutdown = true;
+
+    return server_reply (c, true, NULL);
+  }
+
+  bool config = (strcmp (cmd, "path") == 0    ||
+                 strcmp (cmd, "sysroot") == 0 ||
+                 strcmp (cmd, "define") == 0  ||
+                 strcmp (cmd, "flags") == 0);
+
+  if (!config                           &&
+      strcmp (cmd, "cflags") != 0       &&
+      strcmp (cmd, "libs") != 0         &&
+      strcmp (cmd, "modversion") != 0   &&
+      strcmp (cmd, "exists") != 0)
+  {
+    char m[64];
+    snprintf (m, sizeof (m), "unknown command '%.32s'", cmd);
+    return server_reply (c, false, m);
+  }
+
+  if (arg == NULL || *arg == '\0')
+    return server_reply (c, false, "missing argument");
+
+  if (!config)
+  {
+    bool r = server_query (s, c, cmd, arg);
+    server_trim (s);
+    return r;
+  }
+
+  char flags[16];
+
+  if (cmd[0] == 'f')
+  {
+    char* e;
+    errno = 0;
+    unsigned long v = strtoul (arg, &e, 0);
+
+    if (*e != '\0' || errno != 0 || v > UINT_MAX || arg[0] == '-')
+      return server_reply (c, false, "invalid flags");
+
+    snprintf (flags, sizeof (flags), "%lu", v);
+    arg = flags;
+  }
+
+  /* Append "<cmd> <arg>\n" to the configuration.
+   */
+  size_t cn = strlen (cmd);
+  size_t an = strlen (arg);
+  char* p = realloc (c->config, c->config_size + cn + an + 3);
+
+  if (p == NULL)
+    return server_reply (c, false, "unable to allocate memory");
+
+  sprintf (p + c->config_size, "%s %s\n", cmd, arg);
+  c->config = p;
+  c->config_size += cn + an + 2;
+
+  return server_reply (c, true, NULL);
+}
+
+/* Read the available input and handle the complete request lines,
+ * returning false if the connection should be closed.
+ */
+static bool
+server_read (pkg_config_server_t* s, server_conn_t* c)
+{
+  ssize_t k;
+
+  while ((k = read (c->in, c->buf + c->size, sizeof (c->buf) - c->size)) ==
+         -1)
+  {
+    if (errno != EINTR)
+      return false;
+  }
+
+  if (k == 0)
+    return false; /* EOF. */
+
+  c->size += (size_t)k;
+
+  char* b = c->buf;
+  char* e;
+
+  while ((e = memchr (b, '\n', c->size - (b - c->buf))) != NULL)
+  {
+    *e = '\0';
+
+    if (e != b && e[-1] == '\r')
+      e[-1] = '\0';
+
+    if (!server_request (s, c, b))
+      return false;
+
+    b = e + 1;
+  }
+
+  c->size -= b - c->buf;
+  memmove (c->buf, b, c->size);
+
+  if (c->size == sizeof (c->buf))
+  {
+    server_reply (c, false, "request line too long");
+    return false;
+  }
+
+  return true;
+}
+
+static server_conn_t*
+server_conn_new (pkg_config_list_t* conns, int in, int out, bool own)
+{
+  server_conn_t* c = calloc (1, sizeof (server_conn_t));
+
+  if (c != NULL)
+  {
+    c->in = in;
+    c->out = out;
+    c->own = own;
+
+    pkg_config_list_insert_tail (&c->iter, c, conns);
+  }
+
+  return c;
+}
+
+static void
+server_conn_free (pkg_config_list_t* conns, server_conn_t* c)
+{
+  pkg_config_list_delete (&c->iter, conns);
+
+  if (c->own)
+  {
+    close (c->in);
+
+    if (c->out != c->in)
+      close (c->out);
+  }
+
+  free (c->config);
+  free (c);
+}
+
+/* Serve the connections until the listening socket, if any, receives the
+ * shutdown request or, otherwise, the only connection is closed.
+ */
+static int
+server_run (pkg_config_server_t* s, int lfd, int in, int out)
+{
+  pkg_config_list_t conns = LIBPKG_CONFIG_LIST_INITIALIZER;
+  struct pollfd* fds = NULL;
+  size_t cap = 0;
+  int r = 0;
+
+  if (in != -1 && server_conn_new (&conns, in, out, false) == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  s->shutdown = false;
+
+  while (!s->shutdown && (lfd != -1 || conns.length != 0))
+  {
+    size_t n = conns.length + (lfd != -1 ? 1 : 0);
+
+    if (n > cap)
+    {
+      struct pollfd* p = realloc (fds, n * sizeof (struct pollfd));
+
+      if (p == NULL)
+      {
+        errno = ENOMEM;
+        r = -1;
+        break;
+      }
+
+      fds = p;
+      cap = n;
+    }
+
+    pkg_config_node_t* i;
+    size_t j = 0;
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (conns.head, i)
+    {
+      const server_conn_t* c = i->data;
+
+      fds[j].fd = c->in;
+      fds[j].events = POLLIN;
+      fds[j++].revents = 0;
+    }
+
+    if (lfd != -1)
+    {
+      fds[j].fd = lfd;
+      fds[j].events = POLLIN;
+      fds[j].revents = 0;
+    }
+
+    if (poll (fds, (nfds_t)n, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+
+      r = -1;
+      break;
+    }
+
+    /* Handle the connections first since accepting adds to the list.
+     */
+    pkg_config_node_t* ti;
+    j = 0;
+
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY_SAFE (conns.head, ti, i)
+    {
+      server_conn_t* c = i->data;
+
+      if (fds[j++].revents != 0 && (s->shutdown || !server_read (s, c)))
+        server_conn_free (&conns, c);
+    }
+
+    if (lfd != -1 && fds[j].revents != 0 && !s->shutdown)
+    {
+      int fd = accept (lfd, NULL, NULL);
+
+      if (fd != -1)
+      {
+        fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+        if (server_conn_new (&conns, fd, fd, true) == NULL)
+          close (fd);
+      }
+      else if (errno != EINTR      &&
+               errno != EAGAIN     &&
+               errno != EWOULDBLOCK &&
+               errno != ECONNABORTED)
+      {
+        r = -1;
+        break;
+      }
+    }
+  }
+
+  int er = errno;
+
+  while (conns.head != NULL)
+    server_conn_free (&conns, conns.head->data);
+
+  free (fds);
+
+  errno = er;
+  return r;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_server_serve(pkg_config_server_t *server,
+ * int in, int out)
+ *
+ *    Serve a single connection, reading requests from the input file
+ *    descriptor and writing replies to the output file descriptor (which can
+ *    be the same), until the end of input. This is normally used to serve
+ *    the parent process over the standard input and output (the coprocess
+ *    mode). The file descriptors are not closed.
+ *
+ *    :param pkg_config_server_t* server: The server object to use.
+ *    :param int in: The file descriptor to read requests from.
+ *    :param int out: The file descriptor to write replies to.
+ *    :return: 0 on success or -1 on failure, in which case `errno` is set
+ *    (to ``ENOSYS`` if not supported on this platform).
+ *    :rtype: int
+ */
+int
+pkg_config_server_serve (pkg_config_server_t* s, int in, int out)
+{
+  return server_run (s, -1, in, out);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_server_listen(pkg_config_server_t *server,
+ * int fd)
+ *
+ *    Accept connections on the listening socket (normally a Unix domain
+ *    socket) and serve them until the ``shutdown`` request is received. The
+ *    socket is not closed.
+ *
+ *    :param pkg_config_server_t* server: The server object to use.
+ *    :param int fd: The listening socket.
+ *    :return: 0 on success or -1 on failure, in which case `errno` is set
+ *    (to ``ENOSYS`` if not supported on this platform).
+ *    :rtype: int
+ */
+int
+pkg_config_server_listen (pkg_config_server_t* s, int fd)
+{
+  return server_run (s, fd, -1, -1);
+}
+
+#else /* _WIN32 */
+
+pkg_config_server_t*
+pkg_config_server_new (void)
+{
+  errno = ENOSYS;
+  return NULL;
+}
+
+void
+pkg_config_server_free (pkg_config_server_t* s)
+{
+  (void)s;
+}
+
+void
+pkg_config_server_set_memory_limit (pkg_config_server_t* s, size_t limit)
+{
+  (void)s;
+  (void)limit;
+}
+
+int
+pkg_config_server_serve (pkg_config_server_t* s, int in, int out)
+{
+  (void)s;
+  (void)in;
+  (void)out;
+
+  errno = ENOSYS;
+  return -1;
+}
+
+int
+pkg_config_server_listen (pkg_config_server_t* s, int fd)
+{
+  (void)s;
+  (void)fd;
+
+  errno = ENOSYS;
+  return -1;
+}
+
+#endif /* _WIN32 */
@@ -26,6 +26,8 @@
 
 #include <libpkg-config/config.h>
 
+#include <libpkg-config/pkg-config.h>
+
 #include <ctype.h>
 #include <stdio.h>
 #include <assert.h>
@@ -60,7 +62,10 @@
 #else /* _WIN32 */
 
 # define PATH_DEV_NULL "/dev/null"
+# include <fcntl.h>
 # include <unistd.h>
+# include <dirent.h>
+# include <pthread.h>
 # include <limits.h>
 # ifdef PATH_MAX
 #  define PKG_CONFIG_ITEM_SIZE (PATH_MAX + 1024)
@@ -74,6 +79,11 @@
  */
 #define PKG_CONFIG_BUFSIZE (65535)
 
+/* Diagnostics message stack buffer size (longer messages are allocated, see
+ * client.c for details).
+ */
+#define PKG_CONFIG_DIAG_BUFSIZE (256)
+
 #define PKG_CONFIG_ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
 
 /* Hook NTRACE to NDEBUG. This both feels natural and gives us a way to
@@ -83,20 +93,43 @@
 #  define LIBPKG_CONFIG_NTRACE
 #endif
 
+/* Check for the trace handler inline so that neither the call nor the
+ * evaluation of the arguments is paid for if there is none.
+ */
 #ifndef LIBPKG_CONFIG_NTRACE
+#define PKG_CONFIG_TRACE_ENABLED(client)                                    \
+  ((client) != NULL &&                                                     \
+   ((client)->trace_handler != NULL ||                                     \
+    ((client)->diag_kinds & LIBPKG_CONFIG_DIAG_TRACE) != 0))
+
 #if defined(__GNUC__) || defined(__INTEL_COMPILER)
 #define PKG_CONFIG_TRACE(client, ...) do { \
-    pkg_config_trace(client, __FILE__, __LINE__, __PRETTY_FUNCTION__, __VA_ARGS__); \
+    if (PKG_CONFIG_TRACE_ENABLED (client)) \
+      pkg_config_trace(client, __FILE__, __LINE__, __PRETTY_FUNCTION__, __VA_ARGS__); \
   } while (0)
 #else
 #define PKG_CONFIG_TRACE(client, ...) do { \
-    pkg_config_trace(client, __FILE__, __LINE__, __func__, __VA_ARGS__);   \
+    if (PKG_CONFIG_TRACE_ENABLED (client)) \
+      pkg_config_trace(client, __FILE__, __LINE__, __func__, __VA_ARGS__);   \
   } while (0)
 #endif
 #else
 #define PKG_CONFIG_TRACE(client, ...) do {} while (0)
 #endif
 
+/* Report the span begin/end events (see trace.c for details). Check for the
+ * handler inline to keep the span essentially free if there is none.
+ */
+#define PKG_CONFIG_SPAN_BEGIN(client, kind, id) do {                      \
+    if ((client)->span_handler != NULL)                                  \
+      pkg_config_span_begin (client, LIBPKG_CONFIG_SPAN_##kind, id);     \
+  } while (0)
+
+#define PKG_CONFIG_SPAN_END(client, kind, id) do {                        \
+    if ((client)->span_handler != NULL)                                  \
+      pkg_config_span_end (client, LIBPKG_CONFIG_SPAN_##kind, id);       \
+  } while (0)
+
 #ifdef _WIN32
 #  undef PKG_CONFIG_DEFAULT_PATH
 #  define PKG_CONFIG_DEFAULT_PATH "../lib/pkgconfig;../share/pkgconfig"
@@ -108,4 +141,716 @@ extern size_t pkg_config_strlcpy(char *dst, const char *src, size_t siz);
 extern size_t pkg_config_strlcat(char *dst, const char *src, size_t siz);
 extern char *pkg_config_strndup(const char *src, size_t len);
 
+/* Internal (not exported) functions shared between modules.
+ */
+
+/* hash.c */
+typedef struct
+{
+  const void* key; /* Borrowed. */
+  size_t size;     /* Key size or 0 if the key is the pointer value itself. */
+  size_t hash;
+  void* value;
+} pkg_config_hash_entry_t;
+
+typedef struct pkg_config_hash_
+{
+  pkg_config_hash_entry_t* entries;
+  size_t capacity; /* 0 or power of 2. */
+  size_t count;
+
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
+} pkg_config_hash_t;
+
+#define PKG_CONFIG_HASH_INITIALIZER {NULL, 0, 0, NULL}
+
+size_t
+pkg_config_hash_bytes (const void* key, size_t size);
+void**
+pkg_config_hash_lookup (const pkg_config_hash_t* table,
+                        const void* key,
+                        size_t size);
+bool
+pkg_config_hash_insert (pkg_config_hash_t* table,
+                        const void* key,
+                        size_t size,
+                        void* value);
+bool
+pkg_config_hash_remove (pkg_config_hash_t* table,
+                        const void* key,
+                        size_t size);
+void
+pkg_config_hash_free (pkg_config_hash_t* table);
+
+/* watch.c */
+typedef struct pkg_config_watch_ pkg_config_watch_t;
+
+/* thread.c */
+#ifndef _WIN32
+typedef pthread_mutex_t pkg_config_mutex_t;
+typedef pthread_cond_t pkg_config_cond_t;
+
+typedef struct
+{
+  pthread_t handle;
+  void (*func) (void*);
+  void* arg;
+} pkg_config_thread_t;
+#else
+typedef CRITICAL_SECTION pkg_config_mutex_t;
+typedef CONDITION_VARIABLE pkg_config_cond_t;
+
+typedef struct
+{
+  HANDLE handle;
+  void (*func) (void*);
+  void* arg;
+} pkg_config_thread_t;
+#endif
+
+bool
+pkg_config_mutex_init (pkg_config_mutex_t* m);
+void
+pkg_config_mutex_destroy (pkg_config_mutex_t* m);
+void
+pkg_config_mutex_lock (pkg_config_mutex_t* m);
+void
+pkg_config_mutex_unlock (pkg_config_mutex_t* m);
+bool
+pkg_config_cond_init (pkg_config_cond_t* c);
+void
+pkg_config_cond_destroy (pkg_config_cond_t* c);
+void
+pkg_config_cond_wait (pkg_config_cond_t* c, pkg_config_mutex_t* m);
+void
+pkg_config_cond_signal (pkg_config_cond_t* c);
+void
+pkg_config_cond_broadcast (pkg_config_cond_t* c);
+
+/* The thread object must remain valid until joined.
+ */
+bool
+pkg_config_thread_create (pkg_config_thread_t* t,
+                          void (*func) (void*),
+                          void* arg);
+void
+pkg_config_thread_join (pkg_config_thread_t* t);
+unsigned int
+pkg_config_thread_hardware_concurrency (void);
+
+/* Atomic operations on int (used for reference counts). We cannot use C11
+ * atomic types since the counters are part of the public structures (which
+ * are also used from C++) and not all the supported compilers provide
+ * <stdatomic.h>. So we use the equivalent builtins/intrinsics on plain int
+ * objects.
+ *
+ * The increment is relaxed (a new reference can only be made from an
+ * existing one). The decrement is acquire/release so that all the accesses
+ * through the other references happen before the object is freed by the
+ * thread that drops the count to zero (we don't use a release decrement
+ * followed by an acquire fence since thread sanitizers do not understand
+ * fences).
+ */
+#if defined(_MSC_VER) && !defined(__clang__)
+static inline int
+pkg_config_atomic_load (const int* p)
+{
+  return *(const volatile int*)p;
+}
+
+static inline void
+pkg_config_atomic_inc (int* p)
+{
+  InterlockedIncrement ((volatile long*)p);
+}
+
+static inline int
+pkg_config_atomic_dec (int* p)
+{
+  return (int)InterlockedDecrement ((volatile long*)p); /* Full barrier. */
+}
+
+static inline bool
+pkg_config_atomic_cas (int* p, int expected, int desired)
+{
+  return InterlockedCompareExchange ((volatile long*)p, desired, expected) ==
+         expected;
+}
+#else
+static inline int
+pkg_config_atomic_load (const int* p)
+{
+  return __atomic_load_n (p, __ATOMIC_RELAXED);
+}
+
+static inline void
+pkg_config_atomic_inc (int* p)
+{
+  __atomic_fetch_add (p, 1, __ATOMIC_RELAXED);
+}
+
+static inline int
+pkg_config_atomic_dec (int* p)
+{
+  return __atomic_sub_fetch (p, 1, __ATOMIC_ACQ_REL);
+}
+
+static inline bool
+pkg_config_atomic_cas (int* p, int expected, int desired)
+{
+  return __atomic_compare_exchange_n (
+      p, &expected, desired, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+#endif
+
+/* Relaxed atomic operations on size_t (used for performance counters).
+ */
+#if defined(_MSC_VER) && !defined(__clang__)
+static inline size_t
+pkg_config_atomic_load_size (const size_t* p)
+{
+  return *(const volatile size_t*)p;
+}
+
+static inline void
+pkg_config_atomic_store_size (size_t* p, size_t v)
+{
+  *(volatile size_t*)p = v;
+}
+
+static inline void
+pkg_config_atomic_add_size (size_t* p, size_t n)
+{
+#  ifdef _WIN64
+  InterlockedExchangeAdd64 ((volatile LONG64*)p, (LONG64)n);
+#  else
+  InterlockedExchangeAdd ((volatile long*)p, (long)n);
+#  endif
+}
+
+static inline bool
+pkg_config_atomic_cas_size (size_t* p, size_t expected, size_t desired)
+{
+#  ifdef _WIN64
+  return (size_t)InterlockedCompareExchange64 (
+             (volatile LONG64*)p, (LONG64)desired, (LONG64)expected) ==
+         expected;
+#  else
+  return (size_t)InterlockedCompareExchange (
+             (volatile long*)p, (long)desired, (long)expected) == expected;
+#  endif
+}
+#else
+static inline size_t
+pkg_config_atomic_load_size (const size_t* p)
+{
+  return __atomic_load_n (p, __ATOMIC_RELAXED);
+}
+
+static inline void
+pkg_config_atomic_store_size (size_t* p, size_t v)
+{
+  __atomic_store_n (p, v, __ATOMIC_RELAXED);
+}
+
+static inline void
+pkg_config_atomic_add_size (size_t* p, size_t n)
+{
+  __atomic_fetch_add (p, n, __ATOMIC_RELAXED);
+}
+
+static inline bool
+pkg_config_atomic_cas_size (size_t* p, size_t expected, size_t desired)
+{
+  return __atomic_compare_exchange_n (
+      p, &expected, desired, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+#endif
+
+static inline void
+pkg_config_atomic_max_size (size_t* p, size_t v)
+{
+  size_t c;
+  while ((c = pkg_config_atomic_load_size (p)) < v &&
+         !pkg_config_atomic_cas_size (p, c, v))
+    ;
+}
+
+/* Update the client performance counters (see pkg_config_client_stats_t).
+ * The counters are updated atomically since the client can be used by
+ * multiple threads during the parallel dependency resolution (see
+ * resolve.c). Note that the client may be const.
+ *
+ * Unless LIBPKG_CONFIG_NSTATS is defined, the counters are maintained
+ * regardless of NDEBUG: an uncontended relaxed atomic increment is cheap
+ * compared to the work being counted (opening a file, allocating a
+ * fragment, etc) and the counters are meant to be available in production.
+ */
+#ifndef LIBPKG_CONFIG_NSTATS
+#define PKG_CONFIG_STATS_ADD(client, counter, n)                          \
+  pkg_config_atomic_add_size (                                            \
+    &((pkg_config_client_t*)(client))->stats.counter, (n))
+#define PKG_CONFIG_STATS_MAX(client, counter, v)                          \
+  pkg_config_atomic_max_size (                                            \
+    &((pkg_config_client_t*)(client))->stats.counter, (v))
+#else
+#define PKG_CONFIG_STATS_ADD(client, counter, n) ((void)0)
+#define PKG_CONFIG_STATS_MAX(client, counter, v) ((void)0)
+#endif
+
+#define PKG_CONFIG_STATS_INC(client, counter)                             \
+  PKG_CONFIG_STATS_ADD (client, counter, 1)
+
+/* Allocate and free memory with the allocator or with the C library if the
+ * allocator is NULL (see pkg_config_allocator_t). Objects should be freed
+ * with the allocator recorded in them rather than with the current client
+ * allocator, which may have changed since.
+ */
+static inline void*
+pkg_config_mem_alloc (const pkg_config_allocator_t* a, size_t n)
+{
+  return a == NULL ? malloc (n) : a->alloc (a->data, n);
+}
+
+static inline void*
+pkg_config_mem_calloc (const pkg_config_allocator_t* a, size_t c, size_t n)
+{
+  void* r;
+
+  if (a == NULL)
+    return calloc (c, n);
+
+  if (n != 0 && c > (size_t)-1 / n)
+    return NULL;
+
+  if ((r = a->alloc (a->data, c * n)) != NULL)
+    memset (r, 0, c * n);
+
+  return r;
+}
+
+static inline void*
+pkg_config_mem_realloc (const pkg_config_allocator_t* a, void* p, size_t n)
+{
+  return a == NULL ? realloc (p, n) : a->realloc (a->data, p, n);
+}
+
+static inline void
+pkg_config_mem_free (const pkg_config_allocator_t* a, void* p)
+{
+  if (a == NULL)
+    free (p);
+  else if (p != NULL)
+    a->free (a->data, p);
+}
+
+static inline char*
+pkg_config_mem_strndup (const pkg_config_allocator_t* a,
+                        const char* s,
+                        size_t n)
+{
+  const char* e;
+  char* r;
+
+  if (a == NULL)
+    return pkg_config_strndup (s, n);
+
+  if ((e = memchr (s, '\0', n)) != NULL)
+    n = (size_t)(e - s);
+
+  if ((r = a->alloc (a->data, n + 1)) != NULL)
+  {
+    memcpy (r, s, n);
+    r[n] = '\0';
+  }
+
+  return r;
+}
+
+static inline char*
+pkg_config_mem_strdup (const pkg_config_allocator_t* a, const char* s)
+{
+  return a == NULL ? strdup (s) : pkg_config_mem_strndup (a, s, strlen (s));
+}
+
+/* argvsplit.c */
+int
+pkg_config_argv_split_with (const pkg_config_allocator_t* a,
+                            const char* src,
+                            int* argc,
+                            char*** argv);
+void
+pkg_config_argv_free_with (const pkg_config_allocator_t* a, char** argv);
+
+/* path.c */
+
+/* The client may be NULL, in which case the C library allocator is used
+ * and nothing is cached (see path.c for details).
+ */
+void
+pkg_config_path_add_with (pkg_config_client_t* client,
+                          const char* text,
+                          pkg_config_list_t* dirlist,
+                          bool filter);
+size_t
+pkg_config_path_split_with (pkg_config_client_t* client,
+                            const char* text,
+                            pkg_config_list_t* dirlist,
+                            bool filter);
+size_t
+pkg_config_path_build_from_environ_with (pkg_config_client_t* client,
+                                         const char* envvarname,
+                                         const char* fallback,
+                                         pkg_config_list_t* dirlist,
+                                         bool filter);
+void
+pkg_config_path_copy_list_with (const pkg_config_allocator_t* a,
+                                pkg_config_list_t* dst,
+                                const pkg_config_list_t* src);
+
+typedef struct pkg_config_path_cache_ pkg_config_path_cache_t;
+
+void
+pkg_config_path_cache_reset (pkg_config_path_cache_t* cache);
+void
+pkg_config_path_cache_free (pkg_config_path_cache_t* cache);
+
+/* Search directory handles (pkg_config_path_t::dir_fd values).
+ */
+#define PKG_CONFIG_DIR_FD_NONE   (-1) /* Not opened yet. */
+#define PKG_CONFIG_DIR_FD_FAILED (-2) /* Could not be opened. */
+
+#if !defined(_WIN32) && defined(O_DIRECTORY)
+#  define PKG_CONFIG_DIR_FDS
+int
+pkg_config_path_dir_fd (pkg_config_path_t* node);
+#endif
+
+void
+pkg_config_path_close_dirs (pkg_config_list_t* dirlist);
+
+/* loader.c */
+
+/* The loader is only supported on Linux and reads the files relative to the
+ * search directory handles.
+ */
+#if defined(__linux__) && defined(PKG_CONFIG_DIR_FDS)
+#  define PKG_CONFIG_LOADER
+
+typedef struct pkg_config_loader_ pkg_config_loader_t;
+
+/* Value of pkg_config_load_t::error for a file that should be read the
+ * usual way.
+ */
+#define PKG_CONFIG_LOAD_FALLBACK (-1)
+
+/* Number of files the callers load at a time (to bound the memory used by
+ * the buffers).
+ */
+#define PKG_CONFIG_LOAD_BATCH 64
+
+typedef struct
+{
+  const char* name; /* File name relative to the directory. */
+
+  /* If read, 0 and the file contents (which the caller should free with
+   * the allocator) and identity (device, inode, size, and modification
+   * time). Otherwise, the errno value if the file could not be opened or
+   * PKG_CONFIG_LOAD_FALLBACK.
+   */
+  int error;
+  char* buf;
+  size_t size;
+  struct stat st;
+
+  const pkg_config_allocator_t* allocator; /* NULL means C library. */
+} pkg_config_load_t;
+
+/* Return NULL if batch loading is not available or disabled.
+ */
+pkg_config_loader_t*
+pkg_config_loader_new (const pkg_config_client_t* client);
+
+/* Return the client's loader (see pkg_config_client_t::loader), creating it
+ * on the first call, or NULL if batch loading is not available or disabled.
+ */
+pkg_config_loader_t*
+pkg_config_loader_get (pkg_config_client_t* client);
+void
+pkg_config_loader_free (pkg_config_loader_t* loader);
+void
+pkg_config_loader_load (pkg_config_loader_t* loader,
+                        const pkg_config_client_t* client,
+                        pkg_config_path_t* dir,
+                        pkg_config_load_t* loads,
+                        size_t count);
+#endif
+
+/* client.c */
+void
+pkg_config_client_merge_stats (pkg_config_client_t* client,
+                               const pkg_config_client_stats_t* stats);
+
+/* parser.c */
+
+/* Package file line split into key, separator, and value (see
+ * pkg_config_parser_lex()). The key and value are offsets into the source
+ * buffer.
+ */
+typedef struct
+{
+  size_t lineno;
+  size_t key;
+  size_t value;
+  char op;
+  bool trailing_ws; /* Trailing whitespace was stripped from the value. */
+} pkg_config_source_line_t;
+
+/* Package file split into lines. This is the part of parsing that does not
+ * depend on the client configuration and can be shared between clients
+ * (see pkg_config_source_cache_t).
+ */
+typedef struct
+{
+  /* Source cache entry data: the file path and identity (the same as in
+   * pkg_config_pkg_t) as well as the number of references, protected by the
+   * cache mutex.
+   */
+  char* filename;
+  uint64_t file_dev;
+  uint64_t file_ino;
+  uint64_t file_size;
+  int64_t file_mtime;
+  size_t refs;
+
+  char* buf;
+  size_t size;
+
+  pkg_config_source_line_t* lines;
+  size_t lines_count;
+} pkg_config_source_t;
+
+/* Sources shared between a client and its clones (see
+ * pkg_config_client_clone()). Sources are keyed by the file path and are
+ * only used if the file identity matches.
+ */
+typedef struct pkg_config_source_cache_
+{
+  pkg_config_mutex_t mutex;
+  size_t refs;               /* Number of clients sharing the cache. */
+  pkg_config_hash_t sources; /* Path to pkg_config_source_t*. */
+} pkg_config_source_cache_t;
+
+unsigned int
+pkg_config_parser_lex (pkg_config_client_t* client,
+                       FILE* f,
+                       const char* filename,
+                       pkg_config_source_t** result);
+unsigned int
+pkg_config_parser_apply (pkg_config_client_t* client,
+                         const pkg_config_source_t* src,
+                         void* data,
+                         const pkg_config_parser_operand_func_t* ops,
+                         size_t ops_count,
+                         const char* filename);
+void
+pkg_config_source_free (pkg_config_source_t* src);
+
+pkg_config_source_cache_t*
+pkg_config_source_cache_new (void);
+pkg_config_source_cache_t*
+pkg_config_source_cache_ref (pkg_config_source_cache_t* cache);
+void
+pkg_config_source_cache_unref (pkg_config_source_cache_t* cache);
+pkg_config_source_t*
+pkg_config_source_cache_find (pkg_config_source_cache_t* cache,
+                              const pkg_config_pkg_t* pkg);
+void
+pkg_config_source_cache_add (pkg_config_source_cache_t* cache,
+                             const pkg_config_pkg_t* pkg,
+                             pkg_config_source_t* src);
+void
+pkg_config_source_cache_release (pkg_config_source_cache_t* cache,
+                                 pkg_config_source_t* src);
+
+/* resolve.c */
+
+/* State shared between threads while pkg_config_pkg_resolve() is in progress
+ * (see pkg_config_client_t::resolver).
+ */
+typedef struct pkg_config_resolver_
+{
+  /* Guards the package cache, dependency matches, and releasing of the last
+   * package references (see resolve.c for details).
+   */
+  pkg_config_mutex_t cache_lock;
+
+  /* Serializes calls to the diagnostics handlers.
+   */
+  pkg_config_mutex_t diag_lock;
+} pkg_config_resolver_t;
+
+static inline void
+pkg_config_cache_lock (const pkg_config_client_t* client)
+{
+  if (client->resolver != NULL)
+    pkg_config_mutex_lock (&client->resolver->cache_lock);
+}
+
+static inline void
+pkg_config_cache_unlock (const pkg_config_client_t* client)
+{
+  if (client->resolver != NULL)
+    pkg_config_mutex_unlock (&client->resolver->cache_lock);
+}
+
+pkg_config_pkg_t*
+pkg_config_resolve_find (pkg_config_client_t* client,
+                         const char* name,
+                         unsigned int* eflags);
+
+/* cache.c */
+#define PKG_CONFIG_CACHE_RESULT_CFLAGS 1
+#define PKG_CONFIG_CACHE_RESULT_LIBS   2
+
+pkg_config_pkg_t*
+pkg_config_cache_find (pkg_config_client_t* client, const char* id);
+
+const pkg_config_list_t*
+pkg_config_cache_result_lookup (const pkg_config_client_t* client,
+                                const pkg_config_pkg_t* root,
+                                unsigned int kind,
+                                unsigned int flags,
+                                int maxdepth);
+void
+pkg_config_cache_result_add (pkg_config_client_t* client,
+                             const pkg_config_pkg_t* root,
+                             unsigned int kind,
+                             unsigned int flags,
+                             int maxdepth,
+                             const pkg_config_list_t* frags);
+void
+pkg_config_cache_result_free (pkg_config_client_t* client);
+void
+pkg_config_cache_result_drop (pkg_config_client_t* client,
+                              const pkg_config_pkg_t* root);
+
+bool
+pkg_config_cache_set_match (pkg_config_client_t* client,
+                            pkg_config_dependency_t* dep,
+                            pkg_config_pkg_t* pkg);
+void
+pkg_config_cache_unindex_match (pkg_config_client_t* client,
+                                pkg_config_dependency_t* dep);
+unsigned int
+pkg_config_cache_invalidate (pkg_config_client_t* client,
+                             bool (*pred) (const pkg_config_pkg_t*, void*),
+                             void* data);
+
+/* pkg.c */
+
+/* Flags that are taken from the traversal context rather than from the
+ * client (see pkg_config_traversal_init() for details).
+ */
+#define PKG_CONFIG_TRAVERSAL_FLAGS                                           \
+  (LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE |                                   \
+   LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS |                            \
+   LIBPKG_CONFIG_PKG_PKGF_SKIP_CONFLICTS |                                   \
+   LIBPKG_CONFIG_PKG_PKGF_SKIP_ERRORS |                                      \
+   LIBPKG_CONFIG_PKG_PKGF_NO_CACHE |                                         \
+   LIBPKG_CONFIG_PKG_PKGF_DONT_FILTER_INTERNAL_CFLAGS)
+
+/* Return the flags that determine the traversal result (the memoized result
+ * and graph cache key).
+ */
+static inline unsigned int
+pkg_config_traversal_result_flags (const pkg_config_traversal_t* t)
+{
+  return (t->client->flags & ~PKG_CONFIG_TRAVERSAL_FLAGS) |
+         (t->flags & PKG_CONFIG_TRAVERSAL_FLAGS);
+}
+
+bool
+pkg_config_pkg_file_changed (const pkg_config_pkg_t* pkg);
+bool
+pkg_config_pkg_unref_shared (pkg_config_pkg_t* pkg);
+pkg_config_pkg_t*
+pkg_config_pkg_find_in_dirs (pkg_config_client_t* client,
+                             const char* name,
+                             unsigned int* eflags);
+bool
+pkg_config_pkg_find_all_in_dirs (pkg_config_client_t* client,
+                                 const char* const* names,
+                                 size_t count,
+                                 pkg_config_pkg_t** pkgs);
+
+/* Version string pre-split into segments for repeated comparison. Separators
+ * are dropped, numeric segments are stored without leading zeros (and as
+ * integers, if they fit), and each '~' is a segment of its own.
+ */
+#define PKG_CONFIG_VERSION_SEG_TILDE  0
+#define PKG_CONFIG_VERSION_SEG_NUMBER 1
+#define PKG_CONFIG_VERSION_SEG_ALPHA  2
+
+/* Maximum number of digits in a segment that is stored as an integer.
+ */
+#define PKG_CONFIG_VERSION_NUMBER_DIGITS 19
+
+typedef struct
+{
+  const char* str; /* Segment characters in the version string. */
+  size_t size;
+  uint64_t number; /* Value if numeric and not too long, 0 otherwise. */
+  unsigned int type;
+} pkg_config_version_segment_t;
+
+typedef struct pkg_config_version_
+{
+  const char* str; /* Borrowed version string. */
+  size_t size;
+  size_t count;
+  pkg_config_version_segment_t segments[];
+} pkg_config_version_t;
+
+pkg_config_version_t*
+pkg_config_version_parse (const pkg_config_allocator_t* a, const char* str);
+int
+pkg_config_version_compare (const pkg_config_version_t* a,
+                            const pkg_config_version_t* b);
+
+pkg_config_dependency_t*
+pkg_config_pkg_find_conflict (pkg_config_client_t* client,
+                              const pkg_config_pkg_t* root,
+                              pkg_config_pkg_t** conflict);
+void
+pkg_config_pkg_report_conflict (pkg_config_client_t* client,
+                                const pkg_config_pkg_t* root,
+                                const pkg_config_dependency_t* parentnode,
+                                const pkg_config_pkg_t* pkgdep);
+unsigned int
+pkg_config_pkg_report_graph_error (pkg_config_client_t* client,
+                                   const pkg_config_pkg_t* parent,
+                                   pkg_config_pkg_t* pkg,
+                                   const pkg_config_dependency_t* node,
+                                   unsigned int eflags);
+void
+pkg_config_pkg_cflags_collect (const pkg_config_traversal_t* t,
+                               pkg_config_pkg_t* pkg,
+                               void* data);
+void
+pkg_config_pkg_cflags_private_collect (const pkg_config_traversal_t* t,
+                                       pkg_config_pkg_t* pkg,
+                                       void* data);
+void
+pkg_config_pkg_libs_collect (const pkg_config_traversal_t* t,
+                             pkg_config_pkg_t* pkg,
+                             void* data);
+
+/* graph.c */
+void
+pkg_config_graph_cache_free (pkg_config_client_t* client);
+void
+pkg_config_graph_cache_drop (pkg_config_client_t* client,
+                             const pkg_config_hash_t* pkgs);
+
 #endif /* LIBPKG_CONFIG_STDINC_H */
@@ -0,0 +1,222 @@
+/*
+ * thread.c
+ * threading primitives
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+/* Thin portability layer over POSIX threads and the Windows (Vista and
+ * later) threading API. Only what is needed internally is provided.
+ */
+
+#ifndef _WIN32
+
+bool
+pkg_config_mutex_init (pkg_config_mutex_t* m)
+{
+  return pthread_mutex_init (m, NULL) == 0;
+}
+
+void
+pkg_config_mutex_destroy (pkg_config_mutex_t* m)
+{
+  pthread_mutex_destroy (m);
+}
+
+void
+pkg_config_mutex_lock (pkg_config_mutex_t* m)
+{
+  int r = pthread_mutex_lock (m);
+  assert (r == 0);
+  (void)r;
+}
+
+void
+pkg_config_mutex_unlock (pkg_config_mutex_t* m)
+{
+  int r = pthread_mutex_unlock (m);
+  assert (r == 0);
+  (void)r;
+}
+
+bool
+pkg_config_cond_init (pkg_config_cond_t* c)
+{
+  return pthread_cond_init (c, NULL) == 0;
+}
+
+void
+pkg_config_cond_destroy (pkg_config_cond_t* c)
+{
+  pthread_cond_destroy (c);
+}
+
+void
+pkg_config_cond_wait (pkg_config_cond_t* c, pkg_config_mutex_t* m)
+{
+  int r = pthread_cond_wait (c, m);
+  assert (r == 0);
+  (void)r;
+}
+
+void
+pkg_config_cond_signal (pkg_config_cond_t* c)
+{
+  pthread_cond_signal (c);
+}
+
+void
+pkg_config_cond_broadcast (pkg_config_cond_t* c)
+{
+  pthread_cond_broadcast (c);
+}
+
+static void*
+thread_start (void* arg)
+{
+  pkg_config_thread_t* t = arg;
+  t->func (t->arg);
+  return NULL;
+}
+
+bool
+pkg_config_thread_create (pkg_config_thread_t* t,
+                          void (*func) (void*),
+                          void* arg)
+{
+  t->func = func;
+  t->arg = arg;
+
+  return pthread_create (&t->handle, NULL, thread_start, t) == 0;
+}
+
+void
+pkg_config_thread_join (pkg_config_thread_t* t)
+{
+  pthread_join (t->handle, NULL);
+}
+
+unsigned int
+pkg_config_thread_hardware_concurrency (void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (unsigned int)n : 1;
+#else
+  return 1;
+#endif
+}
+
+#else /* _WIN32 */
+
+bool
+pkg_config_mutex_init (pkg_config_mutex_t* m)
+{
+  InitializeCriticalSection (m);
+  return true;
+}
+
+void
+pkg_config_mutex_destroy (pkg_config_mutex_t* m)
+{
+  DeleteCriticalSection (m);
+}
+
+void
+pkg_config_mutex_lock (pkg_config_mutex_t* m)
+{
+  EnterCriticalSection (m);
+}
+
+void
+pkg_config_mutex_unlock (pkg_config_mutex_t* m)
+{
+  LeaveCriticalSection (m);
+}
+
+bool
+pkg_config_cond_init (pkg_config_cond_t* c)
+{
+  InitializeConditionVariable (c);
+  return true;
+}
+
+void
+pkg_config_cond_destroy (pkg_config_cond_t* c)
+{
+  (void)c; /* Nothing to destroy. */
+}
+
+void
+pkg_config_cond_wait (pkg_config_cond_t* c, pkg_config_mutex_t* m)
+{
+  SleepConditionVariableCS (c, m, INFINITE);
+}
+
+void
+pkg_config_cond_signal (pkg_config_cond_t* c)
+{
+  WakeConditionVariable (c);
+}
+
+void
+pkg_config_cond_broadcast (pkg_config_cond_t* c)
+{
+  WakeAllConditionVariable (c);
+}
+
+static DWORD WINAPI
+thread_start (LPVOID arg)
+{
+  pkg_config_thread_t* t = arg;
+  t->func (t->arg);
+  return 0;
+}
+
+bool
+pkg_config_thread_create (pkg_config_thread_t* t,
+                          void (*func) (void*),
+                          void* arg)
+{
+  t->func = func;
+  t->arg = arg;
+  t->handle = CreateThread (NULL, 0, thread_start, t, 0, NULL);
+
+  return t->handle != NULL;
+}
+
+void
+pkg_config_thread_join (pkg_config_thread_t* t)
+{
+  WaitForSingleObject (t->handle, INFINITE);
+  CloseHandle (t->handle);
+}
+
+unsigned int
+pkg_config_thread_hardware_concurrency (void)
+{
+  SYSTEM_INFO si;
+  GetSystemInfo (&si);
+  return si.dwNumberOfProcessors > 0 ? (unsigned int)si.dwNumberOfProcessors
+                                     : 1;
+}
+
+#endif /* _WIN32 */
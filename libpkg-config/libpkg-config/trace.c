@@ -0,0 +1,330 @@
+/*
+ * trace.c
+ * structured trace spans
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+#include <inttypes.h> /* PRIu64 */
+
+#ifndef _WIN32
+#  include <time.h> /* clock_gettime() */
+#endif
+
+/*
+ * !doc
+ *
+ * libpkg-config `trace` module
+ * ============================
+ *
+ * Besides the free-form trace messages (see pkg_config_trace()), the library
+ * reports the timed spans of its work: finding a package, parsing its file,
+ * expanding its variables and fields, traversing a dependency graph, and
+ * rendering the flags. Each span is reported to the client's span handler
+ * (see pkg_config_client_set_span_handler()) as a pair of the begin and end
+ * events with the monotonic timestamps, the span kind, and the package id
+ * (or the name being searched for, in case of the find spans). The spans of
+ * a thread are properly nested.
+ *
+ * The span handler calls are serialized during the parallel dependency
+ * resolution, the same as the diagnostics handler calls. Note also that
+ * unlike the trace messages, the spans are not disabled with
+ * LIBPKG_CONFIG_NTRACE: without a handler a span costs a pointer check.
+ *
+ * The module also provides the span handler that writes the spans as
+ * Chrome trace events (JSON) which can be loaded into chrome://tracing or
+ * Perfetto (see pkg_config_chrome_trace_open()).
+ */
+
+static uint64_t
+span_time (void)
+{
+#ifndef _WIN32
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+#else
+  static LARGE_INTEGER f; /* Ticks per second (never changes). */
+  LARGE_INTEGER c;
+
+  if (f.QuadPart == 0)
+    QueryPerformanceFrequency (&f);
+
+  QueryPerformanceCounter (&c);
+
+  /* Split to avoid overflowing for large counter values.
+   */
+  uint64_t t = (uint64_t)c.QuadPart;
+  uint64_t q = (uint64_t)f.QuadPart;
+  return t / q * 1000000000 + t % q * 1000000000 / q;
+#endif
+}
+
+static uint64_t
+span_thread (void)
+{
+#ifndef _WIN32
+  return (uint64_t)(uintptr_t)pthread_self ();
+#else
+  return (uint64_t)GetCurrentThreadId ();
+#endif
+}
+
+static void
+span_report (const pkg_config_client_t* client,
+             unsigned int kind,
+             bool end,
+             const char* id)
+{
+  pkg_config_span_t s;
+  s.kind = kind;
+  s.end = end;
+  s.id = id != NULL ? id : "";
+  s.time = span_time ();
+  s.thread = span_thread ();
+
+  if (client->resolver != NULL)
+    pkg_config_mutex_lock (&client->resolver->diag_lock);
+
+  client->span_handler (&s, client, client->span_handler_data);
+
+  if (client->resolver != NULL)
+    pkg_config_mutex_unlock (&client->resolver->diag_lock);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_span_begin(const pkg_config_client_t
+ * *client, unsigned int kind, const char *id)
+ *
+ *    Report the beginning of a span to the client's span handler, if any.
+ *    Besides the library itself, the application can report its own spans
+ *    (for example, the rendering of the flags it has collected).
+ *
+ *    :param pkg_config_client_t* client: The client object to report the
+ *    span to.
+ *    :param uint kind: The span kind (one of ``LIBPKG_CONFIG_SPAN_*``).
+ *    :param char* id: The package id or NULL.
+ *    :return: nothing
+ */
+void
+pkg_config_span_begin (const pkg_config_client_t* client,
+                       unsigned int kind,
+                       const char* id)
+{
+  if (client != NULL && client->span_handler != NULL)
+    span_report (client, kind, false /* end */, id);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_span_end(const pkg_config_client_t
+ * *client, unsigned int kind, const char *id)
+ *
+ *    Report the end of a span begun with pkg_config_span_begin() to the
+ *    client's span handler, if any.
+ *
+ *    :param pkg_config_client_t* client: The client object to report the
+ *    span to.
+ *    :param uint kind: The span kind (one of ``LIBPKG_CONFIG_SPAN_*``).
+ *    :param char* id: The package id or NULL.
+ *    :return: nothing
+ */
+void
+pkg_config_span_end (const pkg_config_client_t* client,
+                     unsigned int kind,
+                     const char* id)
+{
+  if (client != NULL && client->span_handler != NULL)
+    span_report (client, kind, true /* end */, id);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const char *pkg_config_span_kind_name(unsigned int kind)
+ *
+ *    Return the span kind name (``find``, ``parse``, ``expand``,
+ *    ``traverse``, or ``render``).
+ *
+ *    :param uint kind: The span kind (one of ``LIBPKG_CONFIG_SPAN_*``).
+ *    :return: The span kind name or ``unknown``.
+ *    :rtype: const char *
+ */
+const char*
+pkg_config_span_kind_name (unsigned int kind)
+{
+  switch (kind)
+  {
+  case LIBPKG_CONFIG_SPAN_FIND:     return "find";
+  case LIBPKG_CONFIG_SPAN_PARSE:    return "parse";
+  case LIBPKG_CONFIG_SPAN_EXPAND:   return "expand";
+  case LIBPKG_CONFIG_SPAN_TRAVERSE: return "traverse";
+  case LIBPKG_CONFIG_SPAN_RENDER:   return "render";
+  }
+
+  return "unknown";
+}
+
+/* Chrome trace event sink.
+ *
+ * The events are written in the JSON array format, one per line, with the
+ * timestamps in microseconds relative to the sink creation. The sink may be
+ * shared by multiple clients used from different threads.
+ */
+struct pkg_config_chrome_trace_
+{
+  FILE* out;
+  uint64_t start;
+  bool first;
+
+  pkg_config_mutex_t mutex;
+};
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkg_config_chrome_trace_t *pkg_config_chrome_trace_open(FILE
+ * *out)
+ *
+ *    Create the span sink that writes the spans to the stream as Chrome
+ *    trace events. To use it, set pkg_config_chrome_trace_handler() as the
+ *    client's span handler with the sink as the handler data. The stream
+ *    must remain open until the sink is closed.
+ *
+ *    :param FILE* out: The stream to write the events to.
+ *    :return: The sink or NULL if unable to allocate memory.
+ *    :rtype: pkg_config_chrome_trace_t *
+ */
+pkg_config_chrome_trace_t*
+pkg_config_chrome_trace_open (FILE* out)
+{
+  pkg_config_chrome_trace_t* t =
+      calloc (1, sizeof (pkg_config_chrome_trace_t));
+
+  if (t == NULL)
+    return NULL;
+
+  if (!pkg_config_mutex_init (&t->mutex))
+  {
+    free (t);
+    return NULL;
+  }
+
+  t->out = out;
+  t->start = span_time ();
+  t->first = true;
+
+  fputs ("[", out);
+  return t;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_chrome_trace_close(pkg_config_chrome_trace_t
+ * *trace)
+ *
+ *    Finish writing the events and free the sink. The stream is not closed.
+ *    The sink must no longer be used by any client.
+ *
+ *    :param pkg_config_chrome_trace_t* trace: The sink to close.
+ *    :return: nothing
+ */
+void
+pkg_config_chrome_trace_close (pkg_config_chrome_trace_t* trace)
+{
+  fputs ("\n]\n", trace->out);
+  fflush (trace->out);
+
+  pkg_config_mutex_destroy (&trace->mutex);
+  free (trace);
+}
+
+/* Write the string as a JSON string literal.
+ */
+static void
+chrome_trace_string (FILE* out, const char* s)
+{
+  fputc ('"', out);
+
+  for (; *s != '\0'; ++s)
+  {
+    unsigned char c = (unsigned char)*s;
+
+    if (c == '"' || c == '\\')
+    {
+      fputc ('\\', out);
+      fputc (c, out);
+    }
+    else if (c < 0x20)
+      fprintf (out, "\\u%04x", c);
+    else
+      fputc (c, out);
+  }
+
+  fputc ('"', out);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_chrome_trace_handler(const
+ * pkg_config_span_t *span, const pkg_config_client_t *client, void *data)
+ *
+ *    The span handler that writes the span event to the Chrome trace sink
+ *    passed as the handler data (see pkg_config_chrome_trace_open()).
+ *
+ *    :param pkg_config_span_t* span: The span event.
+ *    :param pkg_config_client_t* client: The client reporting the span.
+ *    :param void* data: The sink.
+ *    :return: nothing
+ */
+void
+pkg_config_chrome_trace_handler (const pkg_config_span_t* span,
+                                 const pkg_config_client_t* client,
+                                 void* data)
+{
+  pkg_config_chrome_trace_t* t = data;
+  uint64_t ts = span->time > t->start ? span->time - t->start : 0;
+
+  (void)client;
+
+  pkg_config_mutex_lock (&t->mutex);
+
+  fputs (t->first ? "\n" : ",\n", t->out);
+  t->first = false;
+
+  fputs ("{\"name\":", t->out);
+  chrome_trace_string (t->out, span->id);
+  fprintf (t->out,
+           ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03u,"
+           "\"pid\":1,\"tid\":%" PRIu64 "}",
+           pkg_config_span_kind_name (span->kind),
+           span->end ? 'E' : 'B',
+           ts / 1000,
+           (unsigned int)(ts % 1000),
+           span->thread);
+
+  pkg_config_mutex_unlock (&t->mutex);
+}
@@ -122,9 +122,12 @@ pkg_config_tuple_free_global (pkg_config_client_t* client)
 void
 pkg_config_tuple_define_global (pkg_config_client_t* client, const char* kv)
 {
-  char* workbuf = strdup (kv);
+  char* workbuf = pkg_config_mem_strdup (client->allocator, kv);
   char* value;
 
+  if (workbuf == NULL)
+    return;
+
   value = strchr (workbuf, '=');
   if (value == NULL)
     goto out;
@@ -132,7 +135,7 @@ pkg_config_tuple_define_global (pkg_config_client_t* client, const char* kv)
   *value++ = '\0';
   pkg_config_tuple_add_global (client, workbuf, value);
 out:
-  free (workbuf);
+  pkg_config_mem_free (client->allocator, workbuf);
 }
 
 static void
@@ -153,9 +156,9 @@ pkg_config_tuple_find_delete (pkg_config_list_t* list, const char* key)
 }
 
 static char*
-dequote (const char* value)
+dequote (const pkg_config_allocator_t* a, const char* value)
 {
-  char* buf = calloc ((strlen (value) + 1) * 2, 1);
+  char* buf = pkg_config_mem_calloc (a, (strlen (value) + 1) * 2, 1);
   char* bptr = buf;
   const char* i;
   char quote = 0;
@@ -200,12 +203,16 @@ pkg_config_tuple_add (const pkg_config_client_t* client,
                       const char* value,
                       bool parse)
 {
+  const pkg_config_allocator_t* a = client->allocator;
   char* dequote_value;
-  pkg_config_tuple_t* tuple = calloc (1, sizeof (pkg_config_tuple_t));
+  pkg_config_tuple_t* tuple =
+      pkg_config_mem_calloc (a, 1, sizeof (pkg_config_tuple_t));
 
+  PKG_CONFIG_STATS_INC (client, allocations);
   pkg_config_tuple_find_delete (list, key);
 
-  dequote_value = dequote (value);
+  tuple->allocator = a;
+  dequote_value = dequote (a, value);
 
   PKG_CONFIG_TRACE (client,
                     "adding tuple to @%p: %s => %s (parsed? %d)",
@@ -214,15 +221,15 @@ pkg_config_tuple_add (const pkg_config_client_t* client,
                     dequote_value,
                     parse);
 
-  tuple->key = strdup (key);
+  tuple->key = pkg_config_mem_strdup (a, key);
   if (parse)
     tuple->value = pkg_config_tuple_parse (client, list, dequote_value);
   else
-    tuple->value = strdup (dequote_value);
+    tuple->value = pkg_config_mem_strdup (a, dequote_value);
 
   pkg_config_list_insert (&tuple->iter, tuple, list);
 
-  free (dequote_value);
+  pkg_config_mem_free (a, dequote_value);
 
   return tuple;
 }
@@ -262,24 +269,14 @@ pkg_config_tuple_find (const pkg_config_client_t* client,
   return NULL;
 }
 
-/*
- * !doc
- *
- * .. c:function:: char *pkg_config_tuple_parse(const pkg_config_client_t
- * *client, pkg_config_list_t *vars, const char *value)
- *
- *    Parse an expression for variable substitution.
- *
- *    :param pkg_config_client_t* client: The pkg-config client object to
- * access. :param pkg_config_list_t* list: The variable list to search for
- * variables (along side the global variable list). :param char* value: The
- * ``key=value`` string to parse. :return: the variable data with any
- * variables substituted :rtype: char *
+/* Parse the value at the specified variable expansion nesting depth (0 for
+ * the top-level value).
  */
-char*
-pkg_config_tuple_parse (const pkg_config_client_t* client,
-                        pkg_config_list_t* vars,
-                        const char* value)
+static char*
+tuple_parse (const pkg_config_client_t* client,
+             pkg_config_list_t* vars,
+             const char* value,
+             size_t depth)
 {
   /* Allocate the buffer dynamically to make sure it will at least fit the
      value provided it has no expansions. */
@@ -289,7 +286,7 @@ pkg_config_tuple_parse (const pkg_config_client_t* client,
   if (bufn < PKG_CONFIG_BUFSIZE)
     bufn = PKG_CONFIG_BUFSIZE;
 
-  buf = malloc (bufn);
+  buf = pkg_config_mem_alloc (client->allocator, bufn);
 
   const char* ptr;
   char* bptr = buf;
@@ -337,6 +334,9 @@ pkg_config_tuple_parse (const pkg_config_client_t* client,
       ptr += (pptr - ptr);
       size_t n = bufn - (bptr - buf) - 1; /* Available. */
 
+      PKG_CONFIG_STATS_INC (client, var_expansions);
+      PKG_CONFIG_STATS_MAX (client, var_max_depth, depth + 1);
+
       kv = pkg_config_tuple_find_global (client, varname);
       if (kv != NULL)
       {
@@ -350,13 +350,13 @@ pkg_config_tuple_parse (const pkg_config_client_t* client,
 
         if (kv != NULL)
         {
-          parsekv = pkg_config_tuple_parse (client, vars, kv);
+          parsekv = tuple_parse (client, vars, kv, depth + 1);
 
           size_t l = strlen (parsekv);
           strncpy (bptr, parsekv, n);
           bptr += l < n ? l : n;
 
-          free (parsekv);
+          pkg_config_mem_free (client->allocator, parsekv);
         }
       }
     }
@@ -397,15 +397,38 @@ pkg_config_tuple_parse (const pkg_config_client_t* client,
         cleanpath, buf + strlen (client->sysroot_dir), sizeof cleanpath);
     pkg_config_path_relocate (cleanpath, sizeof cleanpath);
 
-    result = strdup (cleanpath);
+    result = pkg_config_mem_strdup (client->allocator, cleanpath);
   }
   else
-    result = strdup (buf);
+    result = pkg_config_mem_strdup (client->allocator, buf);
 
-  free (buf);
+  pkg_config_mem_free (client->allocator, buf);
   return result;
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkg_config_tuple_parse(const pkg_config_client_t
+ * *client, pkg_config_list_t *vars, const char *value)
+ *
+ *    Parse an expression for variable substitution.
+ *
+ *    :param pkg_config_client_t* client: The pkg-config client object to
+ * access. :param pkg_config_list_t* list: The variable list to search for
+ * variables (along side the global variable list). :param char* value: The
+ * ``key=value`` string to parse. :return: the variable data with any
+ * variables substituted, allocated with the client allocator (see
+ * pkg_config_client_set_allocator()) :rtype: char *
+ */
+char*
+pkg_config_tuple_parse (const pkg_config_client_t* client,
+                        pkg_config_list_t* vars,
+                        const char* value)
+{
+  return tuple_parse (client, vars, value, 0);
+}
+
 /*
  * !doc
  *
@@ -423,11 +446,13 @@ void
 pkg_config_tuple_free_entry (pkg_config_tuple_t* tuple,
                              pkg_config_list_t* list)
 {
+  const pkg_config_allocator_t* a = tuple->allocator;
+
   pkg_config_list_delete (&tuple->iter, list);
 
-  free (tuple->key);
-  free (tuple->value);
-  free (tuple);
+  pkg_config_mem_free (a, tuple->key);
+  pkg_config_mem_free (a, tuple->value);
+  pkg_config_mem_free (a, tuple);
 }
 
 /*
@@ -0,0 +1,423 @@
+/*
+ * watch.c
+ * search directory change notification
+ *
+ * ISC License
+ *
+ * Copyright (c) the build2 authors (see the COPYRIGHT, AUTHORS files).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <libpkg-config/stdinc.h>
+
+#include <errno.h>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <sys/inotify.h>
+#endif
+
+/*
+ * !doc
+ *
+ * libpkg-config `watch` module
+ * ============================
+ *
+ * The libpkg-config `watch` module allows a long-running client to notice
+ * package files being added, removed, or changed in the search directories
+ * without re-stat'ing them. It is currently only supported on Linux (using
+ * inotify).
+ *
+ * The host event loop polls the file descriptor returned by
+ * pkg_config_watch_open() for input and calls pkg_config_watch_process()
+ * when it becomes readable. Every event for a ``<name>.pc`` (or
+ * ``<name>-uninstalled.pc``) file invalidates the cached package with this
+ * name (which may now be changed, removed, or shadowed) together with the
+ * memoized results of its dependents (see pkg_config_cache_refresh() for
+ * details). Note that failed lookups are not cached and so need no
+ * invalidation.
+ */
+
+#ifdef __linux__
+
+#define PKG_CONFIG_WATCH_MASK                                         \
+  (IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/* Watched search directory: the path and the watch descriptor or -1 if the
+ * directory is not currently watched (for example, because it does not
+ * exist).
+ */
+typedef struct
+{
+  char* path;
+  int wd;
+} pkg_config_watch_dir_t;
+
+struct pkg_config_watch_
+{
+  int fd;
+
+  pkg_config_watch_dir_t* dirs; /* In the dir_list order. */
+  size_t dirs_count;
+};
+
+static void
+watch_free (pkg_config_watch_t* w)
+{
+  for (size_t i = 0; i != w->dirs_count; ++i)
+    free (w->dirs[i].path);
+
+  close (w->fd);
+  free (w->dirs);
+  free (w);
+}
+
+/* Try to (re-)add the watch for the directory. Return true on success.
+ */
+static bool
+watch_add (const pkg_config_client_t* client,
+           pkg_config_watch_t* w,
+           pkg_config_watch_dir_t* d)
+{
+  (void)client;
+
+  d->wd = inotify_add_watch (w->fd, d->path, PKG_CONFIG_WATCH_MASK);
+
+  if (d->wd == -1)
+  {
+    PKG_CONFIG_TRACE (client, "unable to watch %s", d->path);
+    return false;
+  }
+
+  PKG_CONFIG_TRACE (client, "watching %s", d->path);
+  return true;
+}
+
+/* Handle the removal or move of the watched directory (or the removal of
+ * its watch) with the specified watch descriptor. Return true if this is
+ * one of our directories.
+ */
+static bool
+watch_lost (const pkg_config_client_t* client, pkg_config_watch_t* w, int wd)
+{
+  bool r = false;
+
+  (void)client;
+
+  for (size_t i = 0; i != w->dirs_count; ++i)
+  {
+    pkg_config_watch_dir_t* d = &w->dirs[i];
+
+    if (d->wd != wd)
+      continue;
+
+    /* Note that if the directory was moved, then the watch is still on it
+     * (at its new location) and so we have to remove it ourselves (the
+     * removal is a noop if the watch is already gone and the resulting
+     * IN_IGNORED event won't match any directory).
+     */
+    if (!r)
+      inotify_rm_watch (w->fd, wd);
+
+    PKG_CONFIG_TRACE (client, "lost %s", d->path);
+
+    d->wd = -1;
+    r = true;
+  }
+
+  return r;
+}
+
+/* Return the length of the package name the file name or id corresponds to
+ * (that is, with the .pc extension, if requested, and the -uninstalled
+ * suffix stripped) or 0 if it doesn't correspond to any.
+ */
+static size_t
+watch_name (const char* s, bool ext)
+{
+  static const char u[] = "-uninstalled";
+  size_t n = strlen (s);
+  size_t en = sizeof (PKG_CONFIG_EXT) - 1;
+  size_t un = sizeof (u) - 1;
+
+  if (ext)
+  {
+    if (n <= en || strcmp (s + n - en, PKG_CONFIG_EXT) != 0)
+      return 0;
+
+    n -= en;
+  }
+
+  if (n > un && strncmp (s + n - un, u, un) == 0)
+    n -= un;
+
+  return n;
+}
+
+/* Invalidation predicate: the package name is in the set or the set is
+ * NULL (everything is invalidated).
+ */
+static bool
+watch_stale (const pkg_config_pkg_t* pkg, void* data)
+{
+  const pkg_config_hash_t* names = data;
+
+  return names == NULL ||
+         pkg_config_hash_lookup (names, pkg->id, watch_name (pkg->id, false))
+         != NULL;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: int pkg_config_watch_open(pkg_config_client_t *client)
+ *
+ *    Starts watching the client object's search directories (`dir_list`)
+ *    for changes. The directories that do not exist (or cannot be watched
+ *    for some other reason) are retried by pkg_config_watch_process() (see
+ *    its documentation for details). The directories added to the list
+ *    later are not watched (close and re-open the watch to pick them up). If
+ *    already watching, returns the existing file descriptor.
+ *
+ *    :param pkg_config_client_t* client: The client object to modify.
+ *    :return: A non-blocking file descriptor that becomes readable when
+ *    there are changes to process or -1 on failure, in which case `errno`
+ *    is set (to ``ENOSYS`` if not supported on this platform).
+ *    :rtype: int
+ */
+int
+pkg_config_watch_open (pkg_config_client_t* client)
+{
+  pkg_config_node_t* n;
+  pkg_config_watch_t* w;
+
+  if (client->watch != NULL)
+    return client->watch->fd;
+
+  if ((w = calloc (1, sizeof (pkg_config_watch_t))) == NULL)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  if ((w->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) == -1)
+  {
+    int e = errno;
+    free (w);
+    errno = e;
+    return -1;
+  }
+
+  if (client->dir_list.length != 0 &&
+      (w->dirs = calloc (client->dir_list.length,
+                         sizeof (pkg_config_watch_dir_t))) == NULL)
+  {
+    watch_free (w);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  LIBPKG_CONFIG_FOREACH_LIST_ENTRY (client->dir_list.head, n)
+  {
+    const pkg_config_path_t* p = n->data;
+    pkg_config_watch_dir_t* d = &w->dirs[w->dirs_count];
+
+    if ((d->path = strdup (p->path)) == NULL)
+    {
+      watch_free (w);
+      errno = ENOMEM;
+      return -1;
+    }
+
+    w->dirs_count++;
+    watch_add (client, w, d);
+  }
+
+  client->watch = w;
+  return w->fd;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkg_config_watch_process(pkg_config_client_t
+ * *client)
+ *
+ *    Reads all the pending change events (without blocking) and invalidates
+ *    the affected cached packages and results. If events were lost (queue
+ *    overflow) or a watched directory itself was removed or moved, then
+ *    all the cached packages as well as the cached search directory file
+ *    ids and handles (see pkg_config_cache_refresh()) are invalidated.
+ *
+ *    A removed or moved directory is watched again at its original path as
+ *    soon as it (or its replacement) exists. Likewise, the search
+ *    directories that did not exist when the watch was opened (for example,
+ *    because they were removed after being added to the list) start being
+ *    watched once they are created. Note, however, that this is only
+ *    checked by this function (which invalidates all the cached packages
+ *    once such a directory appears) since the creation of the directory
+ *    does not make the watch file descriptor readable. A caller that only
+ *    calls this function when the descriptor becomes readable will
+ *    therefore not notice the directory until some other change occurs.
+ *
+ *    :param pkg_config_client_t* client: The client object to modify.
+ *    :return: ``LIBPKG_CONFIG_ERRF_OK`` on success or
+ *    ``LIBPKG_CONFIG_ERRF_MEMORY`` if unable to allocate memory, in which
+ *    case some of the events may have been lost.
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkg_config_watch_process (pkg_config_client_t* client)
+{
+  unsigned int r = LIBPKG_CONFIG_ERRF_OK;
+  pkg_config_watch_t* w = client->watch;
+
+  if (w == NULL)
+    return r;
+
+  /* Package names from the events in the buffer (keys point into it).
+   */
+  pkg_config_hash_t names = PKG_CONFIG_HASH_INITIALIZER;
+  bool all = false;
+
+  union
+  {
+    struct inotify_event e;
+    char buf[4096];
+  } u;
+
+  for (;;)
+  {
+    ssize_t k = read (w->fd, u.buf, sizeof (u.buf));
+
+    if (k <= 0)
+    {
+      if (k == -1 && errno == EINTR)
+        continue;
+
+      break; /* EAGAIN: no more events. */
+    }
+
+    for (ssize_t i = 0; i < k; )
+    {
+      const struct inotify_event* e = (const struct inotify_event*)(u.buf + i);
+      i += sizeof (struct inotify_event) + e->len;
+
+      if (e->mask & IN_Q_OVERFLOW)
+      {
+        all = true;
+        continue;
+      }
+
+      if (e->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+      {
+        if (watch_lost (client, w, e->wd))
+          all = true;
+
+        continue;
+      }
+
+      size_t n;
+      if (all || e->len == 0 || (n = watch_name (e->name, true)) == 0)
+        continue;
+
+      PKG_CONFIG_TRACE (client, "changed: %s", e->name);
+
+      if (!pkg_config_hash_insert (&names, e->name, n, NULL))
+        r = LIBPKG_CONFIG_ERRF_MEMORY;
+    }
+
+    /* Invalidate before the next read overwrites the names.
+     */
+    if (!all && names.count != 0 && r == LIBPKG_CONFIG_ERRF_OK)
+      r = pkg_config_cache_invalidate (client, watch_stale, &names);
+
+    pkg_config_hash_free (&names);
+  }
+
+  /* (Re-)add the watches for the directories that are not watched, if they
+   * exist now. Note that if one does, we have no idea what has changed in
+   * it.
+   */
+  for (size_t i = 0; i != w->dirs_count; ++i)
+  {
+    pkg_config_watch_dir_t* d = &w->dirs[i];
+
+    if (d->wd == -1 && watch_add (client, w, d))
+      all = true;
+  }
+
+  if (all && r == LIBPKG_CONFIG_ERRF_OK)
+  {
+    /* A directory may have been replaced, in which case its cached file id
+     * and handle refer to the old one.
+     */
+    pkg_config_path_cache_reset (client->path_cache);
+    pkg_config_path_close_dirs (&client->dir_list);
+
+    r = pkg_config_cache_invalidate (client, watch_stale, NULL);
+  }
+
+  return r;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkg_config_watch_close(pkg_config_client_t *client)
+ *
+ *    Stops watching the client object's search directories and closes the
+ *    file descriptor. Does nothing if not watching.
+ *
+ *    :param pkg_config_client_t* client: The client object to modify.
+ *    :return: nothing
+ */
+void
+pkg_config_watch_close (pkg_config_client_t* client)
+{
+  if (client->watch == NULL)
+    return;
+
+  watch_free (client->watch);
+  client->watch = NULL;
+}
+
+#else /* __linux__ */
+
+int
+pkg_config_watch_open (pkg_config_client_t* client)
+{
+  (void)client;
+
+  errno = ENOSYS;
+  return -1;
+}
+
+unsigned int
+pkg_config_watch_process (pkg_config_client_t* client)
+{
+  (void)client;
+  return LIBPKG_CONFIG_ERRF_OK;
+}
+
+void
+pkg_config_watch_close (pkg_config_client_t* client)
+{
+  (void)client;
+}
+
+#endif /* __linux__ */
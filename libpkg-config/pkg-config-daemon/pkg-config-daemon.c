@@ -0,0 +1,153 @@
+/* file      : pkg-config-daemon/pkg-config-daemon.c
+ * license   : ISC; see accompanying COPYING file
+ */
+
+#include <libpkg-config/pkg-config.h>
+
+#include <stdio.h>    /* fprintf(), stderr */
+#include <stdlib.h>   /* strtoull() */
+#include <string.h>   /* strcmp(), strlen(), strerror() */
+#include <errno.h>
+#include <signal.h>   /* signal(), SIGPIPE, SIGINT, SIGTERM */
+#include <unistd.h>   /* unlink(), _exit() */
+#include <sys/un.h>
+#include <sys/stat.h> /* lstat(), umask(), S_ISSOCK() */
+#include <sys/socket.h>
+
+static const char* socket_path = NULL;
+
+/* Remove the socket file, leaving alone anything else that may have been
+ * specified as the socket path by mistake.
+ */
+static void
+remove_socket (void)
+{
+  struct stat s;
+
+  if (lstat (socket_path, &s) == 0 && S_ISSOCK (s.st_mode))
+    unlink (socket_path);
+}
+
+static void
+terminate (int sig)
+{
+  (void) sig; /* Unused. */
+
+  if (socket_path != NULL)
+    remove_socket ();
+
+  _exit (0);
+}
+
+/* Usage: argv[0] [--socket <path>] [--memory-limit <bytes>]
+ *
+ * Answer pkg-config queries using warm clients (see server.c in libpkg-config
+ * for the protocol).
+ *
+ * --socket <path>
+ *     Listen on the Unix domain socket at the specified path until the
+ *     shutdown request or SIGINT/SIGTERM. The socket is only accessible to
+ *     the current user. If not specified, serve the standard input and
+ *     output until the end of input (the coprocess mode).
+ *
+ * --memory-limit <bytes>
+ *     Free the least recently used warm clients while their memory usage
+ *     exceeds the limit (see pkg_config_server_set_memory_limit()).
+ */
+int
+main (int argc, const char* argv[])
+{
+  size_t memory_limit = 0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    bool ok = i + 1 != argc;
+
+    if (ok && strcmp (argv[i], "--socket") == 0)
+      socket_path = argv[++i];
+    else if (ok && strcmp (argv[i], "--memory-limit") == 0)
+    {
+      char* e;
+      memory_limit = (size_t)strtoull (argv[++i], &e, 10);
+      ok = *argv[i] != '\0' && *e == '\0';
+    }
+    else
+      ok = false;
+
+    if (!ok)
+    {
+      fprintf (stderr,
+               "usage: %s [--socket <path>] [--memory-limit <bytes>]\n",
+               argv[0]);
+      return 1;
+    }
+  }
+
+  signal (SIGPIPE, SIG_IGN);
+
+  pkg_config_server_t* s = pkg_config_server_new ();
+
+  if (s == NULL)
+  {
+    fprintf (stderr, "error: unable to create server: %s\n", strerror (errno));
+    return 1;
+  }
+
+  pkg_config_server_set_memory_limit (s, memory_limit);
+
+  int r;
+
+  if (socket_path == NULL)
+    r = pkg_config_server_serve (s, 0 /* stdin */, 1 /* stdout */);
+  else
+  {
+    struct sockaddr_un a;
+    size_t n = strlen (socket_path);
+
+    if (n >= sizeof (a.sun_path))
+    {
+      fprintf (stderr, "error: socket path too long\n");
+      pkg_config_server_free (s);
+      return 1;
+    }
+
+    memset (&a, 0, sizeof (a));
+    a.sun_family = AF_UNIX;
+    memcpy (a.sun_path, socket_path, n + 1);
+
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+    /* Remove the socket left behind by a previous instance, if any, and
+     * make sure the new one is only accessible to the current user. Note
+     * that if the path exists but is not a socket, then bind() fails.
+     */
+    remove_socket ();
+    umask (077);
+
+    if (fd == -1                                                 ||
+        bind (fd, (const struct sockaddr*)&a, sizeof (a)) == -1 ||
+        listen (fd, SOMAXCONN) == -1)
+    {
+      fprintf (stderr,
+               "error: unable to listen on %s: %s\n",
+               socket_path,
+               strerror (errno));
+      pkg_config_server_free (s);
+      return 1;
+    }
+
+    signal (SIGINT, terminate);
+    signal (SIGTERM, terminate);
+
+    r = pkg_config_server_listen (s, fd);
+
+    close (fd);
+    remove_socket ();
+  }
+
+  if (r == -1)
+    fprintf (stderr, "error: unable to serve: %s\n", strerror (errno));
+
+  pkg_config_server_free (s);
+  return r == -1 ? 1 : 0;
+}
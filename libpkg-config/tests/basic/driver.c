@@ -10,13 +10,21 @@
 
 #include <libpkg-config/pkg-config.h>
 
-#include <stdio.h>   /* printf(), fprintf(), stderr */
+#include <stdio.h>   /* printf(), fprintf(), vfprintf(), snprintf(), stderr,
+                        rename() */
+#include <stdarg.h>  /* va_list */
 #include <stddef.h>  /* NULL */
-#include <stdlib.h>  /* free() */
+#include <stdlib.h>  /* malloc(), realloc(), free(), atoi() */
 #include <assert.h>
 #include <string.h>  /* strcmp() */
 #include <stdbool.h> /* bool, true, false */
 
+#ifdef _WIN32
+#  include <windows.h> /* CreateThread(), WaitForSingleObject() */
+#else
+#  include <pthread.h>
+#endif
+
 static void
 diag_handler (unsigned int e,
               const char* file,
@@ -40,24 +48,341 @@ diag_handler (unsigned int e,
     fprintf (stderr, "%s: %s\n", w, msg);
 }
 
+/* Deferred diagnostics handler that prints the same as diag_handler().
+ */
+static void
+deferred_handler (unsigned int k,
+                  unsigned int e,
+                  const char* file,
+                  size_t line,
+                  const char* func,
+                  const char* fmt,
+                  va_list args,
+                  const pkg_config_client_t* c,
+                  void* d)
+{
+  (void) e;    /* Unused. */
+  (void) func; /* Unused. */
+  (void) c;    /* Unused. */
+  (void) d;    /* Unused. */
+
+  const char* w = (k == LIBPKG_CONFIG_DIAG_WARN ? "warning" : "error");
+
+  if (file != NULL)
+    fprintf (stderr, "%s:" LIBPKG_CONFIG_SIZE_FMT ": %s: ", file, line, w);
+  else
+    fprintf (stderr, "%s: ", w);
+
+  vfprintf (stderr, fmt, args);
+  fputc ('\n', stderr);
+}
+
 static void
-print_and_free (pkg_config_list_t* list)
+print_and_free (const pkg_config_client_t* c,
+                const char* name,
+                pkg_config_list_t* list)
 {
+  pkg_config_span_begin (c, LIBPKG_CONFIG_SPAN_RENDER, name);
   char* buf = pkg_config_fragment_render (list,
                                           true /* escape */,
                                           NULL /* options */);
+  pkg_config_span_end (c, LIBPKG_CONFIG_SPAN_RENDER, name);
   printf("%s", buf);
   free (buf);
 
   pkg_config_fragment_free (list);
 }
 
-/* Usage: argv[0] [--cflags] [--libs] (--with-path <dir>)* <name>
+static bool
+print_revdep (const pkg_config_pkg_t* pkg,
+              const pkg_config_dependency_t* dep,
+              unsigned int colour,
+              int depth,
+              void* data)
+{
+  (void) dep;  /* Unused. */
+  (void) data; /* Unused. */
+
+  printf ("%s %d%s\n",
+          pkg->id,
+          depth,
+          (colour & LIBPKG_CONFIG_GRAPH_EDGE_PRIVATE) != 0 ? " private" : "");
+
+  return false;
+}
+
+static void
+print_async (pkg_config_client_t* c,
+             pkg_config_pkg_t* pkg,
+             pkg_config_list_t* list,
+             unsigned int e,
+             void* data)
+{
+  (void) c; /* Unused. */
+
+  if (e != LIBPKG_CONFIG_ERRF_OK)
+  {
+    *(bool*)data = false;
+    return;
+  }
+
+  if (list == NULL)
+    printf ("%s %s\n", pkg->id, pkg->version);
+  else
+  {
+    /* Note: the list is freed by the caller.
+     */
+    char* buf = pkg_config_fragment_render (list,
+                                            true /* escape */,
+                                            NULL /* options */);
+
+    size_t n = strlen (buf);
+    if (n != 0 && buf[n - 1] == ' ') /* Strip the trailing separator. */
+      buf[n - 1] = '\0';
+
+    printf("%s\n", buf);
+    free (buf);
+  }
+}
+
+/* Caller-provided executor (see --executor) that queues the tasks to be run
+ * by the main loop in order.
+ */
+typedef struct
+{
+  struct
+  {
+    pkg_config_async_task_func_t func;
+    void* task;
+  } tasks[8];
+
+  size_t size;
+} executor_queue_t;
+
+static void
+executor_submit (pkg_config_async_task_func_t func, void* task, void* data)
+{
+  executor_queue_t* q = data;
+
+  assert (q->size != sizeof (q->tasks) / sizeof (q->tasks[0]));
+
+  q->tasks[q->size].func = func;
+  q->tasks[q->size].task = task;
+  q->size++;
+}
+
+/* Completion callback for the find request which submits the flags requests
+ * (see --executor).
+ */
+typedef struct
+{
+  pkg_config_async_t* async;
+  const char* name;
+  int max_depth;
+  bool cflags;
+  bool libs;
+  bool ok;
+} async_followup_t;
+
+static void
+print_async_followup (pkg_config_client_t* c,
+                      pkg_config_pkg_t* pkg,
+                      pkg_config_list_t* list,
+                      unsigned int e,
+                      void* data)
+{
+  async_followup_t* f = data;
+
+  print_async (c, pkg, list, e, &f->ok);
+
+  /* Note that the executor should not run these requests before we return
+   * since the client is locked.
+   */
+  if (f->cflags)
+  {
+    bool r = pkg_config_async_cflags (f->async,
+                                      f->name,
+                                      f->max_depth,
+                                      print_async,
+                                      &f->ok);
+    assert (r);
+  }
+
+  if (f->libs)
+  {
+    bool r = pkg_config_async_libs (f->async,
+                                    f->name,
+                                    f->max_depth,
+                                    print_async,
+                                    &f->ok);
+    assert (r);
+  }
+}
+
+/* Print the span begin events indented according to their nesting.
+ */
+static void
+print_span (const pkg_config_span_t* s,
+            const pkg_config_client_t* c,
+            void* data)
+{
+  (void) c; /* Unused. */
+
+  int* depth = data;
+
+  if (!s->end)
+  {
+    fprintf (stderr,
+             "%*s%s %s\n",
+             *depth * 2, "",
+             pkg_config_span_kind_name (s->kind),
+             s->id);
+    ++*depth;
+  }
+  else
+    --*depth;
+}
+
+/* Allocator that counts the live blocks (in the size_t pointed to by the
+ * allocator data) and marks them to detect blocks freed with a wrong
+ * allocator. Not thread-safe.
+ */
+#define COUNTING_ALLOCATOR_MAGIC 0x9c9c9c9cU
+
+typedef union
+{
+  unsigned int magic;
+  long double align1; /* Keep the blocks suitably aligned. */
+  void* align2;
+  long long align3;
+} counting_allocator_header;
+
+static void*
+counting_alloc (void* data, size_t n)
+{
+  counting_allocator_header* h = malloc (sizeof (*h) + n);
+
+  if (h == NULL)
+    return NULL;
+
+  h->magic = COUNTING_ALLOCATOR_MAGIC;
+  ++*(size_t*)data;
+  return h + 1;
+}
+
+static void
+counting_free (void* data, void* p)
+{
+  counting_allocator_header* h = (counting_allocator_header*)p - 1;
+
+  assert (h->magic == COUNTING_ALLOCATOR_MAGIC && *(size_t*)data != 0);
+
+  h->magic = 0;
+  --*(size_t*)data;
+  free (h);
+}
+
+static void*
+counting_realloc (void* data, void* p, size_t n)
+{
+  if (p == NULL)
+    return counting_alloc (data, n);
+
+  counting_allocator_header* h = (counting_allocator_header*)p - 1;
+  assert (h->magic == COUNTING_ALLOCATOR_MAGIC);
+
+  if ((h = realloc (h, sizeof (*h) + n)) == NULL)
+    return NULL;
+
+  return h + 1;
+}
+
+static void
+print_stats (const pkg_config_client_t* c)
+{
+  pkg_config_client_stats_t s;
+  pkg_config_client_get_stats (c, &s);
+
+  fprintf (stderr,
+           "files_opened " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "files_failed " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "lines_parsed " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "pkg_cache_hits " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "pkg_cache_misses " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "result_cache_hits " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "result_cache_misses " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "pkg_not_found " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "var_expansions " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "var_max_depth " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "edges_verified " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "traversals " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "nodes_visited " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "max_traversal_nodes " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "fragments_copied " LIBPKG_CONFIG_SIZE_FMT "\n"
+           "fragments_merged " LIBPKG_CONFIG_SIZE_FMT "\n",
+           s.files_opened,
+           s.files_failed,
+           s.lines_parsed,
+           s.pkg_cache_hits,
+           s.pkg_cache_misses,
+           s.result_cache_hits,
+           s.result_cache_misses,
+           s.pkg_not_found,
+           s.var_expansions,
+           s.var_max_depth,
+           s.edges_verified,
+           s.traversals,
+           s.nodes_visited,
+           s.max_traversal_nodes,
+           s.fragments_copied,
+           s.fragments_merged);
+}
+
+/* Write the chain of packages chain0.pc, chain1.pc, etc into the current
+ * directory where each package requires the next one and only the last one
+ * has the flags.
+ */
+static void
+write_chain (int n)
+{
+  for (int i = 0; i != n; ++i)
+  {
+    char f[32];
+    snprintf (f, sizeof (f), "chain%d.pc", i);
+
+    FILE* o = fopen (f, "w");
+    assert (o != NULL);
+
+    fprintf (o,
+             "Name: chain%d\n"
+             "Description: Chain library\n"
+             "Version: 1.0\n",
+             i);
+
+    if (i + 1 != n)
+      fprintf (o, "Requires: chain%d\n", i + 1);
+    else
+      fprintf (o, "Cflags: -DCHAIN\nLibs: -lchain\n");
+
+    fclose (o);
+  }
+}
+
+/* Usage: argv[0] [--stack <size>] [--cflags] [--libs] [--static] [--graph]
+ *                [--dot] [--threads <num>] [--refresh <from> <to>] [--watch]
+ *                [--revdep <depth>] [--clone <sysroot>] [--async] [--executor]
+ *                [--stats] [--spans] [--chrome-trace <file>] [--allocator]
+ *                [--deferred] [--no-batch] [--chain <num>]
+ *                [--max-depth <depth>] (--with-path <dir>)* <name>
  *
  * Print package compiler and linker flags. If the package name has '.pc'
  * extension it is interpreted as a file name. Prints all flags, as pkg-config
  * utility does when --keep-system-libs and --keep-system-cflags are specified.
  *
+ * --stack <size>
+ *     Run on a thread with the specified stack size in KiB. Must be
+ *     specified first.
+ *
  * --cflags
  *     Print compiler flags.
  *
@@ -67,12 +392,91 @@ print_and_free (pkg_config_list_t* list)
  * --static
  *     Assume static linking.
  *
+ * --graph
+ *     Resolve the dependency graph once and extract flags from it.
+ *
+ * --dot
+ *     Print the resolved dependency graph in the DOT format.
+ *
+ * --threads <num>
+ *     Resolve the dependencies in parallel using the specified number of
+ *     threads (0 for the number of hardware threads) before extracting flags.
+ *
+ * --refresh <from> <to>
+ *     After printing the flags, move the <from> file or directory to <to>
+ *     (moving the existing <to>, if any, to <to>.old), refresh the package
+ *     cache, and print the linker flags again. Can be specified multiple
+ *     times, in which case the moves are performed in order.
+ *
+ * --watch
+ *     Watch the search directories for changes and refresh the package cache
+ *     by processing the change events (see --refresh).
+ *
+ * --revdep <depth>
+ *     Instead of printing the flags, print the packages that require the
+ *     package up to the specified depth (-1 for unlimited), one per line in
+ *     the '<name> <depth> [private]' form. Only consider Requires unless
+ *     --static is specified.
+ *
+ * --clone <sysroot>
+ *     After printing the flags, print the linker flags again using two
+ *     clones of the client with the specified sysroot directory, one after
+ *     another (so that the second reuses the package files read by the
+ *     first).
+ *
+ * --async
+ *     Find the package and collect the flags using asynchronous requests
+ *     (resolving in parallel if --threads is specified), printing the
+ *     package id and version followed by the flags on separate lines.
+ *
+ * --executor
+ *     With --async, execute the requests with a caller-provided executor
+ *     (run by the main loop) rather than the internal worker thread and
+ *     submit the flags requests from the completion callback of the find
+ *     request. The output is expected to be the same.
+ *
+ * --stats
+ *     Before exiting, print the client performance counters to stderr, one
+ *     per line in the '<name> <value>' form (see pkg_config_client_stats_t
+ *     for the counters; the ones that depend on the environment, such as the
+ *     number of bytes read, are omitted).
+ *
+ * --spans
+ *     Print the spans to stderr as they begin, one per line in the
+ *     '<kind> <id>' form, indented according to their nesting.
+ *
+ * --chrome-trace <file>
+ *     Write the spans to the file as Chrome trace events.
+ *
+ * --allocator
+ *     Allocate the library objects with a counting allocator and verify
+ *     that they are all freed with it before exiting. Should not be combined
+ *     with --threads or --async.
+ *
+ * --deferred
+ *     Report the errors and warnings via the deferred diagnostics handler
+ *     (see pkg_config_client_set_diag_handler()) rather than the message
+ *     handlers. The output is expected to be the same.
+ *
+ * --no-batch
+ *     Read the package files one at a time rather than in batches, where
+ *     supported (see LIBPKG_CONFIG_PKG_PKGF_NO_BATCH_LOAD). The output is
+ *     expected to be the same.
+ *
+ * --chain <num>
+ *     Before searching, write a chain of the specified number of packages,
+ *     chain0 requiring chain1 requiring chain2, etc, into the current
+ *     directory. Only the last package has the flags (-DCHAIN and -lchain).
+ *
+ * --max-depth <depth>
+ *     Maximum dependency depth (-1 for unlimited). The default is 2000.
+ *
  * --with-path <dir>
  *     Search through the directory for pc-files. If at least one --with-path
  *     is specified then the default directories are not searched through.
  */
-int
-main (int argc, const char* argv[])
+static int
+run (int argc, const char* argv[])
 {
   pkg_config_client_t* c =
     pkg_config_client_new (diag_handler,
@@ -86,8 +490,28 @@ main (int argc, const char* argv[])
 
   bool cflags = false;
   bool libs = false;
+  bool graph = false;
+  bool dot = false;
+  int threads = -1;
+  const char* refresh[8]; /* <from> <to> pairs. */
+  size_t refresh_count = 0;
+  bool watch = false;
+  int revdep = 0;
+  const char* clone_sysroot = NULL;
+  bool async = false;
+  bool executor = false;
+  bool stats = false;
+  int span_depth = 0;
+  const char* chrome_trace = NULL;
+  size_t alloc_live = 0;
+  pkg_config_allocator_t alloc = {counting_alloc,
+                                  counting_realloc,
+                                  counting_free,
+                                  &alloc_live};
+  bool counting = false;
   bool default_dirs = true;
   int client_flags = LIBPKG_CONFIG_PKG_PKGF_MERGE_SPECIAL_FRAGMENTS;
+  int max_depth = 2000;
 
   int i = 1;
   for (; i < argc; ++i)
@@ -101,6 +525,87 @@ main (int argc, const char* argv[])
     else if (strcmp (o, "--static") == 0)
       client_flags |= LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE |
                       LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS;
+    else if (strcmp (o, "--graph") == 0)
+      graph = true;
+    else if (strcmp (o, "--dot") == 0)
+      dot = true;
+    else if (strcmp (o, "--threads") == 0)
+    {
+      ++i;
+      assert (i < argc);
+
+      threads = atoi (argv[i]);
+      assert (threads >= 0);
+    }
+    else if (strcmp (o, "--refresh") == 0)
+    {
+      i += 2;
+      assert (i < argc);
+
+      assert (refresh_count != sizeof (refresh) / sizeof (refresh[0]));
+
+      refresh[refresh_count++] = argv[i - 1];
+      refresh[refresh_count++] = argv[i];
+    }
+    else if (strcmp (o, "--watch") == 0)
+      watch = true;
+    else if (strcmp (o, "--revdep") == 0)
+    {
+      ++i;
+      assert (i < argc);
+
+      revdep = atoi (argv[i]);
+      assert (revdep != 0);
+    }
+    else if (strcmp (o, "--clone") == 0)
+    {
+      ++i;
+      assert (i < argc);
+
+      clone_sysroot = argv[i];
+    }
+    else if (strcmp (o, "--async") == 0)
+      async = true;
+    else if (strcmp (o, "--executor") == 0)
+      executor = true;
+    else if (strcmp (o, "--stats") == 0)
+      stats = true;
+    else if (strcmp (o, "--spans") == 0)
+      pkg_config_client_set_span_handler (c, print_span, &span_depth);
+    else if (strcmp (o, "--chrome-trace") == 0)
+    {
+      ++i;
+      assert (i < argc);
+
+      chrome_trace = argv[i];
+    }
+    else if (strcmp (o, "--allocator") == 0)
+    {
+      pkg_config_client_set_allocator (c, &alloc);
+      counting = true;
+    }
+    else if (strcmp (o, "--deferred") == 0)
+      pkg_config_client_set_diag_handler (c,
+                                          deferred_handler,
+                                          NULL /* diag_handler_data */,
+                                          LIBPKG_CONFIG_DIAG_ERROR |
+                                          LIBPKG_CONFIG_DIAG_WARN);
+    else if (strcmp (o, "--no-batch") == 0)
+      client_flags |= LIBPKG_CONFIG_PKG_PKGF_NO_BATCH_LOAD;
+    else if (strcmp (o, "--chain") == 0)
+    {
+      ++i;
+      assert (i < argc);
+
+      write_chain (atoi (argv[i]));
+    }
+    else if (strcmp (o, "--max-depth") == 0)
+    {
+      ++i;
+      assert (i < argc);
+
+      max_depth = atoi (argv[i]);
+    }
     else if (strcmp (o, "--with-path") == 0)
     {
       ++i;
@@ -117,35 +622,171 @@ main (int argc, const char* argv[])
   const char* name = argv[i];
 
   int r = 1;
-  int max_depth = 2000;
 
   pkg_config_client_set_flags (c, client_flags);
 
+  FILE* chrome_file = NULL;
+  pkg_config_chrome_trace_t* chrome_sink = NULL;
+
+  if (chrome_trace != NULL)
+  {
+    chrome_file = fopen (chrome_trace, "w");
+    assert (chrome_file != NULL);
+
+    chrome_sink = pkg_config_chrome_trace_open (chrome_file);
+    assert (chrome_sink != NULL);
+
+    pkg_config_client_set_span_handler (c,
+                                        pkg_config_chrome_trace_handler,
+                                        chrome_sink);
+  }
+
   /* Bootstrap the package search default paths if not specified explicitly.
    */
   if (default_dirs)
     pkg_config_client_dir_list_build (c);
 
+  if (watch)
+  {
+    int fd = pkg_config_watch_open (c);
+    assert (fd != -1);
+  }
+
   unsigned int e;
+
+  if (revdep != 0)
+  {
+    pkg_config_revdep_index_t* x = pkg_config_revdep_index_build (c, &e);
+    assert (x != NULL);
+
+    unsigned int colours =
+      (client_flags & LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE) != 0
+      ? LIBPKG_CONFIG_GRAPH_EDGE_PUBLIC  |
+        LIBPKG_CONFIG_GRAPH_EDGE_PRIVATE |
+        LIBPKG_CONFIG_GRAPH_EDGE_INTERNAL
+      : LIBPKG_CONFIG_GRAPH_EDGE_PUBLIC;
+
+    e = pkg_config_revdep_query (x, name, colours, revdep, print_revdep, NULL);
+    assert (e == LIBPKG_CONFIG_ERRF_OK);
+
+    pkg_config_revdep_index_free (x);
+    pkg_config_client_free (c);
+    return 0;
+  }
+
+  if (async && executor)
+  {
+    executor_queue_t q = {0};
+
+    pkg_config_async_t* a =
+      pkg_config_async_new (c,
+                            threads != -1 ? (unsigned int)threads : 1,
+                            executor_submit,
+                            &q);
+    assert (a != NULL);
+
+    async_followup_t f = {a, name, max_depth, cflags, libs, true};
+
+    bool sr = pkg_config_async_find (a, name, print_async_followup, &f);
+    assert (sr);
+
+    /* Run the tasks, including the ones submitted while running, in order.
+     */
+    for (size_t j = 0; j != q.size; ++j)
+      q.tasks[j].func (q.tasks[j].task);
+
+    pkg_config_async_wait (a);
+    pkg_config_async_free (a);
+    pkg_config_client_free (c);
+    return f.ok ? 0 : 1;
+  }
+
+  if (async)
+  {
+    pkg_config_async_t* a =
+      pkg_config_async_new (c,
+                            threads != -1 ? (unsigned int)threads : 1,
+                            NULL /* executor */,
+                            NULL /* executor_data */);
+    assert (a != NULL);
+
+    bool ok = true;
+
+    /* The requests are executed in order by the internal worker thread.
+     */
+    bool sr = pkg_config_async_find (a, name, print_async, &ok);
+    assert (sr);
+
+    if (cflags)
+    {
+      sr = pkg_config_async_cflags (a, name, max_depth, print_async, &ok);
+      assert (sr);
+    }
+
+    if (libs)
+    {
+      sr = pkg_config_async_libs (a, name, max_depth, print_async, &ok);
+      assert (sr);
+    }
+
+    pkg_config_async_wait (a);
+    pkg_config_async_free (a);
+    pkg_config_client_free (c);
+    return ok ? 0 : 1;
+  }
+
   pkg_config_pkg_t* p = pkg_config_pkg_find (c, name, &e);
 
   if (p != NULL)
   {
-    /* Print C flags.
+    /* Resolve the dependencies (including private, which are needed for C
+     * flags) in parallel.
      */
-    if (cflags)
+    if (threads != -1)
     {
       pkg_config_client_set_flags (
         c,
         client_flags | LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE);
 
+      e = pkg_config_pkg_resolve (c, p, max_depth, (unsigned int)threads);
+      assert (e == LIBPKG_CONFIG_ERRF_OK);
+
+      pkg_config_client_set_flags (c, client_flags); /* Restore. */
+    }
+
+    /* Traversal context with the client flags.
+     */
+    pkg_config_traversal_t t;
+    pkg_config_traversal_init (&t, c);
+
+    /* Print C flags.
+     */
+    if (cflags)
+    {
       pkg_config_list_t list = LIBPKG_CONFIG_LIST_INITIALIZER;
-      e = pkg_config_pkg_cflags (c, p, &list, max_depth);
 
-      if (e == LIBPKG_CONFIG_ERRF_OK)
-        print_and_free (&list);
+      /* The private dependencies are needed for C flags. If they are already
+       * searched according to the client flags (--static), then use
+       * pkg_config_pkg_cflags() to also exercise this API.
+       */
+      pkg_config_traversal_t ct = t;
+      ct.flags |= LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE;
 
-      pkg_config_client_set_flags (c, client_flags); /* Restore. */
+      if (graph)
+      {
+        pkg_config_graph_t* g = pkg_config_graph_build (&ct, p, max_depth);
+        assert (g != NULL);
+
+        e = pkg_config_graph_cflags (&ct, g, &list);
+        pkg_config_graph_unref (g);
+      }
+      else if ((client_flags & LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE) != 0)
+        e = pkg_config_pkg_cflags (c, p, &list, max_depth);
+      else
+        e = pkg_config_traversal_cflags (&ct, p, &list, max_depth);
+
+      if (e == LIBPKG_CONFIG_ERRF_OK)
+        print_and_free (c, name, &list);
     }
 
     /* Print libs.
@@ -153,10 +794,94 @@ main (int argc, const char* argv[])
     if (libs && e == LIBPKG_CONFIG_ERRF_OK)
     {
       pkg_config_list_t list = LIBPKG_CONFIG_LIST_INITIALIZER;
-      e = pkg_config_pkg_libs (c, p, &list, max_depth);
+
+      if (graph)
+      {
+        pkg_config_graph_t* g = pkg_config_graph_build (&t, p, max_depth);
+        assert (g != NULL);
+
+        e = pkg_config_graph_libs (&t, g, &list);
+        pkg_config_graph_unref (g);
+      }
+      else
+        e = pkg_config_pkg_libs (c, p, &list, max_depth);
+
+      if (e == LIBPKG_CONFIG_ERRF_OK)
+        print_and_free (c, name, &list);
+    }
+
+    /* Replace the package file or directory, refresh the cache, and print
+     * libs again.
+     */
+    for (size_t j = 0; j != refresh_count && e == LIBPKG_CONFIG_ERRF_OK; j += 2)
+    {
+      const char* from = refresh[j];
+      const char* to = refresh[j + 1];
+
+      /* Note that we move rather than remove the old file or directory so
+       * that the latter keeps existing.
+       */
+      char old[1024];
+      snprintf (old, sizeof (old), "%s.old", to);
+      rename (to, old);
+
+      int rr = rename (from, to);
+      assert (rr == 0);
+
+      e = watch ? pkg_config_watch_process (c) : pkg_config_cache_refresh (c);
+      assert (e == LIBPKG_CONFIG_ERRF_OK);
+
+      pkg_config_list_t list = LIBPKG_CONFIG_LIST_INITIALIZER;
+
+      if (graph)
+      {
+        pkg_config_graph_t* g = pkg_config_graph_build (&t, p, max_depth);
+        assert (g != NULL);
+
+        e = pkg_config_graph_libs (&t, g, &list);
+        pkg_config_graph_unref (g);
+      }
+      else
+        e = pkg_config_pkg_libs (c, p, &list, max_depth);
+
+      if (e == LIBPKG_CONFIG_ERRF_OK)
+        print_and_free (c, name, &list);
+    }
+
+    /* Print libs using the clones.
+     */
+    for (int j = 0; j != 2 && clone_sysroot != NULL; ++j)
+    {
+      pkg_config_client_t* cc = pkg_config_client_clone (c);
+      assert (cc != NULL);
+
+      pkg_config_client_set_sysroot_dir (cc, clone_sysroot);
+
+      pkg_config_pkg_t* cp = pkg_config_pkg_find (cc, name, &e);
+      assert (cp != NULL);
+
+      pkg_config_list_t list = LIBPKG_CONFIG_LIST_INITIALIZER;
+      e = pkg_config_pkg_libs (cc, cp, &list, max_depth);
 
       if (e == LIBPKG_CONFIG_ERRF_OK)
-        print_and_free (&list);
+        print_and_free (cc, name, &list);
+
+      pkg_config_pkg_unref (cc, cp);
+      pkg_config_client_free (cc);
+
+      if (e != LIBPKG_CONFIG_ERRF_OK)
+        break;
+    }
+
+    /* Print the dependency graph.
+     */
+    if (dot && e == LIBPKG_CONFIG_ERRF_OK)
+    {
+      pkg_config_graph_t* g = pkg_config_graph_build (&t, p, max_depth);
+      assert (g != NULL);
+
+      pkg_config_graph_write_dot (g, stdout);
+      pkg_config_graph_unref (g);
     }
 
     if (e == LIBPKG_CONFIG_ERRF_OK)
@@ -176,6 +901,90 @@ main (int argc, const char* argv[])
        except for allocation errors. */
     fprintf (stderr, "unable to load package '%s'\n", name);
 
+  if (stats)
+    print_stats (c);
+
   pkg_config_client_free (c);
+
+  if (counting)
+    assert (alloc_live == 0);
+
+  if (chrome_sink != NULL)
+  {
+    pkg_config_chrome_trace_close (chrome_sink);
+    fclose (chrome_file);
+  }
+
   return r;
 }
+
+typedef struct
+{
+  int argc;
+  const char** argv;
+  int r;
+} run_data;
+
+#ifdef _WIN32
+static DWORD WINAPI
+run_thread (LPVOID arg)
+{
+  run_data* d = arg;
+  d->r = run (d->argc, d->argv);
+  return 0;
+}
+#else
+static void*
+run_thread (void* arg)
+{
+  run_data* d = arg;
+  d->r = run (d->argc, d->argv);
+  return NULL;
+}
+#endif
+
+int
+main (int argc, const char* argv[])
+{
+  if (argc < 3 || strcmp (argv[1], "--stack") != 0)
+    return run (argc, argv);
+
+  size_t n = (size_t)atoi (argv[2]) * 1024;
+
+  /* Pass the program name followed by the remaining options.
+   */
+  argv[2] = argv[0];
+  run_data d = {argc - 2, argv + 2, 1};
+
+#ifdef _WIN32
+  HANDLE t = CreateThread (NULL,
+                           n,
+                           run_thread,
+                           &d,
+                           STACK_SIZE_PARAM_IS_A_RESERVATION,
+                           NULL);
+  assert (t != NULL);
+
+  WaitForSingleObject (t, INFINITE);
+  CloseHandle (t);
+#else
+  pthread_attr_t a;
+  pthread_t t;
+
+  int e = pthread_attr_init (&a);
+  assert (e == 0);
+
+  e = pthread_attr_setstacksize (&a, n);
+  assert (e == 0);
+
+  e = pthread_create (&t, &a, run_thread, &d);
+  assert (e == 0);
+
+  e = pthread_join (t, NULL);
+  assert (e == 0);
+
+  pthread_attr_destroy (&a);
+#endif
+
+  return d.r;
+}
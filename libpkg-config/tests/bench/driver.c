@@ -0,0 +1,566 @@
+/* file      : tests/bench/driver.c
+ * license   : ISC; see accompanying COPYING file
+ */
+
+/* Enable assertions.
+ */
+#ifdef NDEBUG
+#  undef NDEBUG
+#endif
+
+#include <libpkg-config/pkg-config.h>
+
+#include <stdio.h>    /* printf(), fprintf(), fopen(), stderr */
+#include <stddef.h>   /* NULL, size_t */
+#include <stdint.h>   /* uint32_t, uint64_t */
+#include <stdlib.h>   /* malloc(), free(), atoi(), qsort() */
+#include <assert.h>
+#include <string.h>   /* strcmp() */
+#include <stdbool.h>  /* bool, true, false */
+#include <errno.h>
+
+#ifdef _WIN32
+#  include <direct.h> /* _mkdir() */
+#  include <windows.h>
+#else
+#  include <time.h>     /* clock_gettime() */
+#  include <sys/stat.h> /* mkdir() */
+#endif
+
+/* Synthetic corpus shape (see usage below).
+ */
+typedef struct
+{
+  int packages;
+  int depth;
+  int fanout;
+  int diamonds;
+  int chain;
+  int cflags;
+  int libs;
+  int conflicts;
+  int private_;
+  int internal;
+  unsigned int seed;
+} shape_t;
+
+static uint32_t rng_state;
+
+/* Deterministic xorshift generator (so that the corpus only depends on the
+ * shape).
+ */
+static uint32_t
+rng (void)
+{
+  uint32_t x = rng_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return rng_state = x;
+}
+
+/* Return true with the percent probability.
+ */
+static bool
+chance (int percent)
+{
+  return (int)(rng () % 100) < percent;
+}
+
+/* First package of the level.
+ */
+static int
+level_begin (const shape_t* s, int l)
+{
+  return (int)(((long long)l * s->packages + s->depth - 1) / s->depth);
+}
+
+static int
+level_of (const shape_t* s, int i)
+{
+  int l = (int)((long long)i * s->depth / s->packages);
+
+  /* Adjust for rounding.
+   */
+  while (l + 1 < s->depth && level_begin (s, l + 1) <= i)
+    ++l;
+
+  while (level_begin (s, l) > i)
+    --l;
+
+  return l;
+}
+
+/* Append the requires list entry to the buffer.
+ */
+static void
+add_require (char* buf, size_t size, int p, bool versioned)
+{
+  size_t n = strlen (buf);
+
+  snprintf (buf + n, size - n,
+            "%spkg%d%s",
+            n != 0 ? ", " : "",
+            p,
+            versioned ? " >= 1.0" : "");
+}
+
+/* Write the package files into the directory, returning the number of
+ * bytes written.
+ */
+static long
+generate (const char* dir, const shape_t* s)
+{
+  long bytes = 0;
+  size_t rsize = (size_t)s->fanout * 32 + 1;
+  char* req = malloc (rsize);
+  char* req_private = malloc (rsize);
+  char* req_internal = malloc (rsize);
+  int* targets = malloc (sizeof (int) * (size_t)(s->fanout + 1));
+
+  assert (req != NULL && req_private != NULL && req_internal != NULL &&
+          targets != NULL);
+
+  rng_state = s->seed != 0 ? s->seed : 1;
+
+  for (int i = 0; i != s->packages; ++i)
+  {
+    int l = level_of (s, i);
+
+    req[0] = req_private[0] = req_internal[0] = '\0';
+
+    /* Requires, targeting the next level. With the diamond probability the
+     * target is chosen among a few "hot" packages shared by many dependents.
+     */
+    if (l + 1 < s->depth)
+    {
+      int b = level_begin (s, l + 1);
+      int e = (l + 2 < s->depth ? level_begin (s, l + 2) : s->packages);
+      int n = e - b;
+      int hot = (s->fanout < n ? s->fanout : n);
+      int k = 0;
+
+      for (int j = 0; j != s->fanout && n != 0; ++j)
+      {
+        int t = b + (int)(rng () % (uint32_t)(chance (s->diamonds) ? hot : n));
+
+        bool dup = false;
+        for (int m = 0; m != k; ++m)
+          dup = dup || targets[m] == t;
+
+        if (dup)
+          continue;
+
+        targets[k++] = t;
+
+        bool v = (j % 2 == 0);
+
+        if (chance (s->private_))
+          add_require (req_private, rsize, t, v);
+        else if (chance (s->internal))
+          add_require (req_internal, rsize, t, v);
+        else
+          add_require (req, rsize, t, v);
+      }
+    }
+
+    char path[4096];
+    snprintf (path, sizeof (path), "%s/pkg%d.pc", dir, i);
+
+    FILE* f = fopen (path, "w");
+    assert (f != NULL);
+
+    int r = fprintf (f,
+                     "prefix=/opt/pkg%d\n"
+                     "libdir=${prefix}/lib\n"
+                     "v0=${prefix}\n",
+                     i);
+
+    for (int c = 1; c <= s->chain; ++c)
+      r += fprintf (f, "v%d=${v%d}/v%d\n", c, c - 1, c);
+
+    r += fprintf (f,
+                  "\n"
+                  "Name: pkg%d\n"
+                  "Description: Synthetic package %d at level %d\n"
+                  "Version: 1.%d\n",
+                  i, i, l, i);
+
+    if (req[0] != '\0')
+      r += fprintf (f, "Requires: %s\n", req);
+
+    if (req_private[0] != '\0')
+      r += fprintf (f, "Requires.private: %s\n", req_private);
+
+    if (req_internal[0] != '\0')
+      r += fprintf (f, "Requires.internal: %s\n", req_internal);
+
+    /* Never satisfied (all the versions are 1.N).
+     */
+    if (s->packages > 1 && chance (s->conflicts))
+      r += fprintf (f,
+                    "Conflicts: pkg%d < 0.1\n",
+                    (int)(rng () % (uint32_t)s->packages));
+
+    r += fprintf (f, "Cflags:");
+
+    for (int c = 0; c != s->cflags; ++c)
+      r += (c == 0
+            ? fprintf (f, " -I${v%d}/include", s->chain)
+            : fprintf (f, " -DPKG%d_%d", i, c));
+
+    r += fprintf (f, "\nLibs:");
+
+    for (int c = 0; c != s->libs; ++c)
+      r += (c == 0
+            ? fprintf (f, " -L${libdir} -lpkg%d", i)
+            : fprintf (f, " -lpkg%d_%d", i, c));
+
+    r += fprintf (f, "\nLibs.private: -lm\n");
+
+    assert (r > 0);
+    bytes += r;
+
+    int cr = fclose (f);
+    assert (cr == 0);
+  }
+
+  free (targets);
+  free (req_internal);
+  free (req_private);
+  free (req);
+
+  return bytes;
+}
+
+static uint64_t
+now_ns (void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER c, f;
+  QueryPerformanceCounter (&c);
+  QueryPerformanceFrequency (&f);
+  return (uint64_t)((double)c.QuadPart * 1e9 / (double)f.QuadPart);
+#else
+  struct timespec t;
+  int r = clock_gettime (CLOCK_MONOTONIC, &t);
+  assert (r == 0);
+  return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+#endif
+}
+
+static int
+compare_ns (const void* x, const void* y)
+{
+  uint64_t a = *(const uint64_t*)x;
+  uint64_t b = *(const uint64_t*)y;
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static void
+report (const char* name, uint64_t* samples, int n, long ops)
+{
+  qsort (samples, (size_t)n, sizeof (uint64_t), compare_ns);
+
+  printf ("{\"kind\":\"timing\",\"benchmark\":\"%s\",\"iterations\":%d,"
+          "\"operations\":%ld,\"min_ns\":%llu,\"median_ns\":%llu,"
+          "\"max_ns\":%llu}\n",
+          name,
+          n,
+          ops,
+          (unsigned long long)samples[0],
+          (unsigned long long)samples[n / 2],
+          (unsigned long long)samples[n - 1]);
+}
+
+/* Usage: argv[0] [--packages <num>] [--depth <num>] [--fanout <num>]
+ *                [--diamonds <percent>] [--chain <num>] [--cflags <num>]
+ *                [--libs <num>] [--conflicts <percent>]
+ *                [--private <percent>] [--internal <percent>]
+ *                [--seed <num>] [--iterations <num>] [--static]
+ *                [--no-generate] <dir>
+ *
+ * Generate a synthetic package corpus in the directory (created if it does
+ * not exist) and time finding all the packages, collecting the compiler
+ * and linker flags of the root packages (those on the first level) with
+ * the cold and memoized caches, rendering the flags, and tearing down the
+ * client. Print the results to stdout as JSON objects, one per line: the
+ * corpus shape first (kind "shape") followed by the timings (kind "timing"),
+ * in nanoseconds over the iterations.
+ *
+ * The tests only run a small corpus. To benchmark, run the driver directly,
+ * for example:
+ *
+ * driver --packages 10000 --depth 12 --fanout 6 --iterations 10 corpus
+ *
+ * --packages <num>
+ *     Number of packages (default 1000).
+ *
+ * --depth <num>
+ *     Number of dependency levels (default 6). Packages on each level only
+ *     require packages on the next level.
+ *
+ * --fanout <num>
+ *     Number of requires per package (default 3).
+ *
+ * --diamonds <percent>
+ *     Probability of a require to target one of a few packages on the next
+ *     level shared by many dependents (default 25).
+ *
+ * --chain <num>
+ *     Length of the variable chain the include directory is defined with
+ *     (default 4).
+ *
+ * --cflags <num>
+ * --libs <num>
+ *     Number of fragments in Cflags and Libs (default 4).
+ *
+ * --conflicts <percent>
+ *     Probability of a package to have a (never satisfied) Conflicts entry
+ *     (default 10).
+ *
+ * --private <percent>
+ * --internal <percent>
+ *     Probability of a require to be in Requires.private or
+ *     Requires.internal (default 20 and 5).
+ *
+ * --seed <num>
+ *     Corpus random generator seed (default 1).
+ *
+ * --iterations <num>
+ *     Number of timed iterations, each with a new client (default 5).
+ *
+ * --static
+ *     Assume static linking.
+ *
+ * --no-generate
+ *     Use the existing corpus in the directory.
+ */
+int
+main (int argc, const char* argv[])
+{
+  shape_t s = {1000, 6, 3, 25, 4, 4, 4, 10, 20, 5, 1};
+  int iterations = 5;
+  bool generate_corpus = true;
+  unsigned int flags = LIBPKG_CONFIG_PKG_PKGF_MERGE_SPECIAL_FRAGMENTS;
+
+  int i = 1;
+  for (; i < argc; ++i)
+  {
+    const char* o = argv[i];
+    int* v = NULL;
+
+    if      (strcmp (o, "--packages") == 0)   v = &s.packages;
+    else if (strcmp (o, "--depth") == 0)      v = &s.depth;
+    else if (strcmp (o, "--fanout") == 0)     v = &s.fanout;
+    else if (strcmp (o, "--diamonds") == 0)   v = &s.diamonds;
+    else if (strcmp (o, "--chain") == 0)      v = &s.chain;
+    else if (strcmp (o, "--cflags") == 0)     v = &s.cflags;
+    else if (strcmp (o, "--libs") == 0)       v = &s.libs;
+    else if (strcmp (o, "--conflicts") == 0)  v = &s.conflicts;
+    else if (strcmp (o, "--private") == 0)    v = &s.private_;
+    else if (strcmp (o, "--internal") == 0)   v = &s.internal;
+    else if (strcmp (o, "--iterations") == 0) v = &iterations;
+    else if (strcmp (o, "--seed") == 0)
+    {
+      ++i;
+      assert (i < argc);
+
+      s.seed = (unsigned int)atoi (argv[i]);
+      continue;
+    }
+    else if (strcmp (o, "--static") == 0)
+    {
+      flags |= LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE |
+               LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS;
+      continue;
+    }
+    else if (strcmp (o, "--no-generate") == 0)
+    {
+      generate_corpus = false;
+      continue;
+    }
+    else
+      break;
+
+    ++i;
+    assert (i < argc);
+
+    *v = atoi (argv[i]);
+    assert (*v >= 0);
+  }
+
+  assert (i + 1 == argc);
+  const char* dir = argv[i];
+
+  assert (s.packages > 0 && s.depth > 0 && iterations > 0);
+
+  if (s.depth > s.packages)
+    s.depth = s.packages;
+
+  long bytes = 0;
+
+  if (generate_corpus)
+  {
+#ifdef _WIN32
+    int r = _mkdir (dir);
+#else
+    int r = mkdir (dir, 0777);
+#endif
+    assert (r == 0 || errno == EEXIST);
+
+    bytes = generate (dir, &s);
+  }
+
+  int roots = level_begin (&s, 1);
+
+  printf ("{\"kind\":\"shape\",\"packages\":%d,\"depth\":%d,\"fanout\":%d,"
+          "\"diamonds\":%d,\"chain\":%d,\"cflags\":%d,\"libs\":%d,"
+          "\"conflicts\":%d,\"private\":%d,\"internal\":%d,\"seed\":%u,"
+          "\"roots\":%d,\"bytes\":%ld,\"static\":%s}\n",
+          s.packages, s.depth, s.fanout,
+          s.diamonds, s.chain, s.cflags, s.libs,
+          s.conflicts, s.private_, s.internal, s.seed,
+          roots, bytes,
+          (flags & LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE) != 0 ? "true"
+                                                               : "false");
+
+  enum {find, cflags, libs, cflags_memo, libs_memo, render, teardown, count};
+
+  static const char* names[count] = {"find",
+                                     "cflags",
+                                     "libs",
+                                     "cflags_memoized",
+                                     "libs_memoized",
+                                     "render",
+                                     "teardown"};
+
+  uint64_t* samples[count];
+  for (int k = 0; k != count; ++k)
+  {
+    samples[k] = malloc (sizeof (uint64_t) * (size_t)iterations);
+    assert (samples[k] != NULL);
+  }
+
+  pkg_config_pkg_t** pkgs = malloc (sizeof (pkg_config_pkg_t*) *
+                                    (size_t)s.packages);
+  pkg_config_list_t* lists = malloc (sizeof (pkg_config_list_t) *
+                                     (size_t)roots * 2);
+  assert (pkgs != NULL && lists != NULL);
+
+  for (int it = 0; it != iterations; ++it)
+  {
+    pkg_config_client_t* c =
+      pkg_config_client_new (NULL /* error_handler */,
+                             NULL /* error_handler_data */,
+                             true /* init_filters */);
+    assert (c != NULL);
+
+    pkg_config_client_set_flags (c, flags);
+    pkg_config_path_add (dir, &c->dir_list, true /* filter_duplicates */);
+
+    unsigned int e;
+    char name[32];
+    uint64_t t = now_ns ();
+
+    for (int p = 0; p != s.packages; ++p)
+    {
+      snprintf (name, sizeof (name), "pkg%d", p);
+      pkgs[p] = pkg_config_pkg_find (c, name, &e);
+      assert (pkgs[p] != NULL);
+    }
+
+    uint64_t t1 = now_ns ();
+    samples[find][it] = t1 - t;
+    t = t1;
+
+    /* Collect the flags twice: the second time the results are memoized.
+     */
+    for (int pass = 0; pass != 2; ++pass)
+    {
+      for (int p = 0; p != roots; ++p)
+      {
+        pkg_config_list_t* l = &lists[p * 2];
+
+        if (pass != 0)
+          pkg_config_fragment_free (l);
+
+        l->head = l->tail = NULL;
+        l->length = 0;
+
+        e = pkg_config_pkg_cflags (c, pkgs[p], l, -1);
+        assert (e == LIBPKG_CONFIG_ERRF_OK);
+      }
+
+      t1 = now_ns ();
+      samples[pass == 0 ? cflags : cflags_memo][it] = t1 - t;
+      t = t1;
+
+      for (int p = 0; p != roots; ++p)
+      {
+        pkg_config_list_t* l = &lists[p * 2 + 1];
+
+        if (pass != 0)
+          pkg_config_fragment_free (l);
+
+        l->head = l->tail = NULL;
+        l->length = 0;
+
+        e = pkg_config_pkg_libs (c, pkgs[p], l, -1);
+        assert (e == LIBPKG_CONFIG_ERRF_OK);
+      }
+
+      t1 = now_ns ();
+      samples[pass == 0 ? libs : libs_memo][it] = t1 - t;
+      t = t1;
+    }
+
+    size_t rendered = 0;
+
+    for (int p = 0; p != roots * 2; ++p)
+    {
+      char* b = pkg_config_fragment_render (&lists[p],
+                                            true /* escape */,
+                                            NULL /* options */);
+      assert (b != NULL);
+
+      rendered += strlen (b);
+      free (b);
+    }
+
+    t1 = now_ns ();
+    samples[render][it] = t1 - t;
+
+    assert (rendered != 0);
+
+    for (int p = 0; p != roots * 2; ++p)
+      pkg_config_fragment_free (&lists[p]);
+
+    t = now_ns ();
+
+    for (int p = 0; p != s.packages; ++p)
+      pkg_config_pkg_unref (c, pkgs[p]);
+
+    pkg_config_client_free (c);
+
+    samples[teardown][it] = now_ns () - t;
+  }
+
+  long ops[count] = {s.packages,
+                     roots,
+                     roots,
+                     roots,
+                     roots,
+                     (long)roots * 2,
+                     s.packages};
+
+  for (int k = 0; k != count; ++k)
+  {
+    report (names[k], samples[k], iterations, ops[k]);
+    free (samples[k]);
+  }
+
+  free (lists);
+  free (pkgs);
+  return 0;
+}
@@ -0,0 +1,473 @@
+/* file      : tests/complexity/driver.c
+ * license   : ISC; see accompanying COPYING file
+ */
+
+/* Enable assertions.
+ */
+#ifdef NDEBUG
+#  undef NDEBUG
+#endif
+
+#include <libpkg-config/pkg-config.h>
+
+#include <stdio.h>    /* printf(), fprintf(), fopen(), stderr */
+#include <stddef.h>   /* NULL, size_t */
+#include <stdlib.h>   /* malloc(), realloc(), free() */
+#include <assert.h>
+#include <string.h>   /* strcmp() */
+#include <stdbool.h>  /* bool, true, false */
+#include <errno.h>
+
+#ifdef _WIN32
+#  include <direct.h> /* _mkdir() */
+#else
+#  include <sys/stat.h> /* mkdir() */
+#endif
+
+static void
+make_dir (const char* dir)
+{
+#ifdef _WIN32
+  int r = _mkdir (dir);
+#else
+  int r = mkdir (dir, 0777);
+#endif
+  assert (r == 0 || errno == EEXIST);
+}
+
+/* Write the package file. The requires lists are comma-separated package
+ * numbers or NULL.
+ */
+static void
+write_package (const char* dir,
+               int i,
+               const char* requires,
+               const char* requires_private,
+               const char* conflicts)
+{
+  char path[4096];
+  snprintf (path, sizeof (path), "%s/pkg%d.pc", dir, i);
+
+  FILE* f = fopen (path, "w");
+  assert (f != NULL);
+
+  fprintf (f,
+           "prefix=/opt/pkg%d\n"
+           "includedir=${prefix}/include\n"
+           "\n"
+           "Name: pkg%d\n"
+           "Description: Synthetic package %d\n"
+           "Version: 1.%d\n",
+           i, i, i, i);
+
+  if (requires != NULL)
+    fprintf (f, "Requires: %s\n", requires);
+
+  if (requires_private != NULL)
+    fprintf (f, "Requires.private: %s\n", requires_private);
+
+  if (conflicts != NULL)
+    fprintf (f, "Conflicts: %s\n", conflicts);
+
+  /* Note that -L/opt/lib and -lm are shared by all the packages and so are
+   * merged.
+   */
+  fprintf (f,
+           "Cflags: -I${includedir} -DPKG%d\n"
+           "Libs: -L/opt/lib -lpkg%d\n"
+           "Libs.private: -lm\n",
+           i, i);
+
+  int r = fclose (f);
+  assert (r == 0);
+}
+
+/* Generated graph families. Package 0 is the root and the graph has
+ * approximately n packages.
+ *
+ * Note that the traversal (see pkg_config_traversal_walk()) visits a
+ * package once for each path leading to it, as pkg-config does, so only
+ * the graph building is checked for the lattice, which has 2^(n/2) paths
+ * to the last level.
+ */
+typedef enum
+{
+  chain,   /* Each package requires the next one. */
+  wide,    /* The root requires (and conflicts with old versions of) all the
+              other packages. */
+  diamond, /* The root requires all the other packages except the last,
+              which they all require (publicly or privately). */
+  lattice, /* Levels of two packages, each requiring both on the next level
+              (privately for the second). */
+  family_count
+} family_t;
+
+static const char* family_names[family_count] = {"chain",
+                                                 "wide",
+                                                 "diamond",
+                                                 "lattice"};
+
+/* Return the comma-separated list of the package numbers in the [b, e)
+ * range with the suffix appended to each. Free the result with free().
+ */
+static char*
+package_list (int b, int e, const char* suffix)
+{
+  size_t n = (size_t)(e - b) * (32 + strlen (suffix)) + 1;
+  char* r = malloc (n);
+  assert (r != NULL);
+
+  r[0] = '\0';
+
+  for (int i = b; i != e; ++i)
+  {
+    size_t l = strlen (r);
+    snprintf (r + l, n - l, "%spkg%d%s", i != b ? ", " : "", i, suffix);
+  }
+
+  return r;
+}
+
+static void
+generate (const char* dir, family_t fm, int n)
+{
+  char r[64];
+
+  make_dir (dir);
+
+  switch (fm)
+  {
+  case chain:
+    {
+      for (int i = 0; i != n; ++i)
+      {
+        snprintf (r, sizeof (r), "pkg%d", i + 1);
+        write_package (dir, i, i + 1 != n ? r : NULL, NULL, NULL);
+      }
+      break;
+    }
+  case wide:
+    {
+      char* w = package_list (1, n, " >= 1.0");
+      char* c = package_list (1, n, " < 0.1");
+
+      write_package (dir, 0, w, NULL, c);
+
+      for (int i = 1; i != n; ++i)
+        write_package (dir, i, NULL, NULL, NULL);
+
+      free (c);
+      free (w);
+      break;
+    }
+  case diamond:
+    {
+      char* w = package_list (1, n - 1, "");
+
+      write_package (dir, 0, w, NULL, NULL);
+
+      snprintf (r, sizeof (r), "pkg%d", n - 1);
+
+      for (int i = 1; i != n - 1; ++i)
+        write_package (dir,
+                       i,
+                       i % 2 == 0 ? r : NULL,
+                       i % 2 != 0 ? r : NULL,
+                       NULL);
+
+      write_package (dir, n - 1, NULL, NULL, NULL);
+
+      free (w);
+      break;
+    }
+  case lattice:
+    {
+      /* Packages 2l+1 and 2l+2 are on level l.
+       */
+      int levels = n / 2;
+
+      for (int i = 0; i != levels * 2 + 1; ++i)
+      {
+        int l = i == 0 ? -1 : (i - 1) / 2;
+
+        if (l + 1 != levels)
+        {
+          int x = (l + 1) * 2 + 1;
+
+          if (i % 2 == 0)
+          {
+            snprintf (r, sizeof (r), "pkg%d, pkg%d", x, x + 1);
+            write_package (dir, i, r, NULL, NULL);
+          }
+          else
+          {
+            char p[32];
+            snprintf (r, sizeof (r), "pkg%d", x);
+            snprintf (p, sizeof (p), "pkg%d", x + 1);
+            write_package (dir, i, r, p, NULL);
+          }
+        }
+        else
+          write_package (dir, i, NULL, NULL, NULL);
+      }
+      break;
+    }
+  case family_count:
+    assert (false);
+  }
+}
+
+/* Allocator that counts the calls (in the size_t pointed to by the
+ * allocator data). The live blocks are not tracked.
+ */
+static void*
+counting_alloc (void* data, size_t n)
+{
+  ++*(size_t*)data;
+  return malloc (n);
+}
+
+static void*
+counting_realloc (void* data, void* p, size_t n)
+{
+  ++*(size_t*)data;
+  return realloc (p, n);
+}
+
+static void
+counting_free (void* data, void* p)
+{
+  (void) data; /* Unused. */
+  free (p);
+}
+
+/* Counters whose growth is checked.
+ */
+typedef enum
+{
+  files_opened,
+  lines_parsed,
+  pkg_cache_compares,
+  var_expansions,
+  edges_verified,
+  traversals,
+  nodes_visited,
+  fragments_copied,
+  fragments_merged,
+  allocations,
+  allocator_calls,
+  counter_count
+} counter_t;
+
+static const char* counter_names[counter_count] = {"files_opened",
+                                                   "lines_parsed",
+                                                   "pkg_cache_compares",
+                                                   "var_expansions",
+                                                   "edges_verified",
+                                                   "traversals",
+                                                   "nodes_visited",
+                                                   "fragments_copied",
+                                                   "fragments_merged",
+                                                   "allocations",
+                                                   "allocator_calls"};
+
+/* Find the root package, collect its flags (both for dynamic and static
+ * linking) or, for the lattice, build its dependency graph, and return the
+ * counters.
+ */
+static void
+run (const char* dir, family_t fm, size_t* counters)
+{
+  size_t calls = 0;
+  pkg_config_allocator_t a = {counting_alloc,
+                              counting_realloc,
+                              counting_free,
+                              &calls};
+
+  pkg_config_client_t* c =
+    pkg_config_client_new (NULL /* error_handler */,
+                           NULL /* error_handler_data */,
+                           true /* init_filters */);
+  assert (c != NULL);
+
+  unsigned int flags = LIBPKG_CONFIG_PKG_PKGF_MERGE_SPECIAL_FRAGMENTS;
+  unsigned int static_flags = flags |
+                              LIBPKG_CONFIG_PKG_PKGF_SEARCH_PRIVATE |
+                              LIBPKG_CONFIG_PKG_PKGF_ADD_PRIVATE_FRAGMENTS;
+
+  pkg_config_client_set_flags (c, flags);
+  pkg_config_client_set_allocator (c, &a);
+  pkg_config_path_add (dir, &c->dir_list, true /* filter_duplicates */);
+
+  unsigned int e;
+  pkg_config_pkg_t* p = pkg_config_pkg_find (c, "pkg0", &e);
+  assert (p != NULL);
+
+  if (fm != lattice)
+  {
+    pkg_config_list_t l = LIBPKG_CONFIG_LIST_INITIALIZER;
+
+    e = pkg_config_pkg_cflags (c, p, &l, -1);
+    assert (e == LIBPKG_CONFIG_ERRF_OK);
+    pkg_config_fragment_free (&l);
+    pkg_config_list_zero (&l);
+
+    e = pkg_config_pkg_libs (c, p, &l, -1);
+    assert (e == LIBPKG_CONFIG_ERRF_OK);
+    pkg_config_fragment_free (&l);
+    pkg_config_list_zero (&l);
+
+    pkg_config_client_set_flags (c, static_flags);
+
+    e = pkg_config_pkg_libs (c, p, &l, -1);
+    assert (e == LIBPKG_CONFIG_ERRF_OK);
+    pkg_config_fragment_free (&l);
+  }
+  else
+  {
+    pkg_config_client_set_flags (c, static_flags);
+
+    pkg_config_traversal_t t;
+    pkg_config_traversal_init (&t, c);
+
+    pkg_config_graph_t* g = pkg_config_graph_build (&t, p, -1);
+    assert (g != NULL);
+    pkg_config_graph_unref (g);
+  }
+
+  pkg_config_pkg_unref (c, p);
+
+  pkg_config_client_stats_t s;
+  pkg_config_client_get_stats (c, &s);
+
+  pkg_config_client_free (c);
+
+  counters[files_opened] = s.files_opened;
+  counters[lines_parsed] = s.lines_parsed;
+  counters[pkg_cache_compares] = s.pkg_cache_compares;
+  counters[var_expansions] = s.var_expansions;
+  counters[edges_verified] = s.edges_verified;
+  counters[traversals] = s.traversals;
+  counters[nodes_visited] = s.nodes_visited;
+  counters[fragments_copied] = s.fragments_copied;
+  counters[fragments_merged] = s.fragments_merged;
+  counters[allocations] = s.allocations;
+  counters[allocator_calls] = calls;
+}
+
+/* Usage: argv[0] [--sizes <num>] [--verbose] <dir>
+ *
+ * For each graph family (see family_t), generate the graphs of doubling
+ * sizes in the directory (created if it does not exist), run each through
+ * the library (see run()), and check that the deterministic cost counters
+ * (see counter_t) grow near-linearly with the graph size. Print
+ * '<family> linear' to stdout for each family on success and the counters
+ * that grow faster to stderr on failure.
+ *
+ * Unlike timings, the counters do not depend on the machine or its load
+ * and so a quadratic (or worse) algorithm reintroduced anywhere along the
+ * way (for example, in fragment merging or diamond traversal) reliably
+ * fails the test.
+ *
+ * --sizes <num>
+ *     Number of sizes, starting from 32 packages (default 5).
+ *
+ * --verbose
+ *     Print the counters to stderr.
+ */
+int
+main (int argc, const char* argv[])
+{
+  int sizes = 5;
+  bool verbose = false;
+
+  int i = 1;
+  for (; i < argc; ++i)
+  {
+    const char* o = argv[i];
+
+    if (strcmp (o, "--sizes") == 0)
+    {
+      ++i;
+      assert (i < argc);
+
+      sizes = atoi (argv[i]);
+      assert (sizes >= 2);
+    }
+    else if (strcmp (o, "--verbose") == 0)
+      verbose = true;
+    else
+      break;
+  }
+
+  assert (i + 1 == argc);
+  const char* dir = argv[i];
+
+  make_dir (dir);
+
+  size_t* counters = malloc (sizeof (size_t) * counter_count * (size_t)sizes);
+  assert (counters != NULL);
+
+  int r = 0;
+
+  for (int fm = 0; fm != family_count; ++fm)
+  {
+    bool ok = true;
+
+    for (int k = 0; k != sizes; ++k)
+    {
+      int n = 32 << k;
+      size_t* cs = counters + counter_count * k;
+
+      char d[4096];
+      snprintf (d, sizeof (d), "%s/%s-%d", dir, family_names[fm], n);
+
+      generate (d, (family_t)fm, n);
+      run (d, (family_t)fm, cs);
+
+      if (verbose)
+      {
+        fprintf (stderr, "%s %d", family_names[fm], n);
+
+        for (int j = 0; j != counter_count; ++j)
+          fprintf (stderr, " %s=" LIBPKG_CONFIG_SIZE_FMT, counter_names[j], cs[j]);
+
+        fprintf (stderr, "\n");
+      }
+
+      if (k == 0)
+        continue;
+
+      /* Doubling the size of a linear algorithm doubles its cost (plus the
+       * constant part, which makes the ratio less than 2). Allow some
+       * slack for the n*log(n) algorithms: a quadratic one quadruples.
+       */
+      const size_t* ps = cs - counter_count;
+
+      for (int j = 0; j != counter_count; ++j)
+      {
+        if (cs[j] * 2 > ps[j] * 5)
+        {
+          fprintf (stderr,
+                   "%s: %s grows from " LIBPKG_CONFIG_SIZE_FMT " to "
+                   LIBPKG_CONFIG_SIZE_FMT " for %d to %d packages\n",
+                   family_names[fm],
+                   counter_names[j],
+                   ps[j],
+                   cs[j],
+                   n / 2,
+                   n);
+          ok = false;
+        }
+      }
+    }
+
+    if (ok)
+      printf ("%s linear\n", family_names[fm]);
+    else
+      r = 1;
+  }
+
+  free (counters);
+  return r;
+}
@@ -0,0 +1,190 @@
+/* file      : tests/daemon/driver.c
+ * license   : ISC; see accompanying COPYING file
+ */
+
+/* Enable assertions.
+ */
+#ifdef NDEBUG
+#  undef NDEBUG
+#endif
+
+#include <libpkg-config/pkg-config.h>
+#include <libpkg-config/query.h>
+
+#include <stdio.h>   /* printf(), fgets(), rename() */
+#include <stddef.h>  /* NULL */
+#include <stdlib.h>  /* free(), strtoul() */
+#include <assert.h>
+#include <string.h>  /* strcmp(), strchr(), strlen() */
+#include <signal.h>  /* signal(), SIGPIPE */
+#include <unistd.h>  /* close(), unlink() */
+#include <pthread.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+typedef struct
+{
+  pkg_config_server_t* server;
+  int fd;
+  bool listen;
+} serve_data_t;
+
+static void*
+serve (void* p)
+{
+  serve_data_t* d = p;
+
+  int r = (d->listen
+           ? pkg_config_server_listen (d->server, d->fd)
+           : pkg_config_server_serve (d->server, d->fd, d->fd));
+
+  assert (r == 0);
+  return NULL;
+}
+
+/* Usage: argv[0] [--socket <path>] [--memory-limit <bytes>]
+ *
+ * Run the query server in a separate thread and send it the requests read
+ * from stdin, one per line, printing the replies to stdout as the
+ * `ok[ <result>]` or `error <diagnostics>` lines. The following lines are
+ * handled by the driver itself:
+ *
+ * !rename <from> <to>
+ *     Rename the file.
+ *
+ * !reconnect
+ *     Close the connection and open a new one.
+ *
+ * --socket <path>
+ *     Serve the connections on the Unix domain socket at the specified path
+ *     rather than a single connection over a socket pair (the coprocess
+ *     mode). The server is shut down at the end of input.
+ *
+ * --memory-limit <bytes>
+ *     Limit the memory used by the warm clients (see
+ *     pkg_config_server_set_memory_limit()).
+ */
+int
+main (int argc, const char* argv[])
+{
+  const char* path = NULL;
+  size_t memory_limit = 0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp (argv[i], "--socket") == 0)
+    {
+      assert (i + 1 != argc);
+      path = argv[++i];
+    }
+    else if (strcmp (argv[i], "--memory-limit") == 0)
+    {
+      assert (i + 1 != argc);
+      memory_limit = strtoul (argv[++i], NULL, 10);
+    }
+    else
+      assert (false);
+  }
+
+  signal (SIGPIPE, SIG_IGN);
+
+  pkg_config_server_t* s = pkg_config_server_new ();
+  assert (s != NULL);
+
+  pkg_config_server_set_memory_limit (s, memory_limit);
+
+  serve_data_t d = {s, -1, path != NULL};
+  pkg_config_query_t* q;
+
+  if (path != NULL)
+  {
+    struct sockaddr_un a;
+    memset (&a, 0, sizeof (a));
+    a.sun_family = AF_UNIX;
+    assert (strlen (path) < sizeof (a.sun_path));
+    strcpy (a.sun_path, path);
+
+    d.fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    assert (d.fd != -1);
+    assert (bind (d.fd, (const struct sockaddr*)&a, sizeof (a)) == 0);
+    assert (listen (d.fd, 8) == 0);
+
+    q = pkg_config_query_connect (path);
+  }
+  else
+  {
+    int fds[2];
+    assert (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    d.fd = fds[0];
+    q = pkg_config_query_open (fds[1], fds[1]);
+  }
+
+  assert (q != NULL);
+
+  pthread_t t;
+  assert (pthread_create (&t, NULL, serve, &d) == 0);
+
+  char line[4096];
+  while (fgets (line, sizeof (line), stdin) != NULL)
+  {
+    size_t n = strlen (line);
+    if (n != 0 && line[n - 1] == '\n')
+      line[--n] = '\0';
+
+    if (strcmp (line, "!reconnect") == 0)
+    {
+      assert (path != NULL);
+
+      pkg_config_query_close (q);
+      q = pkg_config_query_connect (path);
+      assert (q != NULL);
+      continue;
+    }
+
+    if (strncmp (line, "!rename ", 8) == 0)
+    {
+      char* from = line + 8;
+      char* to = strchr (from, ' ');
+      assert (to != NULL);
+      *to++ = '\0';
+
+      assert (rename (from, to) == 0);
+      continue;
+    }
+
+    char* arg = strchr (line, ' ');
+    if (arg != NULL)
+      *arg++ = '\0';
+
+    char* reply;
+    int r = pkg_config_query_request (q, line, arg, &reply);
+    assert (r != LIBPKG_CONFIG_QUERY_FAILED);
+
+    if (r == LIBPKG_CONFIG_QUERY_OK)
+      printf ("ok%s%s\n", *reply != '\0' ? " " : "", reply);
+    else
+      printf ("error %s\n", reply);
+
+    free (reply);
+  }
+
+  /* In the socket mode shut the server down explicitly, otherwise closing
+   * the connection ends the serving.
+   */
+  if (path != NULL)
+    assert (pkg_config_query_request (q, "shutdown", NULL, NULL) ==
+            LIBPKG_CONFIG_QUERY_OK);
+
+  pkg_config_query_close (q);
+
+  assert (pthread_join (t, NULL) == 0);
+
+  close (d.fd);
+
+  if (path != NULL)
+    unlink (path);
+
+  pkg_config_server_free (s);
+  return 0;
+}
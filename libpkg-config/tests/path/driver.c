@@ -0,0 +1,198 @@
+/* file      : tests/path/driver.c
+ * license   : ISC; see accompanying COPYING file
+ */
+
+/* Enable assertions.
+ */
+#ifdef NDEBUG
+#  undef NDEBUG
+#endif
+
+#include <libpkg-config/pkg-config.h>
+
+#include <stdio.h>   /* printf(), rename() */
+#include <stddef.h>  /* size_t, NULL */
+#include <stdlib.h>  /* atoi() */
+#include <assert.h>
+#include <string.h>  /* strcmp(), strlen() */
+#include <stdbool.h> /* bool, true, false */
+
+/* Usage: argv[0] [--dotdot|--list] <path>...
+ *        argv[0] --search <file> <count>
+ *        argv[0] --handle <dir> <name> <name>
+ *
+ * Normalize the paths in place (see pkg_config_path_normalize()) and print
+ * them one per line.
+ *
+ * --dotdot
+ *     Also resolve the `..` segments.
+ *
+ * --list
+ *     Instead, add the paths to a path list, print the list, and verify
+ *     that each path as specified matches the list.
+ *
+ * --search <file> <count>
+ *     Instead, build the client's search directory list from PKG_CONFIG_PATH,
+ *     load the package file the specified number of times (which adds its
+ *     directory to the list), verify that only the first load queries the
+ *     file system for the directory, and print the list.
+ *
+ * --handle <dir> <name> <name>
+ *     Instead, find the first package in the directory, rename the directory
+ *     by adding the .moved extension, and try to find the second package,
+ *     before and after refreshing the client's cache. Print 'found' or 'not
+ *     found' for the attempt after the refresh, and rename the directory
+ *     back. Note that the result of the attempt before the refresh is
+ *     unspecified (see pkg_config_pkg_find()).
+ */
+int
+main (int argc, char* argv[])
+{
+  bool dotdot = false;
+  bool add = false;
+  const char* search = NULL;
+  int count = 0;
+  bool handle = false;
+
+  int i = 1;
+  for (; i < argc; ++i)
+  {
+    const char* o = argv[i];
+
+    if (strcmp (o, "--dotdot") == 0)
+      dotdot = true;
+    else if (strcmp (o, "--list") == 0)
+      add = true;
+    else if (strcmp (o, "--search") == 0)
+    {
+      i += 2;
+      assert (i < argc);
+
+      search = argv[i - 1];
+      count = atoi (argv[i]);
+      assert (count > 0);
+    }
+    else if (strcmp (o, "--handle") == 0)
+      handle = true;
+    else
+      break;
+  }
+
+  if (handle)
+  {
+    assert (i + 3 == argc);
+
+    const char* dir = argv[i];
+    char moved[1024];
+    snprintf (moved, sizeof (moved), "%s.moved", dir);
+
+    pkg_config_client_t* c =
+      pkg_config_client_new (NULL /* error_handler */,
+                             NULL /* error_handler_data */,
+                             false /* init_filters */);
+    assert (c != NULL);
+
+    pkg_config_path_add (dir, &c->dir_list, false /* filter */);
+
+    unsigned int e;
+    pkg_config_pkg_t* p = pkg_config_pkg_find (c, argv[i + 1], &e);
+    assert (p != NULL);
+    pkg_config_pkg_unref (c, p);
+
+    int r = rename (dir, moved);
+    assert (r == 0);
+
+    for (int j = 0; j != 2; ++j)
+    {
+      if (j != 0)
+        pkg_config_cache_refresh (c);
+
+      p = pkg_config_pkg_find (c, argv[i + 2], &e);
+
+      if (j != 0)
+        printf ("%s\n", p != NULL ? "found" : "not found");
+
+      if (p != NULL)
+        pkg_config_pkg_unref (c, p);
+    }
+
+    pkg_config_client_free (c);
+
+    r = rename (moved, dir);
+    assert (r == 0);
+
+    return 0;
+  }
+
+  if (search != NULL)
+  {
+    pkg_config_client_t* c =
+      pkg_config_client_new (NULL /* error_handler */,
+                             NULL /* error_handler_data */,
+                             false /* init_filters */);
+    assert (c != NULL);
+
+    pkg_config_client_set_flags (c, LIBPKG_CONFIG_PKG_PKGF_ENV_ONLY);
+    pkg_config_client_dir_list_build (c);
+
+    size_t stated = 0;
+
+    for (int j = 0; j != count; ++j)
+    {
+      unsigned int e;
+      pkg_config_pkg_t* p = pkg_config_pkg_find (c, search, &e);
+      assert (p != NULL);
+      pkg_config_pkg_unref (c, p);
+
+      pkg_config_client_stats_t s;
+      pkg_config_client_get_stats (c, &s);
+
+      if (j == 0)
+        stated = s.dirs_stated;
+      else
+        assert (s.dirs_stated == stated);
+    }
+
+    pkg_config_node_t* n;
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (c->dir_list.head, n)
+    {
+      pkg_config_path_t* p = n->data;
+      printf ("%s\n", p->path);
+    }
+
+    pkg_config_client_free (c);
+    return 0;
+  }
+
+  if (add)
+  {
+    pkg_config_list_t list = LIBPKG_CONFIG_LIST_INITIALIZER;
+
+    for (int j = i; j < argc; ++j)
+      pkg_config_path_add (argv[j], &list, false /* filter */);
+
+    pkg_config_node_t* n;
+    LIBPKG_CONFIG_FOREACH_LIST_ENTRY (list.head, n)
+    {
+      pkg_config_path_t* p = n->data;
+      printf ("%s\n", p->path);
+    }
+
+    for (int j = i; j < argc; ++j)
+      assert (pkg_config_path_match_list (argv[j], &list));
+
+    pkg_config_path_free (&list);
+    return 0;
+  }
+
+  for (; i < argc; ++i)
+  {
+    char* p = argv[i];
+    size_t n = pkg_config_path_normalize (p, dotdot);
+
+    assert (n == strlen (p));
+    printf ("%s\n", p);
+  }
+
+  return 0;
+}